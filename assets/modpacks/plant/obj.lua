@@ -97,14 +97,16 @@ function Flowers:main()
 	-- TODO: Until we add the ability to refer to instances from the console
 	flowers = self
 
-	if self.water_level > 0 then
-		self.water_level = self.water_level - 10
-	end
+	while true do
+		if self.water_level > 0 then
+			self.water_level = self.water_level - 10
+		end
 
-	-- This is probably something we really don't need anymore...
-	--print( Flowers.name, "Hello from Lua! I am object instance ("..bluebear.util.get_pointer( self )..") and my water level is now "..self.water_level )
+		-- This is probably something we really don't need anymore...
+		--print( Flowers.name, "Hello from Lua! I am object instance ("..bluebear.util.get_pointer( self )..") and my water level is now "..self.water_level )
 
-	self:sleep( bluebear.util.time.minutes_to_ticks( 5 ) ):then_call( bluebear.util.bind( 'game.flowers.base:main', self ) )
+		self:sleep( bluebear.util.time.minutes_to_ticks( 5 ), true )
+	end
 end
 
 function Flowers:replenish_water()
@@ -0,0 +1,303 @@
+#ifndef CHUNKEDCOLLECTION3D
+#define CHUNKEDCOLLECTION3D
+
+#include "containers/collection3d.hpp"
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace BlueBear {
+  namespace Containers {
+
+    /**
+     * Collection3D that only allocates the parts of the grid that hold something. Each level is split into 16x16 chunks, and a chunk is
+     * allocated the first time a non-empty (not default-constructed) item is stored in it; reading from a chunk that was never allocated
+     * gives an empty item. A 256x256 lot with a dozen mostly-empty levels costs a pointer per chunk for the empty parts.
+     *
+     * Every chunk carries a dirty flag and a version. Storing an item marks its chunk dirty and gives it a new version (versions are unique
+     * across the whole collection, so they never repeat); takeDirtyChunks() hands back the chunks changed since it was last called. One
+     * consumer takes the dirty chunks; any others compare versions against the ones they last saw, starting from getVersion().
+     *
+     * Reading through a const collection (or getItem()/getItemDirect()) never allocates: cells in unallocated chunks read as one shared
+     * empty item. The non-const getItemDirectByRef()/getItemByRef() hand out a reference to write through, so they allocate the cell's
+     * chunk first.
+     */
+    template < typename T > class ChunkedCollection3D : public Collection3D< T > {
+      public:
+        static constexpr unsigned int CHUNK_BITS = 4;
+        static constexpr unsigned int CHUNK_SIZE = 1 << CHUNK_BITS;
+        static constexpr unsigned int CHUNK_MASK = CHUNK_SIZE - 1;
+
+        // In chunks, not cells: the chunk's first cell is ( x << CHUNK_BITS, y << CHUNK_BITS )
+        struct ChunkPosition {
+          unsigned int level;
+          unsigned int x;
+          unsigned int y;
+        };
+
+      private:
+        struct Chunk {
+          T items[ CHUNK_SIZE * CHUNK_SIZE ];
+          std::uint64_t version = 0;
+          bool dirty = false;
+        };
+
+        unsigned int chunksX;
+        unsigned int chunksY;
+        std::vector< std::unique_ptr< Chunk > > chunks;
+        std::vector< std::size_t > dirtyChunks;
+        std::uint64_t nextVersion;
+        std::size_t pushed;
+        std::size_t allocated;
+        // What every cell of an unallocated chunk reads as; only ever handed out by const reference
+        const T empty;
+
+        std::size_t getChunkIndex( unsigned int level, unsigned int x, unsigned int y ) const {
+          return ( ( std::size_t ) chunksY * chunksX * level ) + ( chunksX * ( y >> CHUNK_BITS ) ) + ( x >> CHUNK_BITS );
+        }
+
+        static unsigned int getCellIndex( unsigned int x, unsigned int y ) {
+          return ( ( y & CHUNK_MASK ) << CHUNK_BITS ) | ( x & CHUNK_MASK );
+        }
+
+        static bool isEmpty( const T& item ) {
+          return item == T();
+        }
+
+        void decompose( std::size_t direct, unsigned int& level, unsigned int& x, unsigned int& y ) const {
+          std::size_t levelSize = ( std::size_t ) this->dimensions.x * this->dimensions.y;
+          level = direct / levelSize;
+          std::size_t remainder = direct % levelSize;
+          y = remainder / this->dimensions.x;
+          x = remainder % this->dimensions.x;
+        }
+
+        Chunk* touch( std::size_t chunkIndex ) {
+          std::unique_ptr< Chunk >& chunk = chunks[ chunkIndex ];
+          if( !chunk ) {
+            chunk = std::make_unique< Chunk >();
+            allocated++;
+          }
+
+          chunk->version = ++nextVersion;
+          if( !chunk->dirty ) {
+            chunk->dirty = true;
+            dirtyChunks.push_back( chunkIndex );
+          }
+
+          return chunk.get();
+        }
+
+        void store( unsigned int level, unsigned int x, unsigned int y, T item ) {
+          std::size_t chunkIndex = getChunkIndex( level, x, y );
+
+          // Nothing to do for an empty item in a chunk that doesn't exist yet - it's already empty
+          if( !chunks[ chunkIndex ] && isEmpty( item ) ) {
+            return;
+          }
+
+          touch( chunkIndex )->items[ getCellIndex( x, y ) ] = std::move( item );
+        }
+
+        // Shared by both forEachItem()s; Self is this class, const or not
+        template < typename Self, typename Function > static void forEachChunk( Self& self, Function& function ) {
+          for( unsigned int level = 0; level != self.dimensions.levels; level++ ) {
+            for( unsigned int chunkY = 0; chunkY != self.chunksY; chunkY++ ) {
+              for( unsigned int chunkX = 0; chunkX != self.chunksX; chunkX++ ) {
+                typename std::conditional< std::is_const< Self >::value, const Chunk*, Chunk* >::type chunk =
+                  self.chunks[ ( ( std::size_t ) self.chunksY * self.chunksX * level ) + ( self.chunksX * chunkY ) + chunkX ].get();
+                if( !chunk ) {
+                  continue;
+                }
+
+                // Chunks on the far edges hang over the end of the grid
+                unsigned int xBegin = chunkX << CHUNK_BITS;
+                unsigned int yBegin = chunkY << CHUNK_BITS;
+                unsigned int xEnd = std::min( xBegin + CHUNK_SIZE, self.dimensions.x );
+                unsigned int yEnd = std::min( yBegin + CHUNK_SIZE, self.dimensions.y );
+
+                for( unsigned int y = yBegin; y != yEnd; y++ ) {
+                  for( unsigned int x = xBegin; x != xEnd; x++ ) {
+                    function( level, x, y, chunk->items[ getCellIndex( x, y ) ] );
+                  }
+                }
+              }
+            }
+          }
+        }
+
+      public:
+        ChunkedCollection3D( unsigned int levels, unsigned int x, unsigned int y ) :
+          Collection3D< T >( levels, x, y ),
+          chunksX( ( x + CHUNK_MASK ) >> CHUNK_BITS ),
+          chunksY( ( y + CHUNK_MASK ) >> CHUNK_BITS ),
+          chunks( ( std::size_t ) levels * chunksX * chunksY ),
+          nextVersion( 0 ),
+          pushed( 0 ),
+          allocated( 0 ),
+          empty() {}
+
+        /**
+         * A deep copy: the allocated chunks are copied, along with their versions and what's dirty
+         */
+        ChunkedCollection3D( const ChunkedCollection3D& other ) :
+          Collection3D< T >( other ),
+          chunksX( other.chunksX ),
+          chunksY( other.chunksY ),
+          chunks( other.chunks.size() ),
+          dirtyChunks( other.dirtyChunks ),
+          nextVersion( other.nextVersion ),
+          pushed( other.pushed ),
+          allocated( other.allocated ),
+          empty() {
+          for( std::size_t i = 0; i != chunks.size(); i++ ) {
+            if( other.chunks[ i ] ) {
+              chunks[ i ] = std::make_unique< Chunk >( *other.chunks[ i ] );
+            }
+          }
+        }
+
+        T& getItemDirectByRef( unsigned int direct ) override {
+          unsigned int level, x, y;
+          decompose( direct, level, x, y );
+
+          return touch( getChunkIndex( level, x, y ) )->items[ getCellIndex( x, y ) ];
+        }
+
+        const T& getItemDirectByRef( unsigned int direct ) const override {
+          unsigned int level, x, y;
+          decompose( direct, level, x, y );
+
+          const std::unique_ptr< Chunk >& chunk = chunks[ getChunkIndex( level, x, y ) ];
+          if( !chunk ) {
+            return empty;
+          }
+
+          return chunk->items[ getCellIndex( x, y ) ];
+        }
+
+        void setItem( unsigned int level, unsigned int x, unsigned int y, T item ) {
+          store( level, x, y, std::move( item ) );
+        }
+
+        void clear() override {
+          for( std::unique_ptr< Chunk >& chunk : chunks ) {
+            chunk.reset();
+          }
+
+          dirtyChunks.clear();
+          pushed = 0;
+          allocated = 0;
+        }
+
+        /**
+         * Every cell, allocated or not (as Collection3D counts them once it's full)
+         */
+        unsigned int getLength() override {
+          return this->dimensions.levels * this->dimensions.x * this->dimensions.y;
+        }
+
+        void pushDirect( T item ) override {
+          moveDirect( std::move( item ) );
+        }
+
+        void moveDirect( T item ) override {
+          unsigned int level, x, y;
+          decompose( pushed++, level, x, y );
+
+          if( level < this->dimensions.levels ) {
+            store( level, x, y, std::move( item ) );
+          }
+        }
+
+        /**
+         * run copies of item, in storage order, as a loader does. Empty items don't allocate anything.
+         */
+        void pushRun( const T& item, std::size_t run ) {
+          for( std::size_t i = 0; i != run; i++ ) {
+            moveDirect( item );
+          }
+        }
+
+        /**
+         * Call function( level, x, y, item ) for every cell in an allocated chunk, skipping the chunks that were never allocated. Chunks are
+         * visited row by row and so are the cells in each, so a cell's neighbours above and to the left are always visited before it.
+         */
+        template < typename Function > void forEachItem( Function function ) {
+          forEachChunk( *this, function );
+        }
+
+        template < typename Function > void forEachItem( Function function ) const {
+          forEachChunk( *this, function );
+        }
+
+        /**
+         * The chunks changed since this was last called, in the order they were first changed. Clears their dirty flags.
+         */
+        std::vector< ChunkPosition > takeDirtyChunks() {
+          std::vector< ChunkPosition > result;
+          result.reserve( dirtyChunks.size() );
+
+          std::size_t levelChunks = ( std::size_t ) chunksX * chunksY;
+          for( std::size_t chunkIndex : dirtyChunks ) {
+            if( chunks[ chunkIndex ] ) {
+              chunks[ chunkIndex ]->dirty = false;
+            }
+
+            std::size_t remainder = chunkIndex % levelChunks;
+            result.push_back( ChunkPosition{ ( unsigned int )( chunkIndex / levelChunks ), ( unsigned int )( remainder % chunksX ), ( unsigned int )( remainder / chunksX ) } );
+          }
+
+          dirtyChunks.clear();
+          return result;
+        }
+
+        /**
+         * Version of the chunk holding cell ( level, x, y ): 0 if it was never allocated, and different every time the chunk changes
+         */
+        std::uint64_t getChunkVersion( unsigned int level, unsigned int x, unsigned int y ) const {
+          const std::unique_ptr< Chunk >& chunk = chunks[ getChunkIndex( level, x, y ) ];
+          return chunk ? chunk->version : 0;
+        }
+
+        bool isChunkDirty( unsigned int level, unsigned int x, unsigned int y ) const {
+          const std::unique_ptr< Chunk >& chunk = chunks[ getChunkIndex( level, x, y ) ];
+          return chunk && chunk->dirty;
+        }
+
+        /**
+         * The newest version of any chunk; if it hasn't moved, nothing has changed
+         */
+        std::uint64_t getVersion() const {
+          return nextVersion;
+        }
+
+        unsigned int getChunksX() const {
+          return chunksX;
+        }
+
+        unsigned int getChunksY() const {
+          return chunksY;
+        }
+
+        std::size_t getChunkCount() const {
+          return chunks.size();
+        }
+
+        std::size_t getAllocatedChunkCount() const {
+          return allocated;
+        }
+    };
+
+    template < typename T > constexpr unsigned int ChunkedCollection3D< T >::CHUNK_BITS;
+    template < typename T > constexpr unsigned int ChunkedCollection3D< T >::CHUNK_SIZE;
+    template < typename T > constexpr unsigned int ChunkedCollection3D< T >::CHUNK_MASK;
+
+  }
+}
+
+
+#endif
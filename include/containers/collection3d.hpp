@@ -13,7 +13,7 @@ namespace BlueBear {
 
       protected:
         std::vector< T > items;
-        unsigned int getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) {
+        unsigned int getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) const {
           return ( dimensions.y * dimensions.x * level ) + ( dimensions.x * y ) + x;
         }
 
@@ -35,15 +35,15 @@ namespace BlueBear {
       public:
         Collection3D( unsigned int levels, unsigned int x, unsigned int y ) : dimensions( Dimensions{ x, y, levels } ) {}
 
-        unsigned int getX() {
+        unsigned int getX() const {
           return getDimensions().x;
         }
 
-        unsigned int getY() {
+        unsigned int getY() const {
           return getDimensions().y;
         }
 
-        unsigned int getLevels() {
+        unsigned int getLevels() const {
           return getDimensions().levels;
         }
 
@@ -51,21 +51,31 @@ namespace BlueBear {
          * RVO might destroy thread safety here?
          * This is SUPPOSED to be a copy, explicitly
          */
-        virtual Dimensions getDimensions() {
+        virtual Dimensions getDimensions() const {
           return dimensions;
         }
 
+        /**
+         * Writable reference to an item. Subclasses that store items sparsely allocate the item's storage here, so only take one to
+         * write through it; reads go through the const overloads (or getItem/getItemDirect, which use them).
+         */
         virtual T& getItemDirectByRef( unsigned int direct ) {
           return getItems()[ direct ];
         }
-        T getItemDirect( unsigned int direct ) {
+        virtual const T& getItemDirectByRef( unsigned int direct ) const {
+          return items[ direct ];
+        }
+        T getItemDirect( unsigned int direct ) const {
           return getItemDirectByRef( direct );
         }
 
         T& getItemByRef( unsigned int level, unsigned int x, unsigned int y ) {
           return getItemDirectByRef( getSingleIndex( level, x, y ) );
         }
-        T getItem( unsigned int level, unsigned int x, unsigned int y ) {
+        const T& getItemByRef( unsigned int level, unsigned int x, unsigned int y ) const {
+          return getItemDirectByRef( getSingleIndex( level, x, y ) );
+        }
+        T getItem( unsigned int level, unsigned int x, unsigned int y ) const {
           return getItemByRef( level, x, y );
         }
 
@@ -0,0 +1,149 @@
+#ifndef PALETTEGRID3D
+#define PALETTEGRID3D
+
+#include "containers/chunkedcollection3d.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+namespace BlueBear {
+  namespace Containers {
+
+    /**
+     * Three-dimensional grid of small indices into a palette of values, for grids like a lot's floor where thousands of cells share a
+     * handful of values. Cells are Index-sized (uint8_t or uint16_t, depending on how big the palette can get) and kept in a
+     * ChunkedCollection3D, so the empty parts of the grid (most of most levels) cost nothing, and edits are tracked chunk by chunk.
+     *
+     * Palette entry 0 is always a default-constructed T, standing for an empty cell. Reading a cell hands back a reference into the palette,
+     * so walking the grid never copies a T (for shared_ptr palettes, never touches a reference count).
+     */
+    template < typename T, typename IndexType = std::uint16_t > class PaletteGrid3D {
+      public:
+        using Index = IndexType;
+        using ChunkPosition = typename ChunkedCollection3D< Index >::ChunkPosition;
+        static constexpr Index EMPTY = 0;
+
+        struct Dimensions {
+          unsigned int x;
+          unsigned int y;
+          unsigned int levels;
+        };
+
+      private:
+        std::vector< T > palette;
+        ChunkedCollection3D< Index > cells;
+        Dimensions dimensions;
+
+      public:
+        PaletteGrid3D( unsigned int levels, unsigned int x, unsigned int y ) : palette( 1 ), cells( levels, x, y ), dimensions( Dimensions{ x, y, levels } ) {}
+
+        unsigned int getX() const {
+          return dimensions.x;
+        }
+
+        unsigned int getY() const {
+          return dimensions.y;
+        }
+
+        unsigned int getLevels() const {
+          return dimensions.levels;
+        }
+
+        Dimensions getDimensions() const {
+          return dimensions;
+        }
+
+        /**
+         * Add a value to the palette, returning its index. Values aren't deduplicated; callers add each of their own dictionary's entries once.
+         */
+        Index addToPalette( const T& value ) {
+          if( palette.size() > std::numeric_limits< Index >::max() ) {
+            throw std::length_error( "PaletteGrid3D palette is full" );
+          }
+
+          palette.push_back( value );
+          return palette.size() - 1;
+        }
+
+        const std::vector< T >& getPalette() const {
+          return palette;
+        }
+
+        std::size_t getPaletteSize() const {
+          return palette.size();
+        }
+
+        const T& getPaletteEntry( Index index ) const {
+          return palette[ index ];
+        }
+
+        /**
+         * Append cells in storage order, as a lot loader does. Cells a loader never gets to stay empty, and any it pushes past the end
+         * are dropped.
+         */
+        void pushDirect( Index index ) {
+          cells.pushDirect( index );
+        }
+
+        void pushRun( Index index, std::size_t run ) {
+          cells.pushRun( index, run );
+        }
+
+        Index getIndex( unsigned int level, unsigned int x, unsigned int y ) const {
+          return cells.getItemByRef( level, x, y );
+        }
+
+        void setIndex( unsigned int level, unsigned int x, unsigned int y, Index index ) {
+          cells.setItem( level, x, y, index );
+        }
+
+        const T& getItemByRef( unsigned int level, unsigned int x, unsigned int y ) const {
+          return palette[ getIndex( level, x, y ) ];
+        }
+
+        const T& getItemDirectByRef( std::size_t direct ) const {
+          return palette[ cells.getItemDirectByRef( direct ) ];
+        }
+
+        /**
+         * Call function( level, x, y, index ) for every cell that isn't EMPTY, in the order ChunkedCollection3D::forEachItem visits them
+         */
+        template < typename Function > void forEachIndex( Function function ) const {
+          cells.forEachItem( [ &function ]( unsigned int level, unsigned int x, unsigned int y, const Index& index ) {
+            if( index != EMPTY ) {
+              function( level, x, y, index );
+            }
+          } );
+        }
+
+        std::size_t getLength() const {
+          return ( std::size_t ) dimensions.levels * dimensions.x * dimensions.y;
+        }
+
+        void clear() {
+          cells.clear();
+        }
+
+        // Edits, chunk by chunk; see ChunkedCollection3D
+        std::vector< ChunkPosition > takeDirtyChunks() {
+          return cells.takeDirtyChunks();
+        }
+
+        std::uint64_t getChunkVersion( unsigned int level, unsigned int x, unsigned int y ) const {
+          return cells.getChunkVersion( level, x, y );
+        }
+
+        std::uint64_t getVersion() const {
+          return cells.getVersion();
+        }
+    };
+
+    template < typename T, typename IndexType > constexpr IndexType PaletteGrid3D< T, IndexType >::EMPTY;
+
+  }
+}
+
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef TIMINGWHEEL
+#define TIMINGWHEEL
+
+#include "bbtypes.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace BlueBear {
+  namespace Containers {
+
+    /**
+     * Hierarchical timing wheel keyed on Tick. Four levels of 256 slots cover the entire range of Tick, so there is no overflow list.
+     * Level 0 holds items due within the current 256-tick block; higher levels hold items further out and are cascaded down as time
+     * advances. Every slot is an intrusive doubly-linked list over a pooled node vector, so insert, cancel and fire are all O(1) and
+     * do not allocate once the pool is warm.
+     *
+     * Handles are generation-checked: cancelling an item that already fired (or a handle from a reused node) is a harmless no-op.
+     */
+    template < typename T > class TimingWheel {
+    public:
+      using Handle = std::uint64_t;
+      static constexpr Handle INVALID_HANDLE = 0;
+
+    private:
+      static constexpr unsigned int SLOT_BITS = 8;
+      static constexpr unsigned int SLOTS = 1 << SLOT_BITS;
+      static constexpr unsigned int SLOT_MASK = SLOTS - 1;
+      static constexpr unsigned int LEVELS = 4;
+      static constexpr unsigned int WORDS = SLOTS / 64;
+      static constexpr std::uint32_t NONE = 0xFFFFFFFF;
+
+      struct Node {
+        Tick deadline;
+        std::uint32_t generation;
+        std::uint32_t previous;
+        std::uint32_t next;
+        std::uint32_t slot;
+        bool active;
+        T item;
+      };
+
+      std::vector< Node > nodes;
+      std::vector< std::uint32_t > freeNodes;
+      std::uint32_t heads[ LEVELS * SLOTS ];
+      std::uint32_t tails[ LEVELS * SLOTS ];
+      std::uint64_t occupied[ LEVELS ][ WORDS ];
+
+      // The next tick that has not yet been fired
+      Tick now;
+      std::size_t count;
+
+      static unsigned int getDigit( Tick tick, unsigned int level ) {
+        return ( tick >> ( level * SLOT_BITS ) ) & SLOT_MASK;
+      }
+
+      /**
+       * The level an item belongs on is the level of the most significant digit in which its deadline differs from "now"
+       */
+      unsigned int getLevel( Tick deadline ) const {
+        Tick difference = deadline ^ now;
+        unsigned int level = 0;
+
+        while( difference > SLOT_MASK ) {
+          difference >>= SLOT_BITS;
+          level++;
+        }
+
+        return level;
+      }
+
+      /**
+       * First occupied slot at or after "from" on the given level; SLOTS if there is none
+       */
+      unsigned int findOccupied( unsigned int level, unsigned int from ) const {
+        for( unsigned int word = from / 64; word < WORDS; word++ ) {
+          std::uint64_t bits = occupied[ level ][ word ];
+          if( word == from / 64 ) {
+            bits &= ~std::uint64_t( 0 ) << ( from % 64 );
+          }
+
+          if( bits ) {
+            return ( word * 64 ) + __builtin_ctzll( bits );
+          }
+        }
+
+        return SLOTS;
+      }
+
+      void link( std::uint32_t index ) {
+        Node& node = nodes[ index ];
+        unsigned int level = getLevel( node.deadline );
+        unsigned int digit = getDigit( node.deadline, level );
+        std::uint32_t slot = ( level * SLOTS ) + digit;
+
+        node.slot = slot;
+        node.next = NONE;
+        node.previous = tails[ slot ];
+
+        if( tails[ slot ] == NONE ) {
+          heads[ slot ] = index;
+          occupied[ level ][ digit / 64 ] |= std::uint64_t( 1 ) << ( digit % 64 );
+        } else {
+          nodes[ tails[ slot ] ].next = index;
+        }
+
+        tails[ slot ] = index;
+      }
+
+      void unlink( std::uint32_t index ) {
+        Node& node = nodes[ index ];
+        std::uint32_t slot = node.slot;
+
+        if( node.previous == NONE ) {
+          heads[ slot ] = node.next;
+        } else {
+          nodes[ node.previous ].next = node.next;
+        }
+
+        if( node.next == NONE ) {
+          tails[ slot ] = node.previous;
+        } else {
+          nodes[ node.next ].previous = node.previous;
+        }
+
+        if( heads[ slot ] == NONE ) {
+          unsigned int level = slot / SLOTS;
+          unsigned int digit = slot % SLOTS;
+          occupied[ level ][ digit / 64 ] &= ~( std::uint64_t( 1 ) << ( digit % 64 ) );
+        }
+      }
+
+      void release( std::uint32_t index ) {
+        Node& node = nodes[ index ];
+
+        node.active = false;
+        node.item = T();
+        // Keep generations within 31 bits so handles stay positive when stored in a signed 64-bit integer (e.g. a Lua integer)
+        node.generation = ( node.generation & 0x7FFFFFFF ) + 1;
+        if( node.generation > 0x7FFFFFFF ) {
+          node.generation = 1;
+        }
+
+        freeNodes.push_back( index );
+        count--;
+      }
+
+      /**
+       * Re-link every item in a slot relative to the current value of "now"
+       */
+      void cascade( unsigned int level, unsigned int digit ) {
+        std::uint32_t slot = ( level * SLOTS ) + digit;
+        std::uint32_t index = heads[ slot ];
+
+        heads[ slot ] = NONE;
+        tails[ slot ] = NONE;
+        occupied[ level ][ digit / 64 ] &= ~( std::uint64_t( 1 ) << ( digit % 64 ) );
+
+        while( index != NONE ) {
+          std::uint32_t next = nodes[ index ].next;
+          link( index );
+          index = next;
+        }
+      }
+
+      /**
+       * Move "now" forward to target. Precondition: nothing is scheduled before target.
+       *
+       * Only items on the highest level whose digit changed, in the slot matching target's digit, can end up on the wrong level;
+       * everything above that level is still correct, and nothing can exist below it without violating the precondition.
+       */
+      void setNow( Tick target ) {
+        unsigned int level = getLevel( target );
+        now = target;
+
+        if( count && level ) {
+          cascade( level, getDigit( target, level ) );
+        }
+      }
+
+    public:
+      TimingWheel() : now( 0 ), count( 0 ) {
+        for( unsigned int i = 0; i != LEVELS * SLOTS; i++ ) {
+          heads[ i ] = NONE;
+          tails[ i ] = NONE;
+        }
+
+        for( unsigned int level = 0; level != LEVELS; level++ ) {
+          for( unsigned int word = 0; word != WORDS; word++ ) {
+            occupied[ level ][ word ] = 0;
+          }
+        }
+      }
+
+      /**
+       * Schedule item for deadline. Deadlines already in the past are scheduled for the next tick that fires.
+       */
+      Handle insert( Tick deadline, T item ) {
+        std::uint32_t index;
+
+        if( freeNodes.empty() ) {
+          index = nodes.size();
+          nodes.push_back( Node{ 0, 1, NONE, NONE, 0, false, T() } );
+        } else {
+          index = freeNodes.back();
+          freeNodes.pop_back();
+        }
+
+        Node& node = nodes[ index ];
+        node.deadline = deadline < now ? now : deadline;
+        node.active = true;
+        node.item = std::move( item );
+        count++;
+
+        link( index );
+
+        return ( Handle( node.generation ) << 32 ) | index;
+      }
+
+      /**
+       * Remove a scheduled item. Returns false if the handle is stale (already fired or cancelled); otherwise the removed item is moved into "item".
+       */
+      bool cancel( Handle handle, T& item ) {
+        std::uint32_t index = handle & 0xFFFFFFFF;
+        std::uint32_t generation = handle >> 32;
+
+        if( index >= nodes.size() || !nodes[ index ].active || nodes[ index ].generation != generation ) {
+          return false;
+        }
+
+        unlink( index );
+        item = std::move( nodes[ index ].item );
+        release( index );
+
+        return true;
+      }
+
+      /**
+       * Earliest pending deadline. Only meaningful if the wheel is not empty.
+       */
+      Tick getNextDeadline() const {
+        unsigned int slot = findOccupied( 0, getDigit( now, 0 ) );
+        if( slot != SLOTS ) {
+          return ( now & ~Tick( SLOT_MASK ) ) | slot;
+        }
+
+        for( unsigned int level = 1; level != LEVELS; level++ ) {
+          slot = findOccupied( level, getDigit( now, level ) );
+
+          if( slot != SLOTS ) {
+            // Everything in this slot precedes anything further out; only this one list needs to be scanned
+            Tick earliest = nodes[ heads[ ( level * SLOTS ) + slot ] ].deadline;
+            for( std::uint32_t index = heads[ ( level * SLOTS ) + slot ]; index != NONE; index = nodes[ index ].next ) {
+              if( nodes[ index ].deadline < earliest ) {
+                earliest = nodes[ index ].deadline;
+              }
+            }
+
+            return earliest;
+          }
+        }
+
+        return now;
+      }
+
+      /**
+       * Fire every item due on or before tick, in deadline order (and insertion order within a deadline). Empty stretches of the wheel are skipped.
+       */
+      template < typename Callback > void advance( Tick tick, Callback fire ) {
+        while( count && now <= tick ) {
+          Tick next = getNextDeadline();
+          if( next > tick ) {
+            break;
+          }
+
+          setNow( next );
+
+          std::uint32_t slot = getDigit( now, 0 );
+          while( heads[ slot ] != NONE ) {
+            std::uint32_t index = heads[ slot ];
+
+            unlink( index );
+            T item = std::move( nodes[ index ].item );
+            release( index );
+
+            fire( item );
+          }
+        }
+
+        // Nothing is left before tick + 1 - step past it (unless that would wrap around)
+        if( now <= tick && tick != Tick( ~Tick( 0 ) ) ) {
+          setNow( tick + 1 );
+        }
+      }
+
+      /**
+       * Visit every pending item as ( deadline, item ), grouped by slot in firing order within each deadline
+       */
+      template < typename Callback > void each( Callback func ) const {
+        for( unsigned int slot = 0; slot != LEVELS * SLOTS; slot++ ) {
+          for( std::uint32_t index = heads[ slot ]; index != NONE; index = nodes[ index ].next ) {
+            func( nodes[ index ].deadline, nodes[ index ].item );
+          }
+        }
+      }
+
+      /**
+       * Remove every pending item drop returns true for. drop sees each item once, and can release whatever the item holds.
+       */
+      template < typename Predicate > void removeIf( Predicate drop ) {
+        for( unsigned int slot = 0; slot != LEVELS * SLOTS; slot++ ) {
+          std::uint32_t index = heads[ slot ];
+
+          while( index != NONE ) {
+            std::uint32_t next = nodes[ index ].next;
+
+            if( drop( nodes[ index ].item ) ) {
+              unlink( index );
+              release( index );
+            }
+
+            index = next;
+          }
+        }
+      }
+
+      std::size_t size() const {
+        return count;
+      }
+
+      bool empty() const {
+        return count == 0;
+      }
+
+      Tick getNow() const {
+        return now;
+      }
+    };
+
+  }
+}
+
+#endif
@@ -90,6 +90,8 @@ namespace BlueBear {
     BasicEvent< void*, void*, int > ITEM_ADDED;
     BasicEvent< void*, void*, int > ITEM_REMOVED;
     BasicEvent< void*, std::string > MESSAGE_LOGGED;
+    // Fired by the engine, on the engine's thread, after each tick - listeners may read (but should not hold on to) the lua_State
+    BasicEvent< void*, Tick > TICK_COMPLETED;
   };
 
   extern EventManager eventManager;
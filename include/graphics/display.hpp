@@ -6,6 +6,8 @@
  */
 #include "bbtypes.hpp"
 #include "containers/collection3d.hpp"
+#include "containers/chunkedcollection3d.hpp"
+#include "containers/palettegrid3d.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -19,10 +21,12 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <map>
+#include <mutex>
 #include "graphics/texturecache.hpp"
 #include "graphics/imagecache.hpp"
+#include "scripting/lot.hpp"
 #include "scripting/tile.hpp"
-#include "scripting/wallcell.hpp"
+#include "scripting/wallgrid.hpp"
 #include "graphics/gui/sfgroot.hpp"
 #include "graphics/imagebuilder/imagesource.hpp"
 #include "graphics/shader.hpp"
@@ -30,13 +34,14 @@
 #include "graphics/camera.hpp"
 #include "graphics/instance/instance.hpp"
 #include "graphics/input/inputmanager.hpp"
+#include "graphics/worldsnapshot.hpp"
+#include "threading/snapshotbuffer.hpp"
 
 namespace BlueBear {
   class EventManager;
 
   namespace Scripting {
     class Engine;
-    class Lot;
   }
 
   namespace Threading {
@@ -65,7 +70,7 @@ namespace BlueBear {
 
       void openDisplay();
       bool update();
-      void changeToMainGameState( unsigned int currentRotation, Containers::Collection3D< std::shared_ptr< Scripting::Tile > >& floorMap, Containers::Collection3D< std::shared_ptr< Scripting::WallCell > >& wallMap );
+      void changeToMainGameState( Scripting::Lot& lot );
 
       // ---------- STATES ----------
       class State {
@@ -100,25 +105,60 @@ namespace BlueBear {
           std::unique_ptr< Model > floorModel;
           ImageCache imageCache;
           TextureCache texCache;
-          // These are from the lot!
-          Containers::Collection3D< std::shared_ptr< Scripting::Tile > >& floorMap;
-          Containers::Collection3D< std::shared_ptr< Scripting::WallCell > >& wallMap;
-          // These are ours!
-          std::unique_ptr< Containers::Collection3D< std::shared_ptr< Instance > > > floorInstanceCollection;
-          std::unique_ptr< Containers::Collection3D< std::shared_ptr< WallCellBundler > > > wallInstanceCollection;
+          // The lot itself is the engine's; only captureLotEdits, on the engine thread, looks at it
+          Scripting::Lot& lot;
+          // The render thread's own copies of the lot's grids, which the instances are built from (and the wall bundlers keep views
+          // into). Scripts' edits reach them through commandBus, so drawing never waits on the engine.
+          Scripting::Lot::FloorMap floorMap;
+          Scripting::WallGrid wallMap;
+          // These are ours! Chunked, since most of most levels is empty
+          std::unique_ptr< Containers::ChunkedCollection3D< std::shared_ptr< Instance > > > floorInstanceCollection;
+          std::unique_ptr< Containers::ChunkedCollection3D< std::shared_ptr< WallCellBundler > > > wallInstanceCollection;
+          // Scripts may run on the engine thread; anything they want done to the camera or lot instances comes through here
+          std::unique_ptr< Threading::CommandBus > commandBus;
+          Threading::SnapshotBuffer< WorldSnapshot > worldSnapshots;
+          // Held while the desktop and the input manager are in use: by the render thread for events and the OSD, and by every GUI function
+          // scripts call (see lua_guiCall). Recursive, since a GUI function can allocate and so collect another widget.
+          std::recursive_mutex guiMutex;
+
+          // The chunks of the lot's grids scripts changed during a tick, copied out for the render thread along with both palettes
+          struct LotEdits {
+            struct FloorChunk {
+              Scripting::Lot::DirtyRegion region;
+              std::vector< Scripting::Lot::FloorMap::Index > cells;
+            };
+
+            struct WallChunk {
+              Scripting::Lot::DirtyRegion region;
+              std::vector< Scripting::WallGrid::Cell > cells;
+            };
+
+            std::vector< std::shared_ptr< Scripting::Tile > > tiles;
+            std::vector< std::shared_ptr< Scripting::Wallpaper > > wallpapers;
+            std::vector< FloorChunk > floor;
+            std::vector< WallChunk > walls;
+          };
+
           void registerEvents();
           void loadIntrinsicModels();
           void processOsd();
           void loadInfrastructure();
           void createFloorInstances();
           void createWallInstances();
+          std::shared_ptr< Instance > createFloorInstance( unsigned int level, unsigned int x, unsigned int y );
+          std::shared_ptr< WallCellBundler > createWallCellBundler( unsigned int level, unsigned int x, unsigned int y );
+          void captureLotEdits();
+          void applyLotEdits( const LotEdits& edits );
+          void rebuildWallRegion( const Scripting::Lot::DirtyRegion& region );
           void setupGUI();
           void submitLuaContributions();
+          void captureWorldSnapshot( Tick tick );
           void drawWorldInstances();
           static int lua_rotateWorldLeft( lua_State* L );
           static int lua_rotateWorldRight( lua_State* L );
           static int lua_zoomIn( lua_State* L );
           static int lua_zoomOut( lua_State* L );
+          static int lua_guiCall( lua_State* L );
         public:
           struct {
             sfg::Desktop desktop;
@@ -131,7 +171,10 @@ namespace BlueBear {
           ImageCache& getImageCache();
           Input::InputManager& getInputManager();
           std::map< std::string, std::shared_ptr< Shader > >& getRegisteredShaders();
-          MainGameState( Display& instance, unsigned int currentRotation, Containers::Collection3D< std::shared_ptr< Scripting::Tile > >& floorMap, Containers::Collection3D< std::shared_ptr< Scripting::WallCell > >& wallMap );
+          Threading::CommandBus& getEngineCommandBus();
+          void pushGuiFunction( lua_State* L, lua_CFunction function, int upvalues );
+          void setGuiFuncs( lua_State* L, const luaL_Reg* functions, int upvalues );
+          MainGameState( Display& instance, Scripting::Lot& lot );
           ~MainGameState();
       };
       // ----------------------------
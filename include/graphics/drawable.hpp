@@ -18,7 +18,7 @@ namespace BlueBear {
 
         Drawable( std::shared_ptr< Mesh > mesh, std::shared_ptr< Material > material );
 
-        void render( std::shared_ptr< Armature > bindPose );
+        void render( std::shared_ptr< Armature > bindPose ) const;
     };
   }
 }
@@ -7,6 +7,8 @@
 #include <lualib.h>
 #include <lauxlib.h>
 #include <memory>
+#include <functional>
+#include <string>
 #include <SFGUI/Widgets.hpp>
 #include <map>
 #include <unordered_map>
@@ -38,6 +40,13 @@ namespace BlueBear {
           unsigned int slotHandle;
         };
 
+        // Read when the event happens, on the render thread, for the handler to see on the engine's
+        struct KeyboardStatus {
+          bool ctrl;
+          bool alt;
+          bool meta;
+        };
+
         static std::map< std::weak_ptr< sfg::Widget >, std::map< sfg::Signal::SignalID, SignalBinding >, std::owner_less< std::weak_ptr< sfg::Widget > > > masterSignalMap;
         static std::map< std::weak_ptr< sfg::Widget >, std::map< std::string, std::string >, std::owner_less< std::weak_ptr< sfg::Widget > > > masterAttrMap;
 
@@ -79,15 +88,26 @@ namespace BlueBear {
         static int lua_getStyleProperty( lua_State* L );
 
         static void elementsToTable( lua_State* L, const std::vector< std::shared_ptr< sfg::Widget > >& widgetList );
-        static void setKeyboardStatus( lua_State* L );
+        static KeyboardStatus getKeyboardStatus();
+        static void setKeyboardStatus( lua_State* L, const KeyboardStatus& status );
         static void getUserdataFromWidget( lua_State* L, std::shared_ptr< sfg::Widget > widget );
         static void registerGenericHandler(
           lua_State* L,
+          Display::MainGameState* state,
           std::shared_ptr< sfg::Widget > widget,
           sfg::Signal::SignalID signalID
         );
+        static void fireHandler(
+          lua_State* L,
+          std::weak_ptr< sfg::Widget > widgetPtr,
+          LuaReference masterReference,
+          const KeyboardStatus& keyboard,
+          std::function< void( lua_State* ) > addFields,
+          const std::string& caller
+        );
         static void clickHandler(
           lua_State* L,
+          Display::MainGameState* state,
           std::weak_ptr< sfg::Widget > selfElement,
           LuaReference masterReference,
           const std::string& buttonTag
@@ -100,6 +120,7 @@ namespace BlueBear {
         );
         static void genericHandler(
           lua_State* L,
+          Display::MainGameState* state,
           std::weak_ptr< sfg::Widget > widgetPtr,
           LuaReference masterReference
         );
@@ -15,11 +15,17 @@
 namespace BlueBear {
   class EventManager;
 
+  namespace Threading {
+    class CommandBus;
+  }
+
   namespace Graphics {
     namespace Input {
 
       class InputManager {
         lua_State* L;
+        // The engine's; script key handlers are bound on its thread
+        Threading::CommandBus& engineCommands;
         std::map< sf::Keyboard::Key, std::function< void() > > keyEvents;
         std::map< sf::Keyboard::Key, std::vector< LuaReference > > luaKeyEvents;
 
@@ -29,13 +35,13 @@ namespace BlueBear {
         void removeSFGUIFocus();
 
         unsigned int insertNearest( std::vector< LuaReference >& vector, LuaReference value );
-        void fireOff( std::vector< LuaReference >& refs );
+        void fireOff( const std::vector< LuaReference >& refs );
 
       public:
         static sf::Keyboard::Key stringToKey( const std::string& key );
         static std::string keyToString( sf::Keyboard::Key key );
 
-        InputManager( lua_State* L );
+        InputManager( lua_State* L, Threading::CommandBus& engineCommands );
         ~InputManager();
         void listen( sf::Keyboard::Key key, std::function< void() > callback );
         void handleEvent( sf::Event& event );
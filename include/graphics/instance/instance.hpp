@@ -4,10 +4,12 @@
 #include "graphics/transform.hpp"
 #include "graphics/drawable.hpp"
 #include "graphics/keyframebundle.hpp"
+#include "graphics/shaderinstancebundle.hpp"
 #include <vector>
 #include <string>
 #include <memory>
 #include <map>
+#include <mutex>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -36,8 +38,13 @@ namespace BlueBear {
         std::shared_ptr< std::map< std::string, Animation > > animations;
         std::shared_ptr< AnimPlayer > currentAnimation;
 
+        // Scripts drive animations from the engine thread while the render thread advances them
+        std::mutex animationMutex;
+
         void prepareInstanceRecursive( const Model& model );
-        void drawEntity( bool dirty, Instance& rootInstance );
+        void updateAnimationPoseUnlocked();
+        void drawEntity( bool dirty, std::shared_ptr< Armature > pose );
+        void captureDraws( std::vector< ShaderInstanceBundle::Draw >& draws, bool dirty, const std::shared_ptr< Armature >& pose );
 
         void setRootLevelItems( const Model& root );
 
@@ -60,6 +67,8 @@ namespace BlueBear {
 
         void drawEntity();
 
+        void captureDraws( std::vector< ShaderInstanceBundle::Draw >& draws );
+
         glm::vec3 getPosition();
 
         void setPosition( const glm::vec3& position );
@@ -77,6 +86,10 @@ namespace BlueBear {
         std::shared_ptr< std::map< std::string, Animation > > getAnimList();
 
         std::shared_ptr< AnimPlayer > getAnimPlayer();
+
+        bool pauseAnimation();
+
+        bool getAnimationPaused( bool& paused );
     };
   }
 }
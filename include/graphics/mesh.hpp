@@ -29,6 +29,12 @@ namespace BlueBear {
         GLuint VAO, VBO, EBO;
         unsigned int size;
 
+        // Meshes can be loaded off the render thread (e.g. by a script calling load_model on the engine thread), where there
+        // is no GL context. Geometry is held here until the first draw, which is always on the render thread.
+        bool uploaded;
+        std::vector< Vertex > pendingVertices;
+        std::vector< Index > pendingIndices;
+
         std::vector< std::string > boneIndices;
         std::shared_ptr< Armature > bind;
 
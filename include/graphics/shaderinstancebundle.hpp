@@ -1,23 +1,36 @@
 #ifndef SHADERINSTANCEBUNDLE
 #define SHADERINSTANCEBUNDLE
 
+#include "graphics/drawable.hpp"
 #include <memory>
 #include <vector>
+#include <string>
+#include <glm/glm.hpp>
 
 namespace BlueBear {
   namespace Graphics {
     class Camera;
     class Shader;
-    class Instance;
+    class Armature;
 
     class ShaderInstanceBundle {
     public:
+      /**
+       * One drawable from an Instance's tree, as it stood when captured: where it was in the world and the pose it was in. Nothing here
+       * is shared with the Instance, so it can be drawn while the Instance goes on changing.
+       */
+      struct Draw {
+        glm::mat4 model;
+        Drawable drawable;
+        std::shared_ptr< Armature > pose;
+      };
+
       std::shared_ptr< Shader > shader;
-      std::vector< std::shared_ptr< Instance > > instances;
+      std::vector< Draw > draws;
 
       ShaderInstanceBundle( const std::string& vertexPath, const std::string& fragmentPath );
       ShaderInstanceBundle( std::shared_ptr< Shader > shader );
-      void drawInstances( Camera& camera );
+      void drawInstances( Camera& camera ) const;
     };
 
   }
@@ -14,6 +14,11 @@ namespace BlueBear {
         Texture( const Texture& );
         Texture& operator=( const Texture& );
 
+        // Textures may be created off the render thread; the image is uploaded the first time the texture is bound
+        bool uploaded = false;
+        sf::Image pendingImage;
+        GLuint id = -1;
+
         void prepareTextureFromImage( sf::Image& texture );
 
       public:
@@ -21,7 +26,7 @@ namespace BlueBear {
         Texture( sf::Image& texture );
         Texture( std::string texFromFile );
         ~Texture();
-        GLuint id = -1;
+        GLuint getId();
         aiString path;
     };
   }
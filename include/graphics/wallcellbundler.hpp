@@ -4,8 +4,10 @@
 #include "containers/collection3d.hpp"
 #include "graphics/imagecache.hpp"
 #include "graphics/texturecache.hpp"
-#include "scripting/wallcell.hpp"
+#include "scripting/wallgrid.hpp"
 #include <memory>
+#include <string>
+#include <vector>
 #include <SFML/Graphics.hpp>
 #include <glm/glm.hpp>
 
@@ -32,13 +34,28 @@ namespace BlueBear {
         std::shared_ptr< sf::Image > rightSegment;
       };
 
-      bool isWallDimensionPresent( std::string& frontPath, std::string& backPath, std::unique_ptr< Scripting::WallCell::Segment >& ptr );
+      // A change a later neighbour made to one of this cell's pieces while joining onto it: a child erased, or a corner copied to an ExtendedSegment
+      struct Join {
+        glm::vec3 by;
+        std::unique_ptr< Instance > WallCellBundler::* piece;
+        std::string child;
+        bool extend;
+        glm::vec3 shift;
+        std::string resultID;
+      };
+      std::vector< Join > joins;
+
+      void eraseFromNeighbour( const std::shared_ptr< WallCellBundler >& neighbour, std::unique_ptr< Instance > WallCellBundler::* piece, const std::string& child );
+      void extendNeighbour( const std::shared_ptr< WallCellBundler >& neighbour, std::unique_ptr< Instance > WallCellBundler::* piece, const std::string& corner, glm::vec3 shift );
+      void applyJoin( const Join& join );
+
+      bool isWallDimensionPresent( std::string& frontPath, std::string& backPath, const Scripting::WallGrid::SegmentView& segment );
       void newXWallInstance( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, std::string& frontWallpaper, std::string& backWallpaper );
       void newYWallInstance( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, std::string& frontWallpaper, std::string& backWallpaper );
       void newDWallInstance( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, std::string& frontWallpaper, std::string& backWallpaper );
       void newRWallInstance( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, std::string& frontWallpaper, std::string& backWallpaper );
 
-      std::shared_ptr< WallCellBundler > safeGetBundler( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, int x, int y, int z );
+      std::shared_ptr< WallCellBundler > safeGetBundler( const Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, int x, int y, int z );
       void createExtendedSegment( std::unique_ptr< Instance >& segment, const std::string& corner, glm::vec3 shift, const std::string& resultID = "ExtendedSegment" );
 
     public:
@@ -47,10 +64,11 @@ namespace BlueBear {
       static float xOrigin;
       static float yOrigin;
 
-      std::shared_ptr< Scripting::WallCell > hostCellPtr;
+      // A view into the lot's WallGrid, which outlives every bundler
+      Scripting::WallGrid::CellView hostCell;
 
       WallCellBundler(
-        std::shared_ptr< Scripting::WallCell > hostCell,
+        Scripting::WallGrid::CellView hostCell,
         Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection,
         glm::vec3 counter,
         unsigned int currentRotation, TextureCache& hostTextureCache, ImageCache& hostImageCache
@@ -61,6 +79,8 @@ namespace BlueBear {
       std::unique_ptr< Instance > d;
       std::unique_ptr< Instance > r;
 
+      void keepJoins( const WallCellBundler& previous, int xMin, int yMin, int xMax, int yMax );
+      void forgetJoins( int xMin, int yMin, int xMax, int yMax );
       SegmentBundle getSegmentBundle( const std::string& path, bool useLeft = true, bool useCenter = true, bool useRight = true );
       void render();
     };
@@ -0,0 +1,23 @@
+#ifndef WORLDSNAPSHOT
+#define WORLDSNAPSHOT
+
+#include "bbtypes.hpp"
+#include "graphics/shaderinstancebundle.hpp"
+#include <vector>
+
+namespace BlueBear {
+  namespace Graphics {
+
+    /**
+     * Everything the render thread needs to draw the entities' world_objects, captured from Lua at the end of an engine tick: copies of
+     * their matrices and poses, not the instances themselves. Once published, a snapshot is never modified.
+     */
+    struct WorldSnapshot {
+      Tick tick;
+      std::vector< ShaderInstanceBundle > bundles;
+    };
+
+  }
+}
+
+#endif
@@ -56,6 +56,9 @@ namespace BlueBear {
       void info( const std::string& tag, const std::string& message );
       void warn( const std::string& tag, const std::string& message );
       void error( const std::string& tag, const std::string& message );
+
+      // For holding across fork(), so the child doesn't inherit it locked by a thread it doesn't have
+      std::mutex& getMutex();
   };
 }
 
@@ -0,0 +1,45 @@
+#ifndef AUTOSAVER
+#define AUTOSAVER
+
+#include "bbtypes.hpp"
+#include "scripting/luakit/binaryserializer.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <cstddef>
+#include <string>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    /**
+     * Periodic checkpoints of the engine's world into a log file (see LuaKit::BinarySerializer::saveCheckpoint). The first checkpoint
+     * writes everything; after that, each one appends only the objects that changed. Once the log has grown past compactFactor times
+     * the size of its first checkpoint, the next checkpoint rewrites it from scratch. The log loads like any other binary world.
+     */
+    class Autosaver {
+      Engine& engine;
+      LuaKit::BinarySerializer serializer;
+      std::string path;
+      Tick interval;
+      unsigned int compactFactor;
+
+      bool primed;
+      bool started;
+      Tick lastCheckpoint;
+      std::size_t baseSize;
+      std::size_t logSize;
+
+    public:
+      Autosaver( Engine& engine, lua_State* L, const std::string& path, Tick interval, unsigned int compactFactor );
+
+      void afterTick( Tick currentTick );
+      bool checkpoint();
+      Tick getNextCheckpoint() const;
+    };
+
+  }
+}
+
+#endif
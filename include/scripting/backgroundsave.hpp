@@ -0,0 +1,58 @@
+#ifndef BACKGROUNDSAVE
+#define BACKGROUNDSAVE
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    /**
+     * Saves the lot from a fork()ed copy of the process, so the simulation only stops for as long as fork() takes. The child inherits a
+     * copy-on-write snapshot of everything - the Lua states, the WaitingTables, the lot - writes it out with Engine::saveLot, and exits.
+     * It reports how far it has got over a pipe, which the engine polls once per tick.
+     *
+     * Only on platforms with fork(); elsewhere start() returns false and the caller saves in the foreground.
+     */
+    class BackgroundSave {
+      using Clock = std::chrono::steady_clock;
+
+      enum class Message : std::uint8_t { PROGRESS = 1, DONE, FAILED };
+
+      struct Report {
+        Message message;
+        std::uint64_t bytes;
+      };
+
+      // Bytes the child writes between progress reports
+      static constexpr std::uint64_t PROGRESS_INTERVAL = 1024 * 1024;
+
+      class ProgressBuffer;
+
+      std::string path;
+      int child;
+      int input;
+      Clock::time_point started;
+      std::chrono::microseconds forkTime;
+      std::uint64_t bytesWritten;
+      bool done;
+
+      static void send( int output, Message message, std::uint64_t bytes );
+      static bool writeSnapshot( Engine& engine, const std::string& path, int output );
+      void readReports();
+      void finish( int status );
+
+    public:
+      BackgroundSave( const std::string& path );
+      ~BackgroundSave();
+
+      bool start( Engine& engine );
+      bool poll();
+    };
+
+  }
+}
+
+#endif
@@ -3,6 +3,12 @@
 
 #include "scripting/event/waitingtable.hpp"
 #include "scripting/luakit/eventbridge.hpp"
+#include "scripting/tickprofiler.hpp"
+#include "scripting/gcscheduler.hpp"
+#include "scripting/autosaver.hpp"
+#include "scripting/backgroundsave.hpp"
+#include "scripting/typeindex.hpp"
+#include "scripting/spatialindex.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -11,18 +17,39 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <list>
 #include <queue>
+#include <mutex>
+#include <ostream>
+#include <atomic>
+#include <chrono>
+#include <utility>
 #include <jsoncpp/json/json.h>
 
 namespace BlueBear {
+	namespace Tools {
+		class JSONIndex;
+		class MappedFile;
+	}
+
+	namespace Threading {
+		class CommandBus;
+	}
+
 	namespace Scripting {
 		namespace LuaKit {
 			class Serializer;
+			class BinarySerializer;
+			class RefCache;
 		}
 
 		class Lot;
 		class InfrastructureFactory;
+		class ShardGroup;
+		class Pathfinder;
+
+		enum class SimulationSpeed { PAUSED, NORMAL, FAST, MAX };
 
 		class Engine {
 			public:
@@ -34,40 +61,128 @@ namespace BlueBear {
 				static constexpr const char* SYSTEM_MODPACK_DIRECTORY = "system/modpacks/";
 				static constexpr const char* MODPACK_MAIN_SCRIPT = "obj.lua";
 				static constexpr const Tick WORLD_TICKS_MAX = 300;
+				// Registry key of the weak table mapping each engine-run coroutine to the function it was started with
+				static constexpr const char* COROUTINE_ENTRIES = "bluebear.coroutine_entries";
+				// Registry key of the weak table mapping each lot object to its reference in objects
+				static constexpr const char* OBJECT_REFERENCES = "bluebear.object_references";
+				// Registry key of the weak table mapping each placed instance's userdata to its id in spatialIndex
+				static constexpr const char* PLACED_INSTANCES = "bluebear.placed_instances";
+				// Registry key of the weak set of parked coroutines that can be saved, because running them again from the top is harmless
+				static constexpr const char* RESTART_POINTS = "bluebear.restart_points";
+				// Registry key of the weak table mapping each callback (function or coroutine) to the lot object it was set on
+				static constexpr const char* CALLBACK_OWNERS = "bluebear.callback_owners";
+				static constexpr const unsigned int MAX_IDLE_THREADS = 64;
 
 				std::chrono::time_point< std::chrono::steady_clock > lastExecuted;
 
 				Tick currentTick;
 				Tick ticksPerSecond;
 
+				// May be set from the render thread (keys) while the engine thread reads it
+				std::atomic< SimulationSpeed > speed;
+				unsigned int fastTicksPerFrame;
+				std::chrono::microseconds maxSpeedBudget;
+
 				Event::WaitingTable waitingTable;
+				TypeIndex typeIndex;
+				SpatialIndex spatialIndex;
+				// Where each lot object is in objects, so removeObject can move the last one into its place
+				std::unordered_map< LuaReference, std::size_t > objectPositions;
+				// Ids are never reused, so an instance collected without being removed can't be mistaken for a new one at the same address
+				SpatialIndex::Instance nextInstance;
+
+				// Finished coroutines kept around for the next callback
+				std::vector< LuaReference > idleThreads;
+				// The coroutine objectLoop is resuming right now, and the reference that keeps it alive
+				lua_State* runningThread;
+				LuaReference runningThreadRef;
 
 				std::unique_ptr< LuaKit::EventBridge > eventBridge;
 				std::unique_ptr< InfrastructureFactory > infrastructureFactory;
+				std::unique_ptr< TickProfiler > profiler;
+				std::unique_ptr< GCScheduler > gcScheduler;
+				std::unique_ptr< Autosaver > autosaver;
+				// The save running in a forked child, if any, and the one to start at the end of this frame
+				std::unique_ptr< BackgroundSave > backgroundSave;
+				std::string pendingSavePath;
+				// Where the current lot was loaded from
+				std::string lotPath;
+				// The group this engine is a shard of (nullptr if the lot isn't sharded), and which shard it is; 0 is the primary
+				ShardGroup* group;
+				unsigned int shardIndex;
+				// Only the primary owns the group
+				std::unique_ptr< ShardGroup > shardGroup;
+				std::unique_ptr< LuaKit::RefCache > refCache;
+				// Searches paths on the current lot; only the primary has a lot
+				std::unique_ptr< Pathfinder > pathfinder;
 				const char* currentModpackDirectory;
 				std::map< std::string, BlueBear::ModpackStatus > loadedModpacks;
 				bool active;
 				bool cancel;
 				unsigned int sleepInterval;
 
+				// Held by whichever thread is currently using L
+				std::mutex luaMutex;
+				// Work other threads (GUI events, script keys) want done with L, run at the start of each update
+				std::unique_ptr< Threading::CommandBus > commandBus;
+
 				void callActionOnObject( const char* playerId, const char* objectId, const char* method );
+				void skipIdleTicks();
+				bool limitSkip( Tick& next ) const;
+				void runCallback( LuaReference reference );
+				void setCoroutineEntry( int threadIndex, int entryIndex );
+				static LuaReference getObjectReference( lua_State* L, int index );
+				static void setOwner( lua_State* L, int callbackIndex, int ownerIndex );
+				static bool pushOwner( lua_State* L, int callbackIndex );
+				LuaReference getOwner( LuaReference callback );
+				SpatialIndex::Instance getInstanceId( int index, bool assign );
+				static bool getPosition( lua_State* L, int index, SpatialIndex::Position& position );
 				// TODO: New method to deserialise function refs will be needed in LuaKit::Serializer
 				void processCommands();
+				void serviceBackgroundSave();
+				unsigned int countUnrestartable();
+				void resolvePaths();
+				void releasePaths();
+				// Byte ranges of the top-level sections of a plain JSON lot file; a missing section is ( 0, 0 )
+				using Section = std::pair< std::size_t, std::size_t >;
+				static bool findLotSections( const Tools::MappedFile& file, Section& revision, Section& lot, Section& engine );
+				bool readLotSource( std::string& revision, std::string& lot );
 
 				friend class LuaKit::Serializer;
+				friend class LuaKit::BinarySerializer;
+				friend class ShardGroup;
 
 			public:
 				std::vector< LuaReference > objects;
 				std::shared_ptr< Lot > currentLot;
 
-				Engine();
+				Engine( ShardGroup* group = nullptr, unsigned int shardIndex = 0 );
 				~Engine();
 				void setupEvents();
 				void enqueue( LuaReference edibleReference );
-				void objectLoop();
+				LuaReference park( lua_State* thread, bool restartable );
+				bool canSave();
+				void addObject( LuaReference object );
+				void removeObject( LuaReference object );
+				unsigned int objectLoop();
+				unsigned int step();
+				unsigned int update();
+				void setSpeed( SimulationSpeed speed );
+				SimulationSpeed getSpeed();
 				bool loadLot( const char* lotPath );
+				void loadWorld( Json::Value& engineJSON );
+				void loadWorld( Tools::JSONIndex& engineIndex );
+				Json::Value saveWorld();
+				void saveWorld( std::ostream& output );
+				bool loadBinaryWorld( const std::string& path );
+				bool saveBinaryWorld( const std::string& path );
+				bool saveLot( std::ostream& output, bool container = false, bool parallel = true );
+				bool saveLot( const std::string& path );
+				bool saveLotInBackground( const std::string& path );
 				bool submitLuaContributions();
 				void setActiveState( bool status );
+				std::mutex& getLuaMutex();
+				Threading::CommandBus& getCommandBus();
 
 				bool loadModpackSet( const char* modpackDirectory );
 				bool loadModpack( const std::string& name );
@@ -76,8 +191,27 @@ namespace BlueBear {
 				static int lua_setupStemcell( lua_State* L );
 				static int lua_print( lua_State* L );
 				static int lua_setTimeout( lua_State* L );
+				static int lua_clearTimeout( lua_State* L );
+				static int lua_sleep( lua_State* L );
+				static int lua_setSpeed( lua_State* L );
+				static int lua_getSpeed( lua_State* L );
+				static int lua_saveLot( lua_State* L );
+				static int lua_getWallSegments( lua_State* L );
+				static int lua_getWallpapers( lua_State* L );
+				static int lua_setTile( lua_State* L );
+				static int lua_fillTiles( lua_State* L );
+				static int lua_setWallSegment( lua_State* L );
+				static int lua_removeWallSegment( lua_State* L );
 				static int lua_getLotObjects( lua_State* L );
 				static int lua_getLotObjectsByType( lua_State* L );
+				static int lua_removeObject( lua_State* L );
+				static int lua_placeInstance( lua_State* L );
+				static int lua_removeInstance( lua_State* L );
+				static int lua_getObjectsInRadius( lua_State* L );
+				static int lua_getObjectsInRect( lua_State* L );
+				static int lua_nearestOfType( lua_State* L );
+				static int lua_findPath( lua_State* L );
+				static int lua_registerType( lua_State* L );
 		};
 	}
 }
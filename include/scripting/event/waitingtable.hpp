@@ -2,15 +2,15 @@
 #define WAITINGTABLE
 
 #include "bbtypes.hpp"
+#include "containers/timingwheel.hpp"
 #include <jsoncpp/json/json.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <functional>
 #include <map>
-#include <list>
 #include <queue>
 #include <string>
-#include <unordered_set>
 
 namespace BlueBear {
   namespace Scripting {
@@ -26,23 +26,29 @@ namespace BlueBear {
        */
       class WaitingTable {
 
-        std::map< Tick, std::list< LuaReference > > timerMap;
-
-        std::list< LuaReference >& getBucket( Tick key );
+        Containers::TimingWheel< LuaReference > timers;
 
       public:
+        using Handle = Containers::TimingWheel< LuaReference >::Handle;
+
         std::queue< LuaReference > queuedCallbacks;
 
-        void loadFromJSON(
-          Json::Value& loadingTable,
-          std::map< std::string, LuaReference >& entities,
-          std::unordered_set< LuaReference >& visitedItems
-        );
-        Json::Value saveToJSON( lua_State* L );
+        void loadFromJSON( Json::Value& loadingTable, const std::function< LuaReference( const Json::Value& ) >& take );
+        Json::Value saveToJSON( lua_State* L, const std::function< Json::Value() >& identify, const std::function< bool( LuaReference ) >& keep = nullptr );
 
-        std::string waitForTick( Tick deadline, LuaReference function );
-        void cancelTick( const std::string& handle );
+        Handle waitForTick( Tick deadline, LuaReference function );
+        LuaReference cancelTick( Handle handle );
         void triggerTick( Tick tick );
+        bool hasPendingTimers() const;
+        Tick getNextDeadline() const;
+
+        template < typename Callback > void eachTimer( Callback callback ) const {
+          timers.each( callback );
+        }
+
+        template < typename Predicate > void dropTimers( Predicate drop ) {
+          timers.removeIf( drop );
+        }
 
       };
 
@@ -0,0 +1,69 @@
+#ifndef GCSCHEDULER
+#define GCSCHEDULER
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <array>
+#include <chrono>
+#include <string>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Decides when the Lua collector runs. In "budget" mode the automatic collector is stopped, and the engine steps it by hand after each
+     * tick for at most a fixed number of microseconds; full collections only happen on ticks where nothing ran. In "auto" mode Lua is left to
+     * itself. Either way, heap size and the time spent collecting are recorded, and written out when the scheduler is destroyed.
+     */
+    class GCScheduler {
+      using Clock = std::chrono::steady_clock;
+
+      // Upper bounds (microseconds) of each histogram bucket; the last bucket takes everything above
+      static constexpr std::array< double, 9 > BUCKETS = {{ 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 }};
+      using Histogram = std::array< unsigned long long, BUCKETS.size() + 1 >;
+
+      lua_State* L;
+      bool manual;
+      std::chrono::microseconds stepBudget;
+      int stepSize;
+      int pause;
+      int emergencyHeap;
+      std::string reportPath;
+
+      // Heap size at which stepping resumes after a cycle completes
+      int threshold;
+      bool collecting;
+      // A full collection is wanted, on the next tick where nothing runs
+      bool fullPending;
+
+      unsigned long long ticks;
+      unsigned long long cycles;
+      unsigned long long fullCollections;
+      int peakHeap;
+      double totalTime;
+      double maxPause;
+      // One sample per call into the collector
+      Histogram pauses;
+      // One sample per tick on which the collector ran
+      Histogram tickTimes;
+
+      static void record( Histogram& histogram, double microseconds );
+      double collect( int what, int data, bool& finished );
+      void fullCollect();
+      void writeReport();
+
+    public:
+      GCScheduler( lua_State* L, const std::string& mode, int stepBudget, int stepSize, int pause, int emergencyHeap, const std::string& reportPath );
+      ~GCScheduler();
+
+      void afterTick( bool idle );
+      void idle();
+      void requestFull();
+      int getHeapSize();
+    };
+
+  }
+}
+
+#endif
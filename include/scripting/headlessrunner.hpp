@@ -0,0 +1,34 @@
+#ifndef HEADLESSRUNNER
+#define HEADLESSRUNNER
+
+#include "bbtypes.hpp"
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    /**
+     * Drives Engine::step without a Display, window or frame limiter. Used to measure how many ticks per second
+     * the Lua world can sustain, and to soak-test lots on machines without a display.
+     */
+    class HeadlessRunner {
+      Engine& engine;
+
+      // Per-tick wall time, in microseconds
+      std::vector< double > tickLatencies;
+      unsigned long long totalCallbacks;
+
+      double getPercentile( std::vector< double >& sorted, double percentile );
+      void report( double elapsedSeconds );
+
+    public:
+      HeadlessRunner( Engine& engine );
+
+      void run( unsigned int ticks, double seconds );
+    };
+
+  }
+}
+
+#endif
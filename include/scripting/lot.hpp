@@ -1,37 +1,61 @@
 #ifndef LOT
 #define LOT
 
-#include "containers/collection3d.hpp"
+#include "containers/palettegrid3d.hpp"
 #include "scripting/infrastructurefactory.hpp"
+#include "scripting/wallgrid.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 #include "bbtypes.hpp"
-#include <jsoncpp/json/json.h>
 #include <vector>
 #include <map>
 #include <string>
 #include <memory>
+#include <ostream>
 
 namespace BlueBear {
+	namespace Tools {
+		class JSONReader;
+	}
+
 	namespace Scripting {
 		class SerializableInstance;
 		class Tile;
-		struct WallCell;
 
 		class Lot {
 
+			public:
+				// Cells index into a palette built from the lot's floor dict, so the grid holds two bytes per cell rather than a shared_ptr
+				using FloorMap = Containers::PaletteGrid3D< std::shared_ptr< Tile > >;
+
+				// A rectangle of cells on one level, inclusive on both ends, for patching what's built from the grids after an edit
+				struct DirtyRegion {
+					unsigned int level;
+					unsigned int xMin;
+					unsigned int yMin;
+					unsigned int xMax;
+					unsigned int yMax;
+				};
+
 			private:
 				lua_State* L;
 				InfrastructureFactory& infrastructureFactory;
-				void buildFloorMap( Json::Value& floor );
-				void buildWallMap( Json::Value& walls );
-				std::shared_ptr< WallCell > getWallCell( Json::Value& object, std::vector< std::shared_ptr< Wallpaper > >& lookup );
-				inline std::shared_ptr< Tile > getTile( int index, std::vector< std::shared_ptr< Tile > >& lookup );
+				void readInfrastructure( Tools::JSONReader& reader );
+				void buildFloorMap( Tools::JSONReader& reader );
+				void buildWallMap( Tools::JSONReader& reader );
+				void readSegment( Tools::JSONReader& reader, WallGrid::Cell& cell, WallGrid::Axis axis );
+				WallGrid::Cell readWallCell( Tools::JSONReader& reader, unsigned int& run );
+				FloorMap::Index readTile( Tools::JSONReader& reader, unsigned int& run );
+				bool edited;
+				bool findTileIndex( const std::string& key, FloorMap::Index& index );
+				bool findWallpaperIndex( const std::string& key, WallGrid::Index& index );
+				void saveFloorMap( std::ostream& output ) const;
+				void saveWallMap( std::ostream& output ) const;
 
 			public:
-				std::unique_ptr< Containers::Collection3D< std::shared_ptr< Tile > > > floorMap;
-				std::unique_ptr< Containers::Collection3D< std::shared_ptr< WallCell > > > wallMap;
+				std::unique_ptr< FloorMap > floorMap;
+				std::unique_ptr< WallGrid > wallMap;
 				int floorX;
 				int floorY;
 				int stories;
@@ -39,7 +63,20 @@ namespace BlueBear {
 				unsigned int currentRotation;
 				BlueBear::TerrainType terrainType;
 
-				Lot( lua_State* L, InfrastructureFactory& infrastructureFactory, Json::Value& rootObject );
+				// Reads the "lot" object the reader is positioned at; check the reader's hasFailed() afterwards
+				Lot( lua_State* L, InfrastructureFactory& infrastructureFactory, Tools::JSONReader& reader );
+
+				// Editing. Scripts make these calls, so they happen with the engine's Lua mutex held. The grids track what changed chunk by chunk
+				// (takeDirtyChunks and the chunk versions), so read that with the mutex held too.
+				// Each returns false, changing nothing, for a position off the lot or a tile or wallpaper that isn't registered.
+				bool setTile( unsigned int level, unsigned int x, unsigned int y, const std::string& key );
+				bool fillTiles( unsigned int level, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2, const std::string& key );
+				bool setWallSegment( unsigned int level, unsigned int x, unsigned int y, WallGrid::Axis axis, const std::string& front, const std::string& back );
+				bool removeWallSegment( unsigned int level, unsigned int x, unsigned int y, WallGrid::Axis axis );
+				bool isEdited() const;
+
+				// The lot section of a lot file, as the constructor reads it
+				void save( std::ostream& output ) const;
 
 		};
 	}
@@ -0,0 +1,42 @@
+#ifndef LOTCONTAINER
+#define LOTCONTAINER
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace BlueBear {
+  namespace Tools {
+    class BlockContainer;
+  }
+
+  namespace Scripting {
+
+    /**
+     * Stores a lot's JSON sections in a Tools::BlockContainer instead of one JSON document. Each level of the floor and wall grids gets a
+     * block of its own ("lot/floor/0", "lot/wall/0"...), as does each member of the engine section ("engine/world", "engine/waitingTable"...),
+     * with the rest of the lot in "lot" (its levels arrays left as null) and the revision in "rev".
+     *
+     * Reading puts the sections back together as the same JSON text loadLot reads from a plain lot file, decompressing blocks in parallel.
+     * Callers that don't need the engine section don't decompress it.
+     */
+    class LotContainer {
+      using Span = std::pair< std::size_t, std::size_t >;
+
+      static constexpr const char* EXTENSION = ".bbc";
+
+      static bool findLevels( const std::string& lot, const char* grid, Span& levels, std::vector< Span >& each );
+      static std::string levelName( const char* grid, std::size_t level );
+
+    public:
+      static bool isContainerPath( const std::string& path );
+      static bool write( std::ostream& output, const std::string& revision, const std::string& lot, const std::string& engine, bool parallel = true );
+      static bool read( const Tools::BlockContainer& container, std::string& revision, std::string& lot, std::string* engine );
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef LUA_BINARY_SERIALIZER
+#define LUA_BINARY_SERIALIZER
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    namespace LuaKit {
+
+      /**
+       * Binary counterpart to LuaKit::Serializer. Objects are numbered in the order they're found (1, 2, 3...) instead of being keyed by
+       * pointer strings, strings are written once into a string table, and everything is written straight from the Lua state into byte
+       * buffers - no JSON DOM in either direction.
+       *
+       * Layout (all integers little-endian):
+       *   "BBW" 0x00, u32 version
+       *   sections: u8 section id, u32 byte length, body
+       *
+       *   STRINGS   u32 count, then ( u32 length, bytes ) per string; string n is referred to by index n
+       *   BYTECODE  u32 count, then ( u32 length, lua_dump output ) per distinct function body (version 2 on)
+       *   OBJECTS   u32 count, then per object: u8 kind, u32 byte length, body
+       *               TABLE      u32 entries, value metatable, ( value key, value value ) per entry
+       *               ITABLE     u32 class id string, u32 entries, ( value key, value value ) per entry
+       *               FUNCTION   u32 bytecode index, u32 upvalues, value per upvalue
+       *                          (version 1: u32 length, bytecode, u32 upvalues, value per upvalue)
+       *               SFUNCTION  u32 class string, u32 method string, value args
+       *               THREAD     value entry function
+       *   ENTITIES  u32 count, value per entity
+       *   TIMERS    u32 count, ( u64 deadline, value callback ) per timer
+       *   WAITERS   u32 count, ( u32 event string, value thread ) per coroutine parked on an event (optional)
+       *   ENGINE_STATE  u64 current tick
+       *
+       *   value: u8 tag, then i64 (INTEGER), f64 (NUMBER), u32 string (STRING, CLASS), u32 object id (REF) or nothing
+       *
+       * Checkpoints (version 3 on) are segments of a log instead, and give objects ids that stay the same from one checkpoint to the
+       * next. Each segment has RECORDS in place of OBJECTS, holding only objects whose encoding changed since the previous checkpoint,
+       * and its STRINGS and BYTECODE sections only add to the tables built up by earlier segments:
+       *   "BBL" 0x00, u32 log version, then ( u32 byte length, "BBW" container ) per segment
+       *   RECORDS   u32 count, then per object: u32 id, u8 kind, u32 byte length, body
+       * Loading a log merges the records of every segment (later ones replace earlier ones) and takes entities, timers, waiters and engine state
+       * from the last.
+       */
+      class BinarySerializer {
+        static constexpr const char MAGIC[ 4 ] = { 'B', 'B', 'W', 0 };
+        static constexpr std::uint32_t VERSION = 3;
+        static constexpr const char LOG_MAGIC[ 4 ] = { 'B', 'B', 'L', 0 };
+        static constexpr std::uint32_t LOG_VERSION = 1;
+
+        enum class Section : std::uint8_t { STRINGS = 1, OBJECTS, ENTITIES, TIMERS, ENGINE_STATE, BYTECODE, RECORDS, WAITERS };
+        enum class Kind : std::uint8_t { TABLE = 1, ITABLE, FUNCTION, SFUNCTION, THREAD };
+        enum class Tag : std::uint8_t { NIL = 0, FALSE, TRUE, INTEGER, NUMBER, STRING, REF, CLASS, ENV_BLUEBEAR, ENV_G };
+
+        struct FormatException : public std::exception {
+          const char* what() const throw() {
+            return "Truncated or malformed world file";
+          }
+        };
+
+        // Substitutions (classes, the bluebear table, _G) are written by name rather than by value
+        struct Substitution {
+          Tag tag;
+          std::string className;
+        };
+
+        struct Record {
+          Kind kind;
+          const char* body;
+          const char* end;
+          std::uint32_t version;
+        };
+
+        struct Segment {
+          std::uint32_t version;
+          std::pair< const char*, const char* > sections[ ( unsigned int ) Section::WAITERS + 1 ];
+        };
+
+        lua_State* L;
+
+        // --- saving ---
+        // Absolute stack index of the table holding every object found so far, by id
+        int objectsIndex;
+        std::uint32_t objectCount;
+        std::unordered_map< const void*, std::uint32_t > objectIds;
+        std::unordered_map< std::string, std::uint32_t > stringIds;
+        std::string strings;
+        std::uint32_t stringCount;
+        std::unordered_map< const void*, Substitution > substitutions;
+        // Keyed by the bytecode itself, so identical function bodies are only written once
+        std::unordered_map< std::string, std::uint32_t > bytecodeIds;
+        std::string bytecode;
+        std::uint32_t bytecodeCount;
+        // Ids given out in discovery order; in a checkpoint, these are the stable ids rather than 1, 2, 3...
+        std::vector< std::uint32_t > discoveredIds;
+
+        // --- checkpoints ---
+        // Stable ids live in a weak-keyed registry table, so objects that are collected don't keep their ids (or themselves) alive
+        static constexpr const char* CHECKPOINT_IDS = "bluebear.checkpoint_ids";
+        bool checkpointing;
+        std::uint32_t nextId;
+        // Fingerprint of each object's encoding at the last checkpoint
+        std::unordered_map< std::uint32_t, std::uint64_t > fingerprints;
+        std::uint32_t changedCount;
+
+        // --- loading ---
+        const char* cursor;
+        const char* end;
+        std::uint32_t version;
+        std::vector< std::pair< const char*, std::size_t > > stringTable;
+        std::vector< std::pair< const char*, std::size_t > > bytecodeTable;
+        std::map< std::uint32_t, Record > records;
+
+        template < typename T > static void write( std::string& buffer, T value ) {
+          buffer.append( ( const char* ) &value, sizeof( T ) );
+        }
+        template < typename T > static void patch( std::string& buffer, std::size_t offset, T value ) {
+          buffer.replace( offset, sizeof( T ), ( const char* ) &value, sizeof( T ) );
+        }
+        template < typename T > T read() {
+          if( ( std::size_t )( end - cursor ) < sizeof( T ) ) {
+            throw FormatException();
+          }
+
+          T value;
+          std::copy( cursor, cursor + sizeof( T ), ( char* ) &value );
+          cursor += sizeof( T );
+          return value;
+        }
+
+        static int dumpWriter( lua_State* L, const void* data, size_t size, void* buffer );
+        static std::uint64_t fingerprint( const char* data, std::size_t length );
+
+        std::uint32_t intern( const char* string, std::size_t length );
+        void buildSubstitutions();
+        void findClasses();
+        bool hasCoroutineEntry( int index );
+        void writeValue( std::string& buffer, int index );
+        void writeObject( std::string& buffer );
+        void writeEntries( std::string& buffer, bool skipClass );
+        void writeSection( std::string& output, Section section, const std::string& body );
+        std::uint32_t stableId( int index );
+        std::string writeWorld( Engine& engine );
+
+        void readSegment( const char* begin, const char* end, Segment& segment );
+        void enter( Segment& segment, Section section );
+        void pushString( std::uint32_t index );
+        void pushClass( std::uint32_t className );
+        void readValue();
+        void createObject( Kind kind );
+        void fillObject( Kind kind );
+        void readEntries( std::uint32_t count );
+        void setUpvalueByName( const char* name );
+
+      public:
+        BinarySerializer( lua_State* L );
+
+        std::string saveWorld( Engine& engine );
+        std::string saveCheckpoint( Engine& engine, bool full );
+        std::uint32_t getChangedCount() const;
+        static std::string getLogHeader();
+        bool loadWorld( const std::string& data, Engine& engine );
+      };
+
+    }
+  }
+}
+
+#endif
@@ -5,9 +5,14 @@
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#include <jsoncpp/json/json.h>
+#include <algorithm>
 #include <vector>
+#include <deque>
 #include <string>
 #include <exception>
+#include <functional>
+#include <mutex>
 
 namespace BlueBear {
   namespace Scripting {
@@ -20,8 +25,20 @@ namespace BlueBear {
         lua_State* L;
 
         std::vector< LuaReference > messageLogged;
+        // Coroutines parked by bluebear.event.wait; each is woken once, by the next event
+        std::vector< LuaReference > messageLoggedWaiters;
 
+        // Messages can be logged from any thread, so they're queued here and only handed to Lua from the engine's thread. Nothing takes
+        // them off while the simulation is paused, so only the latest are kept.
+        static constexpr const std::size_t MAX_QUEUED_MESSAGES = 256;
+        std::mutex queueMutex;
+        std::deque< std::string > queuedMessages;
+
+        void queueMessage( const std::string& logMessage );
         void fireEvents( std::vector< LuaReference >& references, const std::string& logMessage );
+        void wakeWaiters( std::vector< LuaReference >& waiters, const std::string& logMessage );
+
+        std::vector< LuaReference >* getWaiters( const std::string& eventId );
 
         unsigned int enqueue( std::vector< LuaReference >& references, LuaReference masterReference );
         void invalidate( std::vector< LuaReference >& references, int index );
@@ -36,12 +53,30 @@ namespace BlueBear {
 
       public:
         EventBridge( lua_State* L, Scripting::Engine& engine );
+        ~EventBridge();
+
+        void dispatchQueuedMessages();
+
+        void loadFromJSON( Json::Value& waiters, const std::function< LuaReference( const Json::Value& ) >& take );
+        Json::Value saveToJSON( const std::function< Json::Value() >& identify, const std::function< bool( LuaReference ) >& keep = nullptr );
+        bool addWaiter( const std::string& eventId, LuaReference waiter );
+
+        template < typename Callback > void eachWaiter( Callback callback ) const {
+          for( LuaReference waiter : messageLoggedWaiters ) {
+            callback( "MESSAGE_LOGGED", waiter );
+          }
+        }
+
+        template < typename Predicate > void dropWaiters( Predicate drop ) {
+          messageLoggedWaiters.erase( std::remove_if( messageLoggedWaiters.begin(), messageLoggedWaiters.end(), drop ), messageLoggedWaiters.end() );
+        }
 
         unsigned int listen( const std::string& eventId );
         void unlisten( const std::string& eventId, int index );
 
         static int lua_listen( lua_State* L );
         static int lua_unlisten( lua_State* L );
+        static int lua_wait( lua_State* L );
       };
 
     }
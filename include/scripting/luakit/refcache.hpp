@@ -0,0 +1,50 @@
+#ifndef REFCACHE
+#define REFCACHE
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+namespace BlueBear {
+  namespace Scripting {
+    namespace LuaKit {
+
+      /**
+       * Registry references to Lua values the engine calls on every tick (or every event), so hot paths can fetch them with a single
+       * lua_rawgeti instead of a global lookup plus a string-keyed lookup per level of "bluebear.util.whatever".
+       *
+       * One RefCache belongs to each lua_State. A pointer to it is kept in the state's extra space, so code that only has the lua_State
+       * (input handlers, GUI element callbacks) can still find it - and coroutines created from the state inherit it.
+       */
+      class RefCache {
+      public:
+        enum class Entry : unsigned int {
+          // bluebear.util.bind
+          BIND,
+          // bluebear.engine
+          ENGINE_TABLE,
+          ENTRY_COUNT
+        };
+
+      private:
+        lua_State* L;
+        LuaReference references[ ( unsigned int ) Entry::ENTRY_COUNT ];
+
+        bool resolvePath( const char* path );
+
+      public:
+        RefCache( lua_State* L );
+        ~RefCache();
+
+        bool resolve();
+
+        static void push( lua_State* L, Entry entry );
+        static bool holds( lua_State* L, LuaReference reference );
+      };
+
+    }
+  }
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define LUA_SERIALIZER
 
 #include "bbtypes.hpp"
+#include "tools/jsonindex.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -9,9 +10,9 @@
 #include <vector>
 #include <string>
 #include <functional>
-#include <map>
-#include <regex>
-#include <unordered_set>
+#include <limits>
+#include <ostream>
+#include <unordered_map>
 
 namespace BlueBear {
   namespace Scripting {
@@ -19,6 +20,11 @@ namespace BlueBear {
 
     namespace LuaKit {
 
+      /**
+       * Objects are keyed in "world" by dense integer ids ("0", "1", "2"...) given out in the order they're found, and refer to each other,
+       * and are referred to by the entity manager and waiting table, by those ids. Lots saved before that keyed objects by their address
+       * ("0x5609738a47e0"); those still load.
+       */
       class Serializer {
 
         static const std::string TYPE_TABLE;
@@ -28,27 +34,57 @@ namespace BlueBear {
         static const std::string TYPE_REF;
         static const std::string TYPE_CLASSID;
         static const std::string TYPE_ENVREF;
+        static const std::string TYPE_THREAD;
 
         static const std::string ENVREF_MODE_BBGLOBAL;
         static const std::string ENVREF_MODE_G;
 
+        static constexpr unsigned int INVALID_ID = std::numeric_limits< unsigned int >::max();
+
         // These callbacks should leave the stack unmodified
         // They should accept table/function as the first argument on the stack
         using Callback = std::function< Json::Value() >;
 
         lua_State* L;
         Json::Value world;
+        // When saving to a stream, each record is written out as soon as it's complete instead of being kept in world
+        std::ostream* output;
+        bool firstRecord;
+        // Id of everything already written (or being written), so shared and cyclic references are only saved once
+        std::unordered_map< const void*, unsigned int > objectIds;
+        // Function bytecode is pooled: each distinct dump is stored once (base64) and function records refer to it by index
+        std::unordered_map< std::string, unsigned int > bytecodeIds;
+        Json::Value bytecode;
+        std::vector< std::string > bytecodeBlobs;
+        // When loading from a stream, records are parsed one at a time from here instead of from world
+        Tools::JSONIndex* worldIndex;
         // Pointer-to-substitution map usable by both upvalues and tables
-        std::map< std::string, Callback > substitutions;
-        // When loading a lot from disk, use these maps to track top-level objects
-        std::map< std::string, LuaReference > globalEntities;
+        std::unordered_map< const void*, Callback > substitutions;
+        // When loading a lot from disk, every top-level object by id (LUA_NOREF until it's created), and the key of its record in world
+        std::vector< LuaReference > entities;
+        std::vector< std::string > recordKeys;
+        // References handed over to the engine (entity manager, waiting table), which mustn't be released once loading is done
+        std::vector< bool > retained;
+        // Ids for the records of an older lot, keyed by address
+        std::unordered_map< std::string, unsigned int > legacyIds;
 
         // --- saving ---
+        void collectWorld( std::vector< LuaReference >& objects );
+        void collectObjects( std::vector< LuaReference >& objects );
+        void collectValue();
+        void restartCollector( bool collectorRunning, Engine& engine );
+        unsigned int assignId();
+        void emitRecord( unsigned int id, Json::Value& record );
+        Json::Value saveEntityManager( std::vector< LuaReference >& objects );
+        Json::Value saveOwners( Engine& engine, const std::function< bool( LuaReference ) >& keep );
+        static int dumpWriter( lua_State* L, const void* data, size_t size, void* buffer );
         void createTableOnMasterList();
         void createFunctionOnMasterList();
+        void createThreadOnMasterList();
         void inferType( Json::Value& pair, const std::string& field );
 
         Json::Value createReference();
+        Json::Value getObjectId();
         Json::Value createClassReference();
         Json::Value createConcordiaNSReference();
         Json::Value createGReference();
@@ -62,23 +98,24 @@ namespace BlueBear {
         void addUpvalues( Json::Value& funcType );
 
         // --- loading ---
-        LuaReference createGlobalItem( const std::string& addressKey );
-        LuaReference createTable( const std::string& addressKey, Json::Value& tableDefinition );
-        LuaReference createITable( const std::string& addressKey, Json::Value& tableDefinition );
-        LuaReference createFunction( const std::string& addressKey, Json::Value& tableDefinition );
-        LuaReference createSFunction( const std::string& addressKey, Json::Value& tableDefinition );
-        void getReference( const std::string& addressKey );
+        void loadItems( Json::Value& bytecode, Json::Value& waitingTable, Json::Value& eventWaiters, Json::Value& entityManager, Json::Value& owners, Engine& engine );
+        void indexRecords( const std::vector< std::string >& keys );
+        unsigned int resolveId( const Json::Value& token );
+        LuaReference takeReference( const Json::Value& token );
+        LuaReference createGlobalItem( unsigned int id );
+        LuaReference createTable( unsigned int id, Json::Value& tableDefinition );
+        LuaReference createITable( unsigned int id, Json::Value& tableDefinition );
+        LuaReference createFunction( unsigned int id, Json::Value& tableDefinition );
+        LuaReference createSFunction( unsigned int id, Json::Value& tableDefinition );
+        LuaReference createThread( unsigned int id, Json::Value& threadDefinition );
+        void getReference( unsigned int id );
         void getEnvReference( const std::string& envRefKey );
         void determineInnerItem( Json::Value& objectToken );
         void inferTypeFromJSON( Json::Value& objectToken );
-        bool globalItemExists( const std::string& addressKey );
+        bool globalItemExists( unsigned int id );
         void unpackUpvalues( Json::Value& upvalues );
         void setUpvalueByIndex( int upvalueIndex );
-        void unpackEntityManager(
-          const Json::Value& entityManager,
-          std::vector< LuaReference >& refs,
-          std::unordered_set< LuaReference >& waitingTableExclusions
-        );
+        void unpackEntityManager( const Json::Value& entityManager, Engine& engine );
 
       public:
         Serializer( lua_State* L );
@@ -87,7 +124,14 @@ namespace BlueBear {
          * Save the world to JSON value
          */
         Json::Value saveWorld( std::vector< LuaReference >& objects, Engine& engine );
+        /**
+         * Write the "world", "bytecode", "waitingTable", "eventWaiters", "entityManager" and "owners" members of the engine section to output as they're traversed. The
+         * caller writes the enclosing braces and any other members.
+         */
+        void saveWorld( std::ostream& output, std::vector< LuaReference >& objects, Engine& engine );
+        Json::Value savePartition( std::vector< LuaReference >& objects, Engine& engine, const std::function< bool( LuaReference ) >& keep );
         void loadWorld( Json::Value& engineDefinition, Engine& engine );
+        void loadWorld( Tools::JSONIndex& engineIndex, Engine& engine );
       };
 
     }
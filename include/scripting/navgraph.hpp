@@ -0,0 +1,60 @@
+#ifndef NAVGRAPH
+#define NAVGRAPH
+
+#include "scripting/lot.hpp"
+#include "scripting/wallgrid.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Where a doll can step to from each cell of a lot's floor: a byte per cell, with a bit for each of the eight neighbouring cells that
+     * can be reached in one step. Built from the floor and wall grids, then patched a region at a time as the lot is edited.
+     *
+     * Wall cell ( x, y ) sits on the top left corner of floor cell ( x, y ) - its x segment is the floor cell's top edge and its y segment
+     * the left edge, and its d and r segments cross the floor cell diagonally. Segments on an edge block stepping across it. A cell with a
+     * diagonal segment can't be stood on at all, and a diagonal step is only allowed if both of the ways round it are open, so dolls never
+     * cut the corner of a wall. Level 0 is the ground and can be stood on anywhere; higher levels only where there's a floor tile.
+     */
+    class NavGraph {
+    public:
+      // North is towards row 0
+      enum Direction : unsigned int { NORTH = 0, NORTH_EAST, EAST, SOUTH_EAST, SOUTH, SOUTH_WEST, WEST, NORTH_WEST };
+      static constexpr unsigned int DIRECTIONS = 8;
+      static const int DX[ DIRECTIONS ];
+      static const int DY[ DIRECTIONS ];
+
+    private:
+      unsigned int x;
+      unsigned int y;
+      unsigned int levels;
+      std::vector< std::uint8_t > walkable;
+      std::vector< std::uint8_t > moves;
+
+      std::size_t getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) const;
+      bool canStand( const Lot::FloorMap& floorMap, const WallGrid& wallMap, unsigned int level, unsigned int x, unsigned int y ) const;
+      bool canStep( const WallGrid& wallMap, unsigned int level, int x, int y, unsigned int direction ) const;
+      std::uint8_t findMoves( const WallGrid& wallMap, unsigned int level, unsigned int x, unsigned int y ) const;
+
+    public:
+      NavGraph( unsigned int levels, unsigned int x, unsigned int y );
+
+      void build( const Lot::FloorMap& floorMap, const WallGrid& wallMap );
+      void update( const Lot::FloorMap& floorMap, const WallGrid& wallMap, const Lot::DirtyRegion& region );
+
+      unsigned int getX() const;
+      unsigned int getY() const;
+      unsigned int getLevels() const;
+      bool contains( unsigned int level, unsigned int x, unsigned int y ) const;
+      bool isWalkable( unsigned int level, unsigned int x, unsigned int y ) const;
+      std::uint8_t getMoves( unsigned int level, unsigned int x, unsigned int y ) const;
+      const std::uint8_t* getLevel( unsigned int level ) const;
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef PATHBENCHMARK
+#define PATHBENCHMARK
+
+#include "scripting/lot.hpp"
+#include "scripting/pathfinder.hpp"
+#include "scripting/wallgrid.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Times the Pathfinder on generated lots, one thread against a batch spread over the TBB workers, and checks the two find the same
+     * paths. Each lot is built from a seed: the ground floor is divided into 8x8 rooms with a door in every wall and the odd diagonal wall
+     * standing in a room, and a second storey covers the middle of the lot, split in two by a wall with a single door. Requests are between
+     * random cells, nine in ten of them on the ground floor.
+     */
+    class PathBenchmark {
+      static constexpr unsigned int ROOM_SIZE = 8;
+
+      struct Result {
+        unsigned int size;
+        std::size_t paths;
+        std::size_t found;
+        double meanLength;
+        double buildSeconds;
+        double serialSeconds;
+        double batchSeconds;
+        bool matched;
+      };
+
+      unsigned int seed;
+
+      void generate( unsigned int size, Lot::FloorMap& floorMap, WallGrid& wallMap );
+      std::vector< Pathfinder::Request > createRequests( const NavGraph& graph, std::size_t count );
+      bool runOnce( unsigned int size, std::size_t count );
+      void report( const Result& result );
+
+    public:
+      PathBenchmark( unsigned int seed );
+
+      bool run( const std::vector< unsigned int >& sizes, std::size_t count );
+    };
+
+  }
+}
+
+#endif
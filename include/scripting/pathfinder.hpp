@@ -0,0 +1,119 @@
+#ifndef PATHFINDER
+#define PATHFINDER
+
+#include "bbtypes.hpp"
+#include "scripting/lot.hpp"
+#include "scripting/navgraph.hpp"
+#include "scripting/wallgrid.hpp"
+#include <lua.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_group.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Finds paths across the lot for dolls, off the engine thread. Requests made during a tick are collected into a batch, which is searched
+     * on TBB workers between ticks; the engine hands the finished paths to the callbacks waiting for them on a later tick. Only one batch
+     * is searched at a time, and requests made meanwhile wait for the next.
+     *
+     * Searches run on a NavGraph that's shared with the batch in flight. Lot edits patch it chunk by chunk, found by comparing the grids'
+     * chunk versions with the ones it saw last; an edit made while a batch is running patches a copy, so the batch finishes on the lot as
+     * it was when it started.
+     *
+     * Searches are A* over the eight-way grid, with the octile distance as the heuristic. A cell is a node, a straight step costs 1 and
+     * a diagonal step the square root of 2.
+     */
+    class Pathfinder {
+    public:
+      struct Step {
+        unsigned int x;
+        unsigned int y;
+      };
+
+      struct Request {
+        unsigned int level;
+        unsigned int x1;
+        unsigned int y1;
+        unsigned int x2;
+        unsigned int y2;
+        LuaReference callback;
+      };
+
+      struct Path {
+        LuaReference callback;
+        bool found;
+        double length;
+        // Start to goal, both included
+        std::vector< Step > steps;
+      };
+
+      /**
+       * Scratch space for searching, reused from one search to the next. Nodes are marked with the search that last touched them, so
+       * nothing is cleared between searches.
+       */
+      class Search {
+        struct Node {
+          float cost;
+          std::uint32_t search;
+          std::uint8_t from;
+          bool closed;
+        };
+
+        struct Open {
+          float estimate;
+          float cost;
+          std::uint32_t node;
+        };
+
+        std::vector< Node > nodes;
+        std::vector< Open > open;
+        std::uint32_t current;
+
+      public:
+        Search();
+
+        bool find( const NavGraph& graph, const Request& request, std::vector< Step >& steps, double& length );
+      };
+
+    private:
+      std::shared_ptr< NavGraph > graph;
+      // The grids' versions as of the last update, overall and chunk by chunk
+      std::uint64_t floorVersion;
+      std::uint64_t wallVersion;
+      std::vector< std::uint64_t > floorChunkVersions;
+      std::vector< std::uint64_t > wallChunkVersions;
+      std::vector< Request > pending;
+      // The batch in flight, and what it has found; paths[ i ] answers requests[ i ]
+      std::vector< Request > requests;
+      std::vector< Path > paths;
+      std::atomic< bool > running;
+      tbb::enumerable_thread_specific< Search > searches;
+      tbb::task_group group;
+
+    public:
+      Pathfinder( const Lot::FloorMap& floorMap, const WallGrid& wallMap );
+      ~Pathfinder();
+
+      void update( Lot& lot );
+      void request( const Request& request );
+      void dispatch();
+      bool collect( std::vector< Path >& finished );
+      void wait();
+      std::vector< LuaReference > cancel();
+      void findAll( const NavGraph& graph, const std::vector< Request >& batch, std::vector< Path >& results );
+
+      bool isBusy() const;
+      std::size_t getPendingCount() const;
+      const NavGraph& getGraph() const;
+    };
+
+  }
+}
+
+#endif
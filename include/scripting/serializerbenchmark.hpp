@@ -0,0 +1,58 @@
+#ifndef SERIALIZERBENCHMARK
+#define SERIALIZERBENCHMARK
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    /**
+     * Times LuaKit::Serializer on generated worlds, and checks that what comes back is the same shape as what went in. Each world is built
+     * from a seed: instances of a throwaway class with self-references and rings of siblings, chains of nested tables, arrays, tables
+     * sharing a handful of metatables, sfunctions bound to their instance and closures with upvalues. It's saved the way a lot is saved
+     * (streamed), loaded into a second engine the way a lot is loaded, and both worlds are described canonically and compared.
+     *
+     * runLot times Engine::loadLot on a real lot file instead, each time into a fresh engine, for startup time on large lots.
+     */
+    class SerializerBenchmark {
+      static const char* NODE_CLASS;
+      static const char* GENERATOR;
+      static const char* DESCRIBER;
+
+      struct Result {
+        unsigned int requested;
+        std::size_t records;
+        std::size_t bytes;
+        double saveSeconds;
+        double loadSeconds;
+        bool matched;
+      };
+
+      unsigned int seed;
+
+      static std::unique_ptr< Engine > createEngine();
+      static bool runChunk( lua_State* L, const char* chunk, const char* name, int results );
+      static std::uint64_t describe( lua_State* L, std::vector< LuaReference >& roots, std::size_t& described );
+      bool runOnce( unsigned int count );
+      void report( const Result& result );
+
+    public:
+      SerializerBenchmark( unsigned int seed );
+
+      bool run( const std::vector< unsigned int >& counts );
+      static bool runLot( const std::string& path, unsigned int repeats );
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SHARDGROUP
+#define SHARDGROUP
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <jsoncpp/json/json.h>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+
+    /**
+     * Opt-in partitioning of the lot across several Lua states. Shard 0 is the primary Engine (the one the Display and GUI talk to); the
+     * others are worker Engines owned by this group, each with its own lua_State and WaitingTable. Every tick runs all shards at once and
+     * ends with a barrier. Shards can't share Lua values, so they talk through string messages (bluebear.shard.send), which are delivered
+     * after the barrier and handled on the next tick.
+     *
+     * Which entities live on which shard is decided by the lot file ("shards" in the engine section). A lot saved without shards is split
+     * up when it's loaded (see partition). Worker shards have no Display, so anything that needs the world or the GUI belongs on shard 0.
+     */
+    class ShardGroup {
+      struct Message {
+        unsigned int from;
+        std::string channel;
+        std::string payload;
+      };
+
+      // Lot objects are split between shards by which CELL_SIZE x CELL_SIZE cell of the lot they stand in
+      static constexpr double CELL_SIZE = 8.0;
+
+      Engine& primary;
+      std::vector< std::unique_ptr< Engine > > workers;
+
+      // Written from any shard during a tick, read only after the barrier
+      std::mutex mailMutex;
+      std::vector< std::vector< Message > > inboxes;
+
+      // One handler per channel per shard
+      std::vector< std::unordered_map< std::string, LuaReference > > handlers;
+
+      Engine& getShard( unsigned int index );
+      void post( unsigned int from, unsigned int to, const std::string& channel, const std::string& payload );
+      void deliverMail();
+      unsigned int getHome( LuaReference object );
+      unsigned int getCallbackHome( LuaReference callback );
+
+    public:
+      ShardGroup( Engine& primary, unsigned int count );
+      ~ShardGroup();
+
+      unsigned int getCount();
+      bool submitLuaContributions();
+      void registerLuaContributions( lua_State* L, unsigned int index );
+
+      unsigned int tick();
+      void skipIdleTicks();
+      unsigned int countUnrestartable();
+
+      void loadWorld( Json::Value& shards );
+      void partition();
+      Json::Value saveWorld();
+      void saveWorld( std::ostream& output );
+
+      static int lua_send( lua_State* L );
+      static int lua_listen( lua_State* L );
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef SPATIALINDEX
+#define SPATIALINDEX
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lauxlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Where the objects placed on the lot (Entity:place_object) are, so that "what's near here" doesn't mean visiting every object on the lot.
+     * A uniform grid of lot cells, one per level; each cell holds the placed instances whose position falls inside it. Positions are in the
+     * world coordinates place_object takes, where a lot cell is one unit square and a level is two units high.
+     *
+     * An object can have any number of placed instances, each keyed by an id the engine gives its userdata (see Engine::PLACED_INSTANCES).
+     * Queries report each object once.
+     */
+    class SpatialIndex {
+    public:
+      using Instance = unsigned int;
+
+      struct Position {
+        double x;
+        double y;
+        double z;
+      };
+
+    private:
+      struct Entry {
+        LuaReference object;
+        Position position;
+        std::size_t cell;
+      };
+
+      unsigned int x;
+      unsigned int y;
+      unsigned int levels;
+      // World position of the corner of cell ( 0, 0 ) - cell y counts down the world's y axis, the same as Display lays out the floor
+      double xOrigin;
+      double yOrigin;
+
+      std::vector< std::vector< Instance > > cells;
+      std::unordered_map< Instance, Entry > entries;
+      std::unordered_map< LuaReference, std::vector< Instance > > instances;
+
+      int getCellX( double worldX ) const;
+      int getCellY( double worldY ) const;
+      int getLevel( double worldZ ) const;
+      std::size_t getCellIndex( int level, int cellX, int cellY ) const;
+      void removeFromCell( std::size_t cell, Instance instance );
+
+    public:
+      SpatialIndex();
+
+      void resize( unsigned int levels, unsigned int floorX, unsigned int floorY );
+      void clear();
+
+      void place( LuaReference object, Instance instance, const Position& position );
+      void remove( Instance instance );
+      void removeObject( LuaReference object );
+
+      std::size_t getInstanceCount() const;
+
+      /**
+       * Call callback( object ) once for each object with an instance within radius of centre, measured across the level centre is on.
+       */
+      template < typename Callback > void eachInRadius( const Position& centre, double radius, Callback callback ) const {
+        std::unordered_set< LuaReference > seen;
+        int level = getLevel( centre.z );
+        int xMin = getCellX( centre.x - radius );
+        int xMax = getCellX( centre.x + radius );
+        // Cell y runs the opposite way to world y
+        int yMin = getCellY( centre.y + radius );
+        int yMax = getCellY( centre.y - radius );
+        double radiusSquared = radius * radius;
+
+        for( int cellY = yMin; cellY <= yMax; cellY++ ) {
+          for( int cellX = xMin; cellX <= xMax; cellX++ ) {
+            for( Instance instance : cells[ getCellIndex( level, cellX, cellY ) ] ) {
+              const Entry& entry = entries.at( instance );
+              double dx = entry.position.x - centre.x;
+              double dy = entry.position.y - centre.y;
+
+              if( dx * dx + dy * dy <= radiusSquared && seen.insert( entry.object ).second ) {
+                callback( entry.object );
+              }
+            }
+          }
+        }
+      }
+
+      /**
+       * Call callback( object ) once for each object with an instance inside the box between two corners (in either order)
+       */
+      template < typename Callback > void eachInBox( const Position& first, const Position& second, Callback callback ) const {
+        std::unordered_set< LuaReference > seen;
+        Position min{ std::fmin( first.x, second.x ), std::fmin( first.y, second.y ), std::fmin( first.z, second.z ) };
+        Position max{ std::fmax( first.x, second.x ), std::fmax( first.y, second.y ), std::fmax( first.z, second.z ) };
+
+        for( int level = getLevel( min.z ); level <= getLevel( max.z ); level++ ) {
+          for( int cellY = getCellY( max.y ); cellY <= getCellY( min.y ); cellY++ ) {
+            for( int cellX = getCellX( min.x ); cellX <= getCellX( max.x ); cellX++ ) {
+              for( Instance instance : cells[ getCellIndex( level, cellX, cellY ) ] ) {
+                const Entry& entry = entries.at( instance );
+                const Position& position = entry.position;
+
+                if( position.x >= min.x && position.x <= max.x && position.y >= min.y && position.y <= max.y && position.z >= min.z && position.z <= max.z &&
+                    seen.insert( entry.object ).second ) {
+                  callback( entry.object );
+                }
+              }
+            }
+          }
+        }
+      }
+
+      /**
+       * The object with the instance closest to centre, on centre's level and within maxDistance, for which accept( object ) is true.
+       * Searches outward from centre's cell a ring at a time, stopping once no unsearched cell can hold anything closer. Returns LUA_NOREF
+       * if there's no such object; distance is set to how far away the one found is.
+       */
+      template < typename Predicate > LuaReference nearest( const Position& centre, double maxDistance, Predicate accept, double& distance ) const {
+        LuaReference result = LUA_NOREF;
+        double best = maxDistance * maxDistance;
+        int level = getLevel( centre.z );
+        int centreX = getCellX( centre.x );
+        int centreY = getCellY( centre.y );
+        int furthest = std::max( std::max( centreX, ( int ) x - 1 - centreX ), std::max( centreY, ( int ) y - 1 - centreY ) );
+        std::unordered_map< LuaReference, bool > accepted;
+
+        for( int ring = 0; ring <= furthest; ring++ ) {
+          // Everything in this ring or beyond is at least ring - 1 cells away
+          double closest = std::max( ring - 1, 0 );
+          if( closest * closest > best ) {
+            break;
+          }
+
+          for( int cellY = centreY - ring; cellY <= centreY + ring; cellY++ ) {
+            if( cellY < 0 || cellY >= ( int ) y ) {
+              continue;
+            }
+
+            // Whole rows at the top and bottom of the ring, only the two ends of the rows in between
+            int step = ( cellY == centreY - ring || cellY == centreY + ring ) ? 1 : std::max( ring * 2, 1 );
+            for( int cellX = centreX - ring; cellX <= centreX + ring; cellX += step ) {
+              if( cellX < 0 || cellX >= ( int ) x ) {
+                continue;
+              }
+
+              for( Instance instance : cells[ getCellIndex( level, cellX, cellY ) ] ) {
+                const Entry& entry = entries.at( instance );
+                double dx = entry.position.x - centre.x;
+                double dy = entry.position.y - centre.y;
+                double squared = dx * dx + dy * dy;
+
+                if( squared > best ) {
+                  continue;
+                }
+
+                // The predicate may call into Lua, so ask once per object
+                auto known = accepted.find( entry.object );
+                if( known == accepted.end() ) {
+                  known = accepted.emplace( entry.object, accept( entry.object ) ).first;
+                }
+
+                if( known->second ) {
+                  best = squared;
+                  result = entry.object;
+                }
+              }
+            }
+          }
+        }
+
+        distance = result == LUA_NOREF ? std::numeric_limits< double >::infinity() : std::sqrt( best );
+        return result;
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TICKPROFILER
+#define TICKPROFILER
+
+#include "bbtypes.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Optional per-callback profiler for Engine::objectLoop. Each callback is attributed to the sfunction ("class:method") it was bound from,
+     * or failing that, to the chunk and line it was defined on. When destroyed, writes a Chrome/Perfetto trace (chrome://tracing, ui.perfetto.dev)
+     * and logs the callbacks that used the most time.
+     */
+    class TickProfiler {
+      using Clock = std::chrono::steady_clock;
+
+      struct Label {
+        std::string name;
+        unsigned long long calls;
+        double totalTime;
+        double maxTime;
+      };
+
+      struct CallbackEvent {
+        unsigned int label;
+        double start;
+        double duration;
+      };
+
+      struct TickEvent {
+        Tick tick;
+        double start;
+        double duration;
+        unsigned int callbacks;
+        // Range of callbackEvents belonging to this tick
+        std::size_t firstCallback;
+        std::size_t lastCallback;
+      };
+
+      std::string tracePath;
+      unsigned int topN;
+      std::size_t maxEvents;
+      bool truncated;
+
+      Clock::time_point epoch;
+      Clock::time_point tickStart;
+      Tick currentTick;
+      std::size_t tickFirstCallback;
+
+      std::vector< Label > labels;
+      std::unordered_map< std::string, unsigned int > labelIndex;
+      std::vector< CallbackEvent > callbackEvents;
+      std::vector< TickEvent > tickEvents;
+
+      double since( Clock::time_point timePoint );
+      unsigned int intern( const std::string& name );
+      void writeTrace();
+      void logSummary();
+
+    public:
+      TickProfiler( const std::string& tracePath, unsigned int topN, std::size_t maxEvents );
+      ~TickProfiler();
+
+      void beginTick( Tick tick );
+      void endTick( unsigned int callbacks );
+
+      unsigned int identify( lua_State* L );
+      Clock::time_point beginCallback();
+      void endCallback( unsigned int label, Clock::time_point start );
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TYPEINDEX
+#define TYPEINDEX
+
+#include "bbtypes.hpp"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Native mirror of the class hierarchy (fed by bluebear.register_class) and of which lot objects are instances of which class, so that
+     * "every object that is a X" can be answered without calling bluebear.instance_of on every object on the lot.
+     */
+    class TypeIndex {
+      using Instances = std::vector< LuaReference >;
+
+      std::unordered_map< std::string, std::string > parents;
+      // Every class, mapped to itself and every class that derives from it
+      std::unordered_map< std::string, std::unordered_set< std::string > > descendants;
+      // Objects, keyed by their exact class
+      std::unordered_map< std::string, Instances > instances;
+      // Where each object sits in instances, so it can be removed without a search
+      std::unordered_map< LuaReference, std::pair< Instances*, size_t > > positions;
+
+    public:
+      void registerClass( const std::string& classId, const std::string& parentId );
+
+      void addObject( const std::string& classId, LuaReference object );
+      void removeObject( LuaReference object );
+      void clearObjects();
+      bool isInstanceOf( LuaReference object, const std::string& classId ) const;
+
+      template < typename Callback > void eachInstanceOf( const std::string& classId, Callback callback ) const {
+        auto subclasses = descendants.find( classId );
+
+        if( subclasses == descendants.end() ) {
+          // Not registered - can still match objects of exactly this class
+          eachInstanceOfExactly( classId, callback );
+          return;
+        }
+
+        for( const std::string& subclass : subclasses->second ) {
+          eachInstanceOfExactly( subclass, callback );
+        }
+      }
+
+      template < typename Callback > void eachInstanceOfExactly( const std::string& classId, Callback callback ) const {
+        auto list = instances.find( classId );
+
+        if( list != instances.end() ) {
+          for( LuaReference object : list->second ) {
+            callback( object );
+          }
+        }
+      }
+    };
+
+  }
+}
+
+#endif
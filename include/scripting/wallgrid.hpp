@@ -0,0 +1,150 @@
+#ifndef WALLGRID
+#define WALLGRID
+
+#include "containers/chunkedcollection3d.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    struct Wallpaper;
+
+    /**
+     * A lot's walls, packed. Each cell is a bitmask of the segments present (x, y, d and r) and a front and back index per segment into
+     * a palette of wallpapers built from the lot's wall dict; index 0 means no wallpaper. Cells are 18 bytes each with no allocations of
+     * their own, kept in a ChunkedCollection3D: a chunk with no walls in it costs nothing, and edits are tracked chunk by chunk.
+     *
+     * The renderer and Lua read cells through CellView and SegmentView, which are a pointer and an offset - cheap to copy, and they stay
+     * valid for as long as the grid does.
+     */
+    class WallGrid {
+    public:
+      using Index = std::uint16_t;
+      enum class Axis : std::uint8_t { X = 0, Y, D, R };
+      static constexpr unsigned int AXES = 4;
+
+      struct Cell {
+        std::uint8_t segments;
+        // Front then back for each of X, Y, D and R
+        Index wallpapers[ AXES * 2 ];
+
+        bool hasSegment( Axis axis ) const {
+          return segments & ( 1 << ( unsigned int ) axis );
+        }
+
+        bool operator==( const Cell& other ) const {
+          return segments == other.segments && std::equal( std::begin( wallpapers ), std::end( wallpapers ), std::begin( other.wallpapers ) );
+        }
+      };
+
+      using ChunkPosition = Containers::ChunkedCollection3D< Cell >::ChunkPosition;
+
+      struct Dimensions {
+        unsigned int x;
+        unsigned int y;
+        unsigned int levels;
+      };
+
+      class SegmentView {
+        const WallGrid* grid;
+        std::size_t cell;
+        Axis axis;
+
+      public:
+        SegmentView( const WallGrid* grid, std::size_t cell, Axis axis ) : grid( grid ), cell( cell ), axis( axis ) {}
+
+        explicit operator bool() const {
+          return grid && grid->getPacked( cell ).hasSegment( axis );
+        }
+
+        Index getFrontIndex() const {
+          return grid->getPacked( cell ).wallpapers[ ( unsigned int ) axis * 2 ];
+        }
+
+        Index getBackIndex() const {
+          return grid->getPacked( cell ).wallpapers[ ( unsigned int ) axis * 2 + 1 ];
+        }
+
+        const std::shared_ptr< Wallpaper >& getFront() const {
+          return grid->getPaletteEntry( getFrontIndex() );
+        }
+
+        const std::shared_ptr< Wallpaper >& getBack() const {
+          return grid->getPaletteEntry( getBackIndex() );
+        }
+      };
+
+      class CellView {
+        const WallGrid* grid;
+        std::size_t cell;
+
+      public:
+        CellView() : grid( nullptr ), cell( 0 ) {}
+        CellView( const WallGrid* grid, std::size_t cell ) : grid( grid ), cell( cell ) {}
+
+        // False for a cell with no segments at all
+        explicit operator bool() const {
+          return grid && grid->getPacked( cell ).segments;
+        }
+
+        std::uint8_t getSegments() const {
+          return grid ? grid->getPacked( cell ).segments : 0;
+        }
+
+        SegmentView getSegment( Axis axis ) const {
+          return SegmentView( grid, cell, axis );
+        }
+
+        SegmentView x() const { return getSegment( Axis::X ); }
+        SegmentView y() const { return getSegment( Axis::Y ); }
+        SegmentView d() const { return getSegment( Axis::D ); }
+        SegmentView r() const { return getSegment( Axis::R ); }
+      };
+
+    private:
+      std::vector< std::shared_ptr< Wallpaper > > palette;
+      Containers::ChunkedCollection3D< Cell > cells;
+      Dimensions dimensions;
+
+      std::size_t getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) const;
+      const Cell& getPacked( std::size_t cell ) const;
+
+    public:
+      static constexpr Index NONE = 0;
+
+      WallGrid( unsigned int levels, unsigned int x, unsigned int y );
+
+      Dimensions getDimensions() const;
+      unsigned int getX() const;
+      unsigned int getY() const;
+      unsigned int getLevels() const;
+      bool contains( int level, int x, int y ) const;
+
+      Index addToPalette( const std::shared_ptr< Wallpaper >& wallpaper );
+      const std::shared_ptr< Wallpaper >& getPaletteEntry( Index index ) const;
+      std::size_t getPaletteSize() const;
+
+      void pushRun( const Cell& cell, std::size_t run );
+
+      CellView getCell( unsigned int level, unsigned int x, unsigned int y ) const;
+      const Cell& getPacked( unsigned int level, unsigned int x, unsigned int y ) const;
+
+      void setPacked( unsigned int level, unsigned int x, unsigned int y, const Cell& cell );
+      void setSegment( unsigned int level, unsigned int x, unsigned int y, Axis axis, Index front, Index back );
+      void removeSegment( unsigned int level, unsigned int x, unsigned int y, Axis axis );
+
+      std::vector< ChunkPosition > takeDirtyChunks();
+      std::uint64_t getChunkVersion( unsigned int level, unsigned int x, unsigned int y ) const;
+      std::uint64_t getVersion() const;
+
+      static bool getAxis( const char* name, Axis& axis );
+    };
+
+  }
+}
+
+#endif
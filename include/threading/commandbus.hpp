@@ -0,0 +1,29 @@
+#ifndef COMMANDBUS
+#define COMMANDBUS
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace BlueBear {
+  namespace Threading {
+
+    /**
+     * Queue of work to be run on the thread that owns some resource (e.g. the render thread, which owns the camera, the GL context and
+     * the lot instance collections). Any thread may post; only the owner drains.
+     */
+    class CommandBus {
+      std::mutex mutex;
+      std::vector< std::function< void() > > pending;
+      // Swapped with pending on drain, so that commands run without holding the lock and the vector's storage is reused
+      std::vector< std::function< void() > > running;
+
+    public:
+      void post( std::function< void() > command );
+      void drain();
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ENGINETHREAD
+#define ENGINETHREAD
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace BlueBear {
+  namespace Scripting {
+    class Engine;
+  }
+
+  namespace Threading {
+
+    /**
+     * Runs Engine::update on a dedicated thread with a fixed timestep, holding the engine's Lua lock for the duration of each step.
+     * If the engine falls behind it will run back-to-back steps to catch up, but only so many; past that, steps are dropped rather than
+     * letting the backlog grow forever.
+     */
+    class EngineThread {
+      static constexpr unsigned int MAX_CATCH_UP_TICKS = 5;
+
+      Scripting::Engine& engine;
+      std::chrono::steady_clock::duration period;
+      std::atomic< bool > running;
+      std::thread thread;
+
+      void loop();
+
+    public:
+      // RAII style
+      EngineThread( Scripting::Engine& engine );
+      ~EngineThread();
+
+      void start();
+      void stop();
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SNAPSHOTBUFFER
+#define SNAPSHOTBUFFER
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace BlueBear {
+  namespace Threading {
+
+    /**
+     * Hands immutable snapshots from one producer thread to one consumer thread. The producer builds a complete snapshot, then publishes
+     * it; the consumer acquires the most recent one and keeps using it until something newer comes along. Neither side ever waits on
+     * the other for longer than a pointer swap.
+     *
+     * Snapshots are only ever destroyed on the consumer's thread: anything the producer replaces before the consumer saw it is retired
+     * and released on the next acquire. This matters when a snapshot holds the last reference to something like a GL resource.
+     */
+    template < typename T > class SnapshotBuffer {
+      std::mutex mutex;
+      std::shared_ptr< const T > pending;
+      std::vector< std::shared_ptr< const T > > retired;
+
+      // Consumer-only
+      std::shared_ptr< const T > current;
+
+    public:
+      void publish( std::shared_ptr< const T > snapshot ) {
+        std::unique_lock< std::mutex > lock( mutex );
+
+        if( pending ) {
+          retired.push_back( std::move( pending ) );
+        }
+
+        pending = std::move( snapshot );
+      }
+
+      /**
+       * Consumer side. Returns the newest published snapshot, or the last one returned if nothing new was published (nullptr if nothing
+       * has ever been published).
+       */
+      std::shared_ptr< const T > acquire() {
+        std::shared_ptr< const T > previous;
+        std::vector< std::shared_ptr< const T > > garbage;
+
+        {
+          std::unique_lock< std::mutex > lock( mutex );
+
+          if( pending ) {
+            previous = std::move( current );
+            current = std::move( pending );
+          }
+
+          std::swap( garbage, retired );
+        }
+
+        // previous and garbage go out of scope here, outside the lock, on this thread
+        return current;
+      }
+    };
+
+  }
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef BLOCKCONTAINER
+#define BLOCKCONTAINER
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace BlueBear {
+	namespace Tools {
+
+		/**
+		 * File of named, independently compressed blocks with an index up front, so a reader can decompress only the blocks it wants and
+		 * decompress several at once. Blocks are compressed with LZ4Block, or stored as they are when that doesn't make them smaller.
+		 *
+		 * Layout (all integers little-endian):
+		 *   "BBC" 0x00, u32 version, u32 block count
+		 *   index entry per block: u16 name length, name, u8 codec, u64 offset from the start of the file, u32 stored length, u32 length
+		 *   block data
+		 *
+		 * Reading works over memory the caller owns (usually a MappedFile), which must outlive the container.
+		 */
+		class BlockContainer {
+			static constexpr const char MAGIC[ 4 ] = { 'B', 'B', 'C', 0 };
+			static constexpr std::uint32_t VERSION = 1;
+
+			enum class Codec : std::uint8_t { STORED = 0, LZ4 };
+
+			struct Block {
+				std::string name;
+				Codec codec;
+				std::uint64_t offset;
+				std::uint32_t storedLength;
+				std::uint32_t length;
+			};
+
+			const char* data;
+			std::size_t size;
+			std::vector< Block > blocks;
+			std::vector< std::string > names;
+			std::unordered_map< std::string, std::size_t > byName;
+			bool valid;
+
+			bool decode( const Block& block, std::string& output ) const;
+
+		public:
+			using Blocks = std::vector< std::pair< std::string, std::string > >;
+
+			BlockContainer( const char* data, std::size_t size );
+
+			static bool isContainer( const char* data, std::size_t size );
+			// Compressing on TBB workers isn't safe in a fork()ed child; pass parallel = false there
+			static bool write( std::ostream& output, const Blocks& blocks, bool parallel = true );
+
+			bool isValid() const;
+			const std::vector< std::string >& getNames() const;
+			bool hasBlock( const std::string& name ) const;
+			bool read( const std::string& name, std::string& output ) const;
+			bool read( const std::vector< std::string >& wanted, std::vector< std::string >& output ) const;
+		};
+
+	}
+}
+
+#endif
@@ -22,6 +22,12 @@
     return 0; \
   }
 
+#define VERIFY_USER_DATA_N( tag, func, n ) \
+  if( !lua_isuserdata( L, -n ) ) { \
+    Log::getInstance().warn( tag, "Argument " #n " provided to " func " must be a userdata." ); \
+    return 0; \
+  }
+
 #define VERIFY_NUMBER_N( tag, func, n ) \
   if( !lua_isnumber( L, -n ) ) { \
     Log::getInstance().warn( tag, "Argument " #n " provided to " func " must be a number." ); \
@@ -0,0 +1,47 @@
+#ifndef JSONINDEX
+#define JSONINDEX
+
+#include <jsoncpp/json/json.h>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace BlueBear {
+	namespace Tools {
+
+		/**
+		 * Index of the members of one JSON object in a seekable stream. Only each member's key and byte range are kept; members are parsed
+		 * one at a time when read, so a large document never has to exist as a single Json::Value.
+		 *
+		 * The scan only follows structure (brackets, strings, commas) - a member with bad JSON in it is reported when it's read.
+		 */
+		class JSONIndex {
+			using Span = std::pair< std::streamoff, std::streamoff >;
+
+			std::istream& input;
+			std::vector< std::string > keys;
+			std::unordered_map< std::string, Span > members;
+			bool valid;
+
+			int skipWhitespace();
+			bool readString( std::string* result );
+			bool skipValue( int first );
+
+		public:
+			// A negative begin gives an empty, invalid index
+			JSONIndex( std::istream& input, std::streamoff begin = 0 );
+
+			bool isValid() const;
+			bool isMember( const std::string& key ) const;
+			const std::vector< std::string >& getKeys() const;
+
+			Json::Value read( const std::string& key );
+			JSONIndex index( const std::string& key );
+		};
+
+	}
+}
+
+#endif
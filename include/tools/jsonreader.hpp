@@ -0,0 +1,61 @@
+#ifndef JSONREADER
+#define JSONREADER
+
+#include <jsoncpp/json/json.h>
+#include <cstddef>
+#include <string>
+
+namespace BlueBear {
+	namespace Tools {
+
+		/**
+		 * Pull reader over JSON held in memory (usually a MappedFile). Values are read in place, in the order they appear, without a DOM;
+		 * callers walk objects with beginObject/nextMember and arrays with beginArray/nextElement, and skip what they don't want.
+		 *
+		 * Any error puts the reader at the end of its input and sets hasFailed(), so loops over members and elements simply stop.
+		 */
+		class JSONReader {
+		public:
+			enum class Type { END, OBJECT, ARRAY, STRING, NUMBER, BOOLEAN, NIL };
+
+		private:
+			const char* begin;
+			const char* cursor;
+			const char* end;
+			bool failed;
+
+			void fail();
+			void skipWhitespace();
+			bool expect( char character );
+			bool readCodepoint( unsigned int& codepoint );
+			bool readLiteral( const char* literal );
+			bool readSigned( long long& result );
+
+		public:
+			JSONReader( const char* begin, const char* end );
+
+			Type peek();
+
+			bool beginObject();
+			bool nextMember( std::string& key );
+			bool beginArray();
+			bool nextElement();
+
+			bool readString( std::string& result );
+			bool readInt( int& result );
+			bool readUInt( unsigned int& result );
+			bool readDouble( double& result );
+			bool readBool( bool& result );
+			bool skip();
+			// For small pieces where a DOM is fine
+			Json::Value readValue();
+
+			std::size_t getPosition() const;
+			void seek( std::size_t position );
+			bool hasFailed() const;
+		};
+
+	}
+}
+
+#endif
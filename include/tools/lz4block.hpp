@@ -0,0 +1,33 @@
+#ifndef LZ4BLOCK
+#define LZ4BLOCK
+
+#include <cstddef>
+#include <string>
+
+namespace BlueBear {
+	namespace Tools {
+
+		/**
+		 * Compressor and decompressor for the LZ4 block format (no frame format - callers keep track of sizes themselves). Output is
+		 * readable by the reference LZ4 decoder and vice versa. The compressor is the simple greedy one: fast, with ratios a little under
+		 * the reference's.
+		 */
+		class LZ4Block {
+			static constexpr unsigned int HASH_LOG = 16;
+			static constexpr std::size_t MIN_MATCH = 4;
+			static constexpr std::size_t LAST_LITERALS = 5;
+			static constexpr std::size_t MATCH_FIND_LIMIT = 12;
+			static constexpr std::size_t MAX_OFFSET = 65535;
+
+			static void writeLength( std::string& output, std::size_t length );
+
+		public:
+			static std::size_t getBound( std::size_t size );
+			static void compress( const char* input, std::size_t size, std::string& output );
+			static bool decompress( const char* input, std::size_t size, char* output, std::size_t outputSize );
+		};
+
+	}
+}
+
+#endif
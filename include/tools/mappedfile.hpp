@@ -0,0 +1,49 @@
+#ifndef MAPPEDFILE
+#define MAPPEDFILE
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+namespace BlueBear {
+	namespace Tools {
+
+		/**
+		 * A whole file, read-only, mapped into memory. Where mmap isn't available the file is read into a buffer instead, so callers don't
+		 * have to care which they got.
+		 */
+		class MappedFile {
+			const char* data;
+			std::size_t size;
+			bool mapped;
+			bool valid;
+			std::string fallback;
+
+		public:
+			MappedFile( const std::string& path );
+			~MappedFile();
+			MappedFile( const MappedFile& ) = delete;
+			MappedFile& operator=( const MappedFile& ) = delete;
+
+			bool isValid() const;
+			const char* getData() const;
+			const char* getEnd() const;
+			std::size_t getSize() const;
+		};
+
+		/**
+		 * Seekable std::streambuf over memory someone else owns, for reading a MappedFile through a std::istream
+		 */
+		class MemoryBuffer : public std::streambuf {
+		protected:
+			pos_type seekoff( off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode mode ) override;
+			pos_type seekpos( pos_type position, std::ios_base::openmode mode ) override;
+
+		public:
+			MemoryBuffer( const char* begin, const char* end );
+		};
+
+	}
+}
+
+#endif
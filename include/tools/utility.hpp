@@ -81,6 +81,10 @@ namespace BlueBear {
 
 				static std::string decodeUTF8( const std::string& encoded );
 
+				static std::string encodeBase64( const std::string& data );
+
+				static bool decodeBase64( const std::string& encoded, std::string& data );
+
 				/**
 				 * C++ std::string is too fucking stupid to know what a null string is
 				 */
@@ -31,6 +31,7 @@ namespace BlueBear {
     configRoot[ "key_pause" ] = sf::Keyboard::Num1;
     configRoot[ "key_play" ] = sf::Keyboard::Num2;
     configRoot[ "key_play_fast" ] = sf::Keyboard::Num3;
+    configRoot[ "key_play_max" ] = sf::Keyboard::Num4;
     configRoot[ "key_rotate_right" ] = sf::Keyboard::E;
     configRoot[ "key_rotate_left" ] = sf::Keyboard::Q;
     configRoot[ "key_zoom_in" ] = sf::Keyboard::Add;
@@ -39,6 +40,23 @@ namespace BlueBear {
     configRoot[ "disable_texture_cache" ] = false;
     configRoot[ "ui_theme" ] = "system/ui/default.theme";
     configRoot[ "max_ingame_terminal_scrollback" ] = 100; 
+    configRoot[ "engine_thread" ] = false;
+    configRoot[ "fast_ticks_per_frame" ] = 4;
+    configRoot[ "max_speed_frame_budget" ] = 12;
+    configRoot[ "profiler_enabled" ] = false;
+    configRoot[ "profiler_trace_path" ] = "bluebear_trace.json";
+    configRoot[ "profiler_top_n" ] = 20;
+    configRoot[ "profiler_max_events" ] = 1000000;
+    configRoot[ "gc_mode" ] = "auto";
+    configRoot[ "gc_step_budget" ] = 500;
+    configRoot[ "gc_step_size" ] = 8;
+    configRoot[ "gc_pause" ] = 200;
+    configRoot[ "gc_emergency_heap" ] = 0;
+    configRoot[ "gc_report_path" ] = "";
+    configRoot[ "shards" ] = 1;
+    configRoot[ "autosave_path" ] = "";
+    configRoot[ "autosave_interval" ] = 5400;
+    configRoot[ "autosave_compact_factor" ] = 4;
 
     // Load settings.json from file
     std::ifstream settingsFile( SETTINGS_PATH );
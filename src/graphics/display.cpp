@@ -20,10 +20,12 @@
 #include "scripting/lot.hpp"
 #include "scripting/tile.hpp"
 #include "scripting/engine.hpp"
-#include "scripting/wallcell.hpp"
+#include "scripting/wallgrid.hpp"
 #include "scripting/wallpaper.hpp"
+#include "threading/commandbus.hpp"
 #include "localemanager.hpp"
 #include "configmanager.hpp"
+#include "eventmanager.hpp"
 #include "tools/utility.hpp"
 #include "log.hpp"
 #include <SFML/Graphics.hpp>
@@ -38,6 +40,8 @@
 #include <cstdlib>
 #include <utility>
 #include <functional>
+#include <unordered_map>
+#include <algorithm>
 
 namespace BlueBear {
   namespace Graphics {
@@ -111,9 +115,9 @@ namespace BlueBear {
     /**
      * Given a lot, build floorInstanceCollection and translate the Tiles/Wallpanels to instances on the lot. Additionally, send the rotation status.
      */
-    void Display::changeToMainGameState( unsigned int currentRotation, Containers::Collection3D< std::shared_ptr< Scripting::Tile > >& floorMap, Containers::Collection3D< std::shared_ptr< Scripting::WallCell > >& wallMap ) {
+    void Display::changeToMainGameState( Scripting::Lot& lot ) {
 
-      std::unique_ptr< Display::MainGameState > mainGameStatePtr = std::make_unique< Display::MainGameState >( *this, currentRotation, floorMap, wallMap );
+      std::unique_ptr< Display::MainGameState > mainGameStatePtr = std::make_unique< Display::MainGameState >( *this, lot );
 
       currentState = std::move( mainGameStatePtr );
     }
@@ -147,14 +151,16 @@ namespace BlueBear {
     /**
      * Display renderer state for the main game loop
      */
-    Display::MainGameState::MainGameState( Display& instance, unsigned int currentRotation, Containers::Collection3D< std::shared_ptr< Scripting::Tile > >& floorMap, Containers::Collection3D< std::shared_ptr< Scripting::WallCell > >& wallMap ) :
+    Display::MainGameState::MainGameState( Display& instance, Scripting::Lot& lot ) :
       Display::State::State( instance ),
       L( instance.L ),
-      inputManager( Input::InputManager( instance.L ) ),
+      inputManager( Input::InputManager( instance.L, instance.engine->getCommandBus() ) ),
       camera( Camera( instance.x, instance.y ) ),
-      floorMap( floorMap ),
-      wallMap( wallMap ),
-      currentRotation( currentRotation ) {
+      lot( lot ),
+      floorMap( *lot.floorMap ),
+      wallMap( *lot.wallMap ),
+      currentRotation( lot.currentRotation ),
+      commandBus( std::make_unique< Threading::CommandBus >() ) {
 
       // Lay out default shader
       registeredShaders[ "default" ] = std::make_shared< Shader >( "system/shaders/default_vertex.glsl", "system/shaders/default_fragment.glsl" );
@@ -173,8 +179,13 @@ namespace BlueBear {
 
       // Register keyboard events
       registerEvents();
+
+      // Entities' world_objects are only read from Lua when the engine says a tick is done
+      eventManager.TICK_COMPLETED.listen( this, std::bind( &Display::MainGameState::captureWorldSnapshot, this, std::placeholders::_1 ) );
     }
     Display::MainGameState::~MainGameState() {
+      eventManager.TICK_COMPLETED.stopListening( this );
+
       WallCellBundler::Piece.reset();
       WallCellBundler::DPiece.reset();
     }
@@ -189,15 +200,24 @@ namespace BlueBear {
       static sf::Keyboard::Key KEY_RIGHT = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_move_right" );
       static sf::Keyboard::Key KEY_ZOOM_IN = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_zoom_in" );
       static sf::Keyboard::Key KEY_ZOOM_OUT = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_zoom_out" );
+      static sf::Keyboard::Key KEY_PAUSE = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_pause" );
+      static sf::Keyboard::Key KEY_PLAY = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_play" );
+      static sf::Keyboard::Key KEY_PLAY_FAST = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_play_fast" );
+      static sf::Keyboard::Key KEY_PLAY_MAX = ( sf::Keyboard::Key ) ConfigManager::getInstance().getIntValue( "key_play_max" );
 
+      // Rebuilding the walls is slow - defer it until execute() so it doesn't happen while handleEvent holds the GUI lock
       inputManager.listen( KEY_ROTATE_RIGHT, [ & ]() {
-        currentRotation = camera.rotateRight();
-        createWallInstances();
+        commandBus->post( [ & ]() {
+          currentRotation = camera.rotateRight();
+          createWallInstances();
+        } );
       } );
 
       inputManager.listen( KEY_ROTATE_LEFT, [ & ]() {
-        currentRotation = camera.rotateLeft();
-        createWallInstances();
+        commandBus->post( [ & ]() {
+          currentRotation = camera.rotateLeft();
+          createWallInstances();
+        } );
       } );
 
       inputManager.listen( KEY_UP, [ & ]() {
@@ -223,6 +243,22 @@ namespace BlueBear {
       inputManager.listen( KEY_ZOOM_OUT, [ & ]() {
         camera.zoomOut();
       } );
+
+      inputManager.listen( KEY_PAUSE, [ & ]() {
+        instance.engine->setSpeed( Scripting::SimulationSpeed::PAUSED );
+      } );
+
+      inputManager.listen( KEY_PLAY, [ & ]() {
+        instance.engine->setSpeed( Scripting::SimulationSpeed::NORMAL );
+      } );
+
+      inputManager.listen( KEY_PLAY_FAST, [ & ]() {
+        instance.engine->setSpeed( Scripting::SimulationSpeed::FAST );
+      } );
+
+      inputManager.listen( KEY_PLAY_MAX, [ & ]() {
+        instance.engine->setSpeed( Scripting::SimulationSpeed::MAX );
+      } );
     }
     void Display::MainGameState::loadIntrinsicModels() {
       WallCellBundler::Piece = std::make_unique< Model >( Display::WALLPANEL_MODEL_XY_PATH );
@@ -262,37 +298,37 @@ namespace BlueBear {
       // Replacement for most of the LuaGUIContext stuff
       lua_pushstring( L, "find_by_id" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_findById, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_findById, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "find_by_class" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_findByClass, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_findByClass, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "add_from_path" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_addXMLFromPath, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_addXMLFromPath, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "add" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_add, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_add, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "remove" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_removeWidget, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_removeWidget, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "create" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_createWidget, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_createWidget, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "load_theme" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &GUI::LuaDesktopFunctions::lua_loadThemeFromFile, 1 );
+      pushGuiFunction( L, &GUI::LuaDesktopFunctions::lua_loadThemeFromFile, 1 );
       lua_settable( L, -3 );
 
       lua_settable( L, -3 ); // bluebear
@@ -301,12 +337,12 @@ namespace BlueBear {
 
       lua_pushstring( L, "register_key" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &Input::InputManager::lua_registerScriptKey, 1 );
+      pushGuiFunction( L, &Input::InputManager::lua_registerScriptKey, 1 );
       lua_settable( L, -3 );
 
       lua_pushstring( L, "unregister_key" );
       lua_pushlightuserdata( L, this );
-      lua_pushcclosure( L, &Input::InputManager::lua_unregisterScriptKey, 1 );
+      pushGuiFunction( L, &Input::InputManager::lua_unregisterScriptKey, 1 );
       lua_settable( L, -3 );
 
       lua_pop( L, 1 ); // bluebear
@@ -394,7 +430,8 @@ namespace BlueBear {
         // Push the upvalue for this, we're gonna need it in some functions
         lua_pushlightuserdata( L, this ); // upvalue metatable
 
-        luaL_setfuncs( L, elementFuncs, 1 ); // metatable
+        // Widgets are drawn on the render thread, so every one of these (even __gc, which can drop the last reference) takes guiMutex
+        setGuiFuncs( L, elementFuncs, 1 ); // metatable
 
         lua_pushvalue( L, -1 ); // metatable metatable
 
@@ -444,77 +481,213 @@ namespace BlueBear {
     void Display::MainGameState::createFloorInstances() {
       floorInstanceCollection->clear();
 
+      // Only the cells with a tile are visited, so the chunks of the floor with nothing on them are never allocated here either
+      floorMap.forEachIndex( [ & ]( unsigned int level, unsigned int x, unsigned int y, Scripting::Lot::FloorMap::Index ) {
+        floorInstanceCollection->setItem( level, x, y, createFloorInstance( level, x, y ) );
+      } );
+    }
+    /**
+     * The instance for one floor tile, or an empty pointer if there's no tile there
+     */
+    std::shared_ptr< Instance > Display::MainGameState::createFloorInstance( unsigned int level, unsigned int x, unsigned int y ) {
+      const std::shared_ptr< Scripting::Tile >& tilePtr = floorMap.getItemByRef( level, x, y );
+
+      if( !tilePtr ) {
+        return std::shared_ptr< Instance >();
+      }
+
       auto dimensions = floorMap.getDimensions();
 
       float xOrigin = -( (int)dimensions.x / 2 ) + 0.5f;
       float yOrigin = ( dimensions.y / 2 ) - 0.5f;
 
+      // Create instance from the model, and change its material using the material cache
+      std::shared_ptr< Instance > instance = std::make_shared< Instance >( *floorModel );
+
+      Drawable& floorDrawable = *( instance->drawable );
+
+      floorDrawable.material = std::make_shared< Material >( TextureList{ texCache.get( tilePtr->imagePath ) } );
+
+      instance->setPosition( glm::vec3( xOrigin + x, yOrigin - y, level * 2.0f ) );
+
+      return instance;
+    }
+    void Display::MainGameState::createWallInstances() {
+      wallInstanceCollection->clear();
+
+      auto dimensions = wallMap.getDimensions();
+
+      WallCellBundler::xOrigin = -( (int)dimensions.x / 2 ) + 0.5f;
+      WallCellBundler::yOrigin = ( dimensions.y / 2 ) - 0.5f;
+
       for ( unsigned int zCounter = 0; zCounter != dimensions.levels; zCounter++ ) {
         for( unsigned int yCounter = 0; yCounter != dimensions.y; yCounter++ ) {
           for( unsigned int xCounter = 0; xCounter != dimensions.x; xCounter++ ) {
+            wallInstanceCollection->pushDirect( createWallCellBundler( zCounter, xCounter, yCounter ) );
+          }
+        }
+      }
+    }
+    /**
+     * The bundler for one wall cell, or an empty pointer if the cell has no segments. Cells join onto the cells above and to the left of them,
+     * so those must already be in wallInstanceCollection.
+     */
+    std::shared_ptr< WallCellBundler > Display::MainGameState::createWallCellBundler( unsigned int level, unsigned int x, unsigned int y ) {
+      Scripting::WallGrid::CellView wallCell = wallMap.getCell( level, x, y );
 
-            glm::vec3 floorCoords( xOrigin + xCounter, yOrigin - yCounter, zCounter * 2.0f );
+      if( !wallCell ) {
+        return std::shared_ptr< WallCellBundler >();
+      }
 
-            std::shared_ptr< Scripting::Tile > tilePtr = floorMap.getItem( zCounter, xCounter, yCounter );
+      // Several different kinds of wall panel models depending on the type, and several kinds of orientations
+      // If the cell has any segments, at least one of these will be built
+      return std::make_shared< WallCellBundler >(
+        wallCell,
+        *wallInstanceCollection,
+        glm::vec3( x, y, level ),
+        currentRotation, texCache, imageCache
+      );
+    }
+    /**
+     * The cells of one chunk of a grid getX() by getY() cells, trimmed where the chunk hangs over the edge
+     */
+    static Scripting::Lot::DirtyRegion getChunkRegion( unsigned int level, unsigned int chunkX, unsigned int chunkY, unsigned int x, unsigned int y ) {
+      unsigned int xMin = chunkX << Containers::ChunkedCollection3D< Scripting::Lot::FloorMap::Index >::CHUNK_BITS;
+      unsigned int yMin = chunkY << Containers::ChunkedCollection3D< Scripting::Lot::FloorMap::Index >::CHUNK_BITS;
+      unsigned int size = Containers::ChunkedCollection3D< Scripting::Lot::FloorMap::Index >::CHUNK_SIZE;
 
-            if( tilePtr ) {
-              // Create instance from the model, and change its material using the material cache
-              std::shared_ptr< Instance > instance = std::make_shared< Instance >( *floorModel );
+      return Scripting::Lot::DirtyRegion{ level, xMin, yMin, std::min( xMin + size, x ) - 1, std::min( yMin + size, y ) - 1 };
+    }
+    /**
+     * Runs on the engine's thread, with the lua_State to itself. Copies out the chunks of the lot scripts have changed since the last call,
+     * and posts them to the render thread; the command bus keeps every batch, where a snapshot nobody saw in time would be dropped.
+     */
+    void Display::MainGameState::captureLotEdits() {
+      std::vector< Scripting::Lot::FloorMap::ChunkPosition > floorChunks = lot.floorMap->takeDirtyChunks();
+      std::vector< Scripting::WallGrid::ChunkPosition > wallChunks = lot.wallMap->takeDirtyChunks();
+      if( floorChunks.empty() && wallChunks.empty() ) {
+        return;
+      }
 
-              Drawable& floorDrawable = *( instance->drawable );
+      std::shared_ptr< LotEdits > edits = std::make_shared< LotEdits >();
 
-              floorDrawable.material = std::make_shared< Material >( TextureList{ texCache.get( tilePtr->imagePath ) } );
+      // Palettes only ever grow, so the render thread adds whatever it doesn't have yet
+      edits->tiles = lot.floorMap->getPalette();
+      for( std::size_t i = 0; i != lot.wallMap->getPaletteSize(); i++ ) {
+        edits->wallpapers.push_back( lot.wallMap->getPaletteEntry( i ) );
+      }
 
-              instance->setPosition( floorCoords );
+      for( const Scripting::Lot::FloorMap::ChunkPosition& chunk : floorChunks ) {
+        LotEdits::FloorChunk copy{ getChunkRegion( chunk.level, chunk.x, chunk.y, lot.floorMap->getX(), lot.floorMap->getY() ), {} };
 
-              // The pointer to this floor tile goes into the floorInstanceCollection
-              floorInstanceCollection->pushDirect( instance );
-            } else {
-              // There is no floor tile located here. Consequently, insert an empty Instance pointer here; it will be skipped on draw.
-              floorInstanceCollection->pushDirect( std::shared_ptr< Instance >() );
-            }
+        for( unsigned int y = copy.region.yMin; y <= copy.region.yMax; y++ ) {
+          for( unsigned int x = copy.region.xMin; x <= copy.region.xMax; x++ ) {
+            copy.cells.push_back( lot.floorMap->getIndex( copy.region.level, x, y ) );
+          }
+        }
+
+        edits->floor.push_back( std::move( copy ) );
+      }
 
+      for( const Scripting::WallGrid::ChunkPosition& chunk : wallChunks ) {
+        LotEdits::WallChunk copy{ getChunkRegion( chunk.level, chunk.x, chunk.y, lot.wallMap->getX(), lot.wallMap->getY() ), {} };
+
+        for( unsigned int y = copy.region.yMin; y <= copy.region.yMax; y++ ) {
+          for( unsigned int x = copy.region.xMin; x <= copy.region.xMax; x++ ) {
+            copy.cells.push_back( lot.wallMap->getPacked( copy.region.level, x, y ) );
           }
         }
+
+        edits->walls.push_back( std::move( copy ) );
       }
+
+      commandBus->post( [ this, edits ]() {
+        applyLotEdits( *edits );
+      } );
     }
-    void Display::MainGameState::createWallInstances() {
-      wallInstanceCollection->clear();
+    /**
+     * Copy edited chunks into the render thread's grids, and rebuild the instances for them instead of the whole lot. Floor tiles stand
+     * alone, so only the changed chunks are rebuilt. Walls join onto their neighbours, so every changed wall cell is copied in before any
+     * are rebuilt; see rebuildWallRegion.
+     */
+    void Display::MainGameState::applyLotEdits( const LotEdits& edits ) {
+      for( std::size_t i = floorMap.getPaletteSize(); i < edits.tiles.size(); i++ ) {
+        floorMap.addToPalette( edits.tiles[ i ] );
+      }
 
-      auto dimensions = wallMap.getDimensions();
+      for( std::size_t i = wallMap.getPaletteSize(); i < edits.wallpapers.size(); i++ ) {
+        wallMap.addToPalette( edits.wallpapers[ i ] );
+      }
 
-      WallCellBundler::xOrigin = -( (int)dimensions.x / 2 ) + 0.5f;
-      WallCellBundler::yOrigin = ( dimensions.y / 2 ) - 0.5f;
+      for( const LotEdits::FloorChunk& chunk : edits.floor ) {
+        const Scripting::Lot::DirtyRegion& region = chunk.region;
+        std::size_t cell = 0;
 
-      for ( unsigned int zCounter = 0; zCounter != dimensions.levels; zCounter++ ) {
-        for( unsigned int yCounter = 0; yCounter != dimensions.y; yCounter++ ) {
-          for( unsigned int xCounter = 0; xCounter != dimensions.x; xCounter++ ) {
+        for( unsigned int y = region.yMin; y <= region.yMax; y++ ) {
+          for( unsigned int x = region.xMin; x <= region.xMax; x++ ) {
+            floorMap.setIndex( region.level, x, y, chunk.cells[ cell++ ] );
+            floorInstanceCollection->setItem( region.level, x, y, createFloorInstance( region.level, x, y ) );
+          }
+        }
+      }
 
-            std::shared_ptr< Scripting::WallCell > wallCellPtr = wallMap.getItem( zCounter, xCounter, yCounter );
-            std::shared_ptr< WallCellBundler > wallCellBundler;
-            if( wallCellPtr ) {
-              // Several different kinds of wall panel models depending on the type, and several kinds of orientations
-              // If that pointer exists, at least one of these ifs will be fulfilled
-               wallCellBundler = std::make_shared< WallCellBundler >(
-                 wallCellPtr,
-                 *wallInstanceCollection,
-                 glm::vec3( xCounter, yCounter, zCounter ),
-                 currentRotation, texCache, imageCache
-               );
-            }
+      for( const LotEdits::WallChunk& chunk : edits.walls ) {
+        const Scripting::Lot::DirtyRegion& region = chunk.region;
+        std::size_t cell = 0;
 
-            wallInstanceCollection->pushDirect( wallCellBundler );
+        for( unsigned int y = region.yMin; y <= region.yMax; y++ ) {
+          for( unsigned int x = region.xMin; x <= region.xMax; x++ ) {
+            wallMap.setPacked( region.level, x, y, chunk.cells[ cell++ ] );
+          }
+        }
+      }
 
+      for( const LotEdits::WallChunk& chunk : edits.walls ) {
+        rebuildWallRegion( chunk.region );
+      }
+    }
+    /**
+     * A wall cell's pieces depend on the cells around it: it joins onto the cells above and to its left (trimming or extending their corners),
+     * and the cells below and to its right join onto it. So the changed cells are rebuilt along with a border of one cell, in the same order
+     * createWallInstances uses. Joins the border got from cells outside it are redone from the old bundlers' records (see WallCellBundler::keepJoins).
+     */
+    void Display::MainGameState::rebuildWallRegion( const Scripting::Lot::DirtyRegion& region ) {
+      auto dimensions = wallMap.getDimensions();
+
+      int xMin = std::max( ( int ) region.xMin - 1, 0 );
+      int yMin = std::max( ( int ) region.yMin - 1, 0 );
+      int xMax = std::min( ( int ) region.xMax + 1, ( int ) dimensions.x - 1 );
+      int yMax = std::min( ( int ) region.yMax + 1, ( int ) dimensions.y - 1 );
+
+      // Cells just outside the border keep the joins made by cells inside it until they're made again
+      for( int y = std::max( yMin - 1, 0 ); y <= std::min( yMax + 1, ( int ) dimensions.y - 1 ); y++ ) {
+        for( int x = std::max( xMin - 1, 0 ); x <= std::min( xMax + 1, ( int ) dimensions.x - 1 ); x++ ) {
+          std::shared_ptr< WallCellBundler > neighbour = wallInstanceCollection->getItem( region.level, x, y );
+          if( neighbour ) {
+            neighbour->forgetJoins( xMin, yMin, xMax, yMax );
           }
         }
       }
+
+      for( int y = yMin; y <= yMax; y++ ) {
+        for( int x = xMin; x <= xMax; x++ ) {
+          std::shared_ptr< WallCellBundler > previous = wallInstanceCollection->getItem( region.level, x, y );
+          std::shared_ptr< WallCellBundler > bundler = createWallCellBundler( region.level, x, y );
+
+          if( bundler && previous ) {
+            bundler->keepJoins( *previous, xMin, yMin, xMax, yMax );
+          }
+
+          wallInstanceCollection->setItem( region.level, x, y, bundler );
+        }
+      }
     }
     void Display::MainGameState::loadInfrastructure() {
       auto dimensions = floorMap.getDimensions();
-      floorInstanceCollection = std::make_unique< Containers::Collection3D< std::shared_ptr< Instance > > >( dimensions.levels, dimensions.x, dimensions.y );
+      floorInstanceCollection = std::make_unique< Containers::ChunkedCollection3D< std::shared_ptr< Instance > > >( dimensions.levels, dimensions.x, dimensions.y );
 
       auto dimensionsWall = wallMap.getDimensions();
-      wallInstanceCollection = std::make_unique< Containers::Collection3D< std::shared_ptr< WallCellBundler > > >( dimensionsWall.levels, dimensionsWall.x, dimensionsWall.y );
+      wallInstanceCollection = std::make_unique< Containers::ChunkedCollection3D< std::shared_ptr< WallCellBundler > > >( dimensionsWall.levels, dimensionsWall.x, dimensionsWall.y );
 
       createFloorInstances();
       createWallInstances();
@@ -522,6 +695,8 @@ namespace BlueBear {
       Log::getInstance().info( "Display::MainGameState::loadInfrastructure", "Finished creating infrastructure instances." );
     }
     void Display::MainGameState::execute() {
+      commandBus->drain();
+
       glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
       glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 
@@ -531,25 +706,21 @@ namespace BlueBear {
       // USES DEFAULT SHADER
       // Draw entities of each type
       // Floor & Walls with nudging
+      // Lot edits were applied to our own grids and instances by commandBus->drain(), so none of this touches the engine's lot
       registeredShaders[ "default" ]->use();
       camera.sendToShader();
-      auto length = floorInstanceCollection->getLength();
-      for( auto i = 0; i != length; i++ ) {
-        std::shared_ptr< Instance > floorInstance = floorInstanceCollection->getItemDirect( i );
-
+      // Only the chunks that have anything in them are visited
+      floorInstanceCollection->forEachItem( []( unsigned int level, unsigned int x, unsigned int y, std::shared_ptr< Instance >& floorInstance ) {
         if( floorInstance ) {
           floorInstance->drawEntity();
         }
-      }
-
-      auto wallLength = wallInstanceCollection->getLength();
-      for( auto i = 0; i != wallLength; i++ ) {
-        std::shared_ptr< WallCellBundler > wallCellBundler = wallInstanceCollection->getItemDirect( i );
+      } );
 
+      wallInstanceCollection->forEachItem( []( unsigned int level, unsigned int x, unsigned int y, std::shared_ptr< WallCellBundler >& wallCellBundler ) {
         if( wallCellBundler ) {
           wallCellBundler->render();
         }
-      }
+      } );
 
       drawWorldInstances();
 
@@ -557,8 +728,17 @@ namespace BlueBear {
 
       instance.mainWindow.display();
     }
-    void Display::MainGameState::drawWorldInstances() {
-      std::unordered_map< std::shared_ptr< Shader >, std::vector< std::shared_ptr< Instance > > > bundles;
+    /**
+     * Runs on the engine's thread (or the only thread, if the engine doesn't have one), with the lua_State to itself. Instances' animations
+     * advance a frame here, so they play once per tick.
+     */
+    void Display::MainGameState::captureWorldSnapshot( Tick tick ) {
+      std::shared_ptr< WorldSnapshot > snapshot = std::make_shared< WorldSnapshot >();
+      std::unordered_map< std::shared_ptr< Shader >, std::size_t > bundleIndices;
+
+      snapshot->tick = tick;
+
+      captureLotEdits();
 
       // For each entity, dig through its world_objects field (if present) and retrieve all the instances that need to be drawn
       for( LuaReference entity : instance.engine->objects ) {
@@ -571,11 +751,18 @@ namespace BlueBear {
             // Screen for bluebear_graphics_instance
             lua_rawgeti( L, -1, i ); // item world_objects table
 
-            LuaInstanceHelper** helperPtr = ( LuaInstanceHelper** ) luaL_testudata( L, 3, "bluebear_graphics_instance" );
+            LuaInstanceHelper** helperPtr = ( LuaInstanceHelper** ) luaL_testudata( L, -1, "bluebear_graphics_instance" );
             if( helperPtr ) {
               LuaInstanceHelper* helper = *helperPtr;
 
-              bundles[ helper->shader ].push_back( helper->instance );
+              auto pair = bundleIndices.find( helper->shader );
+              if( pair == bundleIndices.end() ) {
+                pair = bundleIndices.emplace( helper->shader, snapshot->bundles.size() ).first;
+                snapshot->bundles.emplace_back( helper->shader );
+              }
+
+              // Copied out here, while the engine can't change the instance; the render thread never touches it
+              helper->instance->captureDraws( snapshot->bundles[ pair->second ].draws );
             }
 
             lua_pop( L, 1 ); // world_objects table
@@ -585,20 +772,28 @@ namespace BlueBear {
         lua_pop( L, 2 ); // EMPTY
       }
 
-      // Now draw each
-      for( auto& pair : bundles ) {
-        // pair.first is the shader
-        pair.first->use();
+      worldSnapshots.publish( snapshot );
+    }
+    /**
+     * Draws from the last published WorldSnapshot - does not touch the lua_State
+     */
+    void Display::MainGameState::drawWorldInstances() {
+      std::shared_ptr< const WorldSnapshot > snapshot = worldSnapshots.acquire();
 
-        // need to re-send the camera
-        camera.sendToShader();
+      if( !snapshot ) {
+        return;
+      }
 
-        for( std::shared_ptr< Instance > individualInstance : pair.second ) {
-          individualInstance->drawEntity();
-        }
+      // Each bundle needs its shader used and the camera re-sent
+      for( const ShaderInstanceBundle& bundle : snapshot->bundles ) {
+        bundle.drawInstances( camera );
       }
     }
     void Display::MainGameState::handleEvent( sf::Event& event ) {
+      // Scripts' GUI functions change the desktop and the script keys from the engine thread. The handlers for both post to the engine
+      // rather than calling into Lua, so this never waits on more than one GUI function.
+      std::unique_lock< std::recursive_mutex > lock( guiMutex );
+
       // Useful for some metadata in event handling
       currentEvent = &event;
 
@@ -609,6 +804,9 @@ namespace BlueBear {
       currentEvent = nullptr;
     }
     void Display::MainGameState::processOsd() {
+      // Widgets are created and modified by scripts
+      std::unique_lock< std::recursive_mutex > lock( guiMutex );
+
       glDisable( GL_DEPTH_TEST );
       gui.desktop.Update( gui.clock.restart().asSeconds() );
       instance.sfgui.Display( instance.mainWindow );
@@ -623,30 +821,97 @@ namespace BlueBear {
     std::map< std::string, std::shared_ptr< Shader > >& Display::MainGameState::getRegisteredShaders() {
       return registeredShaders;
     }
+    /**
+     * For GUI handlers, which are fired on the render thread but have to call into Lua on the engine's
+     */
+    Threading::CommandBus& Display::MainGameState::getEngineCommandBus() {
+      return instance.engine->getCommandBus();
+    }
+    /**
+     * Like lua_pushcclosure, but the closure runs holding guiMutex. Scripts call GUI functions on the engine thread while the render thread
+     * draws the same widgets, and this way neither thread has to hold the other's lock for longer than one call.
+     *
+     * STACK ARGS: upvalue...
+     * RETURNS: closure
+     */
+    void Display::MainGameState::pushGuiFunction( lua_State* L, lua_CFunction function, int upvalues ) {
+      lua_pushcclosure( L, function, upvalues ); // <function>
+      lua_pushlightuserdata( L, &guiMutex ); // mutex <function>
+      lua_insert( L, -2 ); // <function> mutex
+      lua_pushcclosure( L, &Display::MainGameState::lua_guiCall, 2 ); // <gui_function>
+    }
+    /**
+     * Like luaL_setfuncs, but with every function pushed by pushGuiFunction
+     *
+     * STACK ARGS: upvalue... table
+     * (Upvalues are popped)
+     */
+    void Display::MainGameState::setGuiFuncs( lua_State* L, const luaL_Reg* functions, int upvalues ) {
+      for( ; functions->name; functions++ ) {
+        for( int i = 0; i != upvalues; i++ ) {
+          lua_pushvalue( L, -upvalues ); // upvalue upvalue... table
+        }
+
+        pushGuiFunction( L, functions->func, upvalues ); // <gui_function> upvalue... table
+        lua_setfield( L, -( upvalues + 2 ), functions->name ); // upvalue... table
+      }
+
+      lua_pop( L, upvalues ); // table
+    }
+    /**
+     * Call the function in upvalue 2 with guiMutex (upvalue 1) held, and return what it returns. Errors are caught so the lock is released
+     * before they're raised again.
+     */
+    int Display::MainGameState::lua_guiCall( lua_State* L ) {
+      std::recursive_mutex* mutex = ( std::recursive_mutex* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+      int status;
+
+      {
+        std::unique_lock< std::recursive_mutex > lock( *mutex );
+
+        lua_pushvalue( L, lua_upvalueindex( 2 ) ); // <function> args
+        lua_insert( L, 1 ); // args <function>
+        status = lua_pcall( L, lua_gettop( L ) - 1, LUA_MULTRET, 0 ); // results
+      }
+
+      if( status != LUA_OK ) { // error
+        return lua_error( L );
+      }
+
+      return lua_gettop( L );
+    }
     int Display::MainGameState::lua_zoomIn( lua_State* L ) {
       Display::MainGameState* self = ( Display::MainGameState* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-      self->camera.zoomIn();
+      self->commandBus->post( [ self ]() {
+        self->camera.zoomIn();
+      } );
       return 0;
     }
     int Display::MainGameState::lua_zoomOut( lua_State* L ) {
       Display::MainGameState* self = ( Display::MainGameState* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-      self->camera.zoomOut();
+      self->commandBus->post( [ self ]() {
+        self->camera.zoomOut();
+      } );
       return 0;
     }
     int Display::MainGameState::lua_rotateWorldLeft( lua_State* L ) {
       Display::MainGameState* self = ( Display::MainGameState* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-      self->currentRotation = self->camera.rotateLeft();
-      self->createWallInstances();
+      self->commandBus->post( [ self ]() {
+        self->currentRotation = self->camera.rotateLeft();
+        self->createWallInstances();
+      } );
       return 0;
     }
     int Display::MainGameState::lua_rotateWorldRight( lua_State* L ) {
       Display::MainGameState* self = ( Display::MainGameState* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-      self->currentRotation = self->camera.rotateRight();
-      self->createWallInstances();
+      self->commandBus->post( [ self ]() {
+        self->currentRotation = self->camera.rotateRight();
+        self->createWallInstances();
+      } );
       return 0;
     }
   }
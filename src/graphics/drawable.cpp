@@ -10,7 +10,7 @@ namespace BlueBear {
     Drawable::Drawable( std::shared_ptr< Mesh > mesh, std::shared_ptr< Material > material ) :
       mesh( mesh ), material( material ) {}
 
-    void Drawable::render( std::shared_ptr< Armature > bindPose ) {
+    void Drawable::render( std::shared_ptr< Armature > bindPose ) const {
       material->sendToShader();
       mesh->drawElements( bindPose );
     }
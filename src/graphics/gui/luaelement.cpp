@@ -6,6 +6,8 @@
 #include "graphics/widgetbuilder.hpp"
 #include "graphics/imagebuilder/pathimagesource.hpp"
 #include "graphics/display.hpp"
+#include "scripting/luakit/refcache.hpp"
+#include "threading/commandbus.hpp"
 #include "tools/ctvalidators.hpp"
 #include "tools/utility.hpp"
 #include "configmanager.hpp"
@@ -205,11 +207,11 @@ namespace BlueBear {
                 LuaReference masterReference = luaL_ref( L, LUA_REGISTRYINDEX ); // "event" self
                 signalMap[ sfg::Widget::OnLeftClick ] = LuaElement::SignalBinding{
                   masterReference,
-                  element.widget->GetSignal( sfg::Widget::OnLeftClick ).Connect( std::bind( LuaElement::clickHandler, L, element.widget, masterReference, "left" ) )
+                  element.widget->GetSignal( sfg::Widget::OnLeftClick ).Connect( std::bind( LuaElement::clickHandler, L, self, element.widget, masterReference, "left" ) )
                 };
                 signalMap[ sfg::Widget::OnRightClick ] = LuaElement::SignalBinding{
                   masterReference,
-                  element.widget->GetSignal( sfg::Widget::OnRightClick ).Connect( std::bind( LuaElement::clickHandler, L, element.widget, masterReference, "right" ) )
+                  element.widget->GetSignal( sfg::Widget::OnRightClick ).Connect( std::bind( LuaElement::clickHandler, L, self, element.widget, masterReference, "right" ) )
                 };
 
                 lua_pushboolean( L, true ); // true "event" self
@@ -247,22 +249,22 @@ namespace BlueBear {
               }
             case Tools::Utility::hash( "mouse_enter" ):
               {
-                registerGenericHandler( L, element.widget, sfg::Widget::OnMouseEnter ); // true "event" self
+                registerGenericHandler( L, self, element.widget, sfg::Widget::OnMouseEnter ); // true "event" self
                 return 1; // true
               }
             case Tools::Utility::hash( "mouse_leave" ):
               {
-                registerGenericHandler( L, element.widget, sfg::Widget::OnMouseLeave ); // true "event" self
+                registerGenericHandler( L, self, element.widget, sfg::Widget::OnMouseLeave ); // true "event" self
                 return 1; // true
               }
             case Tools::Utility::hash( "focus" ):
               {
-                registerGenericHandler( L, element.widget, sfg::Widget::OnGainFocus ); // true "event" self
+                registerGenericHandler( L, self, element.widget, sfg::Widget::OnGainFocus ); // true "event" self
                 return 1; // true
               }
             case Tools::Utility::hash( "blur" ):
               {
-                registerGenericHandler( L, element.widget, sfg::Widget::OnLostFocus ); // true "event" self
+                registerGenericHandler( L, self, element.widget, sfg::Widget::OnLostFocus ); // true "event" self
                 return 1; // true
               }
             default:
@@ -2350,54 +2352,85 @@ namespace BlueBear {
         lua_setmetatable( L, -2 ); // userdata
       }
 
-      void LuaElement::keyHandler( lua_State* L, std::weak_ptr< sfg::Widget > selfElement, Display::MainGameState* state, LuaReference masterReference ) {
+      /**
+       * @static
+       * Runs on the engine thread, posted by the handlers below (which run on the render thread, and can't use L). Builds the event object
+       * from the keyboard status, the widget and whatever addFields puts on it, double-bags the function with it, and enqueues the result.
+       *
+       * STACK ARGS: (none)
+       * Stack is unmodified after call
+       */
+      void LuaElement::fireHandler(
+        lua_State* L,
+        std::weak_ptr< sfg::Widget > widgetPtr,
+        LuaReference masterReference,
+        const KeyboardStatus& keyboard,
+        std::function< void( lua_State* ) > addFields,
+        const std::string& caller
+      ) {
+        std::shared_ptr< sfg::Widget > widget = widgetPtr.lock();
+        if( !widget ) {
+          Log::getInstance().error( caller, "Could not lock element pointer to build field event.widget" );
+          return;
+        }
 
-        if( !state->currentEvent ) {
-          Log::getInstance().error( "LuaElement::keyHandler", "no state to read the key event from!!" );
+        Scripting::LuaKit::RefCache::push( L, Scripting::LuaKit::RefCache::Entry::BIND ); // <bind>
+        lua_rawgeti( L, LUA_REGISTRYINDEX, masterReference ); // <function> <bind>
+
+        // The handler may have been switched off (and its reference released) since the event was posted
+        if( !lua_isfunction( L, -1 ) ) {
+          lua_pop( L, 2 ); // EMPTY
           return;
         }
 
-        lua_getglobal( L, "bluebear" ); // bluebear
-        Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-        Tools::Utility::getTableValue( L, "bind" ); // <bind> bluebear.util bluebear
-        lua_rawgeti( L, LUA_REGISTRYINDEX, masterReference ); // <function> <bind> bluebear.util bluebear
+        lua_newtable( L ); // newtable <function> <bind>
+
+        setKeyboardStatus( L, keyboard );
+        addFields( L );
+
+        lua_pushstring( L, "widget" ); // "widget" newtable <function> <bind>
+        getUserdataFromWidget( L, widget ); // element "widget" newtable <function> <bind>
+        lua_settable( L, -3 ); // newtable <function> <bind>
 
-        lua_newtable( L ); // newtable <function> <bind> bluebear.util bluebear
+        if( lua_pcall( L, 2, 1, 0 ) ) { // error
+          Log::getInstance().error( caller, "Couldn't create required closure to fire event." );
+          lua_pop( L, 1 ); // EMPTY
+          return;
+        } // <temp_function>
+
+        int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
 
-        setKeyboardStatus( L );
+        eventManager.UI_ACTION_EVENT.trigger( edibleReference );
+      }
 
-        lua_getfield( L, -1, "keyboard" ); // keyboard newtable <function> <bind> bluebear.util bluebear
+      void LuaElement::keyHandler( lua_State* L, std::weak_ptr< sfg::Widget > selfElement, Display::MainGameState* state, LuaReference masterReference ) {
+
+        if( !state->currentEvent ) {
+          Log::getInstance().error( "LuaElement::keyHandler", "no state to read the key event from!!" );
+          return;
+        }
 
         switch( state->currentEvent->type ) {
           case sf::Event::KeyPressed:
           case sf::Event::KeyReleased:
-            lua_pushstring( L, Input::InputManager::keyToString( state->currentEvent->key.code ).c_str() ); // "key" keyboard newtable <function> <bind> bluebear.util bluebear
-            lua_setfield( L, -2, "key" ); // keyboard newtable <function> <bind> bluebear.util bluebear
-            lua_pop( L, 1 ); // newtable <function> <bind> bluebear.util bluebear
             break;
           default:
             Log::getInstance().error( "LuaElement::keyHandler", "incorrect event for key type!!" );
             return;
         }
 
-        if( auto elementPtr = selfElement.lock() ) {
-          getUserdataFromWidget( L, elementPtr ); // element newtable <function> <bind> bluebear.util bluebear
-          lua_setfield( L, -2, "widget" ); // newtable <function> <bind> bluebear.util bluebear
-        } else {
-          Log::getInstance().error( "LuaElement::keyHandler", "Could not lock element pointer to build field event.widget" );
-          return;
-        }
-
-        if( lua_pcall( L, 2, 1, 0 ) ) { // error bluebear.util bluebear
-          Log::getInstance().error( "LuaElement::keyHandler", "Couldn't create required closure to fire event." );
-          lua_pop( L, 3 ); // EMPTY
-          return;
-        } // <temp_function> bluebear.util bluebear
-
-        int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // bluebear.util bluebear
-        lua_pop( L, 2 ); // EMPTY
-
-        eventManager.UI_ACTION_EVENT.trigger( edibleReference );
+        // currentEvent only lasts as long as handleEvent
+        std::string key = Input::InputManager::keyToString( state->currentEvent->key.code );
+        KeyboardStatus keyboard = getKeyboardStatus();
+
+        state->getEngineCommandBus().post( [ L, selfElement, masterReference, keyboard, key ]() {
+          fireHandler( L, selfElement, masterReference, keyboard, [ &key ]( lua_State* L ) {
+            lua_getfield( L, -1, "keyboard" ); // keyboard newtable
+            lua_pushstring( L, key.c_str() ); // "key" keyboard newtable
+            lua_setfield( L, -2, "key" ); // keyboard newtable
+            lua_pop( L, 1 ); // newtable
+          }, "LuaElement::keyHandler" );
+        } );
       }
 
       /**
@@ -2405,78 +2438,43 @@ namespace BlueBear {
        * STACK ARGS: (none)
        * Stack is unmodified after call
        */
-      void LuaElement::clickHandler( lua_State* L, std::weak_ptr< sfg::Widget > selfElement, LuaReference masterReference, const std::string& buttonTag ) {
-        // Create new "disposable" reference that will get ferried through and double-bag it with an event meta object
-
-        // Double-bag this function by slapping an event object onto the argument list
-        lua_getglobal( L, "bluebear" ); // bluebear
-        Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-        Tools::Utility::getTableValue( L, "bind" ); // <bind> bluebear.util bluebear
-        lua_rawgeti( L, LUA_REGISTRYINDEX, masterReference ); // <function> <bind> bluebear.util bluebear
-
-        lua_newtable( L ); // newtable <function> <bind> bluebear.util bluebear
-        lua_pushstring( L, "mouse" ); // "mouse" newtable <function> <bind> bluebear.util bluebear
-        lua_pushstring( L, buttonTag.c_str() ); // "left" "mouse" newtable <function> <bind> bluebear.util bluebear
-        lua_settable( L, -3 ); // newtable <function> <bind> bluebear.util bluebear
-
-        setKeyboardStatus( L );
-
-        if( auto elementPtr = selfElement.lock() ) {
-          lua_pushstring( L, "widget" ); // "widget" newtable <function> <bind> bluebear.util bluebear
-          getUserdataFromWidget( L, elementPtr ); // element "widget" newtable <function> <bind> bluebear.util bluebear
-          lua_settable( L, -3 ); // newtable <function> <bind> bluebear.util bluebear
-        } else {
-          Log::getInstance().error( "LuaElement::clickHandler", "Could not lock element pointer to build field event.widget" );
-          return;
-        }
-
-        if( lua_pcall( L, 2, 1, 0 ) ) { // error bluebear.util bluebear
-          Log::getInstance().error( "LuaElement::clickHandler", "Couldn't create required closure to fire event." );
-          lua_pop( L, 3 ); // EMPTY
-          return;
-        } // <temp_function> bluebear.util bluebear
-
-        int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // bluebear.util bluebear
-        lua_pop( L, 2 ); // EMPTY
-
-        eventManager.UI_ACTION_EVENT.trigger( edibleReference );
+      void LuaElement::clickHandler( lua_State* L, Display::MainGameState* state, std::weak_ptr< sfg::Widget > selfElement, LuaReference masterReference, const std::string& buttonTag ) {
+        KeyboardStatus keyboard = getKeyboardStatus();
+
+        state->getEngineCommandBus().post( [ L, selfElement, masterReference, keyboard, buttonTag ]() {
+          fireHandler( L, selfElement, masterReference, keyboard, [ &buttonTag ]( lua_State* L ) {
+            lua_pushstring( L, "mouse" ); // "mouse" newtable
+            lua_pushstring( L, buttonTag.c_str() ); // "left" "mouse" newtable
+            lua_settable( L, -3 ); // newtable
+          }, "LuaElement::clickHandler" );
+        } );
       }
 
       /**
        * @static
-       * Generic event handler for most events that passes a baseline event object, double-bags the function, and calls it
+       * Generic event handler for most events that passes a baseline event object, double-bags the function, and enqueues it (see fireHandler)
        *
        * STACK ARGS: (none)
        * Stack is unmodified after call
        */
-      void LuaElement::genericHandler( lua_State* L, std::weak_ptr< sfg::Widget > widgetPtr, LuaReference masterReference ) {
-        lua_getglobal( L, "bluebear" ); // bluebear
-        Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-        Tools::Utility::getTableValue( L, "bind" ); // <bind> bluebear.util bluebear
-        lua_rawgeti( L, LUA_REGISTRYINDEX, masterReference ); // <function> <bind> bluebear.util bluebear
+      void LuaElement::genericHandler( lua_State* L, Display::MainGameState* state, std::weak_ptr< sfg::Widget > widgetPtr, LuaReference masterReference ) {
+        KeyboardStatus keyboard = getKeyboardStatus();
 
-        lua_newtable( L ); // newtable <function> <bind> bluebear.util bluebear
-
-        setKeyboardStatus( L );
-
-        if( auto widget = widgetPtr.lock() ) {
-          lua_pushstring( L, "widget" ); // "widget" newtable <function> <bind> bluebear.util bluebear
-          getUserdataFromWidget( L, widget ); // element "widget" newtable <function> <bind> bluebear.util bluebear
-          lua_settable( L, -3 ); // newtable <function> <bind> bluebear.util bluebear
-        } else {
-          Log::getInstance().error( "LuaElement::genericHandler", "Could not lock element pointer to build field event.widget" );
-        }
-
-        if( lua_pcall( L, 2, 1, 0 ) ) { // error bluebear.util bluebear
-          Log::getInstance().error( "LuaElement::genericHandler", "Couldn't create required closure to fire event." );
-          lua_pop( L, 3 ); // EMPTY
-          return;
-        } // <temp_function> bluebear.util bluebear
-
-        int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // bluebear.util bluebear
-        lua_pop( L, 2 ); // EMPTY
+        state->getEngineCommandBus().post( [ L, widgetPtr, masterReference, keyboard ]() {
+          fireHandler( L, widgetPtr, masterReference, keyboard, []( lua_State* L ) {}, "LuaElement::genericHandler" );
+        } );
+      }
 
-        eventManager.UI_ACTION_EVENT.trigger( edibleReference );
+      /**
+       * @static
+       * Which modifier keys are held right now. Only meaningful on the render thread, while an event is being handled.
+       */
+      LuaElement::KeyboardStatus LuaElement::getKeyboardStatus() {
+        return KeyboardStatus{
+          sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ),
+          sf::Keyboard::isKeyPressed( sf::Keyboard::LAlt ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RAlt ),
+          sf::Keyboard::isKeyPressed( sf::Keyboard::LSystem ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RSystem )
+        };
       }
 
       /**
@@ -2484,20 +2482,20 @@ namespace BlueBear {
        * STACK ARGS: newtable
        * (Stack is unmodified after call)
        */
-      void LuaElement::setKeyboardStatus( lua_State* L ) {
+      void LuaElement::setKeyboardStatus( lua_State* L, const KeyboardStatus& status ) {
         lua_pushstring( L, "keyboard" ); // "keyboard" newtable
         lua_newtable( L ); // keyboard "keyboard" newtable
 
         lua_pushstring( L, "ctrl" ); // "ctrl" keyboard "keyboard" newtable
-        lua_pushboolean( L, ( sf::Keyboard::isKeyPressed( sf::Keyboard::LControl ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RControl ) ) ? 1 : 0 );  // true "ctrl" keyboard "keyboard" newtable
+        lua_pushboolean( L, status.ctrl ? 1 : 0 );  // true "ctrl" keyboard "keyboard" newtable
         lua_settable( L, -3 ); // keyboard "keyboard" newtable
 
         lua_pushstring( L, "alt" ); // "alt" keyboard "keyboard" newtable
-        lua_pushboolean( L, ( sf::Keyboard::isKeyPressed( sf::Keyboard::LAlt ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RAlt ) ) ? 1 : 0 );  // true "alt" keyboard "keyboard" newtable
+        lua_pushboolean( L, status.alt ? 1 : 0 );  // true "alt" keyboard "keyboard" newtable
         lua_settable( L, -3 ); // keyboard "keyboard" newtable
 
         lua_pushstring( L, "meta" ); // "meta" keyboard "keyboard" newtable
-        lua_pushboolean( L, ( sf::Keyboard::isKeyPressed( sf::Keyboard::LSystem ) || sf::Keyboard::isKeyPressed( sf::Keyboard::RSystem ) ) ? 1 : 0 );  // true "meta" keyboard "keyboard" newtable
+        lua_pushboolean( L, status.meta ? 1 : 0 );  // true "meta" keyboard "keyboard" newtable
         lua_settable( L, -3 ); // keyboard "keyboard" newtable
 
         lua_settable( L, -3 ); // newtable
@@ -2542,7 +2540,7 @@ namespace BlueBear {
        * STACK ARGS: function
        * RETURNS: true
        */
-      void LuaElement::registerGenericHandler( lua_State* L, std::shared_ptr< sfg::Widget > widget, sfg::Signal::SignalID signalID ) {
+      void LuaElement::registerGenericHandler( lua_State* L, Display::MainGameState* state, std::shared_ptr< sfg::Widget > widget, sfg::Signal::SignalID signalID ) {
         auto& signalMap = masterSignalMap[ widget ];
         unregisterHandler( L, signalMap, widget, signalID );
 
@@ -2550,7 +2548,7 @@ namespace BlueBear {
 
         signalMap[ signalID ] = LuaElement::SignalBinding{
           masterReference,
-          widget->GetSignal( signalID ).Connect( std::bind( LuaElement::genericHandler, L, widget, masterReference ) )
+          widget->GetSignal( signalID ).Connect( std::bind( LuaElement::genericHandler, L, state, widget, masterReference ) )
         };
 
         lua_pushboolean( L, true ); // true
@@ -45,7 +45,7 @@ namespace BlueBear {
             { NULL, NULL }
           };
 
-          luaL_setfuncs( L, tableFuncs, 0 );
+          displayState.setGuiFuncs( L, tableFuncs, 0 );
 
           lua_pushvalue( L, -1 ); // metatable metatable userdata
 
@@ -1,6 +1,8 @@
 #include "graphics/input/inputmanager.hpp"
 #include "graphics/display.hpp"
 #include "graphics/gui/sfgroot.hpp"
+#include "scripting/luakit/refcache.hpp"
+#include "threading/commandbus.hpp"
 #include "tools/ctvalidators.hpp"
 #include "tools/utility.hpp"
 #include "eventmanager.hpp"
@@ -12,7 +14,7 @@ namespace BlueBear {
   namespace Graphics {
     namespace Input {
 
-      InputManager::InputManager( lua_State* L ) : L( L ) {
+      InputManager::InputManager( lua_State* L, Threading::CommandBus& engineCommands ) : L( L ), engineCommands( engineCommands ) {
         eventManager.SFGUI_EAT_EVENT.listen( SFGUIEatEvent::Event::EAT_KEYBOARD_EVENT, [ & ]() {
           eatKeyEvents = true;
         } );
@@ -72,29 +74,34 @@ namespace BlueBear {
         }
       }
 
-      void InputManager::fireOff( std::vector< LuaReference >& refs ) {
-        for( LuaReference reference : refs ) {
+      /**
+       * Called from handleEvent, on the render thread, which doesn't get to use L. The handlers registered right now are copied and bound on
+       * the engine's thread instead.
+       */
+      void InputManager::fireOff( const std::vector< LuaReference >& refs ) {
+        lua_State* L = this->L;
 
-          if( reference != -1 ) {
-            lua_getglobal( L, "bluebear" ); // bluebear
-            Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-            Tools::Utility::getTableValue( L, "bind" ); // <bind> bluebear.util bluebear
-            lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <function> <bind> bluebear.util bluebear
+        engineCommands.post( [ L, refs ]() {
+          for( LuaReference reference : refs ) {
 
-            if( lua_pcall( L, 1, 1, 0 ) ) { // error bluebear.util bluebear
-              Log::getInstance().error( "InputManager::fireOff", "Couldn't create required closure to fire event: " + std::string( lua_tostring( L, -1 ) ) );
-              lua_pop( L, 3 ); // EMPTY
-              return;
-            } // <temp_function> bluebear.util bluebear
+            if( reference != -1 ) {
+              Scripting::LuaKit::RefCache::push( L, Scripting::LuaKit::RefCache::Entry::BIND ); // <bind>
+              lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <function> <bind>
 
-            int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // bluebear.util bluebear
-            lua_pop( L, 2 ); // EMPTY
+              if( lua_pcall( L, 1, 1, 0 ) ) { // error
+                Log::getInstance().error( "InputManager::fireOff", "Couldn't create required closure to fire event: " + std::string( lua_tostring( L, -1 ) ) );
+                lua_pop( L, 1 ); // EMPTY
+                return;
+              } // <temp_function>
 
-            // Enqueue the edible reference
-            eventManager.UI_ACTION_EVENT.trigger( edibleReference );
-          }
+              int edibleReference = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
 
-        }
+              // Enqueue the edible reference
+              eventManager.UI_ACTION_EVENT.trigger( edibleReference );
+            }
+
+          }
+        } );
       }
 
       /**
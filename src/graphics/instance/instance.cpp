@@ -65,6 +65,8 @@ namespace BlueBear {
      * setAnimation will act the same whether or not it's called on a child node or the root node. It will activate all animations as if called from the top of the scene graph.
      */
     void Instance::setAnimation( const std::string& animKey, bool playNow ) {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
       if( !animations ) {
         Log::getInstance().warn( "Instance::setAnimation", "This instance has no animations." );
         return;
@@ -84,6 +86,8 @@ namespace BlueBear {
     }
 
     std::string Instance::getAnimation() {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
       if( currentAnimation ) {
         return currentAnimation->getAnimationID();
       }
@@ -93,6 +97,8 @@ namespace BlueBear {
     }
 
     void Instance::setAnimationFrame( double frame ) {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
       if( currentAnimation ) {
         currentPose = currentAnimation->generateFrame( bindPose, frame );
       } else {
@@ -104,6 +110,12 @@ namespace BlueBear {
      * Update the animation pose if an AnimPlayer is attached.
      */
     void Instance::updateAnimationPose() {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
+      updateAnimationPoseUnlocked();
+    }
+
+    void Instance::updateAnimationPoseUnlocked() {
       if( currentAnimation ) {
         // Use currentAnimation to get new Armature based off the bind pose
         std::shared_ptr< Armature > candidatePose = currentAnimation->generateNextFrame( bindPose );
@@ -125,12 +137,19 @@ namespace BlueBear {
      * Public-facing overload
      */
     void Instance::drawEntity() {
-      updateAnimationPose();
+      std::shared_ptr< Armature > pose;
+
+      {
+        std::unique_lock< std::mutex > lock( animationMutex );
 
-      drawEntity( false, *this );
+        updateAnimationPoseUnlocked();
+        pose = currentPose;
+      }
+
+      drawEntity( false, pose );
     }
 
-    void Instance::drawEntity( bool dirty, Instance& rootInstance ) {
+    void Instance::drawEntity( bool dirty, std::shared_ptr< Armature > pose ) {
       dirty = dirty || transform->dirty;
 
       // Update if dirty
@@ -140,13 +159,48 @@ namespace BlueBear {
 
       if( drawable ) {
         transform->sendToShader();
-        drawable->render( rootInstance.currentPose );
+        drawable->render( pose );
       }
 
       for( auto& pair : children ) {
         // If "dirty" was true here, it'll get passed down to subsequent instances. But if "dirty" was false, and this call ends up being "dirty",
         // it should only propagate to its own children since dirty is passed by value here.
-        pair.second->drawEntity( dirty, rootInstance );
+        pair.second->drawEntity( dirty, pose );
+      }
+    }
+
+    /**
+     * Append what drawEntity would draw, without drawing it: the world matrix and drawable of every node in the tree, and a copy of the
+     * current pose, advanced by a frame. For instances scripts can still change; the copies can be drawn on another thread.
+     */
+    void Instance::captureDraws( std::vector< ShaderInstanceBundle::Draw >& draws ) {
+      std::shared_ptr< Armature > pose;
+
+      {
+        std::unique_lock< std::mutex > lock( animationMutex );
+
+        updateAnimationPoseUnlocked();
+
+        // The bind pose is the model's, and never changes
+        pose = ( currentPose && currentPose != bindPose ) ? std::make_shared< Armature >( *currentPose ) : currentPose;
+      }
+
+      captureDraws( draws, false, pose );
+    }
+
+    void Instance::captureDraws( std::vector< ShaderInstanceBundle::Draw >& draws, bool dirty, const std::shared_ptr< Armature >& pose ) {
+      dirty = dirty || transform->dirty;
+
+      if( dirty ) {
+        transform->update();
+      }
+
+      if( drawable ) {
+        draws.push_back( ShaderInstanceBundle::Draw{ transform->matrix, *drawable, pose } );
+      }
+
+      for( auto& pair : children ) {
+        pair.second->captureDraws( draws, dirty, pose );
       }
     }
 
@@ -184,8 +238,38 @@ namespace BlueBear {
     }
 
     std::shared_ptr< AnimPlayer > Instance::getAnimPlayer() {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
       return currentAnimation;
     }
 
+    /**
+     * Returns false if there is no animation playing
+     */
+    bool Instance::pauseAnimation() {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
+      if( currentAnimation ) {
+        currentAnimation->pause();
+        return true;
+      }
+
+      return false;
+    }
+
+    /**
+     * Returns false if there is no animation playing (and paused is left untouched)
+     */
+    bool Instance::getAnimationPaused( bool& paused ) {
+      std::unique_lock< std::mutex > lock( animationMutex );
+
+      if( currentAnimation ) {
+        paused = currentAnimation->getPaused();
+        return true;
+      }
+
+      return false;
+    }
+
   }
 }
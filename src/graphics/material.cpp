@@ -23,7 +23,7 @@ namespace BlueBear {
           std::stringstream stream;
           stream << "diffuse" << i;
           std::string uniformName = stream.str();
-          glBindTexture( GL_TEXTURE_2D, diffuseTextures[ i ]->id );
+          glBindTexture( GL_TEXTURE_2D, diffuseTextures[ i ]->getId() );
           glUniform1i( Tools::OpenGL::getUniformLocation( uniformName ), i );
       }
     }
@@ -17,14 +17,14 @@ namespace BlueBear {
       std::vector< Index >& indices,
       std::vector< std::string > boneIndices,
       std::shared_ptr< Armature > bind
-    ) : boneIndices( boneIndices ), bind( bind ), size( indices.size() ) {
-      setupMesh( vertices, indices );
-    }
+    ) : boneIndices( boneIndices ), bind( bind ), size( indices.size() ), uploaded( false ), pendingVertices( vertices ), pendingIndices( indices ) {}
 
     Mesh::~Mesh() {
-      glDeleteVertexArrays( 1, &VAO );
-      glDeleteBuffers( 1, &VBO );
-      glDeleteBuffers( 1, &EBO );
+      if( uploaded ) {
+        glDeleteVertexArrays( 1, &VAO );
+        glDeleteBuffers( 1, &VBO );
+        glDeleteBuffers( 1, &EBO );
+      }
     }
 
     void Mesh::setupMesh( std::vector< Vertex >& vertices, std::vector< Index >& indices ) {
@@ -52,9 +52,19 @@ namespace BlueBear {
         glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
       glBindVertexArray( 0 );
+
+      uploaded = true;
     }
 
     void Mesh::drawElements( std::shared_ptr< Armature > currentPose ) {
+      if( !uploaded ) {
+        setupMesh( pendingVertices, pendingIndices );
+
+        // Don't need these anymore
+        std::vector< Vertex >().swap( pendingVertices );
+        std::vector< Index >().swap( pendingIndices );
+      }
+
       std::vector< glm::mat4 > boneUniform;
       // Bone uniform 0 is always identity (for boneless meshes)
       boneUniform.push_back( glm::mat4() );
@@ -126,9 +126,7 @@ namespace BlueBear {
     int LuaInstanceHelper::lua_pauseAnimation( lua_State* L ) {
       LuaInstanceHelper* self = *( ( LuaInstanceHelper** ) luaL_checkudata( L, 1, "bluebear_graphics_instance" ) );
 
-      if( std::shared_ptr< AnimPlayer > animPlayer = self->instance->getAnimPlayer() ) {
-        animPlayer->pause();
-      } else {
+      if( !self->instance->pauseAnimation() ) {
         Log::getInstance().warn( "LuaInstanceHelper::lua_pauseAnimation", "Instance has no animation playing!" );
       }
 
@@ -138,8 +136,9 @@ namespace BlueBear {
     int LuaInstanceHelper::lua_isAnimationPaused( lua_State* L ) {
       LuaInstanceHelper* self = *( ( LuaInstanceHelper** ) luaL_checkudata( L, 1, "bluebear_graphics_instance" ) );
 
-      if( std::shared_ptr< AnimPlayer > animPlayer = self->instance->getAnimPlayer() ) {
-        lua_pushboolean( L, animPlayer->getPaused() ? 1 : 0 ); // true
+      bool paused;
+      if( self->instance->getAnimationPaused( paused ) ) {
+        lua_pushboolean( L, paused ? 1 : 0 ); // true
 
         return 1;
       } else {
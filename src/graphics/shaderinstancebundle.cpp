@@ -1,7 +1,8 @@
 #include "graphics/shaderinstancebundle.hpp"
 #include "graphics/shader.hpp"
-#include "graphics/instance/instance.hpp"
 #include "graphics/camera.hpp"
+#include "tools/opengl.hpp"
+#include <glm/gtc/type_ptr.hpp>
 
 namespace BlueBear {
   namespace Graphics {
@@ -12,12 +13,13 @@ namespace BlueBear {
     ShaderInstanceBundle::ShaderInstanceBundle( std::shared_ptr< Shader > shader ) :
       shader( shader ) {}
 
-    void ShaderInstanceBundle::drawInstances( Camera& camera ) {
+    void ShaderInstanceBundle::drawInstances( Camera& camera ) const {
       shader->use();
       camera.sendToShader();
 
-      for( std::shared_ptr< Instance > instance : instances ) {
-        instance->drawEntity();
+      for( const Draw& draw : draws ) {
+        glUniformMatrix4fv( Tools::OpenGL::getUniformLocation( "model" ), 1, GL_FALSE, glm::value_ptr( draw.model ) );
+        draw.drawable.render( draw.pose );
       }
     }
 
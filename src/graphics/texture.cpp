@@ -10,11 +10,9 @@ namespace BlueBear {
   namespace Graphics {
 
     Texture::Texture( GLuint id, aiString path ) :
-      id( id ), path( path ) {}
+      uploaded( true ), id( id ), path( path ) {}
 
-    Texture::Texture( sf::Image& texture ) {
-      prepareTextureFromImage( texture );
-    }
+    Texture::Texture( sf::Image& texture ) : pendingImage( texture ) {}
 
     Texture::Texture( std::string texFromFile ) {
       sf::Image texture;
@@ -25,11 +23,25 @@ namespace BlueBear {
         return;
       }
 
-      prepareTextureFromImage( texture );
+      pendingImage = texture;
     }
 
     Texture::~Texture() {
-      glDeleteTextures( 1, &id );
+      if( uploaded ) {
+        glDeleteTextures( 1, &id );
+      }
+    }
+
+    /**
+     * Must be called on the render thread
+     */
+    GLuint Texture::getId() {
+      if( !uploaded ) {
+        prepareTextureFromImage( pendingImage );
+        pendingImage = sf::Image();
+      }
+
+      return id;
     }
 
     void Texture::prepareTextureFromImage( sf::Image& texture ) {
@@ -44,6 +56,8 @@ namespace BlueBear {
         glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.getPixelsPtr() );
         glGenerateMipmap( GL_TEXTURE_2D );
       glBindTexture( GL_TEXTURE_2D, 0 );
+
+      uploaded = true;
     }
   }
 }
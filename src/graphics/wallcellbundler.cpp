@@ -9,13 +9,15 @@
 #include "graphics/imagebuilder/pointerimagesource.hpp"
 #include "graphics/material.hpp"
 #include "containers/collection3d.hpp"
-#include "scripting/wallcell.hpp"
+#include "scripting/wallgrid.hpp"
 #include "scripting/wallpaper.hpp"
 #include "log.hpp"
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <map>
 #include <utility>
+#include <vector>
 #include <SFML/Graphics.hpp>
 #include <glm/glm.hpp>
 
@@ -36,11 +38,11 @@ namespace BlueBear {
     float WallCellBundler::xOrigin = 0.0f;
     float WallCellBundler::yOrigin = 0.0f;
 
-    WallCellBundler::WallCellBundler( std::shared_ptr< Scripting::WallCell > hostCell, Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, glm::vec3 counter, unsigned int currentRotation, TextureCache& hostTextureCache, ImageCache& hostImageCache ) :
+    WallCellBundler::WallCellBundler( Scripting::WallGrid::CellView hostCell, Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, glm::vec3 counter, unsigned int currentRotation, TextureCache& hostTextureCache, ImageCache& hostImageCache ) :
      currentRotation( currentRotation ),
      hostTextureCache( hostTextureCache ),
      hostImageCache( hostImageCache ),
-     hostCellPtr( hostCell ),
+     hostCell( hostCell ),
      counter( counter ) {
 
        center = glm::vec3( xOrigin + counter.x, yOrigin - counter.y, counter.z * 2.0f );
@@ -48,7 +50,7 @@ namespace BlueBear {
        std::string frontPath;
        std::string backPath;
 
-       if( isWallDimensionPresent( frontPath, backPath, hostCellPtr->x ) ) {
+       if( isWallDimensionPresent( frontPath, backPath, hostCell.x() ) ) {
          try {
            newXWallInstance( hostCollection, frontPath, backPath );
          } catch( std::exception& e ) {
@@ -59,7 +61,7 @@ namespace BlueBear {
          }
        }
 
-       if( isWallDimensionPresent( frontPath, backPath, hostCellPtr->y ) ) {
+       if( isWallDimensionPresent( frontPath, backPath, hostCell.y() ) ) {
          try {
            newYWallInstance( hostCollection, frontPath, backPath );
          } catch( std::exception& e ) {
@@ -70,7 +72,7 @@ namespace BlueBear {
          }
        }
 
-       if( isWallDimensionPresent( frontPath, backPath, hostCellPtr->d ) ) {
+       if( isWallDimensionPresent( frontPath, backPath, hostCell.d() ) ) {
          try {
            newDWallInstance( hostCollection, frontPath, backPath );
          } catch( std::exception& e ) {
@@ -81,7 +83,7 @@ namespace BlueBear {
          }
        }
 
-       if( isWallDimensionPresent( frontPath, backPath, hostCellPtr->r ) ) {
+       if( isWallDimensionPresent( frontPath, backPath, hostCell.r() ) ) {
          try{
            newRWallInstance( hostCollection, frontPath, backPath );
          } catch( std::exception& e ) {
@@ -111,10 +113,10 @@ namespace BlueBear {
       }
     }
 
-    bool WallCellBundler::isWallDimensionPresent( std::string& frontPath, std::string& backPath, std::unique_ptr< Scripting::WallCell::Segment >& ptr ) {
-      if( ptr ) {
-        frontPath.assign( ptr->front->imagePath );
-        backPath.assign( ptr->back->imagePath );
+    bool WallCellBundler::isWallDimensionPresent( std::string& frontPath, std::string& backPath, const Scripting::WallGrid::SegmentView& segment ) {
+      if( segment ) {
+        frontPath.assign( segment.getFront()->imagePath );
+        backPath.assign( segment.getBack()->imagePath );
         return true;
       } else {
         return false;
@@ -149,7 +151,7 @@ namespace BlueBear {
       return side;
     }
 
-    std::shared_ptr< WallCellBundler > WallCellBundler::safeGetBundler( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, int x, int y, int z ) {
+    std::shared_ptr< WallCellBundler > WallCellBundler::safeGetBundler( const Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, int x, int y, int z ) {
       std::shared_ptr< WallCellBundler > result( nullptr );
       unsigned int xMax = hostCollection.getX();
       unsigned int yMax = hostCollection.getY();
@@ -170,6 +172,63 @@ namespace BlueBear {
       segment->children[ resultID ] = extended;
     }
 
+    /**
+     * Joins change pieces of the (earlier) neighbouring cells. Each is recorded on the neighbour, so that if the neighbour is rebuilt on
+     * its own (see keepJoins), it can be redone without rebuilding this cell too.
+     */
+    void WallCellBundler::eraseFromNeighbour( const std::shared_ptr< WallCellBundler >& neighbour, std::unique_ptr< Instance > WallCellBundler::* piece, const std::string& child ) {
+      if( neighbour && ( *neighbour ).*piece ) {
+        Join join{ counter, piece, child, false, glm::vec3(), "" };
+        neighbour->applyJoin( join );
+        neighbour->joins.push_back( join );
+      }
+    }
+
+    void WallCellBundler::extendNeighbour( const std::shared_ptr< WallCellBundler >& neighbour, std::unique_ptr< Instance > WallCellBundler::* piece, const std::string& corner, glm::vec3 shift ) {
+      if( neighbour && ( *neighbour ).*piece ) {
+        Join join{ counter, piece, corner, true, shift, "ExtendedSegment" };
+        neighbour->applyJoin( join );
+        neighbour->joins.push_back( join );
+      }
+    }
+
+    void WallCellBundler::applyJoin( const Join& join ) {
+      std::unique_ptr< Instance >& segment = this->*join.piece;
+
+      if( join.extend ) {
+        // The corner may have been taken away by another join since
+        if( segment->children.count( join.child ) ) {
+          createExtendedSegment( segment, join.child, join.shift, join.resultID );
+        }
+      } else {
+        segment->children.erase( join.child );
+      }
+    }
+
+    /**
+     * This cell was rebuilt in place of previous. Redo the joins previous got from neighbours outside the rebuilt rectangle; the ones inside
+     * it are rebuilt too, and join onto this cell again themselves.
+     */
+    void WallCellBundler::keepJoins( const WallCellBundler& previous, int xMin, int yMin, int xMax, int yMax ) {
+      for( const Join& join : previous.joins ) {
+        bool rebuilt = join.by.x >= xMin && join.by.x <= xMax && join.by.y >= yMin && join.by.y <= yMax;
+
+        if( !rebuilt && this->*join.piece ) {
+          applyJoin( join );
+          joins.push_back( join );
+        }
+      }
+    }
+
+    /**
+     * Drop the record of joins made by cells in the rectangle, which are about to be rebuilt and will make them again
+     */
+    void WallCellBundler::forgetJoins( int xMin, int yMin, int xMax, int yMax ) {
+      joins.erase( std::remove_if( joins.begin(), joins.end(), [ & ]( const Join& join ) {
+        return join.by.x >= xMin && join.by.x <= xMax && join.by.y >= yMin && join.by.y <= yMax;
+      } ), joins.end() );
+    }
+
     void WallCellBundler::newXWallInstance( Containers::Collection3D< std::shared_ptr< WallCellBundler > >& hostCollection, std::string& frontWallpaper, std::string& backWallpaper ) {
       x = std::make_unique< Instance >( *WallCellBundler::Piece );
 
@@ -201,15 +260,15 @@ namespace BlueBear {
               // Delete the Y-segment piece's RightCorner segment so nothing can collide
               // We can either collide with the top RightCorner, or if the piece to the left was directly before a lower right corner, the left X-segment's ExtendedSegment
               if( top->y->children.find( "RightCorner" ) != top->y->children.end() ) {
-                top->y->children.erase( "RightCorner" );
+                eraseFromNeighbour( top, &WallCellBundler::y, "RightCorner" );
               } else {
                 // The only way this would happen is if RightCorner was already deleted in favor of X to the left's ExtendedSegment. That'll have to go now.
                 std::shared_ptr< WallCellBundler > left = safeGetBundler( hostCollection, counter.x - 1, counter.y, counter.z );
-                left->x->children.erase( "ExtendedSegment" );
+                eraseFromNeighbour( left, &WallCellBundler::x, "ExtendedSegment" );
               }
 
               // Get "upperFront", which is the front image path for the Y-segment wall
-              std::string upperFront = top->hostCellPtr->y->front->imagePath;
+              std::string upperFront = top->hostCell.y().getFront()->imagePath;
 
               // Using upperFront, emplace Side2 as the rightSegment image pointer for that path
               settings.emplace( std::make_pair( "Side2", std::make_unique< PointerImageSource >( getSegmentBundle( upperFront, false, false, true ).rightSegment, "0xs2 " + upperFront ) ) );
@@ -224,7 +283,7 @@ namespace BlueBear {
             bool upperRightContainsY = upperRight && upperRight->y;
             if( upperRightContainsY ) {
               // Copy X-segment's RightCorner and move it
-              upperRight->y->children.erase( "RightCorner" );
+              eraseFromNeighbour( upperRight, &WallCellBundler::y, "RightCorner" );
 
               createExtendedSegment( x, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
             }
@@ -249,9 +308,9 @@ namespace BlueBear {
             std::shared_ptr< WallCellBundler > upperRight = safeGetBundler( hostCollection, counter.x + 1, counter.y - 1, counter.z );
             bool upperRightContainsY = upperRight && upperRight->y;
             if( upperRightContainsY ) {
-              upperRight->y->children.erase( "RightCorner" );
+              eraseFromNeighbour( upperRight, &WallCellBundler::y, "RightCorner" );
 
-              std::string upperRightBack = upperRight->hostCellPtr->y->back->imagePath;
+              std::string upperRightBack = upperRight->hostCell.y().getBack()->imagePath;
 
               settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( upperRightBack, true, false, false ).leftSegment, "1xs1 " + upperRightBack ) ) );
             } else {
@@ -264,7 +323,7 @@ namespace BlueBear {
             bool topContainsY = top && top->y;
             bool leftContainsX = left && left->x;
             if( topContainsY && !leftContainsX ) {
-              top->y->children.erase( "RightCorner" );
+              eraseFromNeighbour( top, &WallCellBundler::y, "RightCorner" );
 
               createExtendedSegment( x, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
             }
@@ -301,7 +360,7 @@ namespace BlueBear {
             bool upperRightContainsY = upperRight && upperRight->y;
             if( upperRightContainsY ) {
               // All we have to do is retexture Side1!
-              std::string back = upperRight->hostCellPtr->y->back->imagePath;
+              std::string back = upperRight->hostCell.y().getBack()->imagePath;
 
               settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( back, false, false, true ).rightSegment, "2xs1 " + back ) ) );
             } else {
@@ -335,7 +394,7 @@ namespace BlueBear {
             bool leftContainsX = left && left->x;
             if( leftContainsX ) {
               if( left->x->children.find( "ExtendedSegment" ) != left->x->children.end() ) {
-                left->x->children.erase( "ExtendedSegment" );
+                eraseFromNeighbour( left, &WallCellBundler::x, "ExtendedSegment" );
               }
             }
 
@@ -353,7 +412,7 @@ namespace BlueBear {
               // CASE: Placing an X in this cell, there is a Y on top, and no X in the left cell. An incomplete corner occurs.
 
               // Need to get front wallpaper for Y panel on top and apply it to Side2
-              std::string frontWallpaper = top->hostCellPtr->y->front->imagePath;
+              std::string frontWallpaper = top->hostCell.y().getFront()->imagePath;
 
               settings.emplace( std::make_pair( "Side2", std::make_unique< PointerImageSource >( getSegmentBundle( frontWallpaper, true, false, true ).leftSegment, "3xs2 " + frontWallpaper ) ) );
             } else {
@@ -444,7 +503,7 @@ namespace BlueBear {
             bool topContainsR = top && top->r;
 
             if( !currentContainsX && leftContainsX && !topContainsY ) {
-              left->x->children.erase( "LeftCorner" );
+              eraseFromNeighbour( left, &WallCellBundler::x, "LeftCorner" );
 
               createExtendedSegment( y, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
             }
@@ -491,15 +550,15 @@ namespace BlueBear {
             std::shared_ptr< WallCellBundler > left = safeGetBundler( hostCollection, counter.x - 1, counter.y, counter.z );
             bool leftContainsX = left && left->x;
             if( leftContainsX ) {
-              left->x->children.erase( "LeftCorner" );
+              eraseFromNeighbour( left, &WallCellBundler::x, "LeftCorner" );
 
-              std::string leftFront = left->hostCellPtr->x->front->imagePath;
+              std::string leftFront = left->hostCell.x().getFront()->imagePath;
 
               settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( leftFront, true, false, false ).leftSegment, "2ys1 " + leftFront ) ) );
             } else {
               // CASE: If no X segment is to the left, but there is an X segment in the current cell, this forms an incomplete corner.
               if( currentContainsX ) {
-                std::string xFront = hostCellPtr->x->front->imagePath;
+                std::string xFront = hostCell.x().getFront()->imagePath;
 
                 settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( xFront, true, false, false ).leftSegment, "2ys1 " + xFront ) ) );
               } else {
@@ -521,19 +580,19 @@ namespace BlueBear {
 
             // CASE: Y-segment we're about to place may collide with an ExtendedSegment from the left
             if( leftContainsX && left->x->children.find( "ExtendedSegment" ) != left->x->children.end() ) {
-              left->x->children.erase( "ExtendedSegment" );
+              eraseFromNeighbour( left, &WallCellBundler::x, "ExtendedSegment" );
             }
 
             if( leftContainsX && !currentContainsX ) {
               // CASE: This cell only has a Y piece and there's an X piece to the left. Get its front texture and apply it to Side1
-              std::string xFront = left->hostCellPtr->x->front->imagePath;
+              std::string xFront = left->hostCell.x().getFront()->imagePath;
 
               settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( xFront, false, false, true ).rightSegment, "3ys1 " + xFront ) ) );
             } else if ( currentContainsX ) {
               // CASE: There's an X piece in this cell but none to the left. A collision occurs in the same cell!
               x->children.erase( "RightCorner" );
 
-              std::string xFront = hostCellPtr->x->front->imagePath;
+              std::string xFront = hostCell.x().getFront()->imagePath;
 
               settings.emplace( std::make_pair( "Side1", std::make_unique< PointerImageSource >( getSegmentBundle( xFront, false, false, true ).rightSegment, "3ys1 " + xFront ) ) );
             } else {
@@ -580,7 +639,7 @@ namespace BlueBear {
 
             if( leftContainsX && !topContainsY && left->x->children.find( "ExtendedSegment" ) == left->x->children.end() ) {
               // Create a new extended X segment from RightCorner for this corner piece to "crash" into
-              createExtendedSegment( left->x, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
+              extendNeighbour( left, &WallCellBundler::x, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
             }
           }
           break;
@@ -610,7 +669,7 @@ namespace BlueBear {
 
             if( !leftContainsX && topContainsY ) {
               // Need to make the extended segment
-              createExtendedSegment( top->y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
+              extendNeighbour( top, &WallCellBundler::y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
             }
           }
           break;
@@ -633,12 +692,12 @@ namespace BlueBear {
 
             // CASE: If there's a Y above but no X to the left, get an extended piece onto Y.
             if( topContainsY && !leftContainsX ) {
-              createExtendedSegment( top->y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
+              extendNeighbour( top, &WallCellBundler::y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
             }
 
             // CASE: If there's an X to the left but no Y above, get an extended piece onto X.
             if( !topContainsY && leftContainsX ) {
-              createExtendedSegment( left->x, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
+              extendNeighbour( left, &WallCellBundler::x, "RightCorner", glm::vec3( -1.0f, 0.0f, 0.0f ) );
             }
           }
           break;
@@ -691,7 +750,7 @@ namespace BlueBear {
               std::shared_ptr< WallCellBundler > upperRight = safeGetBundler( hostCollection, counter.x + 1, counter.y - 1, counter.z );
               bool upperRightContainsY = upperRight && upperRight->y;
               if( upperRightContainsY ) {
-                createExtendedSegment( upperRight->y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
+                extendNeighbour( upperRight, &WallCellBundler::y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
               }
             }
             break;
@@ -707,7 +766,7 @@ namespace BlueBear {
               std::shared_ptr< WallCellBundler > upperRight = safeGetBundler( hostCollection, counter.x + 1, counter.y - 1, counter.z );
               bool upperRightContainsY = upperRight && upperRight->y;
               if( upperRightContainsY ) {
-                createExtendedSegment( upperRight->y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
+                extendNeighbour( upperRight, &WallCellBundler::y, "LeftCorner", glm::vec3( 1.0f, 0.0f, 0.0f ) );
               }
             }
             break;
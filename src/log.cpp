@@ -96,4 +96,8 @@ namespace BlueBear {
   void Log::error( const std::string& tag, const std::string& message ) {
     out( LogMessage { tag, message, LogLevel::ERROR } );
   }
+
+  std::mutex& Log::getMutex() {
+    return mutex;
+  }
 }
@@ -1,4 +1,7 @@
 #include "scripting/engine.hpp"
+#include "scripting/headlessrunner.hpp"
+#include "scripting/serializerbenchmark.hpp"
+#include "scripting/pathbenchmark.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -7,10 +10,15 @@
 #include "graphics/transform.hpp"
 #include "localemanager.hpp"
 #include "scripting/lot.hpp"
+#include "threading/enginethread.hpp"
+#include "configmanager.hpp"
 #include <thread>
 #include <SFML/Window.hpp>
 #include <SFML/System.hpp>
 #include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
@@ -26,32 +34,136 @@ void test() {
 	Log::getInstance().debug( "nomatches", nomatches.find( ":" ) == std::string::npos ? "true" : "false" );
 }
 
-int main() {
+int main( int argc, char* argv[] ) {
 	Log::getInstance().info( "Main", LocaleManager::getInstance().getString( "BLUEBEAR_WELCOME_MESSAGE" ) );
 	sf::err().rdbuf( NULL );
 
+	// Command line: bbexec [--lot path] [--profile [--trace path]] [--headless [--ticks n] [--seconds s]] [--bench-serializer [--objects n] [--seed s]] [--bench-load [--repeat n]] [--bench-paths [--size n] [--paths n] [--seed s]]
+	bool headless = false;
+	bool benchSerializer = false;
+	bool benchLoad = false;
+	bool benchPaths = false;
+	std::vector< unsigned int > benchSizes;
+	unsigned int benchPathCount = 10000;
+	unsigned int benchRepeat = 5;
+	std::vector< unsigned int > benchObjects;
+	unsigned int benchSeed = 1;
+	unsigned int headlessTicks = 0;
+	double headlessSeconds = 0.0;
+	std::string lotPath = "lots/lot01.json";
+	for( int i = 1; i < argc; i++ ) {
+		std::string argument( argv[ i ] );
+		bool hasValue = i + 1 < argc;
+
+		if( argument == "--headless" ) {
+			headless = true;
+		} else if( argument == "--ticks" && hasValue ) {
+			headlessTicks = std::strtoul( argv[ ++i ], nullptr, 10 );
+		} else if( argument == "--seconds" && hasValue ) {
+			headlessSeconds = std::strtod( argv[ ++i ], nullptr );
+		} else if( argument == "--bench-serializer" ) {
+			benchSerializer = true;
+		} else if( argument == "--bench-load" ) {
+			benchLoad = true;
+		} else if( argument == "--bench-paths" ) {
+			benchPaths = true;
+		} else if( argument == "--size" && hasValue ) {
+			benchSizes.push_back( std::strtoul( argv[ ++i ], nullptr, 10 ) );
+		} else if( argument == "--paths" && hasValue ) {
+			benchPathCount = std::strtoul( argv[ ++i ], nullptr, 10 );
+		} else if( argument == "--repeat" && hasValue ) {
+			benchRepeat = std::strtoul( argv[ ++i ], nullptr, 10 );
+		} else if( argument == "--objects" && hasValue ) {
+			benchObjects.push_back( std::strtoul( argv[ ++i ], nullptr, 10 ) );
+		} else if( argument == "--seed" && hasValue ) {
+			benchSeed = std::strtoul( argv[ ++i ], nullptr, 10 );
+		} else if( argument == "--lot" && hasValue ) {
+			lotPath = argv[ ++i ];
+		} else if( argument == "--profile" ) {
+			ConfigManager::getInstance().configRoot[ "profiler_enabled" ] = true;
+		} else if( argument == "--trace" && hasValue ) {
+			ConfigManager::getInstance().configRoot[ "profiler_trace_path" ] = argv[ ++i ];
+		} else {
+			Log::getInstance().warn( "main", "Ignoring unknown argument " + argument );
+		}
+	}
+
+	// Generate worlds, time saving and loading them, and check they come back the same; no lot or Display needed
+	if( benchSerializer ) {
+		if( benchObjects.empty() ) {
+			benchObjects = { 1000, 10000, 100000, 1000000 };
+		}
+
+		Scripting::SerializerBenchmark benchmark( benchSeed );
+		return benchmark.run( benchObjects ) ? 0 : 1;
+	}
+
+	// Time loading --lot from scratch, a few times over
+	if( benchLoad ) {
+		return Scripting::SerializerBenchmark::runLot( lotPath, benchRepeat ) ? 0 : 1;
+	}
+
+	// Search paths across generated lots, on one thread and batched across the workers
+	if( benchPaths ) {
+		if( benchSizes.empty() ) {
+			benchSizes = { 64, 128, 256 };
+		}
+
+		Scripting::PathBenchmark benchmark( benchSeed );
+		return benchmark.run( benchSizes, benchPathCount ) ? 0 : 1;
+	}
+
 	Scripting::Engine engine;
 	if ( !engine.submitLuaContributions() ) {
 		Log::getInstance().error( "main", "Failed to load BlueBear!" );
 		return 1;
 	}
 	// Load a lot object
-	if( !engine.loadLot( "lots/lot01.json" ) ) {
+	bool lotLoaded = engine.loadLot( lotPath.c_str() );
+	if( !lotLoaded ) {
 		Log::getInstance().error( "main", "Failed to load demo lot!" );
 	}
 
+	// No Display at all - just run the simulation as fast as it goes and report on it
+	if( headless ) {
+		// Nobody is watching a headless run, so an empty lot would only report numbers that mean nothing
+		if( !lotLoaded ) {
+			return 1;
+		}
+
+		if( !headlessTicks && headlessSeconds <= 0.0 ) {
+			headlessTicks = 10000;
+		}
+
+		Scripting::HeadlessRunner runner( engine );
+		runner.run( headlessTicks, headlessSeconds );
+		return 0;
+	}
+
 	Graphics::Display display( &engine );
 	display.openDisplay();
 
 	// send engine lot data to display
-	display.changeToMainGameState( engine.currentLot->currentRotation, *engine.currentLot->floorMap, *engine.currentLot->wallMap );
+	display.changeToMainGameState( *engine.currentLot );
+
+	// Optionally, give the engine its own thread with a fixed timestep: a slow tick no longer drops frames, and a slow frame no longer stalls the simulation.
+	// The display draws entities from snapshots the engine publishes at the end of each tick, so it doesn't need the lua_State to draw the world.
+	if( ConfigManager::getInstance().getBoolValue( "engine_thread" ) ) {
+		// Declared after display so that it's stopped before display goes away
+		Threading::EngineThread engineThread( engine );
+		engineThread.start();
+
+		while( display.update() );
+
+		return 0;
+	}
 
 	// Fully de-threaded..."functional decomposition" turned out to be shite
 	// Keep the application responsive by splitting out heavy-duty tasks into threads, "Destiny" style
 	bool active = true;
 	while( active ) {
-		// update the game state first
-		engine.objectLoop();
+		// update the game state first (as many ticks as the simulation speed calls for)
+		engine.update();
 
 		// then render the game
 		active = display.update();
@@ -0,0 +1,103 @@
+#include "scripting/autosaver.hpp"
+#include "scripting/engine.hpp"
+#include "log.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    Autosaver::Autosaver( Engine& engine, lua_State* L, const std::string& path, Tick interval, unsigned int compactFactor ) :
+      engine( engine ), serializer( L ), path( path ), interval( interval ), compactFactor( compactFactor ),
+      primed( false ), started( false ), lastCheckpoint( 0 ), baseSize( 0 ), logSize( 0 ) {
+      Log::getInstance().info( "Autosaver::Autosaver", "Checkpointing to " + path + " every " + std::to_string( interval ) + " ticks" );
+    }
+
+    /**
+     * Counts from the first tick it sees, so loading a lot doesn't trigger a checkpoint straight away
+     */
+    void Autosaver::afterTick( Tick currentTick ) {
+      if( !primed ) {
+        lastCheckpoint = currentTick;
+        primed = true;
+        return;
+      }
+
+      if( currentTick - lastCheckpoint >= interval ) {
+        checkpoint();
+        lastCheckpoint = currentTick;
+      }
+    }
+
+    /**
+     * The tick whose afterTick writes the next checkpoint. Before the first tick it's unknown, and 0 keeps anyone from skipping past it.
+     */
+    Tick Autosaver::getNextCheckpoint() const {
+      return primed ? lastCheckpoint + interval : 0;
+    }
+
+    bool Autosaver::checkpoint() {
+      if( !engine.canSave() ) {
+        return false;
+      }
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      bool full = !started || logSize > baseSize * compactFactor;
+      std::string segment = serializer.saveCheckpoint( engine, full );
+
+      std::string framed;
+      std::uint32_t length = segment.size();
+      framed.append( ( const char* ) &length, sizeof( length ) );
+      framed.append( segment );
+
+      if( full ) {
+        // Written beside the old log and renamed over it, so failing partway through leaves the old log intact
+        std::string temporary = path + ".tmp";
+        std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+        std::string header = LuaKit::BinarySerializer::getLogHeader();
+        file.write( header.data(), header.size() );
+        file.write( framed.data(), framed.size() );
+        file.close();
+
+        if( !file.good() || std::rename( temporary.c_str(), path.c_str() ) ) {
+          Log::getInstance().error( "Autosaver::checkpoint", "Unable to write " + path );
+          started = false;
+          return false;
+        }
+
+        baseSize = logSize = header.size() + framed.size();
+        started = true;
+      } else {
+        std::ofstream file( path, std::ios::binary | std::ios::app );
+        file.write( framed.data(), framed.size() );
+        file.close();
+
+        if( !file.good() ) {
+          // The log no longer matches what the serializer thinks it has written; start over next time
+          Log::getInstance().error( "Autosaver::checkpoint", "Unable to append to " + path );
+          started = false;
+          return false;
+        }
+
+        logSize += framed.size();
+      }
+
+      std::chrono::duration< double, std::milli > elapsed = std::chrono::steady_clock::now() - start;
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << ( full ? "Full" : "Delta" ) << " checkpoint: "
+        << serializer.getChangedCount() << " objects, "
+        << framed.size() << " bytes, "
+        << elapsed.count() << "ms";
+      Log::getInstance().debug( "Autosaver::checkpoint", stream.str() );
+
+      return true;
+    }
+
+  }
+}
@@ -0,0 +1,248 @@
+#include "scripting/backgroundsave.hpp"
+#include "scripting/engine.hpp"
+#include "scripting/lotcontainer.hpp"
+#include "log.hpp"
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <streambuf>
+
+// Not X-Platform
+#ifndef _WIN32
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+#endif
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Passes everything through to the file, and sends a PROGRESS report every PROGRESS_INTERVAL bytes
+     */
+    class BackgroundSave::ProgressBuffer : public std::streambuf {
+      std::streambuf* target;
+      int output;
+      std::uint64_t count;
+      std::uint64_t nextReport;
+
+      void advance( std::streamsize bytes ) {
+        count += bytes;
+        if( count >= nextReport ) {
+          BackgroundSave::send( output, Message::PROGRESS, count );
+          nextReport = count + PROGRESS_INTERVAL;
+        }
+      }
+
+    protected:
+      int overflow( int c ) override {
+        if( c == traits_type::eof() ) {
+          return traits_type::not_eof( c );
+        }
+
+        if( target->sputc( c ) == traits_type::eof() ) {
+          return traits_type::eof();
+        }
+
+        advance( 1 );
+        return c;
+      }
+
+      std::streamsize xsputn( const char* data, std::streamsize length ) override {
+        std::streamsize written = target->sputn( data, length );
+        advance( written );
+        return written;
+      }
+
+      int sync() override {
+        return target->pubsync();
+      }
+
+    public:
+      ProgressBuffer( std::streambuf* target, int output ) : target( target ), output( output ), count( 0 ), nextReport( PROGRESS_INTERVAL ) {}
+
+      std::uint64_t getCount() const {
+        return count;
+      }
+    };
+
+    BackgroundSave::BackgroundSave( const std::string& path ) :
+      path( path ), child( -1 ), input( -1 ), forkTime( 0 ), bytesWritten( 0 ), done( false ) {}
+
+    /**
+     * A save still running when the engine goes away is waited for, rather than left half-written
+     */
+    BackgroundSave::~BackgroundSave() {
+#ifndef _WIN32
+      if( child > 0 && !done ) {
+        Log::getInstance().info( "BackgroundSave::~BackgroundSave", "Waiting for the save to " + path + " to finish" );
+
+        int status = 0;
+        waitpid( child, &status, 0 );
+        readReports();
+        finish( status );
+      }
+
+      if( input >= 0 ) {
+        close( input );
+      }
+#endif
+    }
+
+    void BackgroundSave::send( int output, Message message, std::uint64_t bytes ) {
+#ifndef _WIN32
+      Report report{ message, bytes };
+      // Reports are smaller than PIPE_BUF, so each one arrives whole. There's nothing to be done about a parent that stopped listening.
+      ssize_t written = ::write( output, &report, sizeof( report ) );
+      ( void ) written;
+#endif
+    }
+
+    /**
+     * Runs in the child. Written beside the target and renamed over it, so a save that dies partway through leaves the old file alone.
+     */
+    bool BackgroundSave::writeSnapshot( Engine& engine, const std::string& path, int output ) {
+      std::string temporary = path + ".tmp";
+      std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+      if( !file.is_open() ) {
+        return false;
+      }
+
+      ProgressBuffer buffer( file.rdbuf(), output );
+      std::ostream stream( &buffer );
+      if( !engine.saveLot( stream, LotContainer::isContainerPath( path ), false ) ) {
+        return false;
+      }
+
+      stream.flush();
+      file.close();
+      if( !stream.good() || !file.good() || std::rename( temporary.c_str(), path.c_str() ) ) {
+        return false;
+      }
+
+      send( output, Message::DONE, buffer.getCount() );
+      return true;
+    }
+
+    /**
+     * Call at a tick boundary (in a sharded lot, after the barrier), so no shard is halfway through a tick in the snapshot
+     */
+    bool BackgroundSave::start( Engine& engine ) {
+#ifdef _WIN32
+      return false;
+#else
+      int pipeEnds[ 2 ];
+      if( pipe( pipeEnds ) ) {
+        Log::getInstance().warn( "BackgroundSave::start", "Unable to create a pipe" );
+        return false;
+      }
+
+      Clock::time_point before = Clock::now();
+
+      // Only this thread exists in the child. Holding the log mutex across fork() means no other thread can have it locked in the copy.
+      std::unique_lock< std::mutex > logLock( Log::getInstance().getMutex() );
+      child = fork();
+      logLock.unlock();
+
+      if( child == 0 ) {
+        close( pipeEnds[ 0 ] );
+
+        // The child only needs to live long enough to write the snapshot out
+        lua_gc( engine.L, LUA_GCSTOP, 0 );
+
+        bool success = false;
+        try {
+          success = writeSnapshot( engine, path, pipeEnds[ 1 ] );
+        } catch( ... ) {
+          success = false;
+        }
+
+        if( !success ) {
+          send( pipeEnds[ 1 ], Message::FAILED, 0 );
+        }
+
+        // No destructors or atexit handlers: they belong to the parent
+        _exit( success ? 0 : 1 );
+      }
+
+      forkTime = std::chrono::duration_cast< std::chrono::microseconds >( Clock::now() - before );
+      close( pipeEnds[ 1 ] );
+
+      if( child < 0 ) {
+        Log::getInstance().warn( "BackgroundSave::start", "fork() failed" );
+        close( pipeEnds[ 0 ] );
+        return false;
+      }
+
+      input = pipeEnds[ 0 ];
+      fcntl( input, F_SETFL, fcntl( input, F_GETFL ) | O_NONBLOCK );
+      started = Clock::now();
+
+      Log::getInstance().debug( "BackgroundSave::start", "Saving to " + path + " in process " + std::to_string( child ) + "; fork() took " + std::to_string( forkTime.count() ) + "us" );
+      return true;
+#endif
+    }
+
+    void BackgroundSave::readReports() {
+#ifndef _WIN32
+      Report report;
+      while( read( input, &report, sizeof( report ) ) == sizeof( report ) ) {
+        switch( report.message ) {
+          case Message::PROGRESS:
+            bytesWritten = report.bytes;
+            Log::getInstance().debug( "BackgroundSave::poll", "Saving to " + path + ": " + std::to_string( bytesWritten / 1024 ) + " KiB written" );
+            break;
+          case Message::DONE:
+            bytesWritten = report.bytes;
+            break;
+          case Message::FAILED:
+            break;
+        }
+      }
+#endif
+    }
+
+    void BackgroundSave::finish( int status ) {
+#ifndef _WIN32
+      done = true;
+
+      if( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) {
+        std::chrono::duration< double, std::milli > elapsed = Clock::now() - started;
+        Log::getInstance().info(
+          "BackgroundSave::poll",
+          "Saved " + path + " (" + std::to_string( bytesWritten ) + " bytes) in " + std::to_string( elapsed.count() ) + "ms; the simulation stopped for " +
+          std::to_string( forkTime.count() ) + "us"
+        );
+      } else {
+        Log::getInstance().error( "BackgroundSave::poll", "Background save to " + path + " failed" );
+      }
+#endif
+    }
+
+    /**
+     * Read whatever the child has reported since last time. Returns true once the child has exited.
+     */
+    bool BackgroundSave::poll() {
+#ifdef _WIN32
+      return true;
+#else
+      if( done ) {
+        return true;
+      }
+
+      readReports();
+
+      int status = 0;
+      if( waitpid( child, &status, WNOHANG ) == child ) {
+        // Anything sent between the last read and exiting
+        readReports();
+        finish( status );
+      }
+
+      return done;
+#endif
+    }
+
+  }
+}
@@ -3,16 +3,32 @@
 #include <lualib.h>
 #include <lauxlib.h>
 #include "tools/utility.hpp"
+#include "tools/ctvalidators.hpp"
 #include "scripting/lot.hpp"
+#include "scripting/wallgrid.hpp"
+#include "scripting/wallpaper.hpp"
 #include "scripting/engine.hpp"
 #include "graphics/display.hpp"
 #include "configmanager.hpp"
 #include "eventmanager.hpp"
 #include "scripting/infrastructurefactory.hpp"
 #include "scripting/luakit/serializer.hpp"
+#include "scripting/luakit/binaryserializer.hpp"
+#include "scripting/luakit/refcache.hpp"
+#include "scripting/shardgroup.hpp"
+#include "scripting/lotcontainer.hpp"
+#include "scripting/pathfinder.hpp"
+#include "threading/commandbus.hpp"
+#include "tools/blockcontainer.hpp"
+#include "tools/jsonindex.hpp"
+#include "tools/jsonreader.hpp"
+#include "tools/mappedfile.hpp"
 #include "log.hpp"
 #include <jsoncpp/json/json.h>
 #include <iterator>
+#include <iomanip>
+#include <cstdio>
+#include <fstream>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -23,25 +39,127 @@
 #include <list>
 #include <stdexcept>
 #include <functional>
+#include <algorithm>
+#include <limits>
 
 namespace BlueBear {
 	namespace Scripting {
 
-		Engine::Engine() :
+		Engine::Engine( ShardGroup* group, unsigned int shardIndex ) :
 		 lastExecuted( std::chrono::steady_clock::now() ),
 		 L( luaL_newstate() ),
+		 currentTick( 0 ),
 		 ticksPerSecond( 1000 / ConfigManager::getInstance().getIntValue( "fps_overview" ) ),
+		 speed( SimulationSpeed::NORMAL ),
+		 fastTicksPerFrame( ConfigManager::getInstance().getIntValue( "fast_ticks_per_frame" ) ),
+		 maxSpeedBudget( ConfigManager::getInstance().getIntValue( "max_speed_frame_budget" ) * 1000 ),
+		 nextInstance( 1 ),
+		 runningThread( nullptr ),
+		 runningThreadRef( LUA_NOREF ),
+		 group( group ),
+		 shardIndex( shardIndex ),
 		 currentModpackDirectory( nullptr ),
 		 cancel( false ) {
 			luaL_openlibs( L );
 			setActiveState( false );
 
-			setupEvents();
+			refCache = std::make_unique< LuaKit::RefCache >( L );
+			commandBus = std::make_unique< Threading::CommandBus >();
+
+			gcScheduler = std::make_unique< GCScheduler >(
+				L,
+				ConfigManager::getInstance().getValue( "gc_mode" ),
+				ConfigManager::getInstance().getIntValue( "gc_step_budget" ),
+				ConfigManager::getInstance().getIntValue( "gc_step_size" ),
+				ConfigManager::getInstance().getIntValue( "gc_pause" ),
+				ConfigManager::getInstance().getIntValue( "gc_emergency_heap" ),
+				shardIndex ? std::string() : ConfigManager::getInstance().getValue( "gc_report_path" )
+			);
+
+			// Weak keys: a coroutine nobody references any more shouldn't be kept alive by this
+			lua_newtable( L ); // entries
+			lua_newtable( L ); // metatable entries
+			lua_pushstring( L, "k" ); // "k" metatable entries
+			lua_setfield( L, -2, "__mode" ); // metatable entries
+			lua_setmetatable( L, -2 ); // entries
+			lua_setfield( L, LUA_REGISTRYINDEX, COROUTINE_ENTRIES ); // EMPTY
+
+			// Weak keys here too: this is only for finding an object's reference, and the reference in objects is what keeps it alive
+			lua_newtable( L ); // references
+			lua_newtable( L ); // metatable references
+			lua_pushstring( L, "k" ); // "k" metatable references
+			lua_setfield( L, -2, "__mode" ); // metatable references
+			lua_setmetatable( L, -2 ); // references
+			lua_setfield( L, LUA_REGISTRYINDEX, OBJECT_REFERENCES ); // EMPTY
+
+			// And here: the instances are kept alive by whatever holds them (Entity.world_objects)
+			lua_newtable( L ); // instances
+			lua_newtable( L ); // metatable instances
+			lua_pushstring( L, "k" ); // "k" metatable instances
+			lua_setfield( L, -2, "__mode" ); // metatable instances
+			lua_setmetatable( L, -2 ); // instances
+			lua_setfield( L, LUA_REGISTRYINDEX, PLACED_INSTANCES ); // EMPTY
+
+			// And for restart points, so a coroutine that's thrown away doesn't stay in the set
+			lua_newtable( L ); // points
+			lua_newtable( L ); // metatable points
+			lua_pushstring( L, "k" ); // "k" metatable points
+			lua_setfield( L, -2, "__mode" ); // metatable points
+			lua_setmetatable( L, -2 ); // points
+			lua_setfield( L, LUA_REGISTRYINDEX, RESTART_POINTS ); // EMPTY
+
+			// Weak keys once more: an owner is only worth knowing while its callback is waiting to run
+			lua_newtable( L ); // owners
+			lua_newtable( L ); // metatable owners
+			lua_pushstring( L, "k" ); // "k" metatable owners
+			lua_setfield( L, -2, "__mode" ); // metatable owners
+			lua_setmetatable( L, -2 ); // owners
+			lua_setfield( L, LUA_REGISTRYINDEX, CALLBACK_OWNERS ); // EMPTY
+
+			// Worker shards have no part in the UI
+			if( !shardIndex ) {
+				setupEvents();
+			}
 
 			eventBridge = std::make_unique< LuaKit::EventBridge >( L, *this );
+
+			std::string autosavePath = ConfigManager::getInstance().getValue( "autosave_path" );
+			int autosaveInterval = ConfigManager::getInstance().getIntValue( "autosave_interval" );
+			if( !shardIndex && !autosavePath.empty() && autosaveInterval > 0 ) {
+				autosaver = std::make_unique< Autosaver >(
+					*this,
+					L,
+					autosavePath,
+					autosaveInterval,
+					ConfigManager::getInstance().getIntValue( "autosave_compact_factor" )
+				);
+			}
+
+			if( !shardIndex && ConfigManager::getInstance().getBoolValue( "profiler_enabled" ) ) {
+				profiler = std::make_unique< TickProfiler >(
+					ConfigManager::getInstance().getValue( "profiler_trace_path" ),
+					ConfigManager::getInstance().getIntValue( "profiler_top_n" ),
+					ConfigManager::getInstance().getIntValue( "profiler_max_events" )
+				);
+			}
+
+			int shards = ConfigManager::getInstance().getIntValue( "shards" );
+			if( !group && shards > 1 ) {
+				shardGroup = std::make_unique< ShardGroup >( *this, shards );
+				this->group = shardGroup.get();
+			}
 		}
 
 		Engine::~Engine() {
+			eventManager.UI_ACTION_EVENT.stopListening( this );
+
+			// Write out the profile and collector report, and release cached references, before the state goes away
+			backgroundSave.reset();
+			shardGroup.reset();
+			profiler.reset();
+			autosaver.reset();
+			gcScheduler.reset();
+			refCache.reset();
 			lua_close( L );
 		}
 
@@ -80,6 +198,54 @@ namespace BlueBear {
 			lua_pushcclosure( L, &Engine::lua_getLotObjectsByType, 1 );
 			lua_settable( L, -3 );
 
+			// bluebear.engine.remove_object takes an object off the lot
+			lua_pushstring( L, "remove_object" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_removeObject, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.place_instance indexes where one of an object's placed instances is
+			lua_pushstring( L, "place_instance" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_placeInstance, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.remove_instance forgets a placed instance
+			lua_pushstring( L, "remove_instance" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_removeInstance, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.get_objects_in_radius finds the objects near a point
+			lua_pushstring( L, "get_objects_in_radius" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_getObjectsInRadius, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.get_objects_in_rect finds the objects inside a box
+			lua_pushstring( L, "get_objects_in_rect" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_getObjectsInRect, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.nearest_of_type finds the closest object of a class
+			lua_pushstring( L, "nearest_of_type" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_nearestOfType, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.find_path finds a way across the lot on a worker thread
+			lua_pushstring( L, "find_path" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_findPath, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.register_type adds a class to the native type index
+			lua_pushstring( L, "register_type" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_registerType, 1 );
+			lua_settable( L, -3 );
+
 			// bluebear.engine.require_modpack
 			lua_pushstring( L, "require_modpack" );
 			lua_pushlightuserdata( L, this );
@@ -98,6 +264,72 @@ namespace BlueBear {
 			lua_pushcclosure( L, &Engine::lua_setTimeout, 1 );
 			lua_settable( L, -3 );
 
+			// bluebear.engine.clear_timeout
+			lua_pushstring( L, "clear_timeout" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_clearTimeout, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.sleep
+			lua_pushstring( L, "sleep" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_sleep, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.set_speed
+			lua_pushstring( L, "set_speed" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_setSpeed, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.get_speed
+			lua_pushstring( L, "get_speed" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_getSpeed, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.save_lot
+			lua_pushstring( L, "save_lot" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_saveLot, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.get_wall_segments
+			lua_pushstring( L, "get_wall_segments" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_getWallSegments, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.get_wallpapers
+			lua_pushstring( L, "get_wallpapers" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_getWallpapers, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.set_tile
+			lua_pushstring( L, "set_tile" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_setTile, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.fill_tiles
+			lua_pushstring( L, "fill_tiles" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_fillTiles, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.set_wall_segment
+			lua_pushstring( L, "set_wall_segment" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_setWallSegment, 1 );
+			lua_settable( L, -3 );
+
+			// bluebear.engine.remove_wall_segment
+			lua_pushstring( L, "remove_wall_segment" );
+			lua_pushlightuserdata( L, this );
+			lua_pushcclosure( L, &Engine::lua_removeWallSegment, 1 );
+			lua_settable( L, -3 );
+
 			// bluebear.engine.tick_rate
 			lua_pushstring( L, "tick_rate" );
 			lua_pushnumber( L, ticksPerSecond );
@@ -135,6 +367,12 @@ namespace BlueBear {
 			lua_pushcclosure( L, &LuaKit::EventBridge::lua_unlisten, 1 );
 			lua_settable( L, -3 );
 
+			// bluebear.event.wait
+			lua_pushstring( L, "wait" );
+			lua_pushlightuserdata( L, eventBridge.get() );
+			lua_pushcclosure( L, &LuaKit::EventBridge::lua_wait, 1 );
+			lua_settable( L, -3 );
+
 			// Set the event table on "bluebear"
 			lua_settable( L, -3 );
 
@@ -155,6 +393,11 @@ namespace BlueBear {
 			// Set the util table on "bluebear"
 			lua_settable( L, -3 );
 
+			// bluebear.shard
+			if( group ) {
+				group->registerLuaContributions( L, shardIndex );
+			}
+
 			// Set the table as "bluebear"
 			lua_setglobal( L, "bluebear" );
 
@@ -177,6 +420,15 @@ namespace BlueBear {
 			infrastructureFactory->registerFloorTiles();
 			infrastructureFactory->registerWallpapers();
 
+			// Everything the tick loop calls into exists now
+			if( !refCache->resolve() ) {
+				return false;
+			}
+
+			if( shardGroup ) {
+				return shardGroup->submitLuaContributions();
+			}
+
 			return true;
 		}
 
@@ -281,284 +533,1665 @@ namespace BlueBear {
 		 }
 
 		/**
-		 * Load a lot
+		 * Byte ranges of the "rev", "lot" and "engine" sections of a plain JSON lot file, found without parsing any of them
+		 */
+		bool Engine::findLotSections( const Tools::MappedFile& file, Section& revision, Section& lot, Section& engine ) {
+			Tools::JSONReader reader( file.getData(), file.getEnd() );
+			revision = lot = engine = Section( 0, 0 );
+
+			if( reader.beginObject() ) {
+				std::string key;
+				while( reader.nextMember( key ) ) {
+					reader.peek();
+					std::size_t begin = reader.getPosition();
+					reader.skip();
+					Section section( begin, reader.getPosition() );
+
+					if( key == "rev" ) {
+						revision = section;
+					} else if( key == "lot" ) {
+						lot = section;
+					} else if( key == "engine" ) {
+						engine = section;
+					}
+				}
+			}
+
+			return !reader.hasFailed() && lot.second != lot.first;
+		}
+
+		/**
+		 * Load a lot from a plain JSON file or a LotContainer. A JSON file is mapped rather than read; the lot's grids are filled straight
+		 * from the mapping, and the world is parsed one record at a time as it's loaded. A container's blocks are decompressed in parallel
+		 * first, then read the same way.
 		 */
 		bool Engine::loadLot( const char* lotPath ) {
-			// Get an ifstream from the given lot
-			std::ifstream lot( lotPath );
+			using Clock = std::chrono::steady_clock;
+			Clock::time_point start = Clock::now();
 
-			// Verify it is both open and good
-			if( lot.is_open() && lot.good() ) {
+			Tools::MappedFile file( lotPath );
+			if( !file.isValid() ) {
+				Log::getInstance().error( "Engine::loadLot", "Unable to open " + std::string( lotPath ) );
+				return false;
+			}
 
-				// Set up JsonCpp options
-				// lotJSON is the root JSON object for the lot
-				Json::Value fileJSON;
-				// reader is an object used to parse the std::ifstream file into a JSON object
-				Json::Reader reader;
-				bool parseSuccessful = reader.parse( lot, fileJSON );
+			// Only filled for containers; a JSON file's sections are read where they are
+			std::string revisionText;
+			std::string lotText;
+			std::string engineText;
+			const char* lotBegin;
+			const char* lotEnd;
+			const char* engineBegin = nullptr;
+			const char* engineEnd = nullptr;
+			Json::Value revision;
+
+			if( Tools::BlockContainer::isContainer( file.getData(), file.getSize() ) ) {
+				Tools::BlockContainer container( file.getData(), file.getSize() );
+				if( !container.isValid() || !LotContainer::read( container, revisionText, lotText, &engineText ) ) {
+					Log::getInstance().error( "Engine::loadLot", "Unable to decompress " + std::string( lotPath ) );
+					return false;
+				}
 
-				// If parse was successful, begin loading the lot
-				if( parseSuccessful && fileJSON.isObject() ) {
-					Json::Value lotJSON = fileJSON[ "lot" ];
-					Json::Value engineJSON = fileJSON[ "engine" ];
+				Json::Reader().parse( revisionText, revision );
+				lotBegin = lotText.data();
+				lotEnd = lotBegin + lotText.size();
+				engineBegin = engineText.data();
+				engineEnd = engineBegin + engineText.size();
+			} else {
+				Section revisionSection, lotSection, engineSection;
+				if( !findLotSections( file, revisionSection, lotSection, engineSection ) ) {
+					Log::getInstance().error( "Engine::loadLot", "Unable to parse " + std::string( lotPath ) );
+					return false;
+				}
 
-					// Log some basic information about the loading of the lot
-					Log::getInstance().info( "Engine::loadLot", "[" + std::string( lotPath ) + "] Lot revision: " + fileJSON[ "rev" ].asString() );
+				Json::Reader().parse( file.getData() + revisionSection.first, file.getData() + revisionSection.second, revision );
+				lotBegin = file.getData() + lotSection.first;
+				lotEnd = file.getData() + lotSection.second;
+				if( engineSection.second != engineSection.first ) {
+					engineBegin = file.getData() + engineSection.first;
+					engineEnd = file.getData() + engineSection.second;
+				}
+			}
 
-					// Set world ticks to the one saved in the file
-					currentTick = engineJSON[ "ticks" ].asInt();
+			// Log some basic information about the loading of the lot
+			Log::getInstance().info( "Engine::loadLot", "[" + std::string( lotPath ) + "] Lot revision: " + revision.asString() );
 
-					// Instantiate the lot
-					currentLot = std::make_shared< Lot >( L, *infrastructureFactory, lotJSON );
+			// Instantiate the lot
+			Clock::time_point lotStart = Clock::now();
+			Tools::JSONReader reader( lotBegin, lotEnd );
+			currentLot = std::make_shared< Lot >( L, *infrastructureFactory, reader );
+			if( reader.hasFailed() ) {
+				Log::getInstance().error( "Engine::loadLot", "Unable to parse the lot section of " + std::string( lotPath ) );
+				return false;
+			}
+			spatialIndex.resize( currentLot->stories, currentLot->floorX, currentLot->floorY );
 
-					// Clear the std::map containing all objects
-					objects.clear();
+			// Paths asked for on the previous lot are never answered
+			releasePaths();
+			pathfinder = std::make_unique< Pathfinder >( *currentLot->floorMap, *currentLot->wallMap );
+			Clock::time_point worldStart = Clock::now();
 
-					// Deserialize the world
-					LuaKit::Serializer serializer( L );
-					serializer.loadWorld( engineJSON, *this );
-				} else {
-					Log::getInstance().error( "Engine::loadLot", "Unable to parse " + std::string( lotPath ) );
+			Tools::MemoryBuffer buffer( engineBegin, engineEnd );
+			std::istream stream( &buffer );
+			Tools::JSONIndex engineIndex( stream, engineBegin ? 0 : -1 );
+
+			// A lot can point at a binary world file instead of carrying the world inline
+			if( engineIndex.isMember( "binaryWorld" ) ) {
+				if( !loadBinaryWorld( engineIndex.read( "binaryWorld" ).asString() ) ) {
 					return false;
 				}
 			} else {
-				Log::getInstance().error( "Engine::loadLot", "Unable to parse " + std::string( lotPath ) );
-				return false;
+				loadWorld( engineIndex );
+			}
+
+			// Worker shards each have their own section; a lot saved without them is split up between them
+			if( shardGroup && engineIndex.isMember( "shards" ) ) {
+				Json::Value shards = engineIndex.read( "shards" );
+				shardGroup->loadWorld( shards );
+			} else if( shardGroup && engineIndex.isMember( "owners" ) ) {
+				shardGroup->partition();
+			} else if( shardGroup && !engineIndex.isMember( "binaryWorld" ) ) {
+				// Without owners there's no telling which timers go with which objects, and moving an object without its timers would leave
+				// them running on a copy of it. Owners are saved from now on, so the lot splits once it's been saved again.
+				Log::getInstance().warn( "Engine::loadLot", "This lot was saved before callback owners were recorded, so it isn't split; everything on it runs on shard 0" );
+			} else if( shardGroup ) {
+				// Binary worlds don't cover worker shards yet, so saving would lose anything moved to one
+				Log::getInstance().warn( "Engine::loadLot", "Binary worlds aren't split between shards; everything on this lot runs on shard 0" );
 			}
 
+			this->lotPath = lotPath;
+
+			Clock::time_point finish = Clock::now();
+			std::stringstream timing;
+			timing << std::fixed << std::setprecision( 2 )
+				<< "[" << lotPath << "] Loaded " << file.getSize() / 1024 << "KB in "
+				<< std::chrono::duration< double, std::milli >( finish - start ).count() << "ms (lot grids "
+				<< std::chrono::duration< double, std::milli >( worldStart - lotStart ).count() << "ms, world "
+				<< std::chrono::duration< double, std::milli >( finish - worldStart ).count() << "ms)";
+			Log::getInstance().info( "Engine::loadLot", timing.str() );
+
 			return true;
 		}
 
 		/**
-		 * Sets the active state of the loop. Typically done from an EngineCommand.
+		 * Deserialize the Luasphere and the engine's own state from the "engine" section of a lot (or a shard's section of it)
 		 */
-		void Engine::setActiveState( bool status ) {
-			active = status;
-
-			if( active == true ) {
-				// Cleared for takeoff
-				sleepInterval = 1000;
-			} else {
-				sleepInterval = 300;
-			}
+		void Engine::loadWorld( Json::Value& engineJSON ) {
+			// Set world ticks to the one saved in the file
+			currentTick = engineJSON[ "ticks" ].asInt();
+
+			// Clear the std::map containing all objects
+			objects.clear();
+			objectPositions.clear();
+			typeIndex.clearObjects();
+			spatialIndex.clear();
+
+			// Deserialize the world
+			LuaKit::Serializer serializer( L );
+			serializer.loadWorld( engineJSON, *this );
 		}
 
 		/**
-		 * Where the magic happens
+		 * Same as above, but reading the engine section through an index so the world never exists as a single JSON document
 		 */
-		void Engine::objectLoop() {
+		void Engine::loadWorld( Tools::JSONIndex& engineIndex ) {
+			currentTick = engineIndex.read( "ticks" ).asInt();
 
-			// Move items waiting for this tick out of the waiting table into the callback queue
-			waitingTable.triggerTick( currentTick );
-
-			// If there are any callbacks, update bluebear.engine.current_tick
-			if( !waitingTable.queuedCallbacks.empty() ) {
-				lua_getglobal( L, "bluebear" ); // bluebear
-				lua_pushstring( L, "engine" ); // "engine" bluebear
-				lua_gettable( L, -2 ); // bluebear.engine bluebear
-
-				lua_pushstring( L, "current_tick" ); // "current_tick" bluebear.engine bluebear
-				lua_pushnumber( L, currentTick ); // currentTick "current_tick" bluebear.engine bluebear
-				lua_settable( L, -3 ); // bluebear.engine bluebear
+			objects.clear();
+			objectPositions.clear();
+			typeIndex.clearObjects();
+			spatialIndex.clear();
 
-				lua_pop( L, 2 ); // EMPTY
+			LuaKit::Serializer serializer( L );
+			serializer.loadWorld( engineIndex, *this );
+		}
 
-				// Burn out every function scheduled for this tick
-				while( !waitingTable.queuedCallbacks.empty() ) {
-					LuaReference function = waitingTable.queuedCallbacks.front();
+		/**
+		 * Inverse of loadWorld. A primary with worker shards includes theirs under "shards".
+		 */
+		Json::Value Engine::saveWorld() {
+			LuaKit::Serializer serializer( L );
+			Json::Value engineJSON = serializer.saveWorld( objects, *this );
 
-					lua_getglobal( L, "bluebear" ); // bluebear
-					Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-					Tools::Utility::getTableValue( L, "traceback" ); // <err_handler> bluebear.util bluebear
+			engineJSON[ "ticks" ] = ( Json::UInt64 ) currentTick;
 
-					lua_rawgeti( L, LUA_REGISTRYINDEX, function ); // <function> <err_handler> bluebear.util bluebear
+			if( shardGroup ) {
+				engineJSON[ "shards" ] = shardGroup->saveWorld();
+			}
 
-					if( int stat = lua_pcall( L, 0, 0, -2 ) ) { // error <err_handler> bluebear.util bluebear
-						Log::getInstance().error( "Engine::objectLoop", "Exception thrown on tick " + std::to_string( currentTick ) + ": " + ( stat == -1 ? "<C++ exception>" : lua_tostring( L, -1 ) ) );
-						lua_pop( L, 1 ); // <err_handler> bluebear.util bluebear
-					}
+			return engineJSON;
+		}
 
-					lua_pop( L, 3 ); // EMPTY
+		/**
+		 * Write the same engine section as saveWorld() straight to output, record by record, without building it in memory first
+		 */
+		void Engine::saveWorld( std::ostream& output ) {
+			output << "{\"ticks\":" << currentTick << ",";
 
-					// Only YOU can prevent memory leaks!
-					// The "function" reference should have not been used anywhere else in the pipeline (enqueued to now)
-					luaL_unref( L, LUA_REGISTRYINDEX, function );
+			LuaKit::Serializer serializer( L );
+			serializer.saveWorld( output, objects, *this );
 
-					waitingTable.queuedCallbacks.pop();
-				}
+			if( shardGroup ) {
+				output << ",\"shards\":";
+				shardGroup->saveWorld( output );
 			}
 
-			// On every tick, increment currentTick
-			currentTick++;
-
+			output << "}";
 		}
 
 		/**
-		 * Overrides the default Lua print() function to go through the logger
+		 * Load a world written by saveBinaryWorld. Ticks come from the file; worker shards aren't covered by the binary format yet.
 		 */
-		 int Engine::lua_print( lua_State* L ) {
+		bool Engine::loadBinaryWorld( const std::string& path ) {
+			std::ifstream file( path, std::ios::binary );
+			if( !file.is_open() || !file.good() ) {
+				Log::getInstance().error( "Engine::loadBinaryWorld", "Unable to open " + path );
+				return false;
+			}
 
-			 try {
-				 int numArgs = lua_gettop( L );
+			std::string data( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
 
-				 // print( "message" )
-				 if( numArgs == 1 ) {
-					 lua_getglobal( L, "tostring" ); // <tostring> string
-					 lua_pushvalue( L, -2 ); // string <tostring> string
+			objects.clear();
+			objectPositions.clear();
+			typeIndex.clearObjects();
+			spatialIndex.clear();
 
-					 if( lua_pcall( L, 1, 1, 0 ) == 0 ) { // string string
-						 Log::getInstance().debug( "Lua Script", lua_tostring( L, -1 ) );
-					 } else {
-						 Log::getInstance().error( "Engine::lua_print", "Argument not convertible to string type" );
-					 }
-				 }
+			LuaKit::BinarySerializer serializer( L );
+			return serializer.loadWorld( data, *this );
+		}
 
-				 // print( "tag", "message" )
-				 else if( numArgs == 2 ) {
-					 // message tag
-					 lua_getglobal( L, "tostring" ); // <tostring> message tag
-					 lua_pushvalue( L, -2 ); // message <tostring> message tag
+		bool Engine::saveBinaryWorld( const std::string& path ) {
+			if( !canSave() ) {
+				return false;
+			}
 
-					 if( lua_pcall( L, 1, 1, 0 ) != 0 ) {
-						 Log::getInstance().error( "Engine::lua_print", "Message not convertible to string type" );
-						 return 0;
-					 }
+			LuaKit::BinarySerializer serializer( L );
+			std::string data = serializer.saveWorld( *this );
 
-					 // convertedmessage message tag
-					 lua_getglobal( L, "tostring" ); // <tostring> convertedmessage message tag
-					 lua_pushvalue( L, -4 ); // tag <tostring> convertedmessage message tag
+			std::ofstream file( path, std::ios::binary | std::ios::trunc );
+			file.write( data.data(), data.size() );
+			if( !file.good() ) {
+				Log::getInstance().error( "Engine::saveBinaryWorld", "Unable to write " + path );
+				return false;
+			}
 
-					 if( lua_pcall( L, 1, 1, 0 ) != 0 ) {
-						 Log::getInstance().error( "Engine::lua_print", "Tag not convertible to string type" );
-						 return 0;
-					 }
+			return true;
+		}
 
-					 // convertedtag convertedmessage message tag
-					 Log::getInstance().debug( lua_tostring( L, -1 ), lua_tostring( L, -2 ) );
-				 }
-			 } catch ( std::logic_error e ) {
-				 Log::getInstance().error( "Engine::lua_print", "Failed to print() log message" );
-			 }
+		/**
+		 * Text of the "rev" and "lot" sections of the file the lot was loaded from. Only those blocks are decompressed from a container.
+		 */
+		bool Engine::readLotSource( std::string& revision, std::string& lot ) {
+			Tools::MappedFile file( lotPath );
+			if( !file.isValid() ) {
+				return false;
+			}
 
-			 return 0;
-		 }
+			if( Tools::BlockContainer::isContainer( file.getData(), file.getSize() ) ) {
+				Tools::BlockContainer container( file.getData(), file.getSize() );
+				return container.isValid() && LotContainer::read( container, revision, lot, nullptr );
+			}
 
-		 /**
-		  *
-			* STACK ARGS: interval function
-			* RETURNS: stringhandle
-			*/
-		 int Engine::lua_setTimeout( lua_State* L ) {
+			Section revisionSection, lotSection, engineSection;
+			if( !findLotSections( file, revisionSection, lotSection, engineSection ) ) {
+				return false;
+			}
 
-			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+			revision.assign( file.getData() + revisionSection.first, revisionSection.second - revisionSection.first );
+			if( revision.empty() ) {
+				revision = "null";
+			}
+			lot.assign( file.getData() + lotSection.first, lotSection.second - lotSection.first );
 
-			 // First argument on the stack should be a function
-			 // The rightmost argument is on the top of the stack
-			 if( lua_isfunction( L, -2 ) && lua_isnumber( L, -1 ) ) {
-				 // warning: watch the type of Tick
-				 Tick interval = lua_tointeger( L, -1 );
+			return true;
+		}
 
-				 lua_pop( L, 1 ); // function
+		/**
+		 * Write the whole lot, in either format loadLot reads. The "rev" section, and the "lot" section until something edits the lot, are copied
+		 * from the file it was loaded from. Pass parallel = false from a fork()ed child (see BlockContainer::write).
+		 */
+		bool Engine::saveLot( std::ostream& output, bool container, bool parallel ) {
+			if( !canSave() ) {
+				return false;
+			}
 
-				 // This reference should be a reference owned by the queue-waiting table pair, and should never be used anywhere else.
-				 // When the engine consumes the function, the reference should be luaL_unref'd and freed.
-				 // If you don't do this, you'll get horriffic memory leaks that slowly worsen as a lot is played.
-				 LuaReference function = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+			std::string revision;
+			std::string lot;
+			if( lotPath.empty() || !readLotSource( revision, lot ) ) {
+				return false;
+			}
 
-				 if( interval == 0 ) {
-					 // This function was scheduled to run in the same tick, but when the current stack has completed.
-					 // You GENERALLY shouldn't do this but it's got its use cases.
-					 self->waitingTable.queuedCallbacks.push( function );
+			if( currentLot && currentLot->isEdited() ) {
+				std::stringstream edited;
+				currentLot->save( edited );
+				lot = edited.str();
+			}
 
-					 // You'll get a nil handle because a callback scheduled to go on the current tick cannot be cancelled.
-					 lua_pushnil( L ); // nil
-				 } else {
-					 // This function was scheduled to run at tick+1 or after
-					 std::string handle = self->waitingTable.waitForTick( self->currentTick + interval, function );
+			if( container ) {
+				std::stringstream engine;
+				saveWorld( engine );
+				return LotContainer::write( output, revision, lot, engine.str(), parallel ) && output.good();
+			}
 
-					 lua_pushstring( L, handle.c_str() ); // "handle"
-				 }
+			output << "{\"rev\":" << revision;
+			output << ",\"lot\":" << lot;
+			output << ",\"engine\":";
+			saveWorld( output );
+			output << "}";
 
-				 return 1;
-			 } else {
-				 Log::getInstance().warn( "Engine::lua_setTimeout", "Invalid arguments provided to bluebear.engine.set_timeout: Argument 1 is a function and argument 2 is a number." );
+			return output.good();
+		}
 
-				 return 0;
-			 }
-		 }
+		/**
+		 * Save in the foreground. Written beside path and renamed over it, so a failed save leaves the old file alone. A path ending in
+		 * ".bbc" is written as a LotContainer.
+		 */
+		bool Engine::saveLot( const std::string& path ) {
+			std::string temporary = path + ".tmp";
+			std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
 
-		 int Engine::lua_getLotObjects( lua_State* L ) {
+			bool written = saveLot( file, LotContainer::isContainerPath( path ) );
+			file.close();
 
-			 // Pop the lot off the stack
-			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+			if( !written || !file.good() || std::rename( temporary.c_str(), path.c_str() ) ) {
+				Log::getInstance().error( "Engine::saveLot", "Unable to write " + path );
+				return false;
+			}
 
-			 // Create an array table with as many entries as the size of this->objects
-			 lua_createtable( L, engine->objects.size(), 0 );
+			return true;
+		}
 
-			 // Push 'em on!
-			 size_t tableIndex = 1;
-			 for( int lotEntity : engine->objects ) {
-				 lua_rawgeti( L, LUA_REGISTRYINDEX, lotEntity );
-				 lua_rawseti( L, -2, tableIndex++ );
-			 }
+		/**
+		 * Ask for the lot to be saved from a forked copy of the process (see BackgroundSave) at the end of this frame. Only one save runs at a
+		 * time; returns false if one is already pending or running.
+		 */
+		bool Engine::saveLotInBackground( const std::string& path ) {
+			if( backgroundSave || !pendingSavePath.empty() ) {
+				Log::getInstance().warn( "Engine::saveLotInBackground", "A save is already in progress; not saving to " + path );
+				return false;
+			}
 
-			 return 1;
+			pendingSavePath = path;
+			return true;
+		}
 
-		 }
+		/**
+		 * Called between frames, when no shard is partway through a tick
+		 */
+		void Engine::serviceBackgroundSave() {
+			if( backgroundSave && backgroundSave->poll() ) {
+				backgroundSave.reset();
+			}
 
-		 int Engine::lua_getLotObjectsByType( lua_State* L ) {
+			if( !pendingSavePath.empty() && !backgroundSave && !canSave() ) {
+				Log::getInstance().error( "Engine::serviceBackgroundSave", "Not saving to " + pendingSavePath );
+				pendingSavePath.clear();
+			}
+
+			if( !pendingSavePath.empty() && !backgroundSave ) {
+				backgroundSave = std::make_unique< BackgroundSave >( pendingSavePath );
+
+				if( !backgroundSave->start( *this ) ) {
+					backgroundSave.reset();
+					Log::getInstance().warn( "Engine::serviceBackgroundSave", "Unable to save in the background; saving to " + pendingSavePath + " in the foreground" );
+					saveLot( pendingSavePath );
+				}
+
+				pendingSavePath.clear();
+			}
+		}
+
+		/**
+		 * Whether the world can be saved now. A parked coroutine is saved as the function it was started with, and starts over from the top
+		 * when it's loaded; unless it parked at a restart point (sleep or wait with restart = true), that would repeat whatever it did before
+		 * it parked. So while any coroutine is parked anywhere else, nothing is saved.
+		 */
+		bool Engine::canSave() {
+			unsigned int parked = shardGroup ? shardGroup->countUnrestartable() : countUnrestartable();
+
+			if( parked ) {
+				Log::getInstance().error( "Engine::canSave", "Can't save while " + std::to_string( parked ) + " coroutine(s) are parked somewhere other than a restart point" );
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Number of coroutines parked in this engine's waiting table or event bridge that would repeat work if started over
+		 */
+		unsigned int Engine::countUnrestartable() {
+			unsigned int count = 0;
+
+			lua_getfield( L, LUA_REGISTRYINDEX, RESTART_POINTS ); // points
+			auto check = [ & ]( LuaReference reference ) {
+				lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <callback> points
+
+				// Callbacks that are still functions, and coroutines loaded from a save, haven't started
+				if( lua_isthread( L, -1 ) && lua_status( lua_tothread( L, -1 ) ) == LUA_YIELD ) {
+					lua_rawget( L, -2 ); // <restart point> points
+
+					if( !lua_toboolean( L, -1 ) ) {
+						count++;
+					}
+				}
+
+				lua_pop( L, 1 ); // points
+			};
+
+			waitingTable.eachTimer( [ & ]( Tick, LuaReference callback ) { check( callback ); } );
+			eventBridge->eachWaiter( [ & ]( const std::string&, LuaReference waiter ) { check( waiter ); } );
+
+			std::queue< LuaReference > queued = waitingTable.queuedCallbacks;
+			while( !queued.empty() ) {
+				check( queued.front() );
+				queued.pop();
+			}
+
+			lua_pop( L, 1 ); // EMPTY
+
+			return count;
+		}
+
+		/**
+		 * Sets the active state of the loop. Typically done from an EngineCommand.
+		 */
+		void Engine::setActiveState( bool status ) {
+			active = status;
+
+			if( active == true ) {
+				// Cleared for takeoff
+				sleepInterval = 1000;
+			} else {
+				sleepInterval = 300;
+			}
+		}
+
+		/**
+		 * Only matters when the engine runs on its own thread (see Threading::EngineThread), which holds it for each update. The render
+		 * thread never takes it; what it wants done with L goes through getCommandBus instead.
+		 */
+		std::mutex& Engine::getLuaMutex() {
+			return luaMutex;
+		}
+
+		/**
+		 * Any thread may post here; the commands run on whichever thread calls update, with L to themselves.
+		 */
+		Threading::CommandBus& Engine::getCommandBus() {
+			return *commandBus;
+		}
+
+		/**
+		 * Where the magic happens. Returns the number of callbacks that were run on this tick.
+		 */
+		unsigned int Engine::objectLoop() {
+			unsigned int callbacksRun = 0;
+
+			// Hand over anything logged since the last tick to Lua listeners (enqueued for the next tick)
+			eventBridge->dispatchQueuedMessages();
+
+			// Move items waiting for this tick out of the waiting table into the callback queue
+			waitingTable.triggerTick( currentTick );
+			resolvePaths();
+
+			// If there are any callbacks, update bluebear.engine.current_tick
+			if( !waitingTable.queuedCallbacks.empty() ) {
+				LuaKit::RefCache::push( L, LuaKit::RefCache::Entry::ENGINE_TABLE ); // bluebear.engine
+				lua_pushnumber( L, currentTick ); // currentTick bluebear.engine
+				lua_setfield( L, -2, "current_tick" ); // bluebear.engine
+				lua_pop( L, 1 ); // EMPTY
+
+				if( profiler ) {
+					profiler->beginTick( currentTick );
+				}
+
+				// Burn out every function scheduled for this tick
+				while( !waitingTable.queuedCallbacks.empty() ) {
+					runCallback( waitingTable.queuedCallbacks.front() );
+
+					waitingTable.queuedCallbacks.pop();
+					callbacksRun++;
+				}
+
+				if( profiler ) {
+					profiler->endTick( callbacksRun );
+				}
+			}
+
+			// Search for this tick's paths while the engine waits for the next one, on the lot as this tick left it
+			if( pathfinder ) {
+				pathfinder->update( *currentLot );
+				pathfinder->dispatch();
+			}
+
+			if( autosaver ) {
+				autosaver->afterTick( currentTick );
+			}
+
+			gcScheduler->afterTick( callbacksRun == 0 );
+
+			// On every tick, increment currentTick
+			currentTick++;
+
+			return callbacksRun;
+		}
+
+		/**
+		 * Run one queued callback. A function is started on a coroutine (recycled from a finished callback if one is available) so that it
+		 * can call bluebear.engine.sleep; a coroutine that was parked is resumed where it left off. Takes ownership of reference.
+		 */
+		void Engine::runCallback( LuaReference reference ) {
+			lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <function or thread>
+
+			if( lua_isthread( L, -1 ) ) {
+				runningThread = lua_tothread( L, -1 );
+				runningThreadRef = reference;
+				lua_pop( L, 1 ); // EMPTY
+			} else {
+				if( idleThreads.empty() ) {
+					runningThread = lua_newthread( L ); // thread <function>
+				} else {
+					lua_rawgeti( L, LUA_REGISTRYINDEX, idleThreads.back() ); // thread <function>
+					luaL_unref( L, LUA_REGISTRYINDEX, idleThreads.back() );
+					idleThreads.pop_back();
+					runningThread = lua_tothread( L, -1 );
+				}
+
+				setCoroutineEntry( lua_gettop( L ), lua_gettop( L ) - 1 );
+				runningThreadRef = luaL_ref( L, LUA_REGISTRYINDEX ); // <function>
+				lua_xmove( L, runningThread, 1 ); // EMPTY
+
+				// Only YOU can prevent memory leaks!
+				// The "function" reference should have not been used anywhere else in the pipeline (enqueued to now)
+				luaL_unref( L, LUA_REGISTRYINDEX, reference );
+			}
+
+			unsigned int label = 0;
+			std::chrono::steady_clock::time_point start;
+			if( profiler ) {
+				lua_getfield( L, LUA_REGISTRYINDEX, COROUTINE_ENTRIES ); // entries
+				lua_rawgeti( L, LUA_REGISTRYINDEX, runningThreadRef ); // thread entries
+				lua_rawget( L, -2 ); // <entry> entries
+
+				if( lua_isfunction( L, -1 ) ) {
+					label = profiler->identify( L );
+				}
+
+				lua_pop( L, 2 ); // EMPTY
+				start = profiler->beginCallback();
+			}
+
+			// A coroutine that hasn't started yet has its function sitting below the arguments
+			lua_State* thread = runningThread;
+			int status = lua_resume( thread, L, lua_status( thread ) == LUA_YIELD ? lua_gettop( thread ) : lua_gettop( thread ) - 1 );
+			runningThread = nullptr;
+
+			if( profiler ) {
+				profiler->endCallback( label, start );
+			}
+
+			switch( status ) {
+				case LUA_OK:
+					// Ran to completion; clean it out and keep it for the next callback
+					lua_settop( thread, 0 );
+
+					lua_rawgeti( L, LUA_REGISTRYINDEX, runningThreadRef ); // thread
+					lua_pushnil( L ); // nil thread
+					setCoroutineEntry( lua_gettop( L ) - 1, lua_gettop( L ) );
+					lua_pop( L, 2 ); // EMPTY
+
+					if( idleThreads.size() < MAX_IDLE_THREADS ) {
+						idleThreads.push_back( runningThreadRef );
+					} else {
+						luaL_unref( L, LUA_REGISTRYINDEX, runningThreadRef );
+					}
+					break;
+				case LUA_YIELD:
+					lua_settop( thread, 0 );
+
+					// bluebear.engine.sleep and friends take the reference when they park the coroutine. If it's still here, something
+					// yielded with coroutine.yield, and nothing is ever going to resume it.
+					if( runningThreadRef != LUA_NOREF ) {
+						Log::getInstance().warn( "Engine::runCallback", "Callback yielded on tick " + std::to_string( currentTick ) + " without sleeping or waiting; it will not be resumed" );
+						luaL_unref( L, LUA_REGISTRYINDEX, runningThreadRef );
+					}
+					break;
+				default:
+					// The coroutine is dead, but its stack is intact, so the traceback still points at the error
+					luaL_traceback( L, thread, lua_tostring( thread, -1 ), 0 ); // traceback
+					Log::getInstance().error( "Engine::runCallback", "Exception thrown on tick " + std::to_string( currentTick ) + ": " + lua_tostring( L, -1 ) );
+					lua_pop( L, 1 ); // EMPTY
+
+					luaL_unref( L, LUA_REGISTRYINDEX, runningThreadRef );
+			}
+
+			runningThreadRef = LUA_NOREF;
+		}
+
+		/**
+		 * Queue a callback for each path the pathfinder has finished. Each is started as a coroutine that already has its arguments -
+		 * runCallback passes along whatever sits above the function on a coroutine that hasn't started.
+		 */
+		void Engine::resolvePaths() {
+			std::vector< Pathfinder::Path > paths;
+			if( !pathfinder || !pathfinder->collect( paths ) ) {
+				return;
+			}
+
+			for( Pathfinder::Path& path : paths ) {
+				lua_State* thread = lua_newthread( L ); // thread
+				lua_rawgeti( L, LUA_REGISTRYINDEX, path.callback ); // callback thread
+				luaL_unref( L, LUA_REGISTRYINDEX, path.callback );
+				setCoroutineEntry( lua_gettop( L ) - 1, lua_gettop( L ) );
+
+				if( path.found ) {
+					lua_createtable( L, path.steps.size(), 0 ); // steps callback thread
+
+					lua_Integer stepIndex = 1;
+					for( const Pathfinder::Step& step : path.steps ) {
+						lua_createtable( L, 2, 0 ); // step steps callback thread
+						lua_pushinteger( L, step.x ); // x step steps callback thread
+						lua_rawseti( L, -2, 1 ); // step steps callback thread
+						lua_pushinteger( L, step.y ); // y step steps callback thread
+						lua_rawseti( L, -2, 2 ); // step steps callback thread
+						lua_rawseti( L, -2, stepIndex++ ); // steps callback thread
+					}
+
+					lua_pushnumber( L, path.length ); // length steps callback thread
+					lua_xmove( L, thread, 3 ); // thread
+				} else {
+					lua_pushnil( L ); // nil callback thread
+					lua_xmove( L, thread, 2 ); // thread
+				}
+
+				waitingTable.queuedCallbacks.push( luaL_ref( L, LUA_REGISTRYINDEX ) ); // EMPTY
+			}
+		}
+
+		/**
+		 * Forget every path request that hasn't been answered
+		 */
+		void Engine::releasePaths() {
+			if( !pathfinder ) {
+				return;
+			}
+
+			for( LuaReference callback : pathfinder->cancel() ) {
+				luaL_unref( L, LUA_REGISTRYINDEX, callback );
+			}
+		}
+
+		/**
+		 * Record (or with nil, forget) the function a coroutine was started with. This is what gets saved for a parked coroutine.
+		 *
+		 * STACK ARGS: none (threadIndex and entryIndex must be absolute)
+		 * (Stack is unmodified after call)
+		 */
+		void Engine::setCoroutineEntry( int threadIndex, int entryIndex ) {
+			lua_getfield( L, LUA_REGISTRYINDEX, COROUTINE_ENTRIES ); // entries
+			lua_pushvalue( L, threadIndex ); // thread entries
+			lua_pushvalue( L, entryIndex ); // <entry> thread entries
+			lua_rawset( L, -3 ); // entries
+			lua_pop( L, 1 ); // EMPTY
+		}
+
+		/**
+		 * Track an entity on the lot. The engine takes ownership of the reference.
+		 */
+		void Engine::addObject( LuaReference object ) {
+			objectPositions[ object ] = objects.size();
+			objects.push_back( object );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, OBJECT_REFERENCES ); // references
+			lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object references
+			lua_pushinteger( L, object ); // reference object references
+			lua_rawset( L, -3 ); // references
+			lua_pop( L, 1 ); // EMPTY
+
+			lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object
+			lua_getfield( L, -1, "class" ); // Class object
+
+			if( lua_istable( L, -1 ) ) {
+				lua_getfield( L, -1, "name" ); // "class.id" Class object
+
+				if( lua_isstring( L, -1 ) ) {
+					typeIndex.addObject( lua_tostring( L, -1 ), object );
+				}
+
+				lua_pop( L, 1 ); // Class object
+			}
+
+			lua_pop( L, 2 ); // EMPTY
+		}
+
+		/**
+		 * Stop tracking an entity and release the engine's reference to it.
+		 */
+		void Engine::removeObject( LuaReference object ) {
+			auto position = objectPositions.find( object );
+			if( position == objectPositions.end() ) {
+				return;
+			}
+
+			// Order in objects isn't kept: the last object takes the removed object's place
+			std::size_t index = position->second;
+			if( index != objects.size() - 1 ) {
+				objects[ index ] = objects.back();
+				objectPositions[ objects[ index ] ] = index;
+			}
+
+			objects.pop_back();
+			objectPositions.erase( position );
+			typeIndex.removeObject( object );
+			spatialIndex.removeObject( object );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, OBJECT_REFERENCES ); // references
+			lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object references
+			lua_pushnil( L ); // nil object references
+			lua_rawset( L, -3 ); // references
+			lua_pop( L, 1 ); // EMPTY
+
+			luaL_unref( L, LUA_REGISTRYINDEX, object );
+		}
+
+		/**
+		 * The reference addObject was given for the object at index, or LUA_NOREF if it isn't a lot object. L may be any of the engine's
+		 * coroutines; they share the registry.
+		 */
+		LuaReference Engine::getObjectReference( lua_State* L, int index ) {
+			index = lua_absindex( L, index );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, OBJECT_REFERENCES ); // references
+			lua_pushvalue( L, index ); // object references
+			lua_rawget( L, -2 ); // reference references
+
+			LuaReference reference = lua_isinteger( L, -1 ) ? lua_tointeger( L, -1 ) : LUA_NOREF;
+			lua_pop( L, 2 ); // EMPTY
+
+			return reference;
+		}
+
+		/**
+		 * The spatial index's id for the instance userdata at index, giving it the next one if it has none and assign is true. Returns 0 if
+		 * it has none.
+		 */
+		SpatialIndex::Instance Engine::getInstanceId( int index, bool assign ) {
+			index = lua_absindex( L, index );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, PLACED_INSTANCES ); // instances
+			lua_pushvalue( L, index ); // instance instances
+			lua_rawget( L, -2 ); // id instances
+
+			SpatialIndex::Instance id = lua_isinteger( L, -1 ) ? lua_tointeger( L, -1 ) : 0;
+			lua_pop( L, 1 ); // instances
+
+			if( !id && assign ) {
+				id = nextInstance++;
+
+				lua_pushvalue( L, index ); // instance instances
+				lua_pushinteger( L, id ); // id instance instances
+				lua_rawset( L, -3 ); // instances
+			}
+
+			lua_pop( L, 1 ); // EMPTY
+
+			return id;
+		}
+
+		/**
+		 * Record that the callback (function or coroutine) at callbackIndex was set on the object at ownerIndex. Owners decide which shard a
+		 * callback goes to when a lot is split up (see ShardGroup::partition), and are saved with the lot. L may be any of the engine's
+		 * coroutines.
+		 */
+		void Engine::setOwner( lua_State* L, int callbackIndex, int ownerIndex ) {
+			callbackIndex = lua_absindex( L, callbackIndex );
+			ownerIndex = lua_absindex( L, ownerIndex );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, CALLBACK_OWNERS ); // owners
+			lua_pushvalue( L, callbackIndex ); // callback owners
+			lua_pushvalue( L, ownerIndex ); // owner callback owners
+			lua_rawset( L, -3 ); // owners
+			lua_pop( L, 1 ); // EMPTY
+		}
+
+		/**
+		 * Push the owner of the callback at callbackIndex, or push nothing and return false if it has none. A coroutine that wasn't given
+		 * one of its own belongs to the owner of the function it was started with.
+		 */
+		bool Engine::pushOwner( lua_State* L, int callbackIndex ) {
+			callbackIndex = lua_absindex( L, callbackIndex );
+
+			lua_getfield( L, LUA_REGISTRYINDEX, CALLBACK_OWNERS ); // owners
+			lua_pushvalue( L, callbackIndex ); // callback owners
+			lua_rawget( L, -2 ); // <owner> owners
+
+			if( lua_isnil( L, -1 ) && lua_isthread( L, callbackIndex ) ) {
+				lua_pop( L, 1 ); // owners
+				lua_getfield( L, LUA_REGISTRYINDEX, COROUTINE_ENTRIES ); // entries owners
+				lua_pushvalue( L, callbackIndex ); // thread entries owners
+				lua_rawget( L, -2 ); // <entry> entries owners
+				lua_remove( L, -2 ); // <entry> owners
+				lua_rawget( L, -2 ); // <owner> owners
+			}
+
+			lua_remove( L, -2 ); // <owner>
+
+			if( lua_isnil( L, -1 ) ) {
+				lua_pop( L, 1 ); // EMPTY
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * The lot object callback was set on, or LUA_NOREF if it has no owner or its owner isn't on the lot
+		 */
+		LuaReference Engine::getOwner( LuaReference callback ) {
+			LuaReference owner = LUA_NOREF;
+
+			lua_rawgeti( L, LUA_REGISTRYINDEX, callback ); // callback
+			if( pushOwner( L, -1 ) ) { // owner callback
+				owner = getObjectReference( L, -1 );
+				lua_pop( L, 1 ); // callback
+			}
+
+			lua_pop( L, 1 ); // EMPTY
+
+			return owner;
+		}
+
+		/**
+		 * Read a { x, y, z } table (as Entity:place_object takes) at index. Returns false if it isn't one.
+		 */
+		bool Engine::getPosition( lua_State* L, int index, SpatialIndex::Position& position ) {
+			if( !lua_istable( L, index ) ) {
+				return false;
+			}
+
+			index = lua_absindex( L, index );
+			double* components[] = { &position.x, &position.y, &position.z };
+			bool valid = true;
+
+			for( int i = 0; i != 3; i++ ) {
+				lua_rawgeti( L, index, i + 1 ); // component
+				valid = valid && lua_isnumber( L, -1 );
+				*components[ i ] = lua_tonumber( L, -1 );
+				lua_pop( L, 1 ); // EMPTY
+			}
+
+			return valid;
+		}
+
+		/**
+		 * Take the reference to the coroutine currently being run, so that it can be parked until something should wake it (by handing the
+		 * reference back to the waiting table). Returns LUA_NOREF if thread isn't a coroutine the engine is running - e.g. one Lua created
+		 * itself with coroutine.create. restartable records whether it's parked at a restart point (see canSave).
+		 */
+		LuaReference Engine::park( lua_State* thread, bool restartable ) {
+			if( thread != runningThread ) {
+				return LUA_NOREF;
+			}
+
+			LuaReference reference = runningThreadRef;
+			runningThreadRef = LUA_NOREF;
+
+			lua_getfield( L, LUA_REGISTRYINDEX, RESTART_POINTS ); // points
+			lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // thread points
+			if( restartable ) {
+				lua_pushboolean( L, 1 ); // true thread points
+			} else {
+				lua_pushnil( L ); // nil thread points
+			}
+			lua_rawset( L, -3 ); // points
+			lua_pop( L, 1 ); // EMPTY
+
+			return reference;
+		}
+
+		/**
+		 * Run one tick: just objectLoop, or every shard's objectLoop if the lot is sharded. Returns the number of callbacks run.
+		 */
+		unsigned int Engine::step() {
+			if( shardGroup ) {
+				return shardGroup->tick();
+			}
+
+			return objectLoop();
+		}
+
+		/**
+		 * Run however many ticks the current SimulationSpeed calls for. Called once per frame (or once per step of the engine thread).
+		 * Returns the number of ticks run.
+		 */
+		unsigned int Engine::update() {
+			// GUI and key events queue their Lua handlers from here, in time for this frame's ticks
+			commandBus->drain();
+
+			unsigned int ticksRun = 0;
+
+			switch( speed ) {
+				case SimulationSpeed::PAUSED:
+					gcScheduler->idle();
+					break;
+				case SimulationSpeed::NORMAL:
+					step();
+					ticksRun++;
+					break;
+				case SimulationSpeed::FAST:
+					// Scripts can change the speed mid-frame
+					while( ticksRun != fastTicksPerFrame && speed == SimulationSpeed::FAST ) {
+						step();
+						ticksRun++;
+					}
+					break;
+				case SimulationSpeed::MAX: {
+					// Jump over idle stretches and keep going until this frame's budget is spent
+					std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + maxSpeedBudget;
+
+					do {
+						skipIdleTicks();
+						ticksRun++;
+
+						// Nothing ran even after skipping to the next deadline, so there are no timers left and nothing queued: every tick until
+						// something outside the engine queues a callback would be the same. Give the rest of the frame back instead of spinning through it.
+						if( !step() ) {
+							break;
+						}
+					} while( speed == SimulationSpeed::MAX && std::chrono::steady_clock::now() < deadline );
+					break;
+				}
+			}
+
+			// Only the final state of the world in this frame is worth showing
+			if( ticksRun ) {
+				eventManager.TICK_COMPLETED.trigger( currentTick - 1 );
+			}
+
+			serviceBackgroundSave();
+
+			return ticksRun;
+		}
+
+		/**
+		 * If nothing would run on the current tick, move currentTick straight to the earliest pending deadline. Nothing observable happens
+		 * on the skipped ticks, so the only difference to running them is the time it takes.
+		 */
+		void Engine::skipIdleTicks() {
+			if( shardGroup ) {
+				shardGroup->skipIdleTicks();
+				return;
+			}
+
+			if( waitingTable.queuedCallbacks.empty() && waitingTable.hasPendingTimers() ) {
+				Tick next = waitingTable.getNextDeadline();
+
+				if( limitSkip( next ) && next > currentTick ) {
+					currentTick = next;
+				}
+			}
+		}
+
+		/**
+		 * Work outside the waiting table can also make a tick matter. Lowers next to the next autosave checkpoint, and returns false if no
+		 * tick may be skipped at all: paths still being searched get delivered on whichever tick they finish, and a save that's been asked
+		 * for should capture the tick it was asked on.
+		 */
+		bool Engine::limitSkip( Tick& next ) const {
+			if( ( pathfinder && pathfinder->isBusy() ) || !pendingSavePath.empty() ) {
+				return false;
+			}
+
+			if( autosaver ) {
+				next = std::min( next, autosaver->getNextCheckpoint() );
+			}
+
+			return true;
+		}
+
+		void Engine::setSpeed( SimulationSpeed speed ) {
+			this->speed = speed;
+		}
+
+		SimulationSpeed Engine::getSpeed() {
+			return speed;
+		}
+
+		/**
+		 * Overrides the default Lua print() function to go through the logger
+		 */
+		 int Engine::lua_print( lua_State* L ) {
+
+			 try {
+				 int numArgs = lua_gettop( L );
+
+				 // print( "message" )
+				 if( numArgs == 1 ) {
+					 lua_getglobal( L, "tostring" ); // <tostring> string
+					 lua_pushvalue( L, -2 ); // string <tostring> string
+
+					 if( lua_pcall( L, 1, 1, 0 ) == 0 ) { // string string
+						 Log::getInstance().debug( "Lua Script", lua_tostring( L, -1 ) );
+					 } else {
+						 Log::getInstance().error( "Engine::lua_print", "Argument not convertible to string type" );
+					 }
+				 }
+
+				 // print( "tag", "message" )
+				 else if( numArgs == 2 ) {
+					 // message tag
+					 lua_getglobal( L, "tostring" ); // <tostring> message tag
+					 lua_pushvalue( L, -2 ); // message <tostring> message tag
+
+					 if( lua_pcall( L, 1, 1, 0 ) != 0 ) {
+						 Log::getInstance().error( "Engine::lua_print", "Message not convertible to string type" );
+						 return 0;
+					 }
+
+					 // convertedmessage message tag
+					 lua_getglobal( L, "tostring" ); // <tostring> convertedmessage message tag
+					 lua_pushvalue( L, -4 ); // tag <tostring> convertedmessage message tag
+
+					 if( lua_pcall( L, 1, 1, 0 ) != 0 ) {
+						 Log::getInstance().error( "Engine::lua_print", "Tag not convertible to string type" );
+						 return 0;
+					 }
+
+					 // convertedtag convertedmessage message tag
+					 Log::getInstance().debug( lua_tostring( L, -1 ), lua_tostring( L, -2 ) );
+				 }
+			 } catch ( std::logic_error e ) {
+				 Log::getInstance().error( "Engine::lua_print", "Failed to print() log message" );
+			 }
+
+			 return 0;
+		 }
+
+		 /**
+		  * owner is the lot object the callback is set on (see Engine::setOwner). Left out, the callback belongs to the owner of the
+		  * callback setting it.
+		  *
+			* STACK ARGS: function interval (owner)
+			* RETURNS: handle (integer)
+			*/
+		 int Engine::lua_setTimeout( lua_State* L ) {
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 // First argument on the stack should be a function
+			 if( lua_isfunction( L, 1 ) && lua_isnumber( L, 2 ) ) {
+				 // warning: watch the type of Tick
+				 Tick interval = lua_tointeger( L, 2 );
+
+				 if( !lua_isnoneornil( L, 3 ) ) {
+					 setOwner( L, 1, 3 );
+				 } else {
+					 lua_pushthread( L ); // thread ...
+					 if( pushOwner( L, -1 ) ) { // owner thread ...
+						 setOwner( L, 1, -1 );
+						 lua_pop( L, 1 ); // thread ...
+					 }
+					 lua_pop( L, 1 ); // ...
+				 }
+
+				 lua_settop( L, 1 ); // function
+
+				 // This reference should be a reference owned by the queue-waiting table pair, and should never be used anywhere else.
+				 // When the engine consumes the function, the reference should be luaL_unref'd and freed.
+				 // If you don't do this, you'll get horriffic memory leaks that slowly worsen as a lot is played.
+				 LuaReference function = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+
+				 if( interval == 0 ) {
+					 // This function was scheduled to run in the same tick, but when the current stack has completed.
+					 // You GENERALLY shouldn't do this but it's got its use cases.
+					 self->waitingTable.queuedCallbacks.push( function );
+
+					 // You'll get a nil handle because a callback scheduled to go on the current tick cannot be cancelled.
+					 lua_pushnil( L ); // nil
+				 } else {
+					 // This function was scheduled to run at tick+1 or after
+					 Event::WaitingTable::Handle handle = self->waitingTable.waitForTick( self->currentTick + interval, function );
+
+					 lua_pushinteger( L, handle ); // handle
+				 }
+
+				 return 1;
+			 } else {
+				 Log::getInstance().warn( "Engine::lua_setTimeout", "Invalid arguments provided to bluebear.engine.set_timeout: Argument 1 is a function and argument 2 is a number." );
+
+				 return 0;
+			 }
+		 }
+
+		 /**
+		  * Cancel a callback scheduled with set_timeout. Cancelling a callback that has already run does nothing.
+		  *
+		  * STACK ARGS: handle
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_clearTimeout( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_clearTimeout", "clear_timeout", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 LuaReference function = self->waitingTable.cancelTick( lua_tointeger( L, -1 ) );
+			 if( function != -1 ) {
+				 // The waiting table owned this reference - nobody else will release it now
+				 luaL_unref( L, LUA_REGISTRYINDEX, function );
+			 }
+
+			 return 0;
+		 }
+
+		 /**
+		  * Suspend the calling callback for the given number of ticks. Only callbacks the engine runs can sleep - not code inside a
+		  * coroutine Lua created itself. Pass restart = true if starting the callback over from the top, instead of carrying on from here,
+		  * is harmless (see Engine::canSave); the lot can't be saved while anything sleeps without it. owner, if given, is recorded as the
+		  * lot object the sleeping callback belongs to (see Engine::setOwner).
+		  *
+		  * STACK ARGS: ticks (restart) (owner)
+		  * RETURNS: EMPTY (after the coroutine is resumed)
+		  */
+		 int Engine::lua_sleep( lua_State* L ) {
+			 bool restartable = lua_gettop( L ) >= 2 && lua_toboolean( L, 2 );
+
+			 if( !lua_isnoneornil( L, 3 ) ) {
+				 lua_pushthread( L ); // thread owner restart ticks
+				 setOwner( L, -1, 3 );
+			 }
+
+			 lua_settop( L, 1 ); // ticks
+
+			 VERIFY_NUMBER_N( "Engine::lua_sleep", "sleep", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 lua_Integer interval = lua_tointeger( L, -1 );
+			 if( interval < 0 ) {
+				 return luaL_error( L, "sleep: cannot sleep for a negative number of ticks" );
+			 }
+
+			 LuaReference thread = self->park( L, restartable );
+			 if( thread == LUA_NOREF ) {
+				 return luaL_error( L, "sleep: can only be called from a callback run by the engine" );
+			 }
+
+			 if( interval == 0 ) {
+				 // Let everything else queued for this tick go first
+				 self->waitingTable.queuedCallbacks.push( thread );
+			 } else {
+				 self->waitingTable.waitForTick( self->currentTick + interval, thread );
+			 }
+
+			 return lua_yield( L, 0 );
+		 }
+
+		 /**
+		  * Change the simulation speed: "paused", "normal", "fast" or "max"
+		  *
+		  * STACK ARGS: "speed"
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_setSpeed( lua_State* L ) {
+			 VERIFY_STRING_N( "Engine::lua_setSpeed", "set_speed", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 switch( Tools::Utility::hash( lua_tostring( L, -1 ) ) ) {
+				 case Tools::Utility::hash( "paused" ):
+					 self->setSpeed( SimulationSpeed::PAUSED );
+					 break;
+				 case Tools::Utility::hash( "normal" ):
+					 self->setSpeed( SimulationSpeed::NORMAL );
+					 break;
+				 case Tools::Utility::hash( "fast" ):
+					 self->setSpeed( SimulationSpeed::FAST );
+					 break;
+				 case Tools::Utility::hash( "max" ):
+					 self->setSpeed( SimulationSpeed::MAX );
+					 break;
+				 default:
+					 return luaL_error( L, "set_speed: speed must be one of \"paused\", \"normal\", \"fast\" or \"max\"" );
+			 }
+
+			 return 0;
+		 }
+
+		 /**
+		  * STACK ARGS: none
+		  * RETURNS: "speed"
+		  */
+		 int Engine::lua_getSpeed( lua_State* L ) {
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 switch( self->getSpeed() ) {
+				 case SimulationSpeed::PAUSED:
+					 lua_pushstring( L, "paused" );
+					 break;
+				 case SimulationSpeed::NORMAL:
+					 lua_pushstring( L, "normal" );
+					 break;
+				 case SimulationSpeed::FAST:
+					 lua_pushstring( L, "fast" );
+					 break;
+				 case SimulationSpeed::MAX:
+					 lua_pushstring( L, "max" );
+					 break;
+			 }
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: "path"
+		  * RETURNS: true if the save was started
+		  */
+		 int Engine::lua_saveLot( lua_State* L ) {
+			 VERIFY_STRING_N( "Engine::lua_saveLot", "save_lot", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 if( self->shardIndex ) {
+				 return luaL_error( L, "save_lot: only shard 0 can save the lot" );
+			 }
+
+			 lua_pushboolean( L, self->saveLotInBackground( lua_tostring( L, -1 ) ) );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: level x y
+		  * RETURNS: bitmask of the wall segments in that cell (1 x, 2 y, 4 d, 8 r); 0 for no walls, or a cell off the lot
+		  */
+		 int Engine::lua_getWallSegments( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_getWallSegments", "get_wall_segments", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_getWallSegments", "get_wall_segments", 2 );
+			 VERIFY_NUMBER_N( "Engine::lua_getWallSegments", "get_wall_segments", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 int level = lua_tointeger( L, -3 );
+			 int x = lua_tointeger( L, -2 );
+			 int y = lua_tointeger( L, -1 );
+
+			 std::uint8_t segments = 0;
+			 if( self->currentLot && self->currentLot->wallMap->contains( level, x, y ) ) {
+				 segments = self->currentLot->wallMap->getPacked( level, x, y ).segments;
+			 }
+
+			 lua_pushinteger( L, segments );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: level x y "x"|"y"|"d"|"r"
+		  * RETURNS: "front wallpaper id" "back wallpaper id", or nil if that cell doesn't have that segment
+		  */
+		 int Engine::lua_getWallpapers( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_getWallpapers", "get_wallpapers", 4 );
+			 VERIFY_NUMBER_N( "Engine::lua_getWallpapers", "get_wallpapers", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_getWallpapers", "get_wallpapers", 2 );
+			 VERIFY_STRING_N( "Engine::lua_getWallpapers", "get_wallpapers", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 int level = lua_tointeger( L, -4 );
+			 int x = lua_tointeger( L, -3 );
+			 int y = lua_tointeger( L, -2 );
+			 WallGrid::Axis axis;
+			 if( !WallGrid::getAxis( lua_tostring( L, -1 ), axis ) ) {
+				 return luaL_error( L, "get_wallpapers: segment must be one of \"x\", \"y\", \"d\" or \"r\"" );
+			 }
+
+			 if( !self->currentLot || !self->currentLot->wallMap->contains( level, x, y ) ) {
+				 lua_pushnil( L );
+				 return 1;
+			 }
+
+			 WallGrid::SegmentView segment = self->currentLot->wallMap->getCell( level, x, y ).getSegment( axis );
+			 if( !segment ) {
+				 lua_pushnil( L );
+				 return 1;
+			 }
+
+			 lua_pushstring( L, segment.getFront()->id.c_str() );
+			 lua_pushstring( L, segment.getBack()->id.c_str() );
+
+			 return 2;
+		 }
+
+		 /**
+		  * STACK ARGS: level x y "tile id"|nil
+		  * RETURNS: true if the tile was placed (or, for nil, removed); false for a cell off the lot or a tile that doesn't exist
+		  */
+		 int Engine::lua_setTile( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_setTile", "set_tile", 4 );
+			 VERIFY_NUMBER_N( "Engine::lua_setTile", "set_tile", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_setTile", "set_tile", 2 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 if( self->shardIndex ) {
+				 return luaL_error( L, "set_tile: only shard 0 can edit the lot" );
+			 }
+
+			 if( !lua_isnil( L, -1 ) && !lua_isstring( L, -1 ) ) {
+				 return luaL_error( L, "set_tile: tile must be a tile id, or nil to remove the tile" );
+			 }
+
+			 std::string tile = lua_isnil( L, -1 ) ? "" : lua_tostring( L, -1 );
+
+			 lua_pushboolean( L, self->currentLot && self->currentLot->setTile( lua_tointeger( L, -4 ), lua_tointeger( L, -3 ), lua_tointeger( L, -2 ), tile ) );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: level x1 y1 x2 y2 "tile id"|nil
+		  * RETURNS: true if every cell in the rectangle ( x1, y1 ) - ( x2, y2 ) was filled (or, for nil, cleared); false, with nothing changed, otherwise
+		  */
+		 int Engine::lua_fillTiles( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_fillTiles", "fill_tiles", 6 );
+			 VERIFY_NUMBER_N( "Engine::lua_fillTiles", "fill_tiles", 5 );
+			 VERIFY_NUMBER_N( "Engine::lua_fillTiles", "fill_tiles", 4 );
+			 VERIFY_NUMBER_N( "Engine::lua_fillTiles", "fill_tiles", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_fillTiles", "fill_tiles", 2 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 if( self->shardIndex ) {
+				 return luaL_error( L, "fill_tiles: only shard 0 can edit the lot" );
+			 }
+
+			 if( !lua_isnil( L, -1 ) && !lua_isstring( L, -1 ) ) {
+				 return luaL_error( L, "fill_tiles: tile must be a tile id, or nil to clear the tiles" );
+			 }
+
+			 std::string tile = lua_isnil( L, -1 ) ? "" : lua_tostring( L, -1 );
+
+			 lua_pushboolean( L, self->currentLot && self->currentLot->fillTiles(
+				 lua_tointeger( L, -6 ), lua_tointeger( L, -5 ), lua_tointeger( L, -4 ), lua_tointeger( L, -3 ), lua_tointeger( L, -2 ), tile
+			 ) );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: level x y "x"|"y"|"d"|"r" "front wallpaper id" "back wallpaper id"
+		  * RETURNS: true if the segment was placed, replacing any segment already on that axis
+		  */
+		 int Engine::lua_setWallSegment( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_setWallSegment", "set_wall_segment", 6 );
+			 VERIFY_NUMBER_N( "Engine::lua_setWallSegment", "set_wall_segment", 5 );
+			 VERIFY_NUMBER_N( "Engine::lua_setWallSegment", "set_wall_segment", 4 );
+			 VERIFY_STRING_N( "Engine::lua_setWallSegment", "set_wall_segment", 3 );
+			 VERIFY_STRING_N( "Engine::lua_setWallSegment", "set_wall_segment", 2 );
+			 VERIFY_STRING_N( "Engine::lua_setWallSegment", "set_wall_segment", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 if( self->shardIndex ) {
+				 return luaL_error( L, "set_wall_segment: only shard 0 can edit the lot" );
+			 }
+
+			 WallGrid::Axis axis;
+			 if( !WallGrid::getAxis( lua_tostring( L, -3 ), axis ) ) {
+				 return luaL_error( L, "set_wall_segment: segment must be one of \"x\", \"y\", \"d\" or \"r\"" );
+			 }
+
+			 lua_pushboolean( L, self->currentLot && self->currentLot->setWallSegment(
+				 lua_tointeger( L, -6 ), lua_tointeger( L, -5 ), lua_tointeger( L, -4 ), axis, lua_tostring( L, -2 ), lua_tostring( L, -1 )
+			 ) );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: level x y "x"|"y"|"d"|"r"
+		  * RETURNS: true unless the cell is off the lot
+		  */
+		 int Engine::lua_removeWallSegment( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_removeWallSegment", "remove_wall_segment", 4 );
+			 VERIFY_NUMBER_N( "Engine::lua_removeWallSegment", "remove_wall_segment", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_removeWallSegment", "remove_wall_segment", 2 );
+			 VERIFY_STRING_N( "Engine::lua_removeWallSegment", "remove_wall_segment", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 if( self->shardIndex ) {
+				 return luaL_error( L, "remove_wall_segment: only shard 0 can edit the lot" );
+			 }
+
+			 WallGrid::Axis axis;
+			 if( !WallGrid::getAxis( lua_tostring( L, -1 ), axis ) ) {
+				 return luaL_error( L, "remove_wall_segment: segment must be one of \"x\", \"y\", \"d\" or \"r\"" );
+			 }
+
+			 lua_pushboolean( L, self->currentLot && self->currentLot->removeWallSegment( lua_tointeger( L, -4 ), lua_tointeger( L, -3 ), lua_tointeger( L, -2 ), axis ) );
+
+			 return 1;
+		 }
+
+		 int Engine::lua_getLotObjects( lua_State* L ) {
+
+			 // Pop the lot off the stack
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 // Create an array table with as many entries as the size of this->objects
+			 lua_createtable( L, engine->objects.size(), 0 );
+
+			 // Push 'em on!
+			 size_t tableIndex = 1;
+			 for( int lotEntity : engine->objects ) {
+				 lua_rawgeti( L, LUA_REGISTRYINDEX, lotEntity );
+				 lua_rawseti( L, -2, tableIndex++ );
+			 }
+
+			 return 1;
+
+		 }
+
+		 /**
+		  * STACK ARGS: "class.id"
+		  * RETURNS: array of objects that are instances of class.id or any class derived from it
+		  */
+		 int Engine::lua_getLotObjectsByType( lua_State* L ) {
+			 VERIFY_STRING_N( "Engine::lua_getLotObjectsByType", "get_objects_by_type", 1 );
 
-			 // Because Lua requires methods be static in C closure, pop the first argument: the "this" pointer
 			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-			 // Get argument (the class we are looking for) and remove it from the stack
-			 // Copy using modern C++ string methods into archaic, unsafe C-string format used by Lua API
-			 std::string keystring( lua_tostring( L, -1 ) );
-			 const char* idKey = keystring.c_str();
-			 lua_pop( L, 1 );
+			 std::string classId( lua_tostring( L, -1 ) );
 
-			 // This table will be the array of matching lot
-			 lua_newtable( L );
+			 lua_newtable( L ); // table "class.id"
 
 			 // Start at index number 1 - Lua arrays (tables) start at 1
-			 size_t tableIndex = 1;
+			 lua_Integer tableIndex = 1;
+			 engine->typeIndex.eachInstanceOf( classId, [ & ]( LuaReference lotEntity ) {
+				 lua_rawgeti( L, LUA_REGISTRYINDEX, lotEntity ); // object table "class.id"
+				 lua_rawseti( L, -2, tableIndex++ ); // table "class.id"
+			 } );
 
-			 // Iterate through each object on the lot, checking to see if each is an instance of "idKey"
-			 for( int lotEntity : engine->objects ) {
-				 // Push bluebear global
-				 lua_getglobal( L, "bluebear" );
+			 return 1;
+		 }
+
+		 /**
+		  * Called by Entity:remove_from_lot. Forgets the object everywhere addObject and place_instance recorded it, so it's no longer drawn,
+		  * saved as a lot object, or found by the type and spatial queries.
+		  *
+		  * STACK ARGS: object
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_removeObject( lua_State* L ) {
+			 VERIFY_TABLE_N( "Engine::lua_removeObject", "remove_object", 1 );
 
-				 // Push instance_of utility function
-				 Tools::Utility::getTableValue( L, "instance_of" );
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
-				 // Push the two arguments: identifier, and instance
-				 lua_pushstring( L, idKey );
-				 lua_rawgeti( L, LUA_REGISTRYINDEX, lotEntity );
+			 LuaReference object = getObjectReference( L, -1 );
+			 if( object != LUA_NOREF ) {
+				 engine->removeObject( object );
+			 }
 
-				 // We're ready to call instance_of on object!
-				 if( lua_pcall( L, 2, 1, 0 ) == 0 ) {
-					 // Read the answer left on the stack as a boolean
-					 // lua_getboolean actually returns an int, which we'll need interpreted as a bool
-					 bool isInstance = !!lua_toboolean( L, -1 );
-
-					 // Before we do anything else, get rid of the result, the instance_of function
-					 // and the bluebear tableIndex from the stack - we don't need them anymore
-					 // until the loop restarts, and this will put our return table back at the top
-					 // of the stack.
-					 lua_pop( L, 2 );
-
-					 // If this object is a descendant of idKey, push it onto the table
-					 if( isInstance ) {
-						 // Re-push the instance onto the stack
-						 lua_rawgeti( L, LUA_REGISTRYINDEX, lotEntity );
-						 // Push it onto the table on our stack
-						 lua_rawseti( L, -2, tableIndex++ );
-					 }
-				 }
+			 return 0;
+		 }
+
+		 /**
+		  * Called by Entity:place_object.
+		  *
+		  * STACK ARGS: object instance { x, y, z }
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_placeInstance( lua_State* L ) {
+			 VERIFY_TABLE_N( "Engine::lua_placeInstance", "place_instance", 3 );
+			 VERIFY_USER_DATA_N( "Engine::lua_placeInstance", "place_instance", 2 );
+			 VERIFY_TABLE_N( "Engine::lua_placeInstance", "place_instance", 1 );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 SpatialIndex::Position position;
+			 if( !getPosition( L, -1, position ) ) {
+				 return luaL_error( L, "place_instance: position must be a table of three numbers" );
+			 }
+
+			 LuaReference object = getObjectReference( L, -3 );
+			 if( object == LUA_NOREF ) {
+				 // Not on the lot (yet) - nothing to find it by
+				 return 0;
+			 }
+
+			 engine->spatialIndex.place( object, engine->getInstanceId( -2, true ), position );
+
+			 return 0;
+		 }
+
+		 /**
+		  * Called by Entity:remove_object.
+		  *
+		  * STACK ARGS: instance
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_removeInstance( lua_State* L ) {
+			 VERIFY_USER_DATA( "Engine::lua_removeInstance", "remove_instance" );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 SpatialIndex::Instance instance = engine->getInstanceId( -1, false );
+			 if( instance ) {
+				 engine->spatialIndex.remove( instance );
+			 }
+
+			 return 0;
+		 }
+
+		 /**
+		  * STACK ARGS: { x, y, z } radius
+		  * RETURNS: array of objects with an instance within radius of the point, on the same level
+		  */
+		 int Engine::lua_getObjectsInRadius( lua_State* L ) {
+			 VERIFY_TABLE_N( "Engine::lua_getObjectsInRadius", "get_objects_in_radius", 2 );
+			 VERIFY_NUMBER_N( "Engine::lua_getObjectsInRadius", "get_objects_in_radius", 1 );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 SpatialIndex::Position centre;
+			 if( !getPosition( L, -2, centre ) ) {
+				 return luaL_error( L, "get_objects_in_radius: position must be a table of three numbers" );
+			 }
+
+			 double radius = lua_tonumber( L, -1 );
+
+			 lua_newtable( L ); // table radius position
+
+			 lua_Integer tableIndex = 1;
+			 engine->spatialIndex.eachInRadius( centre, radius, [ & ]( LuaReference object ) {
+				 lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object table radius position
+				 lua_rawseti( L, -2, tableIndex++ ); // table radius position
+			 } );
+
+			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: { x1, y1, z1 } { x2, y2, z2 }
+		  * RETURNS: array of objects with an instance inside the box with those corners
+		  */
+		 int Engine::lua_getObjectsInRect( lua_State* L ) {
+			 VERIFY_TABLE_N( "Engine::lua_getObjectsInRect", "get_objects_in_rect", 2 );
+			 VERIFY_TABLE_N( "Engine::lua_getObjectsInRect", "get_objects_in_rect", 1 );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 SpatialIndex::Position first;
+			 SpatialIndex::Position second;
+			 if( !getPosition( L, -2, first ) || !getPosition( L, -1, second ) ) {
+				 return luaL_error( L, "get_objects_in_rect: corners must be tables of three numbers" );
 			 }
 
+			 lua_newtable( L ); // table second first
+
+			 lua_Integer tableIndex = 1;
+			 engine->spatialIndex.eachInBox( first, second, [ & ]( LuaReference object ) {
+				 lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object table second first
+				 lua_rawseti( L, -2, tableIndex++ ); // table second first
+			 } );
+
 			 return 1;
+		 }
+
+		 /**
+		  * STACK ARGS: { x, y, z } "class.id" maxDistance (optional)
+		  * RETURNS: the closest object on the point's level that is an instance of class.id (or a class derived from it), and its distance;
+		  * nil if there's none within maxDistance
+		  */
+		 int Engine::lua_nearestOfType( lua_State* L ) {
+			 lua_settop( L, 3 ); // maxDistance|nil "class.id" position
+
+			 VERIFY_TABLE_N( "Engine::lua_nearestOfType", "nearest_of_type", 3 );
+			 VERIFY_STRING_N( "Engine::lua_nearestOfType", "nearest_of_type", 2 );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 SpatialIndex::Position centre;
+			 if( !getPosition( L, -3, centre ) ) {
+				 return luaL_error( L, "nearest_of_type: position must be a table of three numbers" );
+			 }
+
+			 std::string classId( lua_tostring( L, -2 ) );
+			 double maxDistance = lua_isnumber( L, -1 ) ? lua_tonumber( L, -1 ) : std::numeric_limits< double >::infinity();
+
+			 double distance;
+			 LuaReference object = engine->spatialIndex.nearest( centre, maxDistance, [ & ]( LuaReference candidate ) {
+				 return engine->typeIndex.isInstanceOf( candidate, classId );
+			 }, distance );
+
+			 if( object == LUA_NOREF ) {
+				 lua_pushnil( L ); // nil maxDistance "class.id" position
+				 return 1;
+			 }
+
+			 lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object maxDistance "class.id" position
+			 lua_pushnumber( L, distance ); // distance object maxDistance "class.id" position
+
+			 return 2;
+		 }
+
+		 /**
+		  * Find a way from ( x1, y1 ) to ( x2, y2 ) on one level of the lot, around the walls. The search runs on a worker thread, and
+		  * callback is run on a later tick with an array of { x, y } cells from start to goal (both included) and the path's length, or
+		  * with nil if there's no way there. Requests still waiting when the lot is saved are not saved.
+		  *
+		  * STACK ARGS: level x1 y1 x2 y2 callback
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_findPath( lua_State* L ) {
+			 VERIFY_NUMBER_N( "Engine::lua_findPath", "find_path", 6 );
+			 VERIFY_NUMBER_N( "Engine::lua_findPath", "find_path", 5 );
+			 VERIFY_NUMBER_N( "Engine::lua_findPath", "find_path", 4 );
+			 VERIFY_NUMBER_N( "Engine::lua_findPath", "find_path", 3 );
+			 VERIFY_NUMBER_N( "Engine::lua_findPath", "find_path", 2 );
+			 VERIFY_FUNCTION_N( "Engine::lua_findPath", "find_path", 1 );
+
+			 Engine* self = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
 
+			 if( !self->pathfinder ) {
+				 return luaL_error( L, "find_path: there is no lot to find paths on (only shard 0 has the lot)" );
+			 }
+
+			 // Cells off the lot just come back with no path
+			 Pathfinder::Request request;
+			 request.level = lua_tointeger( L, -6 );
+			 request.x1 = lua_tointeger( L, -5 );
+			 request.y1 = lua_tointeger( L, -4 );
+			 request.x2 = lua_tointeger( L, -3 );
+			 request.y2 = lua_tointeger( L, -2 );
+			 request.callback = luaL_ref( L, LUA_REGISTRYINDEX ); // y2 x2 y1 x1 level
+
+			 self->pathfinder->request( request );
+
+			 return 0;
+		 }
+
+		 /**
+		  * Called by bluebear.register_class.
+		  *
+		  * STACK ARGS: "class.id" "parent.id" (parent may be nil)
+		  * RETURNS: EMPTY
+		  */
+		 int Engine::lua_registerType( lua_State* L ) {
+			 VERIFY_STRING_N( "Engine::lua_registerType", "register_type", 2 );
+
+			 Engine* engine = ( Engine* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+			 std::string parentId;
+			 if( lua_isstring( L, -1 ) ) {
+				 parentId = lua_tostring( L, -1 );
+			 }
+
+			 engine->typeIndex.registerClass( lua_tostring( L, -2 ), parentId );
+
+			 return 0;
 		 }
 	}
 }
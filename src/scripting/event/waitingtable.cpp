@@ -1,6 +1,4 @@
 #include "scripting/event/waitingtable.hpp"
-#include "tools/utility.hpp"
-#include "log.hpp"
 #include <string>
 #include <sstream>
 
@@ -8,7 +6,10 @@ namespace BlueBear {
   namespace Scripting {
     namespace Event {
 
-      void WaitingTable::loadFromJSON( Json::Value& loadingTable, std::map< std::string, LuaReference >& entities, std::unordered_set< LuaReference >& visitedItems ) {
+      /**
+       * take turns each saved callback (however the saver identified it) into a reference the waiting table can own, or LUA_NOREF to skip it
+       */
+      void WaitingTable::loadFromJSON( Json::Value& loadingTable, const std::function< LuaReference( const Json::Value& ) >& take ) {
 
         // do timerMap
         Json::Value& timerMap = loadingTable[ "timerMap" ];
@@ -19,13 +20,11 @@ namespace BlueBear {
 
           Tick deadline = 0; std::stringstream( key.asString() ) >> deadline;
 
-          std::list< LuaReference >& bucket = getBucket( deadline );
           for( Json::Value& pVal : array ) {
-            std::string pointer = pVal.asString();
-
-            LuaReference function = entities.at( pointer );
-            bucket.push_back( function );
-            visitedItems.insert( function );
+            LuaReference function = take( pVal );
+            if( function != LUA_NOREF ) {
+              timers.insert( deadline, function );
+            }
           }
         }
 
@@ -33,20 +32,29 @@ namespace BlueBear {
 
       /**
        * Recommended that you disable garbage collection before saving the WaitingTable (pointer may save incorrectly)
-       * The assumption here is that any pointer we scoop up here is in the world table by now!
+       * The assumption here is that any pointer we scoop up here is in the world table by now! identify is called with each callback on
+       * top of the stack, and returns what to save in its place. If keep is given, only the callbacks it returns true for are saved.
        */
-      Json::Value WaitingTable::saveToJSON( lua_State* L ) {
+      Json::Value WaitingTable::saveToJSON( lua_State* L, const std::function< Json::Value() >& identify, const std::function< bool( LuaReference ) >& keep ) {
         Json::Value json;
 
         Json::Value& timerMapJSON = json[ "timerMap" ] = Json::Value( Json::objectValue );
 
-        for( auto& pair : timerMap ) {
+        // The wheel isn't ordered by deadline across levels; sort into buckets the same as they've always been saved
+        std::map< Tick, std::vector< LuaReference > > buckets;
+        timers.each( [ & ]( Tick deadline, LuaReference reference ) {
+          if( !keep || keep( reference ) ) {
+            buckets[ deadline ].push_back( reference );
+          }
+        } );
+
+        for( auto& pair : buckets ) {
           Json::Value& entry = timerMapJSON[ std::to_string( pair.first ) ] = Json::Value( Json::arrayValue );
 
           for( LuaReference reference : pair.second ) {
             lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // reference
 
-            entry.append( Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) );
+            entry.append( identify() );
 
             lua_pop( L, 1 ); // EMPTY
           }
@@ -55,70 +63,44 @@ namespace BlueBear {
         return json;
       }
 
-      std::list< LuaReference >& WaitingTable::getBucket( Tick key ) {
-        auto pair = timerMap.find( key );
-
-        if( pair == timerMap.end() ) {
-          timerMap.emplace( key, std::list< LuaReference >{} );
-        }
-
-        return timerMap[ key ];
-      }
-
-      std::string WaitingTable::waitForTick( Tick deadline, LuaReference function ) {
-        auto pair = timerMap.find( deadline );
-
-        if( pair == timerMap.end() ) {
-          // Need to create the bucket
-          timerMap.emplace( deadline, std::list< LuaReference >{} );
-        }
-
-        std::list< LuaReference >& bucket = timerMap[ deadline ];
-        bucket.push_back( function );
-
-        return std::to_string( deadline ) + ":" + Tools::Utility::pointerToString( &( bucket.back() ) );
+      /**
+       * Returns a handle that can be passed to cancelTick. Handles are never reused while the callback is pending,
+       * and a handle for a callback that already ran is simply ignored by cancelTick.
+       */
+      WaitingTable::Handle WaitingTable::waitForTick( Tick deadline, LuaReference function ) {
+        return timers.insert( deadline, function );
       }
 
-      void WaitingTable::cancelTick( const std::string& handle ) {
-        // Decompose the handle into a Tick and bucket pointer
-        std::vector< std::string > tokens = Tools::Utility::split( handle, ':' );
-        Tick deadline = 0; std::stringstream( tokens[ 0 ] ) >> deadline;
-        void* specificPointer = Tools::Utility::stringToPointer( tokens[ 1 ] );
-
-        auto pair = timerMap.find( deadline );
-        if( pair != timerMap.end() ) {
-          std::list< LuaReference >& bucket = pair->second;
-
-          for( std::list< LuaReference >::iterator iterator = bucket.begin(), end = bucket.end(); iterator != end; ++iterator ) {
-            // FUCKING BARF
-            void* pointer = &( *iterator );
-
-            if( pointer == specificPointer ) {
-              bucket.erase( iterator );
-              return;
-            }
-          }
+      /**
+       * Cancel a pending callback. Returns the reference that was waiting, which the caller now owns (and should luaL_unref),
+       * or -1 if the handle was stale. Cancelling a callback that already ran is routine (clear_timeout on a fired timer), so a
+       * stale handle is not an error.
+       */
+      LuaReference WaitingTable::cancelTick( Handle handle ) {
+        LuaReference function = -1;
+        timers.cancel( handle, function );
 
-          Log::getInstance().warn( "Event::WaitingTable::cancelTick", "Bucket found but no callback found for handle " + handle );
-        } else {
-          Log::getInstance().warn( "Event::WaitingTable::cancelTick", "Deadline bucket didn't exist for handle " + handle );
-        }
+        return function;
       }
 
+      /**
+       * Queue every callback due on or before tick
+       */
       void WaitingTable::triggerTick( Tick tick ) {
-        auto pair = timerMap.find( tick );
-
-        if( pair != timerMap.end() ) {
-          std::list< LuaReference >& bucket = pair->second;
+        timers.advance( tick, [ & ]( LuaReference reference ) {
+          queuedCallbacks.push( reference );
+        } );
+      }
 
-          // Push everything in this bucket
-          for( LuaReference reference : bucket ) {
-            queuedCallbacks.push( reference );
-          }
+      bool WaitingTable::hasPendingTimers() const {
+        return !timers.empty();
+      }
 
-          // Destroy the bucket, no need for it any longer
-          timerMap.erase( tick );
-        }
+      /**
+       * Earliest tick anything is waiting for. Only meaningful if hasPendingTimers() is true.
+       */
+      Tick WaitingTable::getNextDeadline() const {
+        return timers.getNextDeadline();
       }
 
     }
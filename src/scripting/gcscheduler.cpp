@@ -0,0 +1,183 @@
+#include "scripting/gcscheduler.hpp"
+#include "log.hpp"
+#include <jsoncpp/json/json.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr std::array< double, 9 > GCScheduler::BUCKETS;
+
+    GCScheduler::GCScheduler( lua_State* L, const std::string& mode, int stepBudget, int stepSize, int pause, int emergencyHeap, const std::string& reportPath ) :
+      L( L ), manual( mode == "budget" ), stepBudget( stepBudget ), stepSize( stepSize ), pause( pause ), emergencyHeap( emergencyHeap ), reportPath( reportPath ),
+      threshold( 0 ), collecting( true ), fullPending( false ), ticks( 0 ), cycles( 0 ), fullCollections( 0 ), peakHeap( 0 ), totalTime( 0.0 ), maxPause( 0.0 ),
+      pauses{}, tickTimes{} {
+
+      if( manual ) {
+        lua_gc( L, LUA_GCSTOP, 0 );
+        Log::getInstance().info( "GCScheduler::GCScheduler", "Collecting for at most " + std::to_string( stepBudget ) + "us per tick" );
+      } else if( mode != "auto" ) {
+        Log::getInstance().warn( "GCScheduler::GCScheduler", "Unknown gc_mode \"" + mode + "\"; leaving the collector to Lua" );
+      }
+    }
+
+    /**
+     * RAII style - the report is written when the owning Engine goes away (which must be before the lua_State is closed)
+     */
+    GCScheduler::~GCScheduler() {
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << cycles << " cycles, " << fullCollections << " full collections, "
+        << ( totalTime / 1000.0 ) << "ms collecting, "
+        << maxPause << "us longest pause, "
+        << peakHeap << "KB peak heap";
+      Log::getInstance().info( "GCScheduler::~GCScheduler", stream.str() );
+
+      if( !reportPath.empty() ) {
+        writeReport();
+      }
+    }
+
+    /**
+     * Heap size in KB
+     */
+    int GCScheduler::getHeapSize() {
+      return lua_gc( L, LUA_GCCOUNT, 0 );
+    }
+
+    void GCScheduler::record( Histogram& histogram, double microseconds ) {
+      std::size_t bucket = std::lower_bound( BUCKETS.begin(), BUCKETS.end(), microseconds ) - BUCKETS.begin();
+      histogram[ bucket ]++;
+    }
+
+    /**
+     * Make one call into the collector, and account for the time it took
+     */
+    double GCScheduler::collect( int what, int data, bool& finished ) {
+      Clock::time_point start = Clock::now();
+      finished = lua_gc( L, what, data ) == 1;
+      double elapsed = std::chrono::duration< double, std::micro >( Clock::now() - start ).count();
+
+      record( pauses, elapsed );
+      maxPause = std::max( maxPause, elapsed );
+      totalTime += elapsed;
+
+      return elapsed;
+    }
+
+    void GCScheduler::fullCollect() {
+      bool finished;
+      double elapsed = collect( LUA_GCCOLLECT, 0, finished );
+      record( tickTimes, elapsed );
+
+      fullCollections++;
+      fullPending = false;
+
+      // Like finishing a cycle; don't start the next until the heap has grown again
+      threshold = getHeapSize() * pause / 100;
+      collecting = false;
+    }
+
+    /**
+     * Called at the end of every tick. idle is true if nothing ran on the tick.
+     */
+    void GCScheduler::afterTick( bool idle ) {
+      ticks++;
+
+      int heap = getHeapSize();
+      peakHeap = std::max( peakHeap, heap );
+
+      if( emergencyHeap && heap >= emergencyHeap ) {
+        fullPending = true;
+      }
+
+      if( idle && fullPending ) {
+        fullCollect();
+        return;
+      }
+
+      if( !manual ) {
+        return;
+      }
+
+      if( !collecting ) {
+        if( heap < threshold ) {
+          return;
+        }
+
+        collecting = true;
+      }
+
+      Clock::time_point deadline = Clock::now() + stepBudget;
+      double tickTime = 0.0;
+
+      do {
+        bool finished;
+        tickTime += collect( LUA_GCSTEP, stepSize, finished );
+
+        if( finished ) {
+          cycles++;
+          threshold = getHeapSize() * pause / 100;
+          collecting = false;
+          break;
+        }
+      } while( Clock::now() < deadline );
+
+      record( tickTimes, tickTime );
+    }
+
+    /**
+     * Called while the simulation is paused. A good time for anything that was put off.
+     */
+    void GCScheduler::idle() {
+      if( fullPending ) {
+        fullCollect();
+      }
+    }
+
+    /**
+     * For anything that leaves a lot of garbage behind it (loading or saving a world). Outside budget mode Lua would clear it up on its own
+     * schedule anyway, so this only matters while the scheduler is doing the collecting.
+     */
+    void GCScheduler::requestFull() {
+      fullPending = true;
+    }
+
+    void GCScheduler::writeReport() {
+      Json::Value report( Json::objectValue );
+      report[ "mode" ] = manual ? "budget" : "auto";
+      report[ "stepBudget" ] = ( Json::Int64 ) stepBudget.count();
+      report[ "ticks" ] = ( Json::UInt64 ) ticks;
+      report[ "cycles" ] = ( Json::UInt64 ) cycles;
+      report[ "fullCollections" ] = ( Json::UInt64 ) fullCollections;
+      report[ "peakHeap" ] = peakHeap;
+      report[ "totalTime" ] = totalTime;
+      report[ "maxPause" ] = maxPause;
+
+      Json::Value& buckets = report[ "buckets" ] = Json::Value( Json::arrayValue );
+      for( double bucket : BUCKETS ) {
+        buckets.append( bucket );
+      }
+
+      Json::Value& pauseCounts = report[ "pauses" ] = Json::Value( Json::arrayValue );
+      Json::Value& tickCounts = report[ "tickTimes" ] = Json::Value( Json::arrayValue );
+      for( std::size_t i = 0; i != pauses.size(); i++ ) {
+        pauseCounts.append( ( Json::UInt64 ) pauses[ i ] );
+        tickCounts.append( ( Json::UInt64 ) tickTimes[ i ] );
+      }
+
+      std::ofstream output( reportPath );
+      if( !output.is_open() ) {
+        Log::getInstance().error( "GCScheduler::writeReport", "Could not open " + reportPath + " for writing" );
+        return;
+      }
+
+      output << report.toStyledString();
+      Log::getInstance().info( "GCScheduler::writeReport", "Wrote collector report to " + reportPath );
+    }
+
+  }
+}
@@ -0,0 +1,79 @@
+#include "scripting/headlessrunner.hpp"
+#include "scripting/engine.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    HeadlessRunner::HeadlessRunner( Engine& engine ) : engine( engine ), totalCallbacks( 0 ) {}
+
+    /**
+     * Run the engine as fast as it will go. If ticks is nonzero, stop after that many ticks; if seconds is nonzero, stop after that much wall time.
+     * Whichever limit is reached first ends the run.
+     */
+    void HeadlessRunner::run( unsigned int ticks, double seconds ) {
+      using Clock = std::chrono::steady_clock;
+
+      tickLatencies.clear();
+      tickLatencies.reserve( ticks ? ticks : 100000 );
+      totalCallbacks = 0;
+
+      Log::getInstance().info( "HeadlessRunner::run", "Starting headless run (" + ( ticks ? std::to_string( ticks ) + " ticks" : std::string( "unbounded ticks" ) ) + ", " + ( seconds > 0.0 ? std::to_string( seconds ) + "s" : std::string( "unbounded time" ) ) + ")" );
+
+      Clock::time_point start = Clock::now();
+      Clock::time_point deadline = start + std::chrono::duration_cast< Clock::duration >( std::chrono::duration< double >( seconds ) );
+
+      for( unsigned int i = 0; ticks == 0 || i != ticks; i++ ) {
+        Clock::time_point tickStart = Clock::now();
+
+        totalCallbacks += engine.step();
+
+        Clock::time_point tickEnd = Clock::now();
+        tickLatencies.push_back( std::chrono::duration< double, std::micro >( tickEnd - tickStart ).count() );
+
+        if( seconds > 0.0 && tickEnd >= deadline ) {
+          break;
+        }
+      }
+
+      report( std::chrono::duration< double >( Clock::now() - start ).count() );
+    }
+
+    /**
+     * Nearest-rank percentile over an already-sorted vector
+     */
+    double HeadlessRunner::getPercentile( std::vector< double >& sorted, double percentile ) {
+      if( sorted.empty() ) {
+        return 0.0;
+      }
+
+      unsigned int rank = std::ceil( ( percentile / 100.0 ) * sorted.size() );
+      return sorted[ rank ? rank - 1 : 0 ];
+    }
+
+    void HeadlessRunner::report( double elapsedSeconds ) {
+      std::vector< double > sorted = tickLatencies;
+      std::sort( sorted.begin(), sorted.end() );
+
+      double tickCount = sorted.size();
+
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << "Ran " << sorted.size() << " ticks in " << elapsedSeconds << "s: "
+        << ( elapsedSeconds > 0.0 ? tickCount / elapsedSeconds : 0.0 ) << " ticks/sec, "
+        << ( tickCount ? totalCallbacks / tickCount : 0.0 ) << " callbacks/tick, "
+        << "p50 " << getPercentile( sorted, 50.0 ) << "us, "
+        << "p99 " << getPercentile( sorted, 99.0 ) << "us, "
+        << "max " << ( sorted.empty() ? 0.0 : sorted.back() ) << "us";
+
+      Log::getInstance().info( "HeadlessRunner::report", stream.str() );
+    }
+
+  }
+}
@@ -6,143 +6,548 @@
 #include "scripting/lot.hpp"
 #include "log.hpp"
 #include "tools/utility.hpp"
-#include <jsoncpp/json/json.h>
+#include "tools/jsonreader.hpp"
 #include "scripting/tile.hpp"
-#include "scripting/wallcell.hpp"
+#include "scripting/wallgrid.hpp"
 #include "scripting/wallpaper.hpp"
+#include <jsoncpp/json/json.h>
+#include <algorithm>
 #include <memory>
+#include <ostream>
 #include <vector>
 #include <cstring>
+#include <stdexcept>
 #include <string>
 #include <utility>
 
 namespace BlueBear {
 	namespace Scripting {
 
-		Lot::Lot( lua_State* L, InfrastructureFactory& infrastructureFactory, Json::Value& rootObject ) :
+		Lot::Lot( lua_State* L, InfrastructureFactory& infrastructureFactory, Tools::JSONReader& reader ) :
 			L( L ),
 			infrastructureFactory( infrastructureFactory ),
-			floorX( rootObject[ "floorx" ].asInt() ),
-			floorY( rootObject[ "floory" ].asInt() ),
-			stories( rootObject[ "stories" ].asInt() ),
-			undergroundStories( rootObject[ "subtr" ].asInt() ),
-			terrainType( TerrainType( rootObject[ "terrain" ].asInt() ) ),
-			currentRotation( rootObject[ "rot" ].asUInt() ) {
-			buildFloorMap( rootObject[ "infr" ][ "floor" ] );
-			buildWallMap( rootObject[ "infr" ][ "wall" ] );
+			edited( false ),
+			floorX( 0 ),
+			floorY( 0 ),
+			stories( 0 ),
+			undergroundStories( 0 ),
+			currentRotation( 0 ),
+			terrainType( TerrainType( 0 ) ) {
+			// The grids need the lot's dimensions, which may come after "infr" in the file
+			std::size_t infrastructure = 0;
+			bool hasInfrastructure = false;
+
+			if( reader.beginObject() ) {
+				std::string key;
+				while( reader.nextMember( key ) ) {
+					switch( Tools::Utility::hash( key.c_str() ) ) {
+						case Tools::Utility::hash( "floorx" ):
+							reader.readInt( floorX );
+							break;
+						case Tools::Utility::hash( "floory" ):
+							reader.readInt( floorY );
+							break;
+						case Tools::Utility::hash( "stories" ):
+							reader.readInt( stories );
+							break;
+						case Tools::Utility::hash( "subtr" ):
+							reader.readInt( undergroundStories );
+							break;
+						case Tools::Utility::hash( "terrain" ): {
+							int terrain = 0;
+							reader.readInt( terrain );
+							terrainType = TerrainType( terrain );
+							break;
+						}
+						case Tools::Utility::hash( "rot" ):
+							reader.readUInt( currentRotation );
+							break;
+						case Tools::Utility::hash( "infr" ):
+							infrastructure = reader.getPosition();
+							hasInfrastructure = true;
+							reader.skip();
+							break;
+						default:
+							reader.skip();
+					}
+				}
+			}
+
+			std::size_t after = reader.getPosition();
+			if( hasInfrastructure ) {
+				reader.seek( infrastructure );
+				readInfrastructure( reader );
+				reader.seek( after );
+			}
+
+			// A lot without any infrastructure still gets (empty) grids
+			if( !floorMap ) {
+				floorMap = std::make_unique< FloorMap >( stories, floorX, floorY );
+			}
+			if( !wallMap ) {
+				wallMap = std::make_unique< WallGrid >( stories, floorX + 1, floorY + 1 );
+			}
+
+			// Loading isn't an edit: whatever is built from the grids is built from all of them
+			floorMap->takeDirtyChunks();
+			wallMap->takeDirtyChunks();
+		}
+
+		void Lot::readInfrastructure( Tools::JSONReader& reader ) {
+			if( !reader.beginObject() ) {
+				return;
+			}
+
+			std::string key;
+			while( reader.nextMember( key ) ) {
+				switch( Tools::Utility::hash( key.c_str() ) ) {
+					case Tools::Utility::hash( "floor" ):
+						buildFloorMap( reader );
+						break;
+					case Tools::Utility::hash( "wall" ):
+						buildWallMap( reader );
+						break;
+					default:
+						reader.skip();
+				}
+			}
 		}
 
 		/**
-		 * Using the object lot.infr.wall, build the Collection3D containing all WallCells on the lot. Renderer (Display)
+		 * Using the object lot.infr.wall, build the WallGrid holding every wall segment on the lot. Renderer (Display)
 		 * will handle where they end up and what joints are used to draw the walls.
 		 */
-		void Lot::buildWallMap( Json::Value& wall ) {
-			Json::Value dict = wall[ "dict" ];
-			Json::Value levels = wall[ "levels" ];
+		void Lot::buildWallMap( Tools::JSONReader& reader ) {
+			std::size_t levels = 0;
+			bool hasLevels = false;
+
+			wallMap = std::make_unique< WallGrid >( stories, floorX + 1, floorY + 1 );
 
-			// Create the vector reference of shared_ptrs by iterating through dict
-			std::vector< std::shared_ptr< Wallpaper > > lookup;
-			for( const Json::Value& dictEntry : dict ) {
-				auto wallpaper = infrastructureFactory.getWallpaper( dictEntry.asString() );
-				lookup.push_back( wallpaper );
+			if( !reader.beginObject() ) {
+				return;
 			}
 
-			wallMap = std::make_unique< Containers::Collection3D< std::shared_ptr< WallCell > > >( stories, floorX + 1, floorY + 1 );
+			// Each dict entry goes in the wallmap's palette (dict index i is palette index i + 1); levels are read once it's complete
+			std::string key;
+			while( reader.nextMember( key ) ) {
+				switch( Tools::Utility::hash( key.c_str() ) ) {
+					case Tools::Utility::hash( "dict" ): {
+						std::string name;
+						reader.beginArray();
+						while( reader.nextElement() && reader.readString( name ) ) {
+							wallMap->addToPalette( infrastructureFactory.getWallpaper( name ) );
+						}
+						break;
+					}
+					case Tools::Utility::hash( "levels" ):
+						levels = reader.getPosition();
+						hasLevels = true;
+						reader.skip();
+						break;
+					default:
+						reader.skip();
+				}
+			}
 
-			for( Json::Value& level : levels ) {
-				for( Json::Value& object : level ) {
-					if( Tools::Utility::isRLEObject( object ) ) {
-						// De-RLE the object
-						std::shared_ptr< WallCell > wallCell = getWallCell( object[ "value" ], lookup );
+			if( hasLevels && !reader.hasFailed() ) {
+				std::size_t after = reader.getPosition();
+				reader.seek( levels );
 
-						unsigned int run = object[ "run" ].asUInt();
-						for( unsigned int i = 0; i != run; i++ ) {
-							wallMap->pushDirect( wallCell );
-						}
-					} else {
-						// Push a wallcell or nothing
-						wallMap->pushDirect( getWallCell( object, lookup ) );
+				reader.beginArray();
+				while( reader.nextElement() ) {
+					reader.beginArray();
+					while( reader.nextElement() ) {
+						// Push a wallcell or nothing, once for each cell in the run
+						unsigned int run = 1;
+						WallGrid::Cell cell = readWallCell( reader, run );
+						wallMap->pushRun( cell, run );
 					}
 				}
+
+				reader.seek( after );
 			}
 		}
 
 		/**
-		 * Build the wall cell in all four possible dimensions
+		 * Read one entry of a wall level: nothing (-1), a wall cell in all four possible dimensions, or an RLE object repeating either
+		 * of those. run is set to the number of cells the entry covers.
 		 */
-		std::shared_ptr< WallCell > Lot::getWallCell( Json::Value& object, std::vector< std::shared_ptr< Wallpaper > >& lookup ) {
-			std::shared_ptr< WallCell > wallCell;
+		WallGrid::Cell Lot::readWallCell( Tools::JSONReader& reader, unsigned int& run ) {
+			WallGrid::Cell cell{};
+			run = 1;
 
-			if( object.isObject() && !object.isNumeric() ) {
-				// usable object
-				wallCell = std::make_shared< WallCell >();
+			if( reader.peek() != Tools::JSONReader::Type::OBJECT ) {
+				reader.skip();
+				return cell;
+			}
 
-				// Check for dimensions x, y, d, and r
-				Json::Value x = object.get( "x", Json::nullValue );
-				Json::Value y = object.get( "y", Json::nullValue );
-				Json::Value d = object.get( "d", Json::nullValue );
-				Json::Value r = object.get( "r", Json::nullValue );
+			WallGrid::Cell value{};
+			unsigned int length = 0;
+			bool hasRun = false;
+			bool hasValue = false;
 
-				if( !x.isNull() ) {
-					wallCell->x = std::make_unique< WallCell::Segment >( lookup.at( x[ "f" ].asUInt() ), lookup.at( x[ "b" ].asUInt() ) );
-				}
-				if( !y.isNull() ) {
-					wallCell->y = std::make_unique< WallCell::Segment >( lookup.at( y[ "f" ].asUInt() ), lookup.at( y[ "b" ].asUInt() ) );
-				}
-				if( !d.isNull() ) {
-					wallCell->d = std::make_unique< WallCell::Segment >( lookup.at( d[ "f" ].asUInt() ), lookup.at( d[ "b" ].asUInt() ) );
-				}
-				if( !r.isNull() ) {
-					wallCell->r = std::make_unique< WallCell::Segment >( lookup.at( r[ "f" ].asUInt() ), lookup.at( r[ "b" ].asUInt() ) );
+			reader.beginObject();
+			std::string key;
+			while( reader.nextMember( key ) ) {
+				WallGrid::Axis axis;
+
+				if( key == "run" ) {
+					hasRun = reader.readUInt( length );
+				} else if( key == "value" ) {
+					hasValue = reader.peek() != Tools::JSONReader::Type::NIL;
+					unsigned int inner;
+					value = readWallCell( reader, inner );
+				} else if( WallGrid::getAxis( key.c_str(), axis ) ) {
+					readSegment( reader, cell, axis );
+				} else {
+					reader.skip();
 				}
 			}
 
-			return wallCell;
+			// De-RLE the object
+			if( hasRun && hasValue ) {
+				run = length;
+				return value;
+			}
+
+			return cell;
 		}
 
-		void Lot::buildFloorMap( Json::Value& floor ) {
-			Json::Value dict = floor[ "dict" ];
-			Json::Value levels = floor[ "levels" ];
+		void Lot::readSegment( Tools::JSONReader& reader, WallGrid::Cell& cell, WallGrid::Axis axis ) {
+			if( reader.peek() != Tools::JSONReader::Type::OBJECT ) {
+				reader.skip();
+				return;
+			}
+
+			unsigned int front = 0;
+			unsigned int back = 0;
 
-			// Create the vector reference of shared_ptrs by iterating through dict
-			std::vector< std::shared_ptr< Tile > > lookup;
-			for( const Json::Value& dictEntry : dict ) {
-				auto tile = infrastructureFactory.getFloorTile( dictEntry.asString() );
-				lookup.push_back( tile );
+			reader.beginObject();
+			std::string key;
+			while( reader.nextMember( key ) ) {
+				if( key == "f" ) {
+					reader.readUInt( front );
+				} else if( key == "b" ) {
+					reader.readUInt( back );
+				} else {
+					reader.skip();
+				}
+			}
+
+			if( front + 1 >= wallMap->getPaletteSize() || back + 1 >= wallMap->getPaletteSize() ) {
+				throw std::out_of_range( "Wallpaper index is not in the lot's dict" );
 			}
 
-			// Use the pointer lookup to create the floormap
-			floorMap = std::make_unique< Containers::Collection3D< std::shared_ptr< Tile > > >( stories, floorX, floorY );
+			cell.segments |= 1 << ( unsigned int ) axis;
+			cell.wallpapers[ ( unsigned int ) axis * 2 ] = front + 1;
+			cell.wallpapers[ ( unsigned int ) axis * 2 + 1 ] = back + 1;
+		}
+
+		void Lot::buildFloorMap( Tools::JSONReader& reader ) {
+			std::size_t levels = 0;
+			bool hasLevels = false;
 
-			for( Json::Value& level : levels ) {
-				for( Json::Value& object : level ) {
-					if( Tools::Utility::isRLEObject( object ) ) {
-						// De-RLE the object
-						unsigned int run = object[ "run" ].asUInt();
-						std::shared_ptr< Tile > entry = getTile( object[ "value" ].asInt(), lookup );
+			floorMap = std::make_unique< FloorMap >( stories, floorX, floorY );
 
-						for( unsigned int i = 0; i != run; i++ ) {
-							floorMap->pushDirect( entry );
+			if( !reader.beginObject() ) {
+				return;
+			}
+
+			// Each dict entry goes in the floormap's palette (dict index i is palette index i + 1); levels are read once it's complete
+			std::string key;
+			while( reader.nextMember( key ) ) {
+				switch( Tools::Utility::hash( key.c_str() ) ) {
+					case Tools::Utility::hash( "dict" ): {
+						std::string name;
+						reader.beginArray();
+						while( reader.nextElement() && reader.readString( name ) ) {
+							floorMap->addToPalette( infrastructureFactory.getFloorTile( name ) );
 						}
+						break;
+					}
+					case Tools::Utility::hash( "levels" ):
+						levels = reader.getPosition();
+						hasLevels = true;
+						reader.skip();
+						break;
+					default:
+						reader.skip();
+				}
+			}
+
+			if( hasLevels && !reader.hasFailed() ) {
+				std::size_t after = reader.getPosition();
+				reader.seek( levels );
+
+				reader.beginArray();
+				while( reader.nextElement() ) {
+					reader.beginArray();
+					while( reader.nextElement() ) {
+						unsigned int run = 1;
+						FloorMap::Index index = readTile( reader, run );
+						floorMap->pushRun( index, run );
+					}
+				}
+
+				reader.seek( after );
+			}
+		}
+
+		/**
+		 * Read one entry of a floor level: a tile index (-1 for no tile), or an RLE object repeating one. Returns the floormap palette index
+		 * of the tile, and sets run to the number of cells the entry covers.
+		 */
+		Lot::FloorMap::Index Lot::readTile( Tools::JSONReader& reader, unsigned int& run ) {
+			int index = -1;
+			run = 1;
+
+			if( reader.peek() == Tools::JSONReader::Type::OBJECT ) {
+				// De-RLE the object
+				reader.beginObject();
+				std::string key;
+				while( reader.nextMember( key ) ) {
+					if( key == "run" ) {
+						reader.readUInt( run );
+					} else if( key == "value" ) {
+						reader.readInt( index );
 					} else {
-						floorMap->pushDirect( getTile( object.asInt(), lookup ) );
+						reader.skip();
 					}
 				}
+			} else {
+				reader.readInt( index );
+			}
+
+			if( index < 0 ) {
+				return FloorMap::EMPTY;
 			}
+
+			if( ( std::size_t ) index + 1 >= floorMap->getPaletteSize() ) {
+				throw std::out_of_range( "Floor tile index " + std::to_string( index ) + " is not in the lot's dict" );
+			}
+
+			return index + 1;
 		}
 
 		/**
-		 * Return a tile given a JSON object and a lookup of tiles. This is a simple inline function that just checks to see
-		 * if the entry is blank or not; if it's not blank (index of -1), the lookup is performed.
+		 * Palette index of a floor tile, adding it to the palette if nothing on the lot has used it yet. The empty string is no tile.
 		 */
-		std::shared_ptr< Tile > Lot::getTile( int index, std::vector< std::shared_ptr< Tile > >& lookup ) {
-			std::shared_ptr< Tile > entry;
+		bool Lot::findTileIndex( const std::string& key, FloorMap::Index& index ) {
+			if( key.empty() ) {
+				index = FloorMap::EMPTY;
+				return true;
+			}
+
+			for( std::size_t i = 1; i < floorMap->getPaletteSize(); i++ ) {
+				if( floorMap->getPaletteEntry( i )->id == key ) {
+					index = i;
+					return true;
+				}
+			}
+
+			try {
+				index = floorMap->addToPalette( infrastructureFactory.getFloorTile( key ) );
+			} catch( std::out_of_range& e ) {
+				Log::getInstance().warn( "Lot::findTileIndex", "No floor tile named " + key );
+				return false;
+			} catch( std::length_error& e ) {
+				Log::getInstance().warn( "Lot::findTileIndex", "Too many kinds of floor tile on this lot to add " + key );
+				return false;
+			}
+
+			return true;
+		}
+
+		bool Lot::findWallpaperIndex( const std::string& key, WallGrid::Index& index ) {
+			for( std::size_t i = 1; i < wallMap->getPaletteSize(); i++ ) {
+				if( wallMap->getPaletteEntry( i )->id == key ) {
+					index = i;
+					return true;
+				}
+			}
+
+			try {
+				index = wallMap->addToPalette( infrastructureFactory.getWallpaper( key ) );
+			} catch( std::out_of_range& e ) {
+				Log::getInstance().warn( "Lot::findWallpaperIndex", "No wallpaper named " + key );
+				return false;
+			} catch( std::length_error& e ) {
+				Log::getInstance().warn( "Lot::findWallpaperIndex", "Too many wallpapers on this lot to add " + key );
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Put the tile named key at ( level, x, y ), or remove the tile there if key is empty
+		 */
+		bool Lot::setTile( unsigned int level, unsigned int x, unsigned int y, const std::string& key ) {
+			return fillTiles( level, x, y, x, y, key );
+		}
+
+		/**
+		 * Fill the rectangle between two corners (inclusive, in either order) with the tile named key, or clear it if key is empty
+		 */
+		bool Lot::fillTiles( unsigned int level, unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2, const std::string& key ) {
+			DirtyRegion region{ level, std::min( x1, x2 ), std::min( y1, y2 ), std::max( x1, x2 ), std::max( y1, y2 ) };
+			if( level >= floorMap->getLevels() || region.xMax >= floorMap->getX() || region.yMax >= floorMap->getY() ) {
+				return false;
+			}
+
+			FloorMap::Index index;
+			if( !findTileIndex( key, index ) ) {
+				return false;
+			}
+
+			for( unsigned int y = region.yMin; y <= region.yMax; y++ ) {
+				for( unsigned int x = region.xMin; x <= region.xMax; x++ ) {
+					floorMap->setIndex( level, x, y, index );
+				}
+			}
+
+			edited = true;
+			return true;
+		}
+
+		bool Lot::setWallSegment( unsigned int level, unsigned int x, unsigned int y, WallGrid::Axis axis, const std::string& front, const std::string& back ) {
+			if( !wallMap->contains( level, x, y ) ) {
+				return false;
+			}
+
+			WallGrid::Index frontIndex;
+			WallGrid::Index backIndex;
+			if( !findWallpaperIndex( front, frontIndex ) || !findWallpaperIndex( back, backIndex ) ) {
+				return false;
+			}
+
+			wallMap->setSegment( level, x, y, axis, frontIndex, backIndex );
+
+			edited = true;
+			return true;
+		}
+
+		bool Lot::removeWallSegment( unsigned int level, unsigned int x, unsigned int y, WallGrid::Axis axis ) {
+			if( !wallMap->contains( level, x, y ) ) {
+				return false;
+			}
+
+			wallMap->removeSegment( level, x, y, axis );
+
+			edited = true;
+			return true;
+		}
+
+		/**
+		 * True once anything has been edited; until then, the lot section of the file it came from is still accurate
+		 */
+		bool Lot::isEdited() const {
+			return edited;
+		}
+
+		void Lot::save( std::ostream& output ) const {
+			output << "{\"floorx\":" << floorX << ",\"floory\":" << floorY << ",\"stories\":" << stories << ",\"subtr\":" << undergroundStories;
+			output << ",\"terrain\":" << ( int ) terrainType << ",\"rot\":" << currentRotation;
+			output << ",\"infr\":{\"floor\":";
+			saveFloorMap( output );
+			output << ",\"wall\":";
+			saveWallMap( output );
+			output << "}}";
+		}
+
+		/**
+		 * Palette index i is written as dict index i - 1, and runs of the same tile are RLE'd
+		 */
+		void Lot::saveFloorMap( std::ostream& output ) const {
+			output << "{\"dict\":[";
+			for( std::size_t i = 1; i < floorMap->getPaletteSize(); i++ ) {
+				output << ( i == 1 ? "" : "," ) << Json::valueToQuotedString( floorMap->getPaletteEntry( i )->id.c_str() );
+			}
+			output << "],\"levels\":[";
+
+			std::size_t width = floorMap->getX();
+			std::size_t levelSize = width * floorMap->getY();
+			for( unsigned int level = 0; level != floorMap->getLevels(); level++ ) {
+				output << ( level ? ",[" : "[" );
+
+				for( std::size_t i = 0; i != levelSize; ) {
+					FloorMap::Index index = floorMap->getIndex( level, i % width, i / width );
+					std::size_t run = 1;
+					while( i + run != levelSize && floorMap->getIndex( level, ( i + run ) % width, ( i + run ) / width ) == index ) {
+						run++;
+					}
+
+					int value = ( int ) index - 1;
+					output << ( i ? "," : "" );
+					if( run > 1 ) {
+						output << "{\"run\":" << run << ",\"value\":" << value << "}";
+					} else {
+						output << value;
+					}
+
+					i += run;
+				}
+
+				output << "]";
+			}
+
+			output << "]}";
+		}
+
+		static void saveWallCell( std::ostream& output, const WallGrid::Cell& cell ) {
+			static const char* AXIS_NAMES[] = { "x", "y", "d", "r" };
+
+			if( !cell.segments ) {
+				output << "-1";
+				return;
+			}
+
+			output << "{";
+			bool first = true;
+			for( unsigned int axis = 0; axis != WallGrid::AXES; axis++ ) {
+				if( cell.hasSegment( ( WallGrid::Axis ) axis ) ) {
+					output << ( first ? "\"" : ",\"" ) << AXIS_NAMES[ axis ] << "\":{\"f\":" << cell.wallpapers[ axis * 2 ] - 1 << ",\"b\":" << cell.wallpapers[ axis * 2 + 1 ] - 1 << "}";
+					first = false;
+				}
+			}
+			output << "}";
+		}
+
+		void Lot::saveWallMap( std::ostream& output ) const {
+			output << "{\"dict\":[";
+			for( std::size_t i = 1; i < wallMap->getPaletteSize(); i++ ) {
+				output << ( i == 1 ? "" : "," ) << Json::valueToQuotedString( wallMap->getPaletteEntry( i )->id.c_str() );
+			}
+			output << "],\"levels\":[";
+
+			std::size_t width = wallMap->getX();
+			std::size_t levelSize = width * wallMap->getY();
+			for( unsigned int level = 0; level != wallMap->getLevels(); level++ ) {
+				output << ( level ? ",[" : "[" );
+
+				for( std::size_t i = 0; i != levelSize; ) {
+					const WallGrid::Cell& cell = wallMap->getPacked( level, i % width, i / width );
+					std::size_t run = 1;
+					while( i + run != levelSize && wallMap->getPacked( level, ( i + run ) % width, ( i + run ) / width ) == cell ) {
+						run++;
+					}
+
+					output << ( i ? "," : "" );
+					if( run > 1 ) {
+						output << "{\"run\":" << run << ",\"value\":";
+						saveWallCell( output, cell );
+						output << "}";
+					} else {
+						saveWallCell( output, cell );
+					}
+
+					i += run;
+				}
 
-			if( index >= 0 ) {
-				entry = lookup.at( index );
+				output << "]";
 			}
 
-			return entry;
+			output << "]}";
 		}
 
 	}
@@ -0,0 +1,195 @@
+#include "scripting/lotcontainer.hpp"
+#include "tools/blockcontainer.hpp"
+#include "tools/jsonreader.hpp"
+#include <jsoncpp/json/json.h>
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr const char* LotContainer::EXTENSION;
+
+    static const char* GRIDS[] = { "floor", "wall" };
+    static const std::string ENGINE_PREFIX = "engine/";
+
+    bool LotContainer::isContainerPath( const std::string& path ) {
+      std::size_t length = std::strlen( EXTENSION );
+      return path.size() >= length && path.compare( path.size() - length, length, EXTENSION ) == 0;
+    }
+
+    std::string LotContainer::levelName( const char* grid, std::size_t level ) {
+      return std::string( "lot/" ) + grid + "/" + std::to_string( level );
+    }
+
+    /**
+     * Find lot.infr.<grid>.levels in the text of a lot section: the byte range of the whole array, and of each level in it
+     */
+    bool LotContainer::findLevels( const std::string& lot, const char* grid, Span& levels, std::vector< Span >& each ) {
+      Tools::JSONReader reader( lot.data(), lot.data() + lot.size() );
+
+      for( const char* wanted : { "infr", grid, "levels" } ) {
+        if( !reader.beginObject() ) {
+          return false;
+        }
+
+        std::string key;
+        bool found = false;
+        while( !found && reader.nextMember( key ) ) {
+          found = key == wanted;
+          if( !found ) {
+            reader.skip();
+          }
+        }
+
+        if( !found ) {
+          return false;
+        }
+      }
+
+      reader.peek();
+      levels.first = reader.getPosition();
+      if( reader.peek() == Tools::JSONReader::Type::ARRAY ) {
+        reader.beginArray();
+        while( reader.nextElement() ) {
+          std::size_t begin = reader.getPosition();
+          reader.skip();
+          each.emplace_back( begin, reader.getPosition() );
+        }
+      } else {
+        reader.skip();
+      }
+      levels.second = reader.getPosition();
+
+      return !reader.hasFailed();
+    }
+
+    /**
+     * Takes the text of a lot file's three sections
+     */
+    bool LotContainer::write( std::ostream& output, const std::string& revision, const std::string& lot, const std::string& engine, bool parallel ) {
+      Tools::BlockContainer::Blocks blocks;
+      blocks.emplace_back( "rev", revision );
+
+      // Each level goes in its own block, and the lot keeps null where its levels were
+      std::vector< Span > removed;
+      for( const char* grid : GRIDS ) {
+        Span levels;
+        std::vector< Span > each;
+        if( !findLevels( lot, grid, levels, each ) ) {
+          continue;
+        }
+
+        for( std::size_t i = 0; i != each.size(); i++ ) {
+          blocks.emplace_back( levelName( grid, i ), lot.substr( each[ i ].first, each[ i ].second - each[ i ].first ) );
+        }
+        removed.push_back( levels );
+      }
+      std::sort( removed.begin(), removed.end() );
+
+      std::string remainder;
+      std::size_t copied = 0;
+      for( const Span& levels : removed ) {
+        remainder.append( lot, copied, levels.first - copied );
+        remainder += "null";
+        copied = levels.second;
+      }
+      remainder.append( lot, copied, std::string::npos );
+      blocks.emplace_back( "lot", std::move( remainder ) );
+
+      // One block per member of the engine section
+      Tools::JSONReader reader( engine.data(), engine.data() + engine.size() );
+      if( reader.beginObject() ) {
+        std::string key;
+        while( reader.nextMember( key ) ) {
+          reader.peek();
+          std::size_t begin = reader.getPosition();
+          reader.skip();
+          blocks.emplace_back( ENGINE_PREFIX + key, engine.substr( begin, reader.getPosition() - begin ) );
+        }
+      }
+
+      if( reader.hasFailed() ) {
+        return false;
+      }
+
+      return Tools::BlockContainer::write( output, blocks, parallel );
+    }
+
+    /**
+     * Decompress the blocks needed for the revision and lot sections (and the engine section, if engine isn't null) all at once, and put
+     * them back together as JSON text
+     */
+    bool LotContainer::read( const Tools::BlockContainer& container, std::string& revision, std::string& lot, std::string* engine ) {
+      std::vector< std::string > wanted = { "rev", "lot" };
+
+      std::vector< std::size_t > levelCounts;
+      for( const char* grid : GRIDS ) {
+        std::size_t count = 0;
+        while( container.hasBlock( levelName( grid, count ) ) ) {
+          wanted.push_back( levelName( grid, count++ ) );
+        }
+        levelCounts.push_back( count );
+      }
+
+      std::vector< std::string > engineKeys;
+      if( engine ) {
+        for( const std::string& name : container.getNames() ) {
+          if( name.compare( 0, ENGINE_PREFIX.size(), ENGINE_PREFIX ) == 0 ) {
+            engineKeys.push_back( name.substr( ENGINE_PREFIX.size() ) );
+            wanted.push_back( name );
+          }
+        }
+      }
+
+      std::vector< std::string > blocks;
+      if( !container.read( wanted, blocks ) ) {
+        return false;
+      }
+
+      revision = std::move( blocks[ 0 ] );
+      std::string remainder = std::move( blocks[ 1 ] );
+      std::size_t next = 2;
+
+      // Put each grid's levels back where the null is
+      std::vector< std::pair< Span, std::string > > restored;
+      for( std::size_t grid = 0; grid != levelCounts.size(); grid++ ) {
+        Span levels;
+        std::vector< Span > each;
+        if( !findLevels( remainder, GRIDS[ grid ], levels, each ) ) {
+          next += levelCounts[ grid ];
+          continue;
+        }
+
+        std::string array = "[";
+        for( std::size_t i = 0; i != levelCounts[ grid ]; i++ ) {
+          array += ( i ? "," : "" ) + blocks[ next++ ];
+        }
+        array += "]";
+        restored.emplace_back( levels, std::move( array ) );
+      }
+      std::sort( restored.begin(), restored.end() );
+
+      lot.clear();
+      std::size_t copied = 0;
+      for( const auto& levels : restored ) {
+        lot.append( remainder, copied, levels.first.first - copied );
+        lot += levels.second;
+        copied = levels.first.second;
+      }
+      lot.append( remainder, copied, std::string::npos );
+
+      if( engine ) {
+        *engine = "{";
+        for( std::size_t i = 0; i != engineKeys.size(); i++ ) {
+          *engine += ( i ? "," : "" ) + Json::valueToQuotedString( engineKeys[ i ].c_str() ) + ":" + blocks[ next++ ];
+        }
+        *engine += "}";
+      }
+
+      return true;
+    }
+
+  }
+}
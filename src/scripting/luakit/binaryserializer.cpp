@@ -0,0 +1,1088 @@
+#include "scripting/luakit/binaryserializer.hpp"
+#include "scripting/luakit/refcache.hpp"
+#include "scripting/engine.hpp"
+#include "scripting/event/waitingtable.hpp"
+#include "scripting/luakit/eventbridge.hpp"
+#include "log.hpp"
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace BlueBear {
+  namespace Scripting {
+    namespace LuaKit {
+
+      constexpr const char BinarySerializer::MAGIC[ 4 ];
+      constexpr std::uint32_t BinarySerializer::VERSION;
+      constexpr const char BinarySerializer::LOG_MAGIC[ 4 ];
+      constexpr std::uint32_t BinarySerializer::LOG_VERSION;
+      constexpr const char* BinarySerializer::CHECKPOINT_IDS;
+
+      BinarySerializer::BinarySerializer( lua_State* L ) : L( L ), checkpointing( false ), nextId( 1 ), changedCount( 0 ) {}
+
+      /**
+       * lua_Writer for lua_dump: append each chunk of bytecode to the std::string passed as userdata
+       */
+      int BinarySerializer::dumpWriter( lua_State*, const void* data, size_t size, void* buffer ) {
+        ( ( std::string* ) buffer )->append( ( const char* ) data, size );
+        return 0;
+      }
+
+      /**
+       * 64-bit FNV-1a, enough to tell whether an object's encoding changed between checkpoints
+       */
+      std::uint64_t BinarySerializer::fingerprint( const char* data, std::size_t length ) {
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+        for( std::size_t i = 0; i != length; i++ ) {
+          hash = ( hash ^ ( unsigned char ) data[ i ] ) * 0x100000001b3ULL;
+        }
+
+        return hash;
+      }
+
+      /**
+       * Add a string to the string table if it isn't there already, and return its index
+       */
+      std::uint32_t BinarySerializer::intern( const char* string, std::size_t length ) {
+        auto result = stringIds.emplace( std::string( string, length ), stringCount );
+
+        if( result.second ) {
+          write< std::uint32_t >( strings, length );
+          strings.append( string, length );
+          stringCount++;
+        }
+
+        return result.first->second;
+      }
+
+      /**
+       * Same substitutions as the JSON Serializer: every registered class, the bluebear table, and _G
+       */
+      void BinarySerializer::buildSubstitutions() {
+        lua_getglobal( L, "bluebear" ); // bluebear
+        lua_getfield( L, -1, "classes" ); // bluebear.classes bluebear
+
+        findClasses(); // bluebear
+
+        substitutions[ lua_topointer( L, -1 ) ] = Substitution{ Tag::ENV_BLUEBEAR, "" };
+        lua_pop( L, 1 ); // EMPTY
+
+        lua_pushglobaltable( L ); // _G
+        substitutions[ lua_topointer( L, -1 ) ] = Substitution{ Tag::ENV_G, "" };
+        lua_pop( L, 1 ); // EMPTY
+      }
+
+      /**
+       * Recursively walk a bluebear.classes namespace table, adding a substitution for each middleclass class found
+       *
+       * STACK ARGS: table
+       * RETURNS: EMPTY
+       */
+      void BinarySerializer::findClasses() {
+        lua_pushnil( L ); // nil table
+        while( lua_next( L, -2 ) ) { // subtable "name" table
+          if( lua_istable( L, -1 ) ) {
+            lua_getfield( L, -1, "__middleclass" ); // boolean subtable "name" table
+            bool isClass = lua_toboolean( L, -1 );
+            lua_pop( L, 1 ); // subtable "name" table
+
+            if( isClass ) {
+              lua_getfield( L, -1, "name" ); // "class.name" subtable "name" table
+              substitutions[ lua_topointer( L, -2 ) ] = Substitution{ Tag::CLASS, lua_tostring( L, -1 ) };
+              lua_pop( L, 2 ); // "name" table
+            } else {
+              findClasses(); // "name" table
+            }
+          } else {
+            lua_pop( L, 1 ); // "name" table
+          }
+        } // table
+
+        lua_pop( L, 1 ); // EMPTY
+      }
+
+      /**
+       * A coroutine can only be saved if the engine started it (and therefore knows its entry function)
+       */
+      bool BinarySerializer::hasCoroutineEntry( int index ) {
+        lua_getfield( L, LUA_REGISTRYINDEX, Engine::COROUTINE_ENTRIES ); // entries
+        lua_pushvalue( L, index ); // thread entries
+        lua_rawget( L, -2 ); // <entry> entries
+        bool result = lua_isfunction( L, -1 );
+        lua_pop( L, 2 ); // EMPTY
+
+        return result;
+      }
+
+      /**
+       * Write the value at index. Tables, functions and threads not seen before are given the next object id and queued on the objects
+       * table; their contents are written later, when the OBJECTS section gets to them.
+       *
+       * (Stack is unmodified after call)
+       */
+      void BinarySerializer::writeValue( std::string& buffer, int index ) {
+        index = lua_absindex( L, index );
+
+        switch( lua_type( L, index ) ) {
+          case LUA_TNIL:
+            write( buffer, Tag::NIL );
+            break;
+          case LUA_TBOOLEAN:
+            write( buffer, lua_toboolean( L, index ) ? Tag::TRUE : Tag::FALSE );
+            break;
+          case LUA_TNUMBER:
+            if( lua_isinteger( L, index ) ) {
+              write( buffer, Tag::INTEGER );
+              write< std::int64_t >( buffer, lua_tointeger( L, index ) );
+            } else {
+              write( buffer, Tag::NUMBER );
+              write< double >( buffer, lua_tonumber( L, index ) );
+            }
+            break;
+          case LUA_TSTRING: {
+            std::size_t length;
+            const char* string = lua_tolstring( L, index, &length );
+
+            write( buffer, Tag::STRING );
+            write< std::uint32_t >( buffer, intern( string, length ) );
+            break;
+          }
+          case LUA_TTABLE:
+          case LUA_TFUNCTION:
+          case LUA_TTHREAD: {
+            const void* pointer = lua_topointer( L, index );
+
+            auto substitution = substitutions.find( pointer );
+            if( substitution != substitutions.end() ) {
+              write( buffer, substitution->second.tag );
+              if( substitution->second.tag == Tag::CLASS ) {
+                const std::string& className = substitution->second.className;
+                write< std::uint32_t >( buffer, intern( className.c_str(), className.length() ) );
+              }
+              break;
+            }
+
+            auto existing = objectIds.find( pointer );
+            if( existing != objectIds.end() ) {
+              write( buffer, Tag::REF );
+              write< std::uint32_t >( buffer, existing->second );
+              break;
+            }
+
+            if( lua_iscfunction( L, index ) || ( lua_isthread( L, index ) && !hasCoroutineEntry( index ) ) ) {
+              Log::getInstance().warn( "LuaKit::BinarySerializer::writeValue", std::string( "Can't save this " ) + luaL_typename( L, index ) + "; it will be loaded as nil" );
+              write( buffer, Tag::NIL );
+              break;
+            }
+
+            std::uint32_t id = objectIds[ pointer ] = checkpointing ? stableId( index ) : objectCount + 1;
+            discoveredIds.push_back( id );
+            lua_pushvalue( L, index ); // value
+            lua_rawseti( L, objectsIndex, ++objectCount ); // EMPTY
+
+            write( buffer, Tag::REF );
+            write< std::uint32_t >( buffer, id );
+            break;
+          }
+          default:
+            Log::getInstance().warn( "LuaKit::BinarySerializer::writeValue", std::string( "Can't save a value of type " ) + luaL_typename( L, index ) + "; it will be loaded as nil" );
+            write( buffer, Tag::NIL );
+        }
+      }
+
+      /**
+       * Write each key/value pair of the table on top of the stack, preceded by their count
+       *
+       * STACK ARGS: table
+       * (Stack is unmodified after call)
+       */
+      void BinarySerializer::writeEntries( std::string& buffer, bool skipClass ) {
+        std::size_t countOffset = buffer.size();
+        std::uint32_t count = 0;
+        write< std::uint32_t >( buffer, 0 );
+
+        lua_pushnil( L ); // nil table
+        while( lua_next( L, -2 ) ) { // value key table
+          // The "class" field of an instance is put back by Class:new
+          if( !( skipClass && lua_type( L, -2 ) == LUA_TSTRING && !std::strcmp( lua_tostring( L, -2 ), "class" ) ) ) {
+            writeValue( buffer, -2 );
+            writeValue( buffer, -1 );
+            count++;
+          }
+
+          lua_pop( L, 1 ); // key table
+        } // table
+
+        patch( buffer, countOffset, count );
+      }
+
+      /**
+       * Write one record of the OBJECTS section
+       *
+       * STACK ARGS: object
+       * RETURNS: EMPTY
+       */
+      void BinarySerializer::writeObject( std::string& buffer ) {
+        std::size_t kindOffset = buffer.size();
+        write( buffer, Kind::TABLE );
+        write< std::uint32_t >( buffer, 0 );
+        std::size_t bodyOffset = buffer.size();
+
+        switch( lua_type( L, -1 ) ) {
+          case LUA_TTABLE: {
+            // Instances of a class are recreated from the class, then have their fields overlaid
+            std::string className;
+            lua_getfield( L, -1, "class" ); // Class table
+            if( lua_istable( L, -1 ) ) {
+              lua_getfield( L, -1, "__middleclass" ); // boolean Class table
+              if( lua_toboolean( L, -1 ) ) {
+                lua_getfield( L, -2, "name" ); // "name" boolean Class table
+                if( lua_isstring( L, -1 ) ) {
+                  className = lua_tostring( L, -1 );
+                }
+                lua_pop( L, 1 ); // boolean Class table
+              }
+              lua_pop( L, 1 ); // Class table
+            }
+            lua_pop( L, 1 ); // table
+
+            if( !className.empty() ) {
+              patch( buffer, kindOffset, Kind::ITABLE );
+              write< std::uint32_t >( buffer, intern( className.c_str(), className.length() ) );
+              writeEntries( buffer, true );
+            } else {
+              // Entry count comes first, so the loader can size the table when it creates it
+              std::size_t countOffset = buffer.size();
+              write< std::uint32_t >( buffer, 0 );
+
+              if( lua_getmetatable( L, -1 ) ) { // metatable table
+                writeValue( buffer, -1 );
+                lua_pop( L, 1 ); // table
+              } else {
+                write( buffer, Tag::NIL );
+              }
+
+              std::uint32_t count = 0;
+              lua_pushnil( L ); // nil table
+              while( lua_next( L, -2 ) ) { // value key table
+                writeValue( buffer, -2 );
+                writeValue( buffer, -1 );
+                count++;
+
+                lua_pop( L, 1 ); // key table
+              } // table
+
+              patch( buffer, countOffset, count );
+            }
+            break;
+          }
+          case LUA_TFUNCTION: {
+            // Functions made by bluebear.util.bind are saved as their class and method name, same as sfunctions in the JSON format
+            const char* derivedClass = nullptr;
+            const char* derivedFunc = nullptr;
+            bool hasArgs = false;
+            for( int i = 1; const char* name = lua_getupvalue( L, -1, i ); i++ ) { // upvalue function
+              if( !std::strcmp( name, "__derived_class" ) && lua_type( L, -1 ) == LUA_TSTRING ) {
+                derivedClass = lua_tostring( L, -1 );
+              } else if( !std::strcmp( name, "__derived_func" ) && lua_type( L, -1 ) == LUA_TSTRING ) {
+                derivedFunc = lua_tostring( L, -1 );
+              } else if( !std::strcmp( name, "args" ) ) {
+                hasArgs = true;
+              }
+
+              // Upvalue strings stay alive as long as the function does
+              lua_pop( L, 1 ); // function
+            }
+
+            if( derivedClass && derivedFunc && hasArgs ) {
+              patch( buffer, kindOffset, Kind::SFUNCTION );
+              write< std::uint32_t >( buffer, intern( derivedClass, std::strlen( derivedClass ) ) );
+              write< std::uint32_t >( buffer, intern( derivedFunc, std::strlen( derivedFunc ) ) );
+
+              for( int i = 1; const char* name = lua_getupvalue( L, -1, i ); i++ ) { // upvalue function
+                if( !std::strcmp( name, "args" ) ) {
+                  writeValue( buffer, -1 );
+                  lua_pop( L, 1 ); // function
+                  break;
+                }
+
+                lua_pop( L, 1 ); // function
+              }
+            } else {
+              patch( buffer, kindOffset, Kind::FUNCTION );
+
+              // Closures of the same function literal have identical bytecode; it goes into the BYTECODE section once
+              std::string dumped;
+              lua_dump( L, dumpWriter, &dumped, 0 );
+              auto result = bytecodeIds.emplace( std::move( dumped ), bytecodeCount );
+              if( result.second ) {
+                write< std::uint32_t >( bytecode, result.first->first.size() );
+                bytecode.append( result.first->first );
+                bytecodeCount++;
+              }
+              write< std::uint32_t >( buffer, result.first->second );
+
+              std::size_t countOffset = buffer.size();
+              std::uint32_t count = 0;
+              write< std::uint32_t >( buffer, 0 );
+              while( lua_getupvalue( L, -1, count + 1 ) ) { // upvalue function
+                writeValue( buffer, -1 );
+                lua_pop( L, 1 ); // function
+                count++;
+              }
+              patch( buffer, countOffset, count );
+            }
+            break;
+          }
+          case LUA_TTHREAD: {
+            patch( buffer, kindOffset, Kind::THREAD );
+
+            lua_getfield( L, LUA_REGISTRYINDEX, Engine::COROUTINE_ENTRIES ); // entries thread
+            lua_pushvalue( L, -2 ); // thread entries thread
+            lua_rawget( L, -2 ); // <entry> entries thread
+            writeValue( buffer, -1 );
+            lua_pop( L, 2 ); // thread
+            break;
+          }
+        }
+
+        patch< std::uint32_t >( buffer, kindOffset + sizeof( Kind ), buffer.size() - bodyOffset );
+
+        lua_pop( L, 1 ); // EMPTY
+      }
+
+      void BinarySerializer::writeSection( std::string& output, Section section, const std::string& body ) {
+        write( output, section );
+        write< std::uint32_t >( output, body.size() );
+        output.append( body );
+      }
+
+      /**
+       * The id this object has had since the log's last full checkpoint, or a new one
+       */
+      std::uint32_t BinarySerializer::stableId( int index ) {
+        lua_getfield( L, LUA_REGISTRYINDEX, CHECKPOINT_IDS ); // ids
+        lua_pushvalue( L, index ); // object ids
+        lua_rawget( L, -2 ); // id ids
+
+        std::uint32_t id;
+        if( lua_isinteger( L, -1 ) ) {
+          id = lua_tointeger( L, -1 );
+          lua_pop( L, 1 ); // ids
+        } else {
+          lua_pop( L, 1 ); // ids
+          id = nextId++;
+          lua_pushvalue( L, index ); // object ids
+          lua_pushinteger( L, id ); // id object ids
+          lua_rawset( L, -3 ); // ids
+        }
+
+        lua_pop( L, 1 ); // EMPTY
+        return id;
+      }
+
+      /**
+       * Save everything reachable from the engine's entities and pending timers. Unlike the JSON Serializer, the registry isn't scanned:
+       * anything the world still needs is reachable from one of those two.
+       */
+      std::string BinarySerializer::saveWorld( Engine& engine ) {
+        stringIds.clear();
+        strings.clear();
+        stringCount = 0;
+        bytecodeIds.clear();
+        bytecode.clear();
+        bytecodeCount = 0;
+        checkpointing = false;
+
+        return writeWorld( engine );
+      }
+
+      /**
+       * Write one segment of a checkpoint log. A full checkpoint starts a new log: ids, strings and bytecode start over, and every
+       * object is written. Otherwise, only objects whose encoding differs from the previous checkpoint are, and only strings and
+       * bytecode that earlier segments didn't have.
+       *
+       * The same BinarySerializer has to write every segment of a log.
+       */
+      std::string BinarySerializer::saveCheckpoint( Engine& engine, bool full ) {
+        lua_getfield( L, LUA_REGISTRYINDEX, CHECKPOINT_IDS ); // ids
+        bool haveIds = lua_istable( L, -1 );
+        lua_pop( L, 1 ); // EMPTY
+
+        if( full || !haveIds ) {
+          lua_newtable( L ); // ids
+          lua_createtable( L, 0, 1 ); // metatable ids
+          lua_pushstring( L, "k" ); // "k" metatable ids
+          lua_setfield( L, -2, "__mode" ); // metatable ids
+          lua_setmetatable( L, -2 ); // ids
+          lua_setfield( L, LUA_REGISTRYINDEX, CHECKPOINT_IDS ); // EMPTY
+
+          nextId = 1;
+          stringIds.clear();
+          stringCount = 0;
+          bytecodeIds.clear();
+          bytecodeCount = 0;
+          fingerprints.clear();
+        }
+
+        strings.clear();
+        bytecode.clear();
+        checkpointing = true;
+
+        std::string segment = writeWorld( engine );
+
+        checkpointing = false;
+        return segment;
+      }
+
+      /**
+       * Number of objects the last checkpoint wrote
+       */
+      std::uint32_t BinarySerializer::getChangedCount() const {
+        return changedCount;
+      }
+
+      /**
+       * The start of a checkpoint log file; each segment then follows as a u32 length and the segment
+       */
+      std::string BinarySerializer::getLogHeader() {
+        std::string header( LOG_MAGIC, sizeof( LOG_MAGIC ) );
+        write( header, LOG_VERSION );
+        return header;
+      }
+
+      std::string BinarySerializer::writeWorld( Engine& engine ) {
+        // Objects are anchored in the objects table as they're found, but there's no point letting the collector walk the state meanwhile
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
+        lua_gc( L, LUA_GCSTOP, 0 );
+
+        objectCount = 0;
+        objectIds.clear();
+        discoveredIds.clear();
+        substitutions.clear();
+
+        std::uint32_t stringBase = stringCount;
+        std::uint32_t bytecodeBase = bytecodeCount;
+
+        buildSubstitutions();
+
+        lua_newtable( L ); // objects
+        objectsIndex = lua_gettop( L );
+
+        std::string entities;
+        write< std::uint32_t >( entities, engine.objects.size() );
+        for( LuaReference object : engine.objects ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object objects
+          writeValue( entities, -1 );
+          lua_pop( L, 1 ); // objects
+        }
+
+        std::string timers;
+        std::uint32_t timerCount = 0;
+        write< std::uint32_t >( timers, 0 );
+        engine.waitingTable.eachTimer( [ & ]( Tick deadline, LuaReference callback ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, callback ); // callback objects
+          write< std::uint64_t >( timers, deadline );
+          writeValue( timers, -1 );
+          lua_pop( L, 1 ); // objects
+          timerCount++;
+        } );
+        patch( timers, 0, timerCount );
+
+        std::string waiters;
+        std::uint32_t waiterCount = 0;
+        write< std::uint32_t >( waiters, 0 );
+        engine.eventBridge->eachWaiter( [ & ]( const std::string& eventId, LuaReference waiter ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, waiter ); // thread objects
+          write< std::uint32_t >( waiters, intern( eventId.c_str(), eventId.size() ) );
+          writeValue( waiters, -1 );
+          lua_pop( L, 1 ); // objects
+          waiterCount++;
+        } );
+        patch( waiters, 0, waiterCount );
+
+        // Writing an object can find more objects; objectCount keeps growing until everything reachable has been written
+        std::string objects;
+        write< std::uint32_t >( objects, 0 );
+        if( checkpointing ) {
+          // Every object is still encoded (that's how changes are found), but unchanged ones are dropped again
+          std::unordered_map< std::uint32_t, std::uint64_t > current;
+          changedCount = 0;
+
+          for( std::uint32_t i = 1; i <= objectCount; i++ ) {
+            std::uint32_t id = discoveredIds[ i - 1 ];
+            std::size_t recordOffset = objects.size();
+            write< std::uint32_t >( objects, id );
+
+            lua_rawgeti( L, objectsIndex, i ); // object objects
+            writeObject( objects ); // objects
+
+            std::uint64_t hash = fingerprint( objects.data() + recordOffset + sizeof( std::uint32_t ), objects.size() - recordOffset - sizeof( std::uint32_t ) );
+            auto previous = fingerprints.find( id );
+            if( previous != fingerprints.end() && previous->second == hash ) {
+              objects.resize( recordOffset );
+            } else {
+              changedCount++;
+            }
+
+            current[ id ] = hash;
+          }
+
+          // Objects that weren't reached this time are gone; forget them
+          fingerprints.swap( current );
+          patch( objects, 0, changedCount );
+        } else {
+          for( std::uint32_t id = 1; id <= objectCount; id++ ) {
+            lua_rawgeti( L, objectsIndex, id ); // object objects
+            writeObject( objects ); // objects
+          }
+          patch( objects, 0, objectCount );
+        }
+
+        lua_pop( L, 1 ); // EMPTY
+
+        std::string engineSection;
+        write< std::uint64_t >( engineSection, engine.currentTick );
+
+        std::string stringSection;
+        write< std::uint32_t >( stringSection, stringCount - stringBase );
+        stringSection.append( strings );
+
+        std::string bytecodeSection;
+        write< std::uint32_t >( bytecodeSection, bytecodeCount - bytecodeBase );
+        bytecodeSection.append( bytecode );
+
+        std::string output( MAGIC, sizeof( MAGIC ) );
+        write( output, VERSION );
+        writeSection( output, Section::STRINGS, stringSection );
+        writeSection( output, Section::BYTECODE, bytecodeSection );
+        writeSection( output, checkpointing ? Section::RECORDS : Section::OBJECTS, objects );
+        writeSection( output, Section::ENTITIES, entities );
+        writeSection( output, Section::TIMERS, timers );
+        writeSection( output, Section::WAITERS, waiters );
+        writeSection( output, Section::ENGINE_STATE, engineSection );
+
+        if( collectorRunning ) {
+          lua_gc( L, LUA_GCRESTART, 0 );
+        }
+
+        return output;
+      }
+
+      void BinarySerializer::pushString( std::uint32_t index ) {
+        if( index >= stringTable.size() ) {
+          throw FormatException();
+        }
+
+        lua_pushlstring( L, stringTable[ index ].first, stringTable[ index ].second );
+      }
+
+      /**
+       * STACK ARGS: none
+       * RETURNS: Class (nil if it isn't loaded)
+       */
+      void BinarySerializer::pushClass( std::uint32_t className ) {
+        lua_getglobal( L, "bluebear" ); // bluebear
+        lua_getfield( L, -1, "get_class" ); // <bluebear.get_class> bluebear
+        pushString( className ); // "classID" <bluebear.get_class> bluebear
+
+        if( lua_pcall( L, 1, 1, 0 ) != 0 ) { // "error" bluebear
+          Log::getInstance().error( "LuaKit::BinarySerializer::pushClass", "Class " + std::string( stringTable[ className ].first, stringTable[ className ].second ) + " doesn't appear to be loaded!" );
+          lua_pop( L, 1 ); // bluebear
+          lua_pushnil( L ); // nil bluebear
+        } // Class bluebear
+
+        lua_remove( L, -2 ); // Class
+      }
+
+      /**
+       * STACK ARGS: none
+       * RETURNS: value
+       */
+      void BinarySerializer::readValue() {
+        switch( read< Tag >() ) {
+          case Tag::NIL:
+            lua_pushnil( L );
+            break;
+          case Tag::FALSE:
+            lua_pushboolean( L, 0 );
+            break;
+          case Tag::TRUE:
+            lua_pushboolean( L, 1 );
+            break;
+          case Tag::INTEGER:
+            lua_pushinteger( L, read< std::int64_t >() );
+            break;
+          case Tag::NUMBER:
+            lua_pushnumber( L, read< double >() );
+            break;
+          case Tag::STRING:
+            pushString( read< std::uint32_t >() );
+            break;
+          case Tag::REF: {
+            std::uint32_t id = read< std::uint32_t >();
+            if( id == 0 || id > objectCount ) {
+              throw FormatException();
+            }
+            lua_rawgeti( L, objectsIndex, id );
+            break;
+          }
+          case Tag::CLASS:
+            pushClass( read< std::uint32_t >() );
+            break;
+          case Tag::ENV_BLUEBEAR:
+            lua_getglobal( L, "bluebear" );
+            break;
+          case Tag::ENV_G:
+            lua_pushglobaltable( L );
+            break;
+          default:
+            throw FormatException();
+        }
+      }
+
+      /**
+       * First pass over an object record: create the object without any of its contents, since those may refer to objects further on.
+       *
+       * STACK ARGS: none
+       * RETURNS: object (nil if it couldn't be created)
+       */
+      void BinarySerializer::createObject( Kind kind ) {
+        switch( kind ) {
+          case Kind::TABLE:
+            lua_createtable( L, 0, read< std::uint32_t >() );
+            break;
+          case Kind::ITABLE: {
+            std::uint32_t className = read< std::uint32_t >();
+            pushClass( className ); // Class
+
+            if( lua_isnil( L, -1 ) ) {
+              break;
+            }
+
+            // "new" for any object shouldn't take any arguments
+            lua_getfield( L, -1, "new" ); // <Class.new> Class
+            lua_insert( L, -2 ); // Class <Class.new>
+
+            if( lua_pcall( L, 1, 1, 0 ) != 0 ) { // "error"
+              Log::getInstance().error( "LuaKit::BinarySerializer::createObject", "Could not initialize class: " + std::string( lua_tostring( L, -1 ) ) );
+              lua_pop( L, 1 ); // EMPTY
+              lua_pushnil( L ); // nil
+            } // instance
+            break;
+          }
+          case Kind::FUNCTION: {
+            const char* body;
+            std::uint32_t length;
+            if( version == 1 ) {
+              // Version 1 kept bytecode inline
+              length = read< std::uint32_t >();
+              if( ( std::size_t )( end - cursor ) < length ) {
+                throw FormatException();
+              }
+              body = cursor;
+            } else {
+              std::uint32_t index = read< std::uint32_t >();
+              if( index >= bytecodeTable.size() ) {
+                throw FormatException();
+              }
+              body = bytecodeTable[ index ].first;
+              length = bytecodeTable[ index ].second;
+            }
+
+            if( luaL_loadbufferx( L, body, length, "=__serialized_lua_chunk", "b" ) != LUA_OK ) { // "error"
+              Log::getInstance().error( "LuaKit::BinarySerializer::createObject", "Could not load function: " + std::string( lua_tostring( L, -1 ) ) );
+              lua_pop( L, 1 ); // EMPTY
+              lua_pushnil( L ); // nil
+            } // <function>
+            break;
+          }
+          case Kind::SFUNCTION: {
+            std::uint32_t derivedClass = read< std::uint32_t >();
+            std::uint32_t derivedFunc = read< std::uint32_t >();
+            if( derivedClass >= stringTable.size() || derivedFunc >= stringTable.size() ) {
+              throw FormatException();
+            }
+
+            std::string key = std::string( stringTable[ derivedClass ].first, stringTable[ derivedClass ].second ) + ":" +
+              std::string( stringTable[ derivedFunc ].first, stringTable[ derivedFunc ].second );
+
+            RefCache::push( L, RefCache::Entry::BIND ); // <bind>
+            lua_pushstring( L, key.c_str() ); // "namespace.class:method" <bind>
+
+            if( lua_pcall( L, 1, 1, 0 ) != 0 ) { // "error"
+              Log::getInstance().error( "LuaKit::BinarySerializer::createObject", "Error creating sfunction: " + std::string( lua_tostring( L, -1 ) ) );
+              lua_pop( L, 1 ); // EMPTY
+              lua_pushnil( L ); // nil
+            } // <bound>
+            break;
+          }
+          case Kind::THREAD:
+            lua_newthread( L );
+            break;
+          default:
+            throw FormatException();
+        }
+      }
+
+      /**
+       * Read count key/value pairs into the table on top of the stack. rawset restores exactly what was saved, even through a
+       * __newindex.
+       *
+       * STACK ARGS: table
+       * (Stack is unmodified after call)
+       */
+      void BinarySerializer::readEntries( std::uint32_t count ) {
+        bool isTable = lua_istable( L, -1 );
+
+        for( std::uint32_t i = 0; i != count; i++ ) {
+          readValue(); // key table
+          readValue(); // value key table
+
+          if( isTable && !lua_isnil( L, -2 ) ) {
+            lua_rawset( L, -3 ); // table
+          } else {
+            lua_pop( L, 2 ); // table
+          }
+        }
+      }
+
+      /**
+       * Set the upvalue called name on the function below it to the value on top of the stack
+       *
+       * STACK ARGS: value function
+       * RETURNS: function
+       */
+      void BinarySerializer::setUpvalueByName( const char* name ) {
+        for( int i = 1; const char* upvalue = lua_getupvalue( L, -2, i ); i++ ) { // upvalue value function
+          lua_pop( L, 1 ); // value function
+
+          if( !std::strcmp( upvalue, name ) ) {
+            lua_setupvalue( L, -2, i ); // function
+            return;
+          }
+        }
+
+        lua_pop( L, 1 ); // function
+      }
+
+      /**
+       * Second pass over an object record: now that every object exists, fill in its contents.
+       *
+       * STACK ARGS: object
+       * (Stack is unmodified after call)
+       */
+      void BinarySerializer::fillObject( Kind kind ) {
+        switch( kind ) {
+          case Kind::TABLE: {
+            std::uint32_t count = read< std::uint32_t >();
+
+            readValue(); // metatable table
+            if( lua_istable( L, -1 ) && lua_istable( L, -2 ) ) {
+              lua_setmetatable( L, -2 ); // table
+            } else {
+              lua_pop( L, 1 ); // table
+            }
+
+            readEntries( count );
+            break;
+          }
+          case Kind::ITABLE:
+            read< std::uint32_t >();
+            readEntries( read< std::uint32_t >() );
+            break;
+          case Kind::FUNCTION: {
+            std::uint32_t length = read< std::uint32_t >();
+            if( version == 1 ) {
+              if( ( std::size_t )( end - cursor ) < length ) {
+                throw FormatException();
+              }
+              cursor += length;
+            }
+
+            std::uint32_t count = read< std::uint32_t >();
+            for( std::uint32_t i = 1; i <= count; i++ ) {
+              readValue(); // upvalue <function>
+              if( !lua_isfunction( L, -2 ) || !lua_setupvalue( L, -2, i ) ) {
+                lua_pop( L, 1 ); // <function>
+              }
+            }
+            break;
+          }
+          case Kind::SFUNCTION:
+            read< std::uint32_t >();
+            read< std::uint32_t >();
+
+            readValue(); // args <bound>
+            if( lua_isfunction( L, -2 ) ) {
+              setUpvalueByName( "args" ); // <bound>
+            } else {
+              lua_pop( L, 1 ); // nil
+            }
+            break;
+          case Kind::THREAD: {
+            readValue(); // <entry> thread
+            if( !lua_isfunction( L, -1 ) ) {
+              lua_pop( L, 1 ); // thread
+              break;
+            }
+
+            // Same as the JSON Serializer: the coroutine starts its entry function again from the top when next resumed
+            lua_getfield( L, LUA_REGISTRYINDEX, Engine::COROUTINE_ENTRIES ); // entries <entry> thread
+            lua_pushvalue( L, -3 ); // thread entries <entry> thread
+            lua_pushvalue( L, -3 ); // <entry> thread entries <entry> thread
+            lua_rawset( L, -3 ); // entries <entry> thread
+            lua_pop( L, 1 ); // <entry> thread
+
+            lua_xmove( L, lua_tothread( L, -2 ), 1 ); // thread
+            break;
+          }
+          default:
+            throw FormatException();
+        }
+      }
+
+      /**
+       * Make section the one being read
+       */
+      void BinarySerializer::enter( Segment& segment, Section section ) {
+        cursor = segment.sections[ ( unsigned int ) section ].first;
+        end = segment.sections[ ( unsigned int ) section ].second;
+        if( !cursor ) {
+          throw FormatException();
+        }
+      }
+
+      /**
+       * Index one "BBW" container: add its strings and bytecode to the tables, and its objects to records (replacing any earlier
+       * record with the same id). Entities, timers and engine state are only located; the caller reads those from the last segment.
+       */
+      void BinarySerializer::readSegment( const char* begin, const char* segmentEnd, Segment& segment ) {
+        cursor = begin;
+        end = segmentEnd;
+
+        if( ( std::size_t )( end - cursor ) < sizeof( MAGIC ) || std::memcmp( cursor, MAGIC, sizeof( MAGIC ) ) ) {
+          throw FormatException();
+        }
+        cursor += sizeof( MAGIC );
+
+        segment.version = read< std::uint32_t >();
+        if( segment.version == 0 || segment.version > VERSION ) {
+          Log::getInstance().error( "LuaKit::BinarySerializer::readSegment", "Unsupported world version " + std::to_string( segment.version ) );
+          throw FormatException();
+        }
+
+        // Sections are processed in a fixed order no matter how they're laid out; unknown sections are skipped
+        for( auto& section : segment.sections ) {
+          section = { nullptr, nullptr };
+        }
+        while( cursor != end ) {
+          std::uint8_t section = read< std::uint8_t >();
+          std::uint32_t length = read< std::uint32_t >();
+          if( ( std::size_t )( end - cursor ) < length ) {
+            throw FormatException();
+          }
+
+          if( section >= ( std::uint8_t ) Section::STRINGS && section <= ( std::uint8_t ) Section::WAITERS ) {
+            segment.sections[ section ] = { cursor, cursor + length };
+          }
+          cursor += length;
+        }
+
+        // Strings point straight into data rather than being copied
+        enter( segment, Section::STRINGS );
+        std::size_t stringBase = stringTable.size();
+        stringTable.resize( stringBase + read< std::uint32_t >() );
+        for( std::size_t i = stringBase; i != stringTable.size(); i++ ) {
+          std::uint32_t length = read< std::uint32_t >();
+          if( ( std::size_t )( end - cursor ) < length ) {
+            throw FormatException();
+          }
+
+          stringTable[ i ] = { cursor, length };
+          cursor += length;
+        }
+
+        // Bytecode also stays in data; luaL_loadbufferx reads it from there
+        if( segment.version >= 2 ) {
+          enter( segment, Section::BYTECODE );
+          std::size_t bytecodeBase = bytecodeTable.size();
+          bytecodeTable.resize( bytecodeBase + read< std::uint32_t >() );
+          for( std::size_t i = bytecodeBase; i != bytecodeTable.size(); i++ ) {
+            std::uint32_t length = read< std::uint32_t >();
+            if( ( std::size_t )( end - cursor ) < length ) {
+              throw FormatException();
+            }
+
+            bytecodeTable[ i ] = { cursor, length };
+            cursor += length;
+          }
+        }
+
+        // A plain save numbers its objects 1, 2, 3...; checkpoint records carry their ids
+        bool explicitIds = segment.sections[ ( unsigned int ) Section::RECORDS ].first != nullptr;
+        enter( segment, explicitIds ? Section::RECORDS : Section::OBJECTS );
+        std::uint32_t count = read< std::uint32_t >();
+        for( std::uint32_t i = 1; i <= count; i++ ) {
+          std::uint32_t id = explicitIds ? read< std::uint32_t >() : i;
+          Kind kind = read< Kind >();
+          std::uint32_t length = read< std::uint32_t >();
+          if( id == 0 || ( std::size_t )( end - cursor ) < length ) {
+            throw FormatException();
+          }
+
+          records[ id ] = Record{ kind, cursor, cursor + length, segment.version };
+          objectCount = std::max( objectCount, id );
+          cursor += length;
+        }
+      }
+
+      /**
+       * Load a world written by saveWorld, or a checkpoint log written by saveCheckpoint, into the engine. The engine is expected to
+       * have no objects already.
+       */
+      bool BinarySerializer::loadWorld( const std::string& data, Engine& engine ) {
+        int base = lua_gettop( L );
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
+        lua_gc( L, LUA_GCSTOP, 0 );
+
+        bool result = true;
+        stringTable.clear();
+        bytecodeTable.clear();
+        records.clear();
+        objectCount = 0;
+
+        try {
+          Segment segment;
+
+          if( data.size() >= sizeof( LOG_MAGIC ) && !std::memcmp( data.data(), LOG_MAGIC, sizeof( LOG_MAGIC ) ) ) {
+            const char* logCursor = data.data() + sizeof( LOG_MAGIC );
+            const char* logEnd = data.data() + data.size();
+
+            cursor = logCursor;
+            end = logEnd;
+            std::uint32_t logVersion = read< std::uint32_t >();
+            if( logVersion != LOG_VERSION ) {
+              Log::getInstance().error( "LuaKit::BinarySerializer::loadWorld", "Unsupported log version " + std::to_string( logVersion ) );
+              throw FormatException();
+            }
+            logCursor = cursor;
+
+            bool anySegment = false;
+            while( logCursor != logEnd ) {
+              cursor = logCursor;
+              end = logEnd;
+              std::uint32_t length = read< std::uint32_t >();
+              if( ( std::size_t )( end - cursor ) < length ) {
+                // A checkpoint cut off partway through being appended; everything before it is still good
+                Log::getInstance().warn( "LuaKit::BinarySerializer::loadWorld", "Ignoring truncated checkpoint at the end of the log" );
+                break;
+              }
+
+              logCursor = cursor + length;
+              readSegment( cursor, logCursor, segment );
+              anySegment = true;
+            }
+
+            if( !anySegment ) {
+              throw FormatException();
+            }
+          } else {
+            readSegment( data.data(), data.data() + data.size(), segment );
+          }
+
+          lua_createtable( L, objectCount, 0 ); // objects
+          objectsIndex = lua_gettop( L );
+
+          for( auto& pair : records ) {
+            cursor = pair.second.body;
+            end = pair.second.end;
+            version = pair.second.version;
+
+            createObject( pair.second.kind ); // object objects
+            lua_rawseti( L, objectsIndex, pair.first ); // objects
+          }
+
+          for( auto& pair : records ) {
+            cursor = pair.second.body;
+            end = pair.second.end;
+            version = pair.second.version;
+
+            lua_rawgeti( L, objectsIndex, pair.first ); // object objects
+            fillObject( pair.second.kind ); // object objects
+            lua_pop( L, 1 ); // objects
+          }
+
+          enter( segment, Section::ENTITIES );
+          std::uint32_t entityCount = read< std::uint32_t >();
+          for( std::uint32_t i = 0; i != entityCount; i++ ) {
+            readValue(); // entity objects
+            if( lua_istable( L, -1 ) ) {
+              engine.addObject( luaL_ref( L, LUA_REGISTRYINDEX ) ); // objects
+            } else {
+              lua_pop( L, 1 ); // objects
+            }
+          }
+
+          enter( segment, Section::TIMERS );
+          std::uint32_t timerCount = read< std::uint32_t >();
+          for( std::uint32_t i = 0; i != timerCount; i++ ) {
+            Tick deadline = read< std::uint64_t >();
+            readValue(); // callback objects
+            if( lua_isnil( L, -1 ) ) {
+              lua_pop( L, 1 ); // objects
+            } else {
+              engine.waitingTable.waitForTick( deadline, luaL_ref( L, LUA_REGISTRYINDEX ) ); // objects
+            }
+          }
+
+          // Worlds saved before coroutines could be parked on events don't have any
+          if( segment.sections[ ( unsigned int ) Section::WAITERS ].first ) {
+            enter( segment, Section::WAITERS );
+            std::uint32_t waiterCount = read< std::uint32_t >();
+            for( std::uint32_t i = 0; i != waiterCount; i++ ) {
+              std::uint32_t eventId = read< std::uint32_t >();
+              if( eventId >= stringTable.size() ) {
+                throw FormatException();
+              }
+
+              readValue(); // thread objects
+              if( !lua_isthread( L, -1 ) ) {
+                lua_pop( L, 1 ); // objects
+                continue;
+              }
+
+              LuaReference waiter = luaL_ref( L, LUA_REGISTRYINDEX ); // objects
+              if( !engine.eventBridge->addWaiter( std::string( stringTable[ eventId ].first, stringTable[ eventId ].second ), waiter ) ) {
+                luaL_unref( L, LUA_REGISTRYINDEX, waiter );
+              }
+            }
+          }
+
+          enter( segment, Section::ENGINE_STATE );
+          engine.currentTick = read< std::uint64_t >();
+        } catch( FormatException& e ) {
+          Log::getInstance().error( "LuaKit::BinarySerializer::loadWorld", e.what() );
+          result = false;
+        }
+
+        lua_settop( L, base ); // EMPTY
+        stringTable.clear();
+        bytecodeTable.clear();
+        records.clear();
+
+        if( collectorRunning ) {
+          lua_gc( L, LUA_GCRESTART, 0 );
+        }
+
+        return result;
+      }
+
+    }
+  }
+}
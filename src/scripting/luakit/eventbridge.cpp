@@ -1,4 +1,5 @@
 #include "scripting/luakit/eventbridge.hpp"
+#include "scripting/luakit/refcache.hpp"
 #include "scripting/engine.hpp"
 #include "tools/ctvalidators.hpp"
 #include "tools/utility.hpp"
@@ -15,7 +16,51 @@ namespace BlueBear {
       EventBridge::EventBridge( lua_State* L, Engine& engine ) : engine( engine ), L( L ) {
         // TODO: Register one of each exposable EventManager type here
         // and in the callbacks, call the trigger method
-        eventManager.MESSAGE_LOGGED.listen( this, std::bind( &EventBridge::fireEvents, this, std::ref( messageLogged ), std::placeholders::_1 ) );
+        eventManager.MESSAGE_LOGGED.listen( this, std::bind( &EventBridge::queueMessage, this, std::placeholders::_1 ) );
+      }
+
+      /**
+       * Log::out keeps calling whoever is listening, so an engine that's gone (the benchmarks make one after another) must stop listening
+       */
+      EventBridge::~EventBridge() {
+        eventManager.MESSAGE_LOGGED.stopListening( this );
+      }
+
+      constexpr const std::size_t EventBridge::MAX_QUEUED_MESSAGES;
+
+      /**
+       * May be called from any thread (Log::out is); nothing here touches the lua_State. Once MAX_QUEUED_MESSAGES are waiting, the oldest
+       * is dropped for each new one.
+       */
+      void EventBridge::queueMessage( const std::string& logMessage ) {
+        std::unique_lock< std::mutex > lock( queueMutex );
+
+        if( queuedMessages.size() == MAX_QUEUED_MESSAGES ) {
+          queuedMessages.pop_front();
+        }
+
+        queuedMessages.push_back( logMessage );
+      }
+
+      /**
+       * Called by the engine at the top of each tick. Messages logged by the listeners themselves are left for the next tick.
+       */
+      void EventBridge::dispatchQueuedMessages() {
+        std::deque< std::string > messages;
+
+        {
+          std::unique_lock< std::mutex > lock( queueMutex );
+          std::swap( messages, queuedMessages );
+        }
+
+        if( messageLogged.empty() && messageLoggedWaiters.empty() ) {
+          return;
+        }
+
+        for( const std::string& message : messages ) {
+          fireEvents( messageLogged, message );
+          wakeWaiters( messageLoggedWaiters, message );
+        }
       }
 
       /**
@@ -23,25 +68,108 @@ namespace BlueBear {
        */
       void EventBridge::fireEvents( std::vector< LuaReference >& references, const std::string& logMessage ) {
 
-        lua_getglobal( L, "bluebear" ); // bluebear
-        Tools::Utility::getTableValue( L, "util" ); // bluebear.util bluebear
-
         for( LuaReference reference : references ) {
-          Tools::Utility::getTableValue( L, "bind" ); // <bind> bluebear.util bluebear
-          lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <function> <bind> bluebear.util bluebear
+          RefCache::push( L, RefCache::Entry::BIND ); // <bind>
+          lua_rawgeti( L, LUA_REGISTRYINDEX, reference ); // <function> <bind>
 
-          lua_pushstring( L, logMessage.c_str() ); // string <function> <bind> bluebear.util bluebear
+          lua_pushstring( L, logMessage.c_str() ); // string <function> <bind>
 
-          if( lua_pcall( L, 2, 1, 0 ) ) { // error bluebear.util bluebear
+          if( lua_pcall( L, 2, 1, 0 ) ) { // error
             // I really don't want to log anything here
-            lua_pop( L, 3 ); // EMPTY
+            lua_pop( L, 1 ); // EMPTY
             return;
-          } // <temp_function> bluebear.util bluebear
+          } // <temp_function>
+
+          engine.enqueue( luaL_ref( L, LUA_REGISTRYINDEX ) ); // EMPTY
+        }
+      }
+
+      /**
+       * Hand the event to every coroutine waiting on it, and queue them all to be resumed
+       */
+      void EventBridge::wakeWaiters( std::vector< LuaReference >& waiters, const std::string& logMessage ) {
+        for( LuaReference waiter : waiters ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, waiter ); // thread
+
+          // Becomes the return value of bluebear.event.wait
+          lua_pushstring( lua_tothread( L, -1 ), logMessage.c_str() );
+
+          lua_pop( L, 1 ); // EMPTY
+
+          engine.enqueue( waiter );
+        }
+
+        waiters.clear();
+      }
+
+      /**
+       * The coroutines parked on eventId, or nullptr if there's no such event
+       */
+      std::vector< LuaReference >* EventBridge::getWaiters( const std::string& eventId ) {
+        switch( Tools::Utility::hash( eventId.c_str() ) ) {
+          case Tools::Utility::hash( "MESSAGE_LOGGED" ):
+            return &messageLoggedWaiters;
+        }
+
+        return nullptr;
+      }
 
-          engine.enqueue( luaL_ref( L, LUA_REGISTRYINDEX ) ); // bluebear.util bluebear
+      /**
+       * Park waiter (a coroutine reference, which the EventBridge now owns) until eventId next fires. Returns false, leaving waiter to the
+       * caller, if there's no such event.
+       */
+      bool EventBridge::addWaiter( const std::string& eventId, LuaReference waiter ) {
+        std::vector< LuaReference >* waiters = getWaiters( eventId );
+        if( !waiters ) {
+          return false;
         }
 
-        lua_pop( L, 2 ); // EMPTY
+        waiters->push_back( waiter );
+        return true;
+      }
+
+      /**
+       * Re-park the coroutines saved by saveToJSON. Their threads are recreated by the serializer without their stacks, so like a parked
+       * sleeper, each starts its entry function again from the top when the event fires.
+       */
+      void EventBridge::loadFromJSON( Json::Value& waiters, const std::function< LuaReference( const Json::Value& ) >& take ) {
+        for( Json::Value::iterator iterator = waiters.begin(); iterator != waiters.end(); ++iterator ) {
+          std::string eventId = iterator.key().asString();
+
+          for( Json::Value& token : *iterator ) {
+            LuaReference waiter = take( token );
+            if( waiter != LUA_NOREF && !addWaiter( eventId, waiter ) ) {
+              luaL_unref( L, LUA_REGISTRYINDEX, waiter );
+            }
+          }
+        }
+      }
+
+      /**
+       * The parked coroutines, by event. identify is called with each coroutine on top of the stack, and returns what to save in its place.
+       * If keep is given, only the coroutines it returns true for are saved.
+       */
+      Json::Value EventBridge::saveToJSON( const std::function< Json::Value() >& identify, const std::function< bool( LuaReference ) >& keep ) {
+        Json::Value json( Json::objectValue );
+
+        eachWaiter( [ & ]( const std::string& eventId, LuaReference waiter ) {
+          if( keep && !keep( waiter ) ) {
+            return;
+          }
+
+          Json::Value& entry = json[ eventId ];
+          if( entry.isNull() ) {
+            entry = Json::Value( Json::arrayValue );
+          }
+
+          lua_rawgeti( L, LUA_REGISTRYINDEX, waiter ); // thread
+
+          entry.append( identify() );
+
+          lua_pop( L, 1 ); // EMPTY
+        } );
+
+        return json;
       }
 
       unsigned int EventBridge::enqueue( std::vector< LuaReference >& references, LuaReference masterReference ) {
@@ -125,6 +253,35 @@ namespace BlueBear {
         return 0;
       }
 
+      /**
+       * Suspend the calling callback until the event next fires. restart works as it does for bluebear.engine.sleep.
+       *
+       * STACK ARGS: "string" (restart)
+       * RETURNS: the event's argument (after the coroutine is resumed)
+       */
+      int EventBridge::lua_wait( lua_State* L ) {
+        bool restartable = lua_gettop( L ) >= 2 && lua_toboolean( L, 2 );
+        lua_settop( L, 1 ); // "string"
+
+        VERIFY_STRING_N( "EventBridge::lua_wait", "wait", 1 );
+
+        EventBridge* self = ( EventBridge* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+
+        std::vector< LuaReference >* waiters = self->getWaiters( lua_tostring( L, -1 ) );
+        if( !waiters ) {
+          return luaL_error( L, "EventBridge: Failed to wait for system event (invalid event type?)" );
+        }
+
+        LuaReference thread = self->engine.park( L, restartable );
+        if( thread == LUA_NOREF ) {
+          return luaL_error( L, "EventBridge: wait can only be called from a callback run by the engine" );
+        }
+
+        waiters->push_back( thread );
+
+        return lua_yield( L, 0 );
+      }
+
     }
   }
 }
@@ -0,0 +1,118 @@
+#include "scripting/luakit/refcache.hpp"
+#include "log.hpp"
+#include <cstring>
+#include <string>
+
+namespace BlueBear {
+  namespace Scripting {
+    namespace LuaKit {
+
+      RefCache::RefCache( lua_State* L ) : L( L ) {
+        for( LuaReference& reference : references ) {
+          reference = LUA_NOREF;
+        }
+
+        *( ( RefCache** ) lua_getextraspace( L ) ) = this;
+      }
+
+      RefCache::~RefCache() {
+        for( LuaReference reference : references ) {
+          luaL_unref( L, LUA_REGISTRYINDEX, reference );
+        }
+
+        *( ( RefCache** ) lua_getextraspace( L ) ) = nullptr;
+      }
+
+      /**
+       * Walk a dotted path starting from the globals table.
+       *
+       * STACK ARGS: none
+       * RETURNS: value (if true is returned); stack is unmodified if false is returned
+       */
+      bool RefCache::resolvePath( const char* path ) {
+        lua_pushglobaltable( L ); // _G
+
+        const char* segment = path;
+        while( *segment ) {
+          const char* end = std::strchr( segment, '.' );
+          std::string key = end ? std::string( segment, end - segment ) : std::string( segment );
+
+          if( !lua_istable( L, -1 ) ) {
+            lua_pop( L, 1 ); // EMPTY
+            return false;
+          }
+
+          lua_getfield( L, -1, key.c_str() ); // value table
+          lua_remove( L, -2 ); // value
+
+          segment = end ? end + 1 : segment + key.length();
+        }
+
+        if( lua_isnil( L, -1 ) ) {
+          lua_pop( L, 1 ); // EMPTY
+          return false;
+        }
+
+        return true;
+      }
+
+      /**
+       * Take references to every entry. Call once the system modpacks have been loaded (they define most of these), and again if anything
+       * replaces one of them.
+       */
+      bool RefCache::resolve() {
+        static const char* paths[ ( unsigned int ) Entry::ENTRY_COUNT ] = {
+          "bluebear.util.bind",
+          "bluebear.engine"
+        };
+
+        bool result = true;
+
+        for( unsigned int i = 0; i != ( unsigned int ) Entry::ENTRY_COUNT; i++ ) {
+          luaL_unref( L, LUA_REGISTRYINDEX, references[ i ] );
+          references[ i ] = LUA_NOREF;
+
+          if( resolvePath( paths[ i ] ) ) { // value
+            references[ i ] = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+          } else {
+            Log::getInstance().error( "RefCache::resolve", std::string( "Could not resolve " ) + paths[ i ] );
+            result = false;
+          }
+        }
+
+        return result;
+      }
+
+      /**
+       * L may be any thread belonging to the state the RefCache was created for.
+       *
+       * STACK ARGS: none
+       * RETURNS: value (nil if unresolved)
+       */
+      void RefCache::push( lua_State* L, Entry entry ) {
+        RefCache* self = *( ( RefCache** ) lua_getextraspace( L ) );
+
+        lua_rawgeti( L, LUA_REGISTRYINDEX, self->references[ ( unsigned int ) entry ] );
+      }
+
+      /**
+       * Whether reference is one of the cache's own. They point into the bluebear namespace rather than the world, so saves leave them out.
+       */
+      bool RefCache::holds( lua_State* L, LuaReference reference ) {
+        RefCache* self = *( ( RefCache** ) lua_getextraspace( L ) );
+        if( !self ) {
+          return false;
+        }
+
+        for( LuaReference cached : self->references ) {
+          if( cached == reference ) {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+    }
+  }
+}
@@ -2,15 +2,17 @@
 #include "scripting/engine.hpp"
 #include "tools/utility.hpp"
 #include "scripting/event/waitingtable.hpp"
+#include "scripting/luakit/eventbridge.hpp"
+#include "scripting/luakit/refcache.hpp"
 #include "log.hpp"
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
 #include <jsoncpp/json/json.h>
+#include <cstdlib>
+#include <functional>
 #include <string>
 #include <sstream>
-#include <iomanip>
-#include <regex>
 
 namespace BlueBear {
   namespace Scripting {
@@ -22,77 +24,286 @@ namespace BlueBear {
       const std::string Serializer::TYPE_FUNCTION = "function";
       // sfunctions are serialized function bindings that can be recreated at runtime without saving actual code to file
       const std::string Serializer::TYPE_SFUNCTION = "sfunction";
-      // refs are references to lua referenceable items (functions and tables only)
+      // refs are references to lua referenceable items (functions, tables and threads only)
       const std::string Serializer::TYPE_REF = "ref";
       // class is a reference to a class type. This allows us to serialise a lot without saving the class/class code in the lot JSON file
       const std::string Serializer::TYPE_CLASSID = "class";
       // An envref refers to a system-level global present in all instances of a Concordia lot (e.g. the "bluebear" global)
       const std::string Serializer::TYPE_ENVREF = "envref";
+      // A coroutine parked by the engine. Only the function it was started with is saved; the stack of a suspended coroutine can't be
+      const std::string Serializer::TYPE_THREAD = "thread";
 
       const std::string Serializer::ENVREF_MODE_BBGLOBAL = "bluebear";
       const std::string Serializer::ENVREF_MODE_G = "_G";
 
-      Serializer::Serializer( lua_State* L ) : L( L ) {}
+      Serializer::Serializer( lua_State* L ) : L( L ), output( nullptr ), firstRecord( true ), worldIndex( nullptr ) {}
 
       /**
        * Using the Engine-tracked index of system.entity.base objects as a starting point, save the current state of the Lua world.
        */
       Json::Value Serializer::saveWorld( std::vector< LuaReference >& objects, Engine& engine ) {
         world = Json::Value( Json::objectValue );
+        output = nullptr;
 
         // STOP the garbage collector so pointer references remain intact as we operate
         // Lua currently doesn't move items around as part of garbage collection (I think) but relying
         // on it is still undefined behaviour
+        // It may already be stopped, if the engine's GCScheduler is stepping it by hand
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
         lua_gc( L, LUA_GCSTOP, 0 );
 
-        // Build all required substitutions (classes, the bluebear global)
-        buildSubstitutions();
+        collectWorld( objects );
 
-        // First scoop up our system.entity.base objects that are tracked in the objects std::vector
-        for( LuaReference instance : objects ) {
-          // table
-          lua_rawgeti( L, LUA_REGISTRYINDEX, instance );
+        Json::Value result = Json::Value( Json::objectValue );
+        result[ "world" ] = world;
+        result[ "bytecode" ] = bytecode;
+        result[ "waitingTable" ] = engine.waitingTable.saveToJSON( L, std::bind( &Serializer::getObjectId, this ) );
+        result[ "eventWaiters" ] = engine.eventBridge->saveToJSON( std::bind( &Serializer::getObjectId, this ) );
+        result[ "entityManager" ] = saveEntityManager( objects );
+        result[ "owners" ] = saveOwners( engine, nullptr );
 
-          // EMPTY
-          createTableOnMasterList();
+        Log::getInstance().debug( "LuaKit::Serializer::saveWorld", "\n" + result.toStyledString() );
+
+        restartCollector( collectorRunning, engine );
+
+        return result;
+      }
+
+      void Serializer::saveWorld( std::ostream& output, std::vector< LuaReference >& objects, Engine& engine ) {
+        world = Json::Value( Json::objectValue );
+        this->output = &output;
+        firstRecord = true;
+
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
+        lua_gc( L, LUA_GCSTOP, 0 );
+
+        output << "\"world\":{";
+        collectWorld( objects );
+        output << "},\"bytecode\":" << Json::FastWriter().write( bytecode );
+        output << ",\"waitingTable\":" << Json::FastWriter().write( engine.waitingTable.saveToJSON( L, std::bind( &Serializer::getObjectId, this ) ) );
+        output << ",\"eventWaiters\":" << Json::FastWriter().write( engine.eventBridge->saveToJSON( std::bind( &Serializer::getObjectId, this ) ) );
+        output << ",\"entityManager\":" << Json::FastWriter().write( saveEntityManager( objects ) );
+        output << ",\"owners\":" << Json::FastWriter().write( saveOwners( engine, nullptr ) );
+
+        this->output = nullptr;
+
+        restartCollector( collectorRunning, engine );
+      }
+
+      /**
+       * Save part of the world: objects, everything they refer to, and the timers and event waiters keep returns true for (and what they
+       * refer to), as a whole engine section. Unlike saveWorld, the registry isn't walked, so nothing else the engine holds comes along.
+       * Used to split a lot between shards (see ShardGroup::partition).
+       */
+      Json::Value Serializer::savePartition( std::vector< LuaReference >& objects, Engine& engine, const std::function< bool( LuaReference ) >& keep ) {
+        world = Json::Value( Json::objectValue );
+        output = nullptr;
+
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
+        lua_gc( L, LUA_GCSTOP, 0 );
+
+        collectObjects( objects );
+
+        auto collect = [ & ]( LuaReference callback ) {
+          if( keep( callback ) ) {
+            lua_rawgeti( L, LUA_REGISTRYINDEX, callback ); // callback
+            collectValue(); // EMPTY
+          }
+        };
+        engine.waitingTable.eachTimer( [ & ]( Tick, LuaReference callback ) { collect( callback ); } );
+        engine.eventBridge->eachWaiter( [ & ]( const std::string&, LuaReference waiter ) { collect( waiter ); } );
+
+        Json::Value result = Json::Value( Json::objectValue );
+        result[ "world" ] = world;
+        result[ "bytecode" ] = bytecode;
+        result[ "waitingTable" ] = engine.waitingTable.saveToJSON( L, std::bind( &Serializer::getObjectId, this ), keep );
+        result[ "eventWaiters" ] = engine.eventBridge->saveToJSON( std::bind( &Serializer::getObjectId, this ), keep );
+        result[ "entityManager" ] = saveEntityManager( objects );
+        result[ "owners" ] = saveOwners( engine, keep );
+
+        restartCollector( collectorRunning, engine );
+
+        return result;
+      }
+
+      /**
+       * Put the collector back the way saving or loading found it, and get the garbage left behind collected. If it was running, Lua's
+       * own; a full cycle now is what it would have done. If it was stopped, the GCScheduler is stepping it by hand, and a full cycle in the
+       * middle of a tick is the pause it's there to avoid, so it's left to the scheduler to do on a tick where nothing runs.
+       */
+      void Serializer::restartCollector( bool collectorRunning, Engine& engine ) {
+        if( collectorRunning ) {
+          lua_gc( L, LUA_GCRESTART, 0 );
+          lua_gc( L, LUA_GCCOLLECT, 0 );
+        } else {
+          engine.gcScheduler->requestFull();
         }
+      }
+
+      /**
+       * Walk everything reachable from the engine's objects and the registry, handing each record to emitRecord as it's finished
+       */
+      void Serializer::collectWorld( std::vector< LuaReference >& objects ) {
+        collectObjects( objects );
 
         // Next, scoop up any items that are known only to the engine, but don't have any reference anywhere else in the game world.
+        // The engine's references are the registry's integer keys. Under names are Lua's own tables (_LOADED, _PRELOAD) and the engine's
+        // bookkeeping, which aren't part of the world; and _G, which sits in the registry too, is only ever saved as a substitution.
+        // The RefCache's references are integers too, but they point into the bluebear namespace. Integer keys up to LUA_RIDX_GLOBALS
+        // are Lua's own (the main thread and the globals), and key 0 is luaL_ref's free list, a plain number.
         lua_pushvalue( L, LUA_REGISTRYINDEX ); // registry
         lua_pushnil( L ); // nil registry
         while( lua_next( L, -2 ) ) { // item 1 registry
-          std::string pointer = Tools::Utility::pointerToString( lua_topointer( L, -1 ) );
-          if( !world.isMember( pointer ) ) {
+          const void* pointer = lua_topointer( L, -1 );
+          bool engineReference = lua_isinteger( L, -2 ) && lua_tointeger( L, -2 ) > LUA_RIDX_GLOBALS && !RefCache::holds( L, lua_tointeger( L, -2 ) );
+          if( engineReference && !objectIds.count( pointer ) && !substitutions.count( pointer ) ) {
             // Needs to be scooped up and saved, it's a part of the Luasphere that is known to the engine but not the game world itself
-            // ORDINARILY, these should only be table or function refs.
-            if( lua_istable( L, -1 ) ) {
-              createTableOnMasterList(); // 1 registry
-            } else if ( lua_isfunction( L, -1 ) ) {
-              createFunctionOnMasterList(); // 1 registry
-            } else {
-              Log::getInstance().error( "LuaKit::Serializer::saveWorld", "Engine tracked a non-table, non-function Lua reference, and I can't serialize it. Bitch at ne0ndrag0n because this is a fully preventable bug." );
-              lua_pop( L, 1 ); // 1 registry
-            }
+            collectValue(); // 1 registry
           } else {
             lua_pop( L, 1 ); // 1 registry
           }
         } // registry
 
         lua_pop( L, 1 ); // EMPTY
+      }
 
-        Json::Value result = Json::Value( Json::objectValue );
-        result[ "world" ] = world;
-        result[ "waitingTable" ] = engine.waitingTable.saveToJSON( L );
+      /**
+       * Start a save: reset the ids, and walk everything reachable from the engine's objects
+       */
+      void Serializer::collectObjects( std::vector< LuaReference >& objects ) {
+        objectIds.clear();
+        bytecodeIds.clear();
+        bytecode = Json::Value( Json::arrayValue );
 
-        // Use this regex when saving to a file, it fixes an annoying thing with JsonCpp where the "\u" is replaced by "\\u"
-        // TODO: Remove when we actually save to file
-        Log::getInstance().debug( "LuaKit::Serializer::saveWorld", "\n" + std::regex_replace( result.toStyledString(), std::regex( R"(\\\\u)" ), "\\u" ) );
+        // Build all required substitutions (classes, the bluebear global)
+        buildSubstitutions();
 
-        // Restart the garbage collector, and give it a good cycle
-        lua_gc( L, LUA_GCRESTART, 0 );
-        lua_gc( L, LUA_GCCOLLECT, 0 );
+        // First scoop up our system.entity.base objects that are tracked in the objects std::vector
+        for( LuaReference instance : objects ) {
+          // table
+          lua_rawgeti( L, LUA_REGISTRYINDEX, instance );
 
-        return result;
+          if( objectIds.count( lua_topointer( L, -1 ) ) ) {
+            lua_pop( L, 1 ); // EMPTY
+            continue;
+          }
+
+          // EMPTY
+          createTableOnMasterList();
+        }
+      }
+
+      /**
+       * Save a value the engine holds a reference to, unless it's been saved already.
+       * ORDINARILY, these should only be table or function refs, or coroutines parked by the engine.
+       *
+       * STACK ARGS: value
+       * RETURNS: EMPTY
+       */
+      void Serializer::collectValue() {
+        const void* pointer = lua_topointer( L, -1 );
+
+        if( objectIds.count( pointer ) || substitutions.count( pointer ) ) {
+          lua_pop( L, 1 ); // EMPTY
+        } else if( lua_istable( L, -1 ) ) {
+          createTableOnMasterList(); // EMPTY
+        } else if ( lua_isfunction( L, -1 ) ) {
+          createFunctionOnMasterList(); // EMPTY
+        } else if ( lua_isthread( L, -1 ) ) {
+          createThreadOnMasterList(); // EMPTY
+        } else {
+          Log::getInstance().error( "LuaKit::Serializer::saveWorld", "Engine tracked a non-table, non-function Lua reference, and I can't serialize it. Bitch at ne0ndrag0n because this is a fully preventable bug." );
+          lua_pop( L, 1 ); // EMPTY
+        }
+      }
+
+      /**
+       * Give the object on top of the stack the next id. Done as soon as an object is found, before anything it refers to is walked.
+       *
+       * STACK ARGS: table, function OR thread
+       * (Stack is unmodified after call)
+       */
+      unsigned int Serializer::assignId() {
+        unsigned int id = objectIds.size();
+        objectIds[ lua_topointer( L, -1 ) ] = id;
+
+        return id;
+      }
+
+      /**
+       * Hand off a finished record: into world, or straight out to the stream
+       */
+      void Serializer::emitRecord( unsigned int id, Json::Value& record ) {
+        std::string key = std::to_string( id );
+
+        if( !output ) {
+          world[ key ] = record;
+          return;
+        }
+
+        std::string text = Json::FastWriter().write( record );
+        // Drop the trailing newline
+        text.pop_back();
+
+        *output << ( firstRecord ? "\"" : ",\"" ) << key << "\":" << text;
+
+        firstRecord = false;
+      }
+
+      /**
+       * The engine's entities, by id. Everything in objects was walked first by collectWorld, so all of them have one.
+       */
+      Json::Value Serializer::saveEntityManager( std::vector< LuaReference >& objects ) {
+        Json::Value entityManager( Json::arrayValue );
+
+        for( LuaReference object : objects ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object
+          entityManager.append( getObjectId() );
+          lua_pop( L, 1 ); // EMPTY
+        }
+
+        return entityManager;
+      }
+
+      /**
+       * Pairs of [ callback, owner ] ids, for each timer and event waiter (that keep returns true for, if given) with an owner that's saved
+       * too (see Engine::setOwner)
+       */
+      Json::Value Serializer::saveOwners( Engine& engine, const std::function< bool( LuaReference ) >& keep ) {
+        Json::Value owners( Json::arrayValue );
+
+        auto save = [ & ]( LuaReference callback ) {
+          if( keep && !keep( callback ) ) {
+            return;
+          }
+
+          lua_rawgeti( L, LUA_REGISTRYINDEX, callback ); // callback
+          if( Engine::pushOwner( L, -1 ) ) { // owner callback
+            Json::Value owner = getObjectId();
+            lua_pop( L, 1 ); // callback
+
+            if( !owner.isNull() ) {
+              Json::Value pair( Json::arrayValue );
+              pair.append( getObjectId() );
+              pair.append( owner );
+              owners.append( pair );
+            }
+          }
+          lua_pop( L, 1 ); // EMPTY
+        };
+
+        engine.waitingTable.eachTimer( [ & ]( Tick, LuaReference callback ) { save( callback ); } );
+        engine.eventBridge->eachWaiter( [ & ]( const std::string&, LuaReference waiter ) { save( waiter ); } );
+
+        return owners;
+      }
+
+      /**
+       * lua_Writer for lua_dump: append each chunk of bytecode to the std::string passed as userdata
+       */
+      int Serializer::dumpWriter( lua_State*, const void* data, size_t size, void* buffer ) {
+        ( ( std::string* ) buffer )->append( ( const char* ) data, size );
+        return 0;
       }
 
       /**
@@ -100,76 +311,213 @@ namespace BlueBear {
        */
       void Serializer::loadWorld( Json::Value& engineDefinition, Engine& engine ) {
         world = engineDefinition[ "world" ];
+        worldIndex = nullptr;
+
+        loadItems( engineDefinition[ "bytecode" ], engineDefinition[ "waitingTable" ], engineDefinition[ "eventWaiters" ], engineDefinition[ "entityManager" ], engineDefinition[ "owners" ], engine );
+      }
+
+      /**
+       * Load the game world from an index over the engine section, parsing one record at a time
+       */
+      void Serializer::loadWorld( Tools::JSONIndex& engineIndex, Engine& engine ) {
+        Tools::JSONIndex index = engineIndex.index( "world" );
+        world = Json::Value();
+        worldIndex = &index;
+
+        Json::Value bytecode = engineIndex.read( "bytecode" );
+        Json::Value waitingTable = engineIndex.read( "waitingTable" );
+        Json::Value eventWaiters = engineIndex.read( "eventWaiters" );
+        Json::Value entityManager = engineIndex.read( "entityManager" );
+        Json::Value owners = engineIndex.isMember( "owners" ) ? engineIndex.read( "owners" ) : Json::Value();
+        loadItems( bytecode, waitingTable, eventWaiters, entityManager, owners, engine );
+
+        worldIndex = nullptr;
+      }
 
-        globalEntities.clear();
+      void Serializer::loadItems( Json::Value& bytecode, Json::Value& waitingTable, Json::Value& eventWaiters, Json::Value& entityManager, Json::Value& owners, Engine& engine ) {
+        indexRecords( worldIndex ? worldIndex->getKeys() : world.getMemberNames() );
+
+        // Each pooled body is decoded once, however many functions share it
+        bytecodeBlobs.clear();
+        for( const Json::Value& encoded : bytecode ) {
+          bytecodeBlobs.emplace_back();
+          if( !Tools::Utility::decodeBase64( encoded.asString(), bytecodeBlobs.back() ) ) {
+            Log::getInstance().error( "LuaKit::Serializer::loadItems", "Bytecode entry " + std::to_string( bytecodeBlobs.size() - 1 ) + " is not valid base64" );
+            bytecodeBlobs.back().clear();
+          }
+        }
 
         // STOP the garbage collector so pointer references remain intact as we operate
+        bool collectorRunning = lua_gc( L, LUA_GCISRUNNING, 0 );
         lua_gc( L, LUA_GCSTOP, 0 );
 
-        for( Json::Value::iterator jsonIterator = world.begin(); jsonIterator != world.end(); ++jsonIterator ) {
-          std::string addressKey = jsonIterator.key().asString();
-
-          // This address key may have been already been scooped up by a prior getReference() call
-          if( !globalItemExists( addressKey ) ) {
-            createGlobalItem( addressKey );
+        for( unsigned int id = 0; id != recordKeys.size(); id++ ) {
+          // This item may have been already been scooped up by a prior getReference() call
+          if( !recordKeys[ id ].empty() && !globalItemExists( id ) ) {
+            createGlobalItem( id );
           }
         }
 
-        // Load waiting functions into waitingTableExclusions, returning a list of items that should NOT be unref'd
-        // TODO: This is shit. Would it kill us to repurpose globalInstanceEntities into a general list where references are not released?
-        std::unordered_set< LuaReference > waitingTableExclusions;
+        // Hand the engine the references it keeps
+        engine.waitingTable.loadFromJSON( waitingTable, std::bind( &Serializer::takeReference, this, std::placeholders::_1 ) );
+        engine.eventBridge->loadFromJSON( eventWaiters, std::bind( &Serializer::takeReference, this, std::placeholders::_1 ) );
+        unpackEntityManager( entityManager, engine );
 
-        engine.waitingTable.loadFromJSON( engineDefinition[ "waitingTable" ], globalEntities, waitingTableExclusions );
-        unpackEntityManager( engineDefinition[ "entityManager" ], engine.objects, waitingTableExclusions );
+        for( const Json::Value& pair : owners ) {
+          getReference( resolveId( pair[ 0 ] ) ); // callback
+          getReference( resolveId( pair[ 1 ] ) ); // owner callback
+
+          if( !lua_isnil( L, -2 ) && !lua_isnil( L, -1 ) ) {
+            Engine::setOwner( L, -2, -1 );
+          }
+
+          lua_pop( L, 2 ); // EMPTY
+        }
 
         // Release references to items we no longer require. This allows the engine to start discarding items it no longer requires.
-        for( auto& entityPair : globalEntities ) {
-          if( waitingTableExclusions.find( entityPair.second ) == waitingTableExclusions.end() ) {
-            luaL_unref( L, LUA_REGISTRYINDEX, entityPair.second );
+        for( unsigned int id = 0; id != entities.size(); id++ ) {
+          if( !retained[ id ] && entities[ id ] != LUA_NOREF ) {
+            luaL_unref( L, LUA_REGISTRYINDEX, entities[ id ] );
           }
         }
 
         // After we're done, restart the garbage collector and give it a good cycle
         // If, for some reason, there's any disconnected item in the original file...it will be discarded here
-        lua_gc( L, LUA_GCRESTART, 0 );
-        lua_gc( L, LUA_GCCOLLECT, 0 );
+        restartCollector( collectorRunning, engine );
       }
 
-      void Serializer::unpackEntityManager( const Json::Value& entityManager, std::vector< LuaReference >& refs, std::unordered_set< LuaReference >& waitingTableExclusions ) {
+      void Serializer::unpackEntityManager( const Json::Value& entityManager, Engine& engine ) {
         for( const Json::Value& arrayVal : entityManager ) {
-          std::string pointer = arrayVal.asString();
+          LuaReference entity = takeReference( arrayVal );
+          if( entity != LUA_NOREF ) {
+            engine.addObject( entity );
+          }
+        }
+      }
+
+      /**
+       * Size the id tables from the keys of world. Keys are ids, unless the lot predates them, in which case ids are given out in key order.
+       */
+      void Serializer::indexRecords( const std::vector< std::string >& keys ) {
+        entities.assign( keys.size(), LUA_NOREF );
+        retained.assign( keys.size(), false );
+        recordKeys.assign( keys.size(), std::string() );
+        legacyIds.clear();
+
+        for( unsigned int i = 0; i != keys.size(); i++ ) {
+          const std::string& key = keys[ i ];
+
+          if( key.compare( 0, 2, "0x" ) == 0 ) {
+            legacyIds[ key ] = i;
+            recordKeys[ i ] = key;
+            continue;
+          }
+
+          unsigned int id = std::strtoul( key.c_str(), nullptr, 10 );
+          if( id >= keys.size() || !recordKeys[ id ].empty() ) {
+            Log::getInstance().error( "LuaKit::Serializer::indexRecords", "Skipping record with unexpected key \"" + key + "\"" );
+            continue;
+          }
+
+          recordKeys[ id ] = key;
+        }
+      }
+
+      /**
+       * An id as saved in a ref, the entity manager or the waiting table: a number, or an address in an older lot. INVALID_ID if it doesn't
+       * name a record.
+       */
+      unsigned int Serializer::resolveId( const Json::Value& token ) {
+        unsigned int id = INVALID_ID;
+
+        if( token.isString() ) {
+          auto legacyId = legacyIds.find( token.asString() );
+          if( legacyId != legacyIds.end() ) {
+            id = legacyId->second;
+          }
+        } else if( token.isUInt() && token.asUInt() < recordKeys.size() ) {
+          id = token.asUInt();
+        }
 
-          LuaReference entity = globalEntities.at( pointer );
-          refs.push_back( entity );
-          waitingTableExclusions.insert( entity );
+        if( id == INVALID_ID || recordKeys[ id ].empty() ) {
+          Log::getInstance().error( "LuaKit::Serializer::resolveId", "Reference to missing record " + token.toStyledString() );
+          return INVALID_ID;
         }
+
+        return id;
+      }
+
+      /**
+       * A reference to the object token names, for the engine to keep. The first taker gets the reference made while loading; anyone else
+       * taking the same object gets a new one, so each can be released separately.
+       */
+      LuaReference Serializer::takeReference( const Json::Value& token ) {
+        unsigned int id = resolveId( token );
+        if( id == INVALID_ID ) {
+          return LUA_NOREF;
+        }
+
+        if( !globalItemExists( id ) && createGlobalItem( id ) == -1 ) {
+          return LUA_NOREF;
+        }
+
+        if( !retained[ id ] ) {
+          retained[ id ] = true;
+          return entities[ id ];
+        }
+
+        lua_rawgeti( L, LUA_REGISTRYINDEX, entities[ id ] ); // item
+        return luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
       }
 
       /**
        * Create a "global" Lua item. These are at the top level of world and can be table, itable, function, or sfunction.
        */
-      LuaReference Serializer::createGlobalItem( const std::string& addressKey ) {
-        Json::Value& item = world[ addressKey ];
+      LuaReference Serializer::createGlobalItem( unsigned int id ) {
+        // Streamed records only live as long as it takes to create them
+        Json::Value streamed;
+        Json::Value& item = worldIndex ? ( streamed = worldIndex->read( recordKeys[ id ] ) ) : world[ recordKeys[ id ] ];
 
         switch( Tools::Utility::hash( item[ "type" ].asCString() ) ) {
           case Tools::Utility::hash( "table" ):
-            return createTable( addressKey, item );
+            return createTable( id, item );
           case Tools::Utility::hash( "itable" ):
-            return createITable( addressKey, item );
+            return createITable( id, item );
           case Tools::Utility::hash( "function" ):
-            return createFunction( addressKey, item );
+            return createFunction( id, item );
           case Tools::Utility::hash( "sfunction" ):
-            return createSFunction( addressKey, item );
+            return createSFunction( id, item );
+          case Tools::Utility::hash( "thread" ):
+            return createThread( id, item );
         }
+
+        return -1;
       }
 
       /**
-       * Create a table in RAM and associate it with the given address. Register it with globalEntities, return the reference we just created.
+       * Create a table in RAM and associate it with the given id. Register it with entities, return the reference we just created.
        */
-      LuaReference Serializer::createTable( const std::string& addressKey, Json::Value& tableDefinition ) {
-        lua_newtable( L ); // table
+      LuaReference Serializer::createTable( unsigned int id, Json::Value& tableDefinition ) {
+        Json::Value& entries = tableDefinition[ "entries" ];
+
+        // Count the entries that will land in the array part (integer keys 1..n) so the table is created at its final size
+        int arraySize = 0;
+        for( Json::Value& pair : entries ) {
+          Json::Value& key = pair[ "key" ];
+          if( key.isNumeric() ) {
+            double number = key.asDouble();
+            if( number >= 1 && number <= entries.size() && number == ( int ) number ) {
+              arraySize++;
+            }
+          }
+        }
+        lua_createtable( L, arraySize, entries.size() - arraySize ); // table
 
-        for( Json::Value& pair : tableDefinition[ "entries" ] ) {
+        // Register it before filling it in, so anything in it that refers back to it (a cycle) finds it instead of creating it again
+        lua_pushvalue( L, -1 ); // table table
+        LuaReference ref = entities[ id ] = luaL_ref( L, LUA_REGISTRYINDEX ); // table
+
+        for( Json::Value& pair : entries ) {
           inferTypeFromJSON( pair[ "key" ] ); // key_object table
           inferTypeFromJSON( pair[ "value" ] ); // value_object key_object table
 
@@ -183,13 +531,15 @@ namespace BlueBear {
           lua_setmetatable( L, -2 ); // table
         }
 
-        return globalEntities[ addressKey ] = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+        lua_pop( L, 1 ); // EMPTY
+
+        return ref;
       }
 
       /**
        * Create an itable, which requires first getting the instance of the specified classID, then overlaying the specified properties.
        */
-      LuaReference Serializer::createITable( const std::string& addressKey, Json::Value& tableDefinition ) {
+      LuaReference Serializer::createITable( unsigned int id, Json::Value& tableDefinition ) {
         lua_getglobal( L, "bluebear" ); // bluebear
         lua_pushstring( L, "get_class" ); // "get_class" bluebear
         lua_gettable( L, -2 ); // <bluebear.get_class> bluebear
@@ -214,6 +564,10 @@ namespace BlueBear {
           return -1;
         } // instance Class bluebear
 
+        // Register it before overlaying anything, so properties that refer back to it (a cycle) find it instead of creating it again
+        lua_pushvalue( L, -1 ); // instance instance Class bluebear
+        LuaReference ref = entities[ id ] = luaL_ref( L, LUA_REGISTRYINDEX ); // instance Class bluebear
+
         // Using instance, overlay all properties specified in tableDefinition
         for( Json::Value& pair : tableDefinition[ "entries" ] ) {
           inferTypeFromJSON( pair[ "key" ] ); // key_object instance Class bluebear
@@ -224,10 +578,7 @@ namespace BlueBear {
 
         // No metatable? itable-type objects should never set a metatable because middleclass already does that. Consequently, you should never fuck with the metatable in your game entities.
 
-        // Set reference
-        int ref = globalEntities[ addressKey ] = luaL_ref( L, LUA_REGISTRYINDEX ); // Class bluebear
-
-        lua_pop( L, 2 ); // EMPTY
+        lua_pop( L, 3 ); // EMPTY
 
         return ref;
       }
@@ -235,25 +586,45 @@ namespace BlueBear {
       /**
        * Create a function from its serialized function text and set its upvalues. You generally shouldn't use this functionality; instead, write code to create sfunctions instead.
        */
-      LuaReference Serializer::createFunction( const std::string& addressKey, Json::Value& tableDefinition ) {
+      LuaReference Serializer::createFunction( unsigned int id, Json::Value& tableDefinition ) {
 
         // push the function definition
-        std::string functionBody = Tools::Utility::decodeUTF8( tableDefinition[ "body" ].asString() );
-        if( luaL_loadbuffer( L, functionBody.c_str(), functionBody.length(), "__serialized_lua_chunk" ) ) { // error
+        std::string legacyBody;
+        const std::string* functionBody = &legacyBody;
+        if( tableDefinition.isMember( "bytecode" ) ) {
+          unsigned int index = tableDefinition[ "bytecode" ].asUInt();
+          if( index >= bytecodeBlobs.size() ) {
+            Log::getInstance().error( "LuaKit::Serializer::createFunction", "Function refers to missing bytecode entry " + std::to_string( index ) );
+            return -1;
+          }
+
+          functionBody = &bytecodeBlobs[ index ];
+        } else {
+          // Lots saved before bytecode was pooled carry their own "\u"-escaped body
+          legacyBody = Tools::Utility::decodeUTF8( tableDefinition[ "body" ].asString() );
+        }
+
+        if( luaL_loadbuffer( L, functionBody->c_str(), functionBody->length(), "__serialized_lua_chunk" ) ) { // error
           Log::getInstance().error( "LuaKit::Serializer::createFunction", "Could not load a serialized function chunk: " + std::string( lua_tostring( L, -1 ) ) );
           lua_pop( L, 1 ); // EMPTY
           return -1;
         } // <function>
 
+        // Register it first in case an upvalue refers back to it (a recursive local function)
+        lua_pushvalue( L, -1 ); // <function> <function>
+        LuaReference ref = entities[ id ] = luaL_ref( L, LUA_REGISTRYINDEX ); // <function>
+
         unpackUpvalues( tableDefinition[ "upvalues" ] );
 
-        return globalEntities[ addressKey ] = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+        lua_pop( L, 1 ); // EMPTY
+
+        return ref;
       }
 
       /**
        * Create an sfunction, a serialized form of function where the function body is accessible via a reference to a modpack-registered class.
        */
-      LuaReference Serializer::createSFunction( const std::string& addressKey, Json::Value& tableDefinition ) {
+      LuaReference Serializer::createSFunction( unsigned int id, Json::Value& tableDefinition ) {
         // Set up a standard sfunction-type bluebear.util.bind function without any arguments
 
         lua_getglobal( L, "bluebear" ); // bluebear
@@ -277,12 +648,37 @@ namespace BlueBear {
         // We only wanted the index
         lua_pop( L, 1 ); // <bound> bluebear.util bluebear
 
+        // Register it first in case its args refer back to it
+        lua_pushvalue( L, -1 ); // <bound> <bound> bluebear.util bluebear
+        LuaReference ref = entities[ id ] = luaL_ref( L, LUA_REGISTRYINDEX ); // <bound> bluebear.util bluebear
+
         determineInnerItem( tableDefinition[ "args" ] ); // args <bound> bluebear.util bluebear
         setUpvalueByIndex( upvalueIndex ); // <bound> bluebear.util bluebear
 
-        int ref = globalEntities[ addressKey ] = luaL_ref( L, LUA_REGISTRYINDEX ); // bluebear.util bluebear
+        lua_pop( L, 3 ); // EMPTY
 
-        lua_pop( L, 2 ); // EMPTY
+        return ref;
+      }
+
+      /**
+       * Recreate a coroutine the engine had parked. The new coroutine hasn't started: when it's next resumed, it runs its entry function
+       * again from the top.
+       */
+      LuaReference Serializer::createThread( unsigned int id, Json::Value& threadDefinition ) {
+        lua_State* thread = lua_newthread( L ); // thread
+
+        // Register it first in case the entry function refers back to it
+        LuaReference ref = entities[ id ] = luaL_ref( L, LUA_REGISTRYINDEX ); // EMPTY
+
+        determineInnerItem( threadDefinition[ "entry" ] ); // <entry>
+
+        lua_getfield( L, LUA_REGISTRYINDEX, Engine::COROUTINE_ENTRIES ); // entries <entry>
+        lua_rawgeti( L, LUA_REGISTRYINDEX, ref ); // thread entries <entry>
+        lua_pushvalue( L, -3 ); // <entry> thread entries <entry>
+        lua_rawset( L, -3 ); // entries <entry>
+        lua_pop( L, 1 ); // <entry>
+
+        lua_xmove( L, thread, 1 ); // EMPTY
 
         return ref;
       }
@@ -353,6 +749,9 @@ namespace BlueBear {
           case Json::ValueType::stringValue:
             lua_pushstring( L, objectToken.asCString() ); // string
             return;
+          case Json::ValueType::booleanValue:
+            lua_pushboolean( L, objectToken.asBool() ); // boolean
+            return;
           case Json::ValueType::objectValue:
             determineInnerItem( objectToken ); // (table, function, or nil)
             return;
@@ -369,16 +768,20 @@ namespace BlueBear {
        * STACK ARGS: none
        * RETURNS: (table or function)
        */
-      void Serializer::getReference( const std::string& addressKey ) {
+      void Serializer::getReference( unsigned int id ) {
+        if( id == INVALID_ID ) {
+          lua_pushnil( L ); // nil
+          return;
+        }
+
         // Does the item need to be created or does it already exist?
-        auto geEntry = globalEntities.find( addressKey );
-        if( geEntry != globalEntities.end() ) {
-          lua_rawgeti( L, LUA_REGISTRYINDEX, geEntry->second ); // item
+        if( globalItemExists( id ) ) {
+          lua_rawgeti( L, LUA_REGISTRYINDEX, entities[ id ] ); // item
           return;
         }
 
         // If we got here, then it looks like we need to create the item before pushing it onto the stack
-        lua_rawgeti( L, LUA_REGISTRYINDEX, createGlobalItem( addressKey ) ); // item
+        lua_rawgeti( L, LUA_REGISTRYINDEX, createGlobalItem( id ) ); // item
       }
 
       /**
@@ -392,7 +795,8 @@ namespace BlueBear {
 
         switch( Tools::Utility::hash( type ) ) {
           case Tools::Utility::hash( "ref" ):
-            getReference( objectToken[ "ptr" ].asString() ); // (table or function)
+            // Older lots refer by address
+            getReference( resolveId( objectToken.isMember( "id" ) ? objectToken[ "id" ] : objectToken[ "ptr" ] ) ); // (table or function)
             return;
           case Tools::Utility::hash( "envref" ):
             getEnvReference( objectToken[ "object" ].asString() ); // (table or function)
@@ -422,10 +826,10 @@ namespace BlueBear {
       }
 
       /**
-       * Returns true if the addressKey is defined in either globalEntities
+       * Returns true if the item with this id has been created
        */
-      bool Serializer::globalItemExists( const std::string& addressKey ) {
-        return globalEntities.find( addressKey ) != globalEntities.end();
+      bool Serializer::globalItemExists( unsigned int id ) {
+        return entities[ id ] != LUA_NOREF;
       }
 
       /**
@@ -437,8 +841,8 @@ namespace BlueBear {
       void Serializer::createTableOnMasterList() {
 
         // As soon as a table is found, go ahead and throw it on the pile
-        std::string this_table( Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) );
-        Json::Value& parentItem = world[ this_table ] = Json::Value( Json::objectValue );
+        unsigned int thisTable = assignId();
+        Json::Value parentItem = Json::Value( Json::objectValue );
         Json::Value& item = parentItem[ "entries" ] = Json::Value( Json::arrayValue );
 
         // Is this an INSTANCE-TYPE table? Instance-type tables have a "class" field pointing to a table with the __middleclass system property set to "true"
@@ -493,9 +897,7 @@ namespace BlueBear {
         } // table
 
         if( !isInstanceTable && lua_getmetatable( L, -1 ) ) { // metatable table
-          std::string worldPointer( Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) );
-
-          if( !world.isMember( worldPointer ) ) {
+          if( !objectIds.count( lua_topointer( L, -1 ) ) ) {
             lua_pushvalue( L, -1 ); // metatable metatable table
             createTableOnMasterList(); // metatable table
           }
@@ -505,6 +907,8 @@ namespace BlueBear {
           lua_pop( L, 1 ); // table
         }
 
+        emitRecord( thisTable, parentItem );
+
         lua_pop( L, 1 ); // EMPTY
       }
 
@@ -516,7 +920,8 @@ namespace BlueBear {
        */
        void Serializer::createFunctionOnMasterList() {
 
-         std::string thisTable( Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) );
+         // Mark it before the upvalues are walked, in case one of them is this function
+         unsigned int thisFunction = assignId();
 
          Json::Value func( Json::objectValue );
 
@@ -535,8 +940,7 @@ namespace BlueBear {
            lua_pop( L, 1 ); // function
 
            getUpvalueByName( "args" ); // args function
-           std::string upvaluePointer( Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) );
-           if( !world.isMember( upvaluePointer ) ) {
+           if( !objectIds.count( lua_topointer( L, -1 ) ) ) {
              lua_pushvalue( L, -1 ); // args args function
              createTableOnMasterList(); // args function
            }
@@ -545,41 +949,27 @@ namespace BlueBear {
 
            lua_pop( L, 1 ); // function
 
-           world[ thisTable ] = func;
+           emitRecord( thisFunction, func );
          } else {
            func[ "type" ] = Serializer::TYPE_FUNCTION;
 
-           // Serialize the text/function body of a closure
-           lua_getglobal( L, "string" ); // string function
-           lua_pushstring( L, "dump" ); // "dump" string function
-           lua_gettable( L, -2 ); // <string.dump> string function
-           lua_pushvalue( L, -3 ); // function <string.dump> string function
-
-           if( lua_pcall( L, 1, 1, 0 ) == 0 ) { // "serialized" string function
-             int serializedLength = lua_rawlen( L, -1 );
-             const char* serialized = lua_tostring( L, -1 );
-
-             std::stringstream stringBuilder;
-             for( int i = 0; i != serializedLength; i++ ) {
-               char c = serialized[ i ];
-               unsigned char uc = ( unsigned char ) c;
-               int ic = ( int )uc;
-
-               // Spit out '\uxxxx'
-               stringBuilder << "\\u" << std::setfill( '0' ) << std::setw( 4 ) << std::hex << ic;
+           // Serialize the function body of a closure. Closures made from the same function literal share their bytecode, so it's pooled
+           // by content and only stored once
+           std::string dumped;
+           if( lua_dump( L, dumpWriter, &dumped, 0 ) == 0 ) {
+             auto result = bytecodeIds.emplace( std::move( dumped ), bytecode.size() );
+             if( result.second ) {
+               bytecode.append( Tools::Utility::encodeBase64( result.first->first ) );
              }
 
-             func[ "body" ] = stringBuilder.str();
-
-             lua_pop( L, 2 ); // function
+             func[ "bytecode" ] = result.first->second;
 
              // Now serialize the associated upvalues
              addUpvalues( func );
 
-             world[ thisTable ] = func;
-           } else { // "error" string function
-              Log::getInstance().error( "LuaKit::Serializer::createFunctionOnMasterList", "Could not serialize function: " + std::string( lua_tostring( L, -1 ) ) );
-              lua_pop( L, 2 ); // function
+             emitRecord( thisFunction, func );
+           } else {
+              Log::getInstance().error( "LuaKit::Serializer::createFunctionOnMasterList", "Could not serialize function " + std::to_string( thisFunction ) );
            }
 
          }
@@ -587,6 +977,36 @@ namespace BlueBear {
          lua_pop( L, 1 ); // EMPTY
        }
 
+      /**
+       * Create a thread on the master list. Only coroutines the engine started have an entry function to save; anything else (the main
+       * thread, coroutines Lua made itself) is left out.
+       *
+       * STACK ARGS: thread
+       * RETURNS: none
+       */
+      void Serializer::createThreadOnMasterList() {
+        lua_getfield( L, LUA_REGISTRYINDEX, Engine::COROUTINE_ENTRIES ); // entries thread
+        lua_pushvalue( L, -2 ); // thread entries thread
+        lua_rawget( L, -2 ); // <entry> entries thread
+
+        if( lua_isfunction( L, -1 ) ) {
+          lua_pushvalue( L, -3 ); // thread <entry> entries thread
+          unsigned int thisThread = assignId();
+          lua_pop( L, 1 ); // <entry> entries thread
+
+          Json::Value thread( Json::objectValue );
+          thread[ "type" ] = Serializer::TYPE_THREAD;
+
+          inferType( thread, "entry" ); // entries thread
+
+          emitRecord( thisThread, thread );
+        } else {
+          lua_pop( L, 1 ); // entries thread
+        }
+
+        lua_pop( L, 2 ); // EMPTY
+      }
+
       /**
        * Infer the type, load references if necessary, and place it into pair[field]
        *
@@ -616,13 +1036,12 @@ namespace BlueBear {
             {
 
               // If this table was already found in world, then simply create the reference. Else, expose table to world, then create the reference.
-              std::string worldPointer = Tools::Utility::pointerToString( lua_topointer( L, -1 ) );
-              auto substitution = substitutions.find( worldPointer );
+              auto substitution = substitutions.find( lua_topointer( L, -1 ) );
 
               if( substitution == substitutions.end() ) {
                 // This is a plain old table that does not require any special action ("substitution")
 
-                if( !world.isMember( worldPointer ) ) {
+                if( !objectIds.count( lua_topointer( L, -1 ) ) ) {
                   // Need to create the table
                   // Copy the stack value as createTableOnMasterList will remove it
                   lua_pushvalue( L, -1 ); // table table
@@ -639,13 +1058,12 @@ namespace BlueBear {
             break;
           case Tools::Utility::hash( "function" ):
             {
-              std::string worldPointer = Tools::Utility::pointerToString( lua_topointer( L, -1 ) );
-              auto substitution = substitutions.find( worldPointer );
+              auto substitution = substitutions.find( lua_topointer( L, -1 ) );
 
               if( substitution == substitutions.end() ) {
                 // No substitution required for this function.
                 // We need to serialize code directly to the file
-                if( !world.isMember( worldPointer ) ) {
+                if( !objectIds.count( lua_topointer( L, -1 ) ) ) {
                   // Need to create the function
                   lua_pushvalue( L, -1 ); // function function
                   createFunctionOnMasterList(); // function
@@ -658,6 +1076,19 @@ namespace BlueBear {
               }
             }
             break;
+          case Tools::Utility::hash( "thread" ):
+            {
+              const void* pointer = lua_topointer( L, -1 );
+
+              if( !objectIds.count( pointer ) ) {
+                lua_pushvalue( L, -1 ); // thread thread
+                createThreadOnMasterList(); // thread
+              }
+
+              // Threads that weren't started by the engine can't be saved
+              pair[ field ] = objectIds.count( pointer ) ? createReference() : Json::Value::null;
+            }
+            break;
           default:
             Log::getInstance().warn( "LuaKit::Serializer::inferType", "Invalid type: " + std::string( type ) + ", substituting null." );
           case Tools::Utility::hash( "nil" ):
@@ -676,7 +1107,7 @@ namespace BlueBear {
       void Serializer::addUpvalues( Json::Value& funcType ) {
         Json::Value& upvalues = funcType[ "upvalues" ] = Json::Value( Json::arrayValue );
 
-        for( int i = 1; const char* upvalueId = lua_getupvalue( L, -1, i ); i++ ) { // upvalue function
+        for( int i = 1; lua_getupvalue( L, -1, i ); i++ ) { // upvalue function
           Json::Value upvalue = Json::Value( Json::objectValue );
 
           inferType( upvalue, "value" ); // function
@@ -734,18 +1165,30 @@ namespace BlueBear {
       /**
        * Return a JSON value representing a reference to a floating world object. This function is only defined for the types specified below.
        *
-       * STACK ARGS: table OR function
+       * STACK ARGS: table, function OR thread
        * (Stack is unmodified after call)
        */
       Json::Value Serializer::createReference() {
         Json::Value val( Json::objectValue );
 
         val[ "type" ] = Serializer::TYPE_REF;
-        val[ "ptr" ] = Tools::Utility::pointerToString( lua_topointer( L, -1 ) );
+        val[ "id" ] = objectIds.at( lua_topointer( L, -1 ) );
 
         return val;
       }
 
+      /**
+       * The id given to a world object, or null if it wasn't saved (a coroutine the engine didn't start)
+       *
+       * STACK ARGS: table, function OR thread
+       * (Stack is unmodified after call)
+       */
+      Json::Value Serializer::getObjectId() {
+        auto id = objectIds.find( lua_topointer( L, -1 ) );
+
+        return id == objectIds.end() ? Json::Value::null : Json::Value( id->second );
+      }
+
       /**
        * Return a JSON file representing a reference to a class.
        *
@@ -816,11 +1259,11 @@ namespace BlueBear {
 
         // Substitution 2: The bluebear table itself
         // This object, if it's referred to anywhere, needs to be serialized as "the bluebear table"
-        substitutions[ Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) ] = std::bind( &Serializer::createConcordiaNSReference, this );
+        substitutions[ lua_topointer( L, -1 ) ] = std::bind( &Serializer::createConcordiaNSReference, this );
 
         // Substitution 3: The _G/_ENV variable
         lua_getglobal( L, "_G" ); // _G bluebear
-        substitutions[ Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) ] = std::bind( &Serializer::createGReference, this );
+        substitutions[ lua_topointer( L, -1 ) ] = std::bind( &Serializer::createGReference, this );
 
         lua_pop( L, 2 ); // EMPTY
       }
@@ -844,7 +1287,7 @@ namespace BlueBear {
             lua_pop( L, 1 ); // subtable "name" table
 
             // Type is a proper middleclass object
-            substitutions[ Tools::Utility::pointerToString( lua_topointer( L, -1 ) ) ] = std::bind( &Serializer::createClassReference, this );
+            substitutions[ lua_topointer( L, -1 ) ] = std::bind( &Serializer::createClassReference, this );
 
             lua_pop( L, 1 ); // "name" table
           } else {
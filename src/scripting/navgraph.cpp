@@ -0,0 +1,146 @@
+#include "scripting/navgraph.hpp"
+#include <algorithm>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr unsigned int NavGraph::DIRECTIONS;
+    const int NavGraph::DX[ NavGraph::DIRECTIONS ] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    const int NavGraph::DY[ NavGraph::DIRECTIONS ] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+
+    NavGraph::NavGraph( unsigned int levels, unsigned int x, unsigned int y ) :
+      x( x ), y( y ), levels( levels ),
+      walkable( ( std::size_t ) levels * x * y, 0 ),
+      moves( ( std::size_t ) levels * x * y, 0 ) {}
+
+    std::size_t NavGraph::getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) const {
+      return ( ( std::size_t ) this->y * this->x * level ) + ( this->x * y ) + x;
+    }
+
+    bool NavGraph::canStand( const Lot::FloorMap& floorMap, const WallGrid& wallMap, unsigned int level, unsigned int x, unsigned int y ) const {
+      if( level != 0 && ( level >= floorMap.getLevels() || floorMap.getIndex( level, x, y ) == Lot::FloorMap::EMPTY ) ) {
+        return false;
+      }
+
+      if( wallMap.contains( level, x, y ) ) {
+        const WallGrid::Cell& cell = wallMap.getPacked( level, x, y );
+        return !cell.hasSegment( WallGrid::Axis::D ) && !cell.hasSegment( WallGrid::Axis::R );
+      }
+
+      return true;
+    }
+
+    /**
+     * Whether a doll standing on ( x, y ) can take one step north, east, south or west. Needs walkable to be up to date around ( x, y ).
+     */
+    bool NavGraph::canStep( const WallGrid& wallMap, unsigned int level, int x, int y, unsigned int direction ) const {
+      int nextX = x + DX[ direction ];
+      int nextY = y + DY[ direction ];
+      if( nextX < 0 || nextY < 0 || !contains( level, nextX, nextY ) || !walkable[ getSingleIndex( level, nextX, nextY ) ] ) {
+        return false;
+      }
+
+      // The wall cell holding the edge between the two floor cells, and which of its segments would be on it
+      int wallX = direction == EAST ? x + 1 : x;
+      int wallY = direction == SOUTH ? y + 1 : y;
+      WallGrid::Axis axis = ( direction == NORTH || direction == SOUTH ) ? WallGrid::Axis::X : WallGrid::Axis::Y;
+
+      return !wallMap.contains( level, wallX, wallY ) || !wallMap.getPacked( level, wallX, wallY ).hasSegment( axis );
+    }
+
+    std::uint8_t NavGraph::findMoves( const WallGrid& wallMap, unsigned int level, unsigned int x, unsigned int y ) const {
+      if( !walkable[ getSingleIndex( level, x, y ) ] ) {
+        return 0;
+      }
+
+      std::uint8_t result = 0;
+      for( unsigned int direction = NORTH; direction < DIRECTIONS; direction += 2 ) {
+        if( canStep( wallMap, level, x, y, direction ) ) {
+          result |= 1 << direction;
+        }
+      }
+
+      // A diagonal step needs both of the steps either side of it open, from here and from the cells it passes between
+      for( unsigned int direction = NORTH_EAST; direction < DIRECTIONS; direction += 2 ) {
+        unsigned int first = direction - 1;
+        unsigned int second = ( direction + 1 ) % DIRECTIONS;
+
+        if( ( result & ( 1 << first ) ) && ( result & ( 1 << second ) ) &&
+            canStep( wallMap, level, x + DX[ first ], y + DY[ first ], second ) &&
+            canStep( wallMap, level, x + DX[ second ], y + DY[ second ], first ) ) {
+          result |= 1 << direction;
+        }
+      }
+
+      return result;
+    }
+
+    void NavGraph::build( const Lot::FloorMap& floorMap, const WallGrid& wallMap ) {
+      if( !x || !y ) {
+        return;
+      }
+
+      for( unsigned int level = 0; level != levels; level++ ) {
+        update( floorMap, wallMap, Lot::DirtyRegion{ level, 0, 0, x - 1, y - 1 } );
+      }
+    }
+
+    /**
+     * Whether the cells in region can be stood on only depends on themselves, but the steps out of the cells around them depend on them too
+     */
+    void NavGraph::update( const Lot::FloorMap& floorMap, const WallGrid& wallMap, const Lot::DirtyRegion& region ) {
+      if( region.level >= levels || region.xMin >= x || region.yMin >= y ) {
+        return;
+      }
+
+      unsigned int xMax = std::min( region.xMax, x - 1 );
+      unsigned int yMax = std::min( region.yMax, y - 1 );
+
+      for( unsigned int cellY = region.yMin; cellY <= yMax; cellY++ ) {
+        for( unsigned int cellX = region.xMin; cellX <= xMax; cellX++ ) {
+          walkable[ getSingleIndex( region.level, cellX, cellY ) ] = canStand( floorMap, wallMap, region.level, cellX, cellY );
+        }
+      }
+
+      unsigned int borderYMax = std::min( yMax + 1, y - 1 );
+      unsigned int borderXMax = std::min( xMax + 1, x - 1 );
+      for( unsigned int cellY = region.yMin ? region.yMin - 1 : 0; cellY <= borderYMax; cellY++ ) {
+        for( unsigned int cellX = region.xMin ? region.xMin - 1 : 0; cellX <= borderXMax; cellX++ ) {
+          moves[ getSingleIndex( region.level, cellX, cellY ) ] = findMoves( wallMap, region.level, cellX, cellY );
+        }
+      }
+    }
+
+    unsigned int NavGraph::getX() const {
+      return x;
+    }
+
+    unsigned int NavGraph::getY() const {
+      return y;
+    }
+
+    unsigned int NavGraph::getLevels() const {
+      return levels;
+    }
+
+    bool NavGraph::contains( unsigned int level, unsigned int x, unsigned int y ) const {
+      return level < levels && x < this->x && y < this->y;
+    }
+
+    bool NavGraph::isWalkable( unsigned int level, unsigned int x, unsigned int y ) const {
+      return walkable[ getSingleIndex( level, x, y ) ];
+    }
+
+    std::uint8_t NavGraph::getMoves( unsigned int level, unsigned int x, unsigned int y ) const {
+      return moves[ getSingleIndex( level, x, y ) ];
+    }
+
+    /**
+     * getX() * getY() cells, row by row
+     */
+    const std::uint8_t* NavGraph::getLevel( unsigned int level ) const {
+      return moves.data() + getSingleIndex( level, 0, 0 );
+    }
+
+  }
+}
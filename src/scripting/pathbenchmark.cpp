@@ -0,0 +1,206 @@
+#include "scripting/pathbenchmark.hpp"
+#include "scripting/navgraph.hpp"
+#include "scripting/tile.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr unsigned int PathBenchmark::ROOM_SIZE;
+
+    PathBenchmark::PathBenchmark( unsigned int seed ) : seed( seed ) {}
+
+    void PathBenchmark::generate( unsigned int size, Lot::FloorMap& floorMap, WallGrid& wallMap ) {
+      std::mt19937 random( seed + size );
+
+      Lot::FloorMap::Index ground = floorMap.addToPalette( std::make_shared< Tile >( "system.benchmark.ground", "", "", 0.0 ) );
+      floorMap.pushRun( ground, ( std::size_t ) size * size );
+
+      // A door somewhere along each room's length of a wall
+      auto doorIn = [ & ]( unsigned int roomStart ) {
+        return std::min( roomStart + ( unsigned int )( random() % ROOM_SIZE ), size - 1 );
+      };
+
+      for( unsigned int line = ROOM_SIZE; line < size; line += ROOM_SIZE ) {
+        for( unsigned int along = 0; along < size; along += ROOM_SIZE ) {
+          unsigned int rowDoor = doorIn( along );
+          unsigned int columnDoor = doorIn( along );
+
+          for( unsigned int cell = along; cell < std::min( along + ROOM_SIZE, size ); cell++ ) {
+            if( cell != rowDoor ) {
+              wallMap.setSegment( 0, cell, line, WallGrid::Axis::X, WallGrid::NONE, WallGrid::NONE );
+            }
+            if( cell != columnDoor ) {
+              wallMap.setSegment( 0, line, cell, WallGrid::Axis::Y, WallGrid::NONE, WallGrid::NONE );
+            }
+          }
+        }
+      }
+
+      // Diagonal walls stand clear of a room's walls, so they never block a door
+      for( unsigned int roomY = 0; roomY + ROOM_SIZE <= size; roomY += ROOM_SIZE ) {
+        for( unsigned int roomX = 0; roomX + ROOM_SIZE <= size; roomX += ROOM_SIZE ) {
+          if( random() % 3 == 0 ) {
+            unsigned int x = roomX + 2 + random() % ( ROOM_SIZE - 4 );
+            unsigned int y = roomY + 2 + random() % ( ROOM_SIZE - 4 );
+            WallGrid::Axis axis = random() % 2 ? WallGrid::Axis::D : WallGrid::Axis::R;
+
+            wallMap.setSegment( 0, x, y, axis, WallGrid::NONE, WallGrid::NONE );
+          }
+        }
+      }
+
+      // The second storey: floor over the middle half of the lot, with a wall down its middle
+      if( floorMap.getLevels() > 1 && size >= 4 ) {
+        unsigned int quarter = size / 4;
+        unsigned int door = quarter + random() % ( quarter * 2 );
+
+        for( unsigned int y = quarter; y < quarter * 3; y++ ) {
+          for( unsigned int x = quarter; x < quarter * 3; x++ ) {
+            floorMap.setIndex( 1, x, y, ground );
+          }
+
+          if( y != door ) {
+            wallMap.setSegment( 1, quarter * 2, y, WallGrid::Axis::Y, WallGrid::NONE, WallGrid::NONE );
+          }
+        }
+      }
+    }
+
+    std::vector< Pathfinder::Request > PathBenchmark::createRequests( const NavGraph& graph, std::size_t count ) {
+      std::mt19937 random( seed );
+      std::vector< Pathfinder::Request > requests;
+      requests.reserve( count );
+
+      // Somewhere that can be stood on, if one turns up before long; otherwise somewhere that can't, and the request finds nothing
+      auto pickCell = [ & ]( unsigned int level, unsigned int& x, unsigned int& y ) {
+        for( unsigned int attempt = 0; attempt != 64; attempt++ ) {
+          x = random() % graph.getX();
+          y = random() % graph.getY();
+
+          if( graph.isWalkable( level, x, y ) ) {
+            return;
+          }
+        }
+      };
+
+      for( std::size_t i = 0; i != count; i++ ) {
+        Pathfinder::Request request;
+        request.level = ( graph.getLevels() > 1 && random() % 10 == 0 ) ? 1 : 0;
+        request.callback = LUA_NOREF;
+
+        pickCell( request.level, request.x1, request.y1 );
+        pickCell( request.level, request.x2, request.y2 );
+
+        requests.push_back( request );
+      }
+
+      return requests;
+    }
+
+    /**
+     * Returns false if the batched searches didn't find the same paths as the searches on one thread
+     */
+    bool PathBenchmark::runOnce( unsigned int size, std::size_t count ) {
+      using Clock = std::chrono::steady_clock;
+
+      Result result;
+      result.size = size;
+      result.paths = count;
+      result.found = 0;
+      result.meanLength = 0.0;
+
+      Lot::FloorMap floorMap( 2, size, size );
+      WallGrid wallMap( 2, size + 1, size + 1 );
+      generate( size, floorMap, wallMap );
+
+      Clock::time_point start = Clock::now();
+      Pathfinder pathfinder( floorMap, wallMap );
+      result.buildSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+      std::vector< Pathfinder::Request > requests = createRequests( pathfinder.getGraph(), count );
+
+      // One thread, one search after another
+      std::vector< Pathfinder::Path > serial( requests.size() );
+      Pathfinder::Search search;
+      start = Clock::now();
+      for( std::size_t i = 0; i != requests.size(); i++ ) {
+        serial[ i ].found = search.find( pathfinder.getGraph(), requests[ i ], serial[ i ].steps, serial[ i ].length );
+      }
+      result.serialSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+      // The way the engine asks: one batch, collected when it's done
+      std::vector< Pathfinder::Path > batched;
+      start = Clock::now();
+      for( const Pathfinder::Request& request : requests ) {
+        pathfinder.request( request );
+      }
+      pathfinder.dispatch();
+      pathfinder.wait();
+      pathfinder.collect( batched );
+      result.batchSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+      result.matched = batched.size() == serial.size();
+      for( std::size_t i = 0; result.matched && i != serial.size(); i++ ) {
+        result.matched = serial[ i ].found == batched[ i ].found && std::abs( serial[ i ].length - batched[ i ].length ) < 1e-3;
+
+        if( serial[ i ].found ) {
+          result.found++;
+          result.meanLength += serial[ i ].length;
+        }
+      }
+
+      if( result.found ) {
+        result.meanLength /= result.found;
+      }
+
+      if( !result.matched ) {
+        Log::getInstance().error(
+          "PathBenchmark::runOnce",
+          "Batched paths on a " + std::to_string( size ) + "x" + std::to_string( size ) + " lot (seed " + std::to_string( seed ) + ") don't match the serial ones"
+        );
+      }
+
+      report( result );
+
+      return result.matched;
+    }
+
+    void PathBenchmark::report( const Result& result ) {
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << result.size << "x" << result.size << " lot: graph built in " << result.buildSeconds * 1000.0 << "ms; "
+        << result.paths << " paths (" << result.found << " found, mean length " << result.meanLength << "): "
+        << "serial " << ( result.serialSeconds > 0.0 ? result.paths / result.serialSeconds : 0.0 ) << " paths/sec, "
+        << "batched " << ( result.batchSeconds > 0.0 ? result.paths / result.batchSeconds : 0.0 ) << " paths/sec on "
+        << std::thread::hardware_concurrency() << " hardware threads; "
+        << ( result.matched ? "batched paths match" : "BATCHED PATHS MISMATCH" );
+
+      Log::getInstance().info( "PathBenchmark::report", stream.str() );
+    }
+
+    /**
+     * Returns false if the batched and serial searches disagreed on any lot
+     */
+    bool PathBenchmark::run( const std::vector< unsigned int >& sizes, std::size_t count ) {
+      bool passed = true;
+
+      for( unsigned int size : sizes ) {
+        Log::getInstance().info( "PathBenchmark::run", "Generating a " + std::to_string( size ) + "x" + std::to_string( size ) + " lot (seed " + std::to_string( seed ) + ")" );
+        passed = runOnce( size, count ) && passed;
+      }
+
+      return passed;
+    }
+
+  }
+}
@@ -0,0 +1,312 @@
+#include "scripting/pathfinder.hpp"
+#include "containers/chunkedcollection3d.hpp"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    static const float DIAGONAL_COST = 1.41421356f;
+
+    Pathfinder::Search::Search() : current( 0 ) {}
+
+    /**
+     * Returns false, with steps empty, if there's no way from the start to the goal (or either is off the lot, or can't be stood on)
+     */
+    bool Pathfinder::Search::find( const NavGraph& graph, const Request& request, std::vector< Step >& steps, double& length ) {
+      steps.clear();
+      length = 0.0;
+
+      if( !graph.contains( request.level, request.x1, request.y1 ) || !graph.contains( request.level, request.x2, request.y2 ) ||
+          !graph.isWalkable( request.level, request.x1, request.y1 ) || !graph.isWalkable( request.level, request.x2, request.y2 ) ) {
+        return false;
+      }
+
+      unsigned int width = graph.getX();
+      std::size_t size = ( std::size_t ) width * graph.getY();
+      if( nodes.size() < size ) {
+        nodes.resize( size, Node{ 0.0f, 0, 0, false } );
+      }
+
+      // Once the counter wraps, nodes from four billion searches ago would look like they belong to this one
+      if( ++current == 0 ) {
+        for( Node& node : nodes ) {
+          node.search = 0;
+        }
+        current = 1;
+      }
+
+      // Octile distance: as many diagonal steps as fit, then straight the rest of the way
+      auto estimate = [ & ]( unsigned int x, unsigned int y ) {
+        float dx = std::abs( ( int ) x - ( int ) request.x2 );
+        float dy = std::abs( ( int ) y - ( int ) request.y2 );
+        return dx + dy + ( DIAGONAL_COST - 2.0f ) * std::min( dx, dy );
+      };
+
+      // Cheapest estimate first; among equals, whichever is furthest along
+      auto later = []( const Open& left, const Open& right ) {
+        return left.estimate > right.estimate || ( left.estimate == right.estimate && left.cost < right.cost );
+      };
+
+      std::uint32_t start = request.y1 * width + request.x1;
+      std::uint32_t goal = request.y2 * width + request.x2;
+      const std::uint8_t* moves = graph.getLevel( request.level );
+
+      open.clear();
+      nodes[ start ] = Node{ 0.0f, current, NavGraph::DIRECTIONS, false };
+      open.push_back( Open{ estimate( request.x1, request.y1 ), 0.0f, start } );
+
+      while( !open.empty() ) {
+        std::pop_heap( open.begin(), open.end(), later );
+        Open top = open.back();
+        open.pop_back();
+
+        // Nodes are pushed again when a cheaper way to them turns up, rather than moved up the heap; the old entries are skipped here
+        Node& node = nodes[ top.node ];
+        if( node.closed ) {
+          continue;
+        }
+        node.closed = true;
+
+        if( top.node == goal ) {
+          length = node.cost;
+
+          std::uint32_t at = goal;
+          while( true ) {
+            unsigned int x = at % width;
+            unsigned int y = at / width;
+            steps.push_back( Step{ x, y } );
+
+            std::uint8_t from = nodes[ at ].from;
+            if( from == NavGraph::DIRECTIONS ) {
+              break;
+            }
+
+            at = ( y - NavGraph::DY[ from ] ) * width + ( x - NavGraph::DX[ from ] );
+          }
+
+          std::reverse( steps.begin(), steps.end() );
+          return true;
+        }
+
+        unsigned int x = top.node % width;
+        unsigned int y = top.node / width;
+        std::uint8_t available = moves[ top.node ];
+
+        for( unsigned int direction = 0; direction != NavGraph::DIRECTIONS; direction++ ) {
+          if( !( available & ( 1 << direction ) ) ) {
+            continue;
+          }
+
+          unsigned int nextX = x + NavGraph::DX[ direction ];
+          unsigned int nextY = y + NavGraph::DY[ direction ];
+          std::uint32_t next = nextY * width + nextX;
+          float cost = node.cost + ( direction & 1 ? DIAGONAL_COST : 1.0f );
+
+          Node& neighbour = nodes[ next ];
+          if( neighbour.search != current ) {
+            neighbour = Node{ cost, current, ( std::uint8_t ) direction, false };
+          } else if( neighbour.closed || cost >= neighbour.cost ) {
+            continue;
+          } else {
+            neighbour.cost = cost;
+            neighbour.from = direction;
+          }
+
+          open.push_back( Open{ cost + estimate( nextX, nextY ), cost, next } );
+          std::push_heap( open.begin(), open.end(), later );
+        }
+      }
+
+      return false;
+    }
+
+    /**
+     * Add the chunks of grid whose version has moved since versions was filled in, bringing versions up to date. Each region is widened by
+     * grow cells up and to the left: wall cell ( x, y ) is on the top left corner of floor cell ( x, y ), so its segments border the floor
+     * cells above and to the left of it too.
+     */
+    template < typename Grid > static void findEdited( const Grid& grid, std::vector< std::uint64_t >& versions, unsigned int grow, std::vector< Lot::DirtyRegion >& regions ) {
+      constexpr unsigned int CHUNK_BITS = Containers::ChunkedCollection3D< std::uint8_t >::CHUNK_BITS;
+      constexpr unsigned int CHUNK_SIZE = Containers::ChunkedCollection3D< std::uint8_t >::CHUNK_SIZE;
+
+      unsigned int chunksX = ( grid.getX() + CHUNK_SIZE - 1 ) >> CHUNK_BITS;
+      unsigned int chunksY = ( grid.getY() + CHUNK_SIZE - 1 ) >> CHUNK_BITS;
+      versions.resize( ( std::size_t ) grid.getLevels() * chunksX * chunksY );
+
+      std::size_t chunk = 0;
+      for( unsigned int level = 0; level != grid.getLevels(); level++ ) {
+        for( unsigned int chunkY = 0; chunkY != chunksY; chunkY++ ) {
+          for( unsigned int chunkX = 0; chunkX != chunksX; chunkX++, chunk++ ) {
+            unsigned int xMin = chunkX << CHUNK_BITS;
+            unsigned int yMin = chunkY << CHUNK_BITS;
+
+            std::uint64_t version = grid.getChunkVersion( level, xMin, yMin );
+            if( version == versions[ chunk ] ) {
+              continue;
+            }
+
+            versions[ chunk ] = version;
+            regions.push_back( Lot::DirtyRegion{
+              level,
+              xMin > grow ? xMin - grow : 0,
+              yMin > grow ? yMin - grow : 0,
+              std::min( xMin + CHUNK_SIZE, grid.getX() ) - 1,
+              std::min( yMin + CHUNK_SIZE, grid.getY() ) - 1
+            } );
+          }
+        }
+      }
+    }
+
+    Pathfinder::Pathfinder( const Lot::FloorMap& floorMap, const WallGrid& wallMap ) :
+      graph( std::make_shared< NavGraph >( floorMap.getLevels(), floorMap.getX(), floorMap.getY() ) ),
+      floorVersion( floorMap.getVersion() ),
+      wallVersion( wallMap.getVersion() ),
+      running( false ) {
+      graph->build( floorMap, wallMap );
+
+      // Start from the grids as they are now
+      std::vector< Lot::DirtyRegion > built;
+      findEdited( floorMap, floorChunkVersions, 0, built );
+      findEdited( wallMap, wallChunkVersions, 1, built );
+    }
+
+    /**
+     * The batch in flight only uses its own copy of the graph, but it writes into paths
+     */
+    Pathfinder::~Pathfinder() {
+      group.wait();
+    }
+
+    /**
+     * Patch the graph for whatever has been edited on the lot since the last update. Call with the engine's Lua mutex held.
+     */
+    void Pathfinder::update( Lot& lot ) {
+      // Nothing on the lot has changed since the last update; the usual case, and the only one that runs every tick
+      if( lot.floorMap->getVersion() == floorVersion && lot.wallMap->getVersion() == wallVersion ) {
+        return;
+      }
+
+      floorVersion = lot.floorMap->getVersion();
+      wallVersion = lot.wallMap->getVersion();
+
+      std::vector< Lot::DirtyRegion > regions;
+      findEdited( *lot.floorMap, floorChunkVersions, 0, regions );
+      findEdited( *lot.wallMap, wallChunkVersions, 1, regions );
+      if( regions.empty() ) {
+        return;
+      }
+
+      // Still being searched by the batch in flight
+      if( graph.use_count() > 1 ) {
+        graph = std::make_shared< NavGraph >( *graph );
+      }
+
+      for( const Lot::DirtyRegion& region : regions ) {
+        graph->update( *lot.floorMap, *lot.wallMap, region );
+      }
+    }
+
+    void Pathfinder::request( const Request& request ) {
+      pending.push_back( request );
+    }
+
+    /**
+     * Start searching for everything requested since the last batch, unless the last batch is still running or hasn't been collected
+     */
+    void Pathfinder::dispatch() {
+      if( running || !requests.empty() || pending.empty() ) {
+        return;
+      }
+
+      requests.swap( pending );
+      running = true;
+
+      std::shared_ptr< const NavGraph > snapshot = graph;
+      group.run( [ this, snapshot ]() {
+        findAll( *snapshot, requests, paths );
+        running = false;
+      } );
+    }
+
+    /**
+     * Append the paths from the last batch to finished, if it's done. Returns false if there was nothing to collect.
+     */
+    bool Pathfinder::collect( std::vector< Path >& finished ) {
+      if( running || requests.empty() ) {
+        return false;
+      }
+
+      group.wait();
+
+      std::move( paths.begin(), paths.end(), std::back_inserter( finished ) );
+      paths.clear();
+      requests.clear();
+
+      return true;
+    }
+
+    void Pathfinder::wait() {
+      group.wait();
+    }
+
+    /**
+     * Drop every request that hasn't been answered, in flight or not, returning their callbacks for the caller to release
+     */
+    std::vector< LuaReference > Pathfinder::cancel() {
+      group.wait();
+
+      std::vector< LuaReference > callbacks;
+      for( const Request& request : requests ) {
+        callbacks.push_back( request.callback );
+      }
+      for( const Request& request : pending ) {
+        callbacks.push_back( request.callback );
+      }
+
+      requests.clear();
+      pending.clear();
+      paths.clear();
+
+      return callbacks;
+    }
+
+    /**
+     * Search for every request in batch across the TBB workers; results[ i ] answers batch[ i ]. Each worker keeps its scratch space
+     * from one batch to the next.
+     */
+    void Pathfinder::findAll( const NavGraph& graph, const std::vector< Request >& batch, std::vector< Path >& results ) {
+      results.resize( batch.size() );
+
+      tbb::parallel_for( tbb::blocked_range< std::size_t >( 0, batch.size() ), [ & ]( const tbb::blocked_range< std::size_t >& range ) {
+        Search& search = searches.local();
+
+        for( std::size_t i = range.begin(); i != range.end(); i++ ) {
+          Path& path = results[ i ];
+          path.callback = batch[ i ].callback;
+          path.found = search.find( graph, batch[ i ], path.steps, path.length );
+        }
+      } );
+    }
+
+    /**
+     * True while anything requested hasn't been collected yet
+     */
+    bool Pathfinder::isBusy() const {
+      return running || !requests.empty() || !pending.empty();
+    }
+
+    std::size_t Pathfinder::getPendingCount() const {
+      return requests.size() + pending.size();
+    }
+
+    const NavGraph& Pathfinder::getGraph() const {
+      return *graph;
+    }
+
+  }
+}
@@ -0,0 +1,402 @@
+#include "scripting/serializerbenchmark.hpp"
+#include "scripting/engine.hpp"
+#include "tools/jsonindex.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    const char* SerializerBenchmark::NODE_CLASS = R"LUA(
+      local Node = class( 'system.benchmark.node' )
+
+      function Node:touch( amount )
+        self.touched = ( self.touched or 0 ) + ( amount or 1 )
+      end
+
+      bluebear.register_class( Node )
+    )LUA";
+
+    // Returns function( count, seed ) giving an array of roots with roughly count tables and functions reachable from them. Both directions
+    // of the serializer recurse along references, so sibling rings and table chains are kept short.
+    const char* SerializerBenchmark::GENERATOR = R"LUA(
+      return function( count, seed )
+        math.randomseed( seed )
+
+        local Node = bluebear.get_class( 'system.benchmark.node' )
+        local roots = {}
+
+        local metatables = {}
+        for i = 1, 8 do
+          metatables[ i ] = { __index = { shape = i } }
+        end
+
+        local made = #metatables * 2
+        local ring = {}
+        while made < count do
+          local node = Node:new()
+          node.name = 'node'..made
+          node.me = node
+          made = made + 1
+
+          if #ring == 8 then
+            ring = {}
+          end
+          if #ring > 0 then
+            node.sibling = ring[ #ring ]
+            ring[ 1 ].last = node
+          end
+          ring[ #ring + 1 ] = node
+
+          local chain = node
+          for depth = 1, math.random( 0, 6 ) do
+            chain.child = { depth = depth, even = depth % 2 == 0 }
+            chain = chain.child
+            made = made + 1
+          end
+
+          if math.random() < 0.5 then
+            local list = {}
+            for i = 1, math.random( 1, 32 ) do
+              list[ i ] = i * 0.5
+            end
+            node.list = list
+            made = made + 1
+          end
+
+          node.shaped = setmetatable( { weight = math.random() }, metatables[ math.random( #metatables ) ] )
+          made = made + 1
+
+          if math.random() < 0.5 then
+            node.on_touch = bluebear.util.bind( 'system.benchmark.node:touch', node, math.random( 10 ) )
+            made = made + 2
+          end
+
+          if math.random() < 0.5 then
+            local calls = 0
+            local sibling = node.sibling
+            node.counter = function()
+              calls = calls + 1
+              return calls, sibling
+            end
+            made = made + 1
+          end
+
+          roots[ #roots + 1 ] = node
+        end
+
+        return roots
+      end
+    )LUA";
+
+    // Returns function( roots ) giving a description of everything reachable from roots that doesn't depend on addresses or on the order
+    // tables happen to iterate in, and the number of tables and functions it covers. Objects are numbered breadth-first, keys are sorted,
+    // and numbers are written so that 1 and 1.0 (which the JSON format doesn't tell apart) read the same.
+    const char* SerializerBenchmark::DESCRIBER = R"LUA(
+      return function( roots )
+        local ids, queue, out = {}, {}, {}
+        local named = { [ _G ] = '_G', [ bluebear ] = 'bluebear' }
+
+        local function before( a, b )
+          local ta, tb = type( a ), type( b )
+          if ta ~= tb then
+            return ta < tb
+          end
+          if ta == 'number' or ta == 'string' then
+            return a < b
+          end
+          return tostring( a ) < tostring( b )
+        end
+
+        local function value( v )
+          local kind = type( v )
+          if kind == 'string' then
+            return string.format( '%q', v )
+          elseif kind == 'number' then
+            return string.format( '%.17g', v )
+          elseif kind == 'boolean' or kind == 'nil' then
+            return tostring( v )
+          elseif kind == 'table' and named[ v ] then
+            return named[ v ]
+          elseif kind == 'table' and rawget( v, '__instanceDict' ) and v.__middleclass then
+            return 'class '..v.name
+          elseif kind == 'table' or kind == 'function' or kind == 'thread' then
+            if not ids[ v ] then
+              queue[ #queue + 1 ] = v
+              ids[ v ] = #queue
+            end
+            return '#'..ids[ v ]
+          end
+          return kind
+        end
+
+        local function describeTable( t )
+          local class = t.class
+          local instance = type( class ) == 'table' and class.__middleclass
+          local parts = { instance and ( 'instance '..class.name ) or 'table' }
+
+          local keys = {}
+          for k in next, t do
+            if not ( instance and k == 'class' ) then
+              keys[ #keys + 1 ] = k
+            end
+          end
+          table.sort( keys, before )
+
+          for _, k in ipairs( keys ) do
+            parts[ #parts + 1 ] = value( k )..'='..value( rawget( t, k ) )
+          end
+
+          local metatable = debug.getmetatable( t )
+          if not instance and metatable then
+            parts[ #parts + 1 ] = 'metatable='..value( metatable )
+          end
+
+          return table.concat( parts, ' ' )
+        end
+
+        local function describeFunction( f )
+          local info = debug.getinfo( f, 'Su' )
+          if info.what == 'C' then
+            return 'cfunction'
+          end
+
+          local parts = { 'function', #string.dump( f ) }
+          for i = 1, info.nups do
+            local name, v = debug.getupvalue( f, i )
+            parts[ #parts + 1 ] = name..'='..value( v )
+          end
+
+          return table.concat( parts, ' ' )
+        end
+
+        for i, root in ipairs( roots ) do
+          out[ #out + 1 ] = 'root '..value( root )
+        end
+
+        local head = 1
+        while head <= #queue do
+          local v = queue[ head ]
+          local kind = type( v )
+          if kind == 'table' then
+            out[ #out + 1 ] = '#'..head..' '..describeTable( v )
+          elseif kind == 'function' then
+            out[ #out + 1 ] = '#'..head..' '..describeFunction( v )
+          else
+            out[ #out + 1 ] = '#'..head..' '..kind
+          end
+          head = head + 1
+        end
+
+        return table.concat( out, '\n' ), #queue
+      end
+    )LUA";
+
+    SerializerBenchmark::SerializerBenchmark( unsigned int seed ) : seed( seed ) {}
+
+    std::unique_ptr< Engine > SerializerBenchmark::createEngine() {
+      std::unique_ptr< Engine > engine = std::make_unique< Engine >();
+
+      if( !engine->submitLuaContributions() ) {
+        Log::getInstance().error( "SerializerBenchmark::createEngine", "Failed to load BlueBear!" );
+        return nullptr;
+      }
+
+      return engine;
+    }
+
+    /**
+     * STACK ARGS: none
+     * RETURNS: ( results values from the chunk, if it ran )
+     */
+    bool SerializerBenchmark::runChunk( lua_State* L, const char* chunk, const char* name, int results ) {
+      if( luaL_loadbuffer( L, chunk, std::strlen( chunk ), name ) || lua_pcall( L, 0, results, 0 ) ) { // error
+        Log::getInstance().error( "SerializerBenchmark::runChunk", std::string( name ) + ": " + lua_tostring( L, -1 ) );
+        lua_pop( L, 1 ); // EMPTY
+        return false;
+      }
+
+      return true;
+    }
+
+    /**
+     * FNV-1a of the description of everything reachable from roots. described is set to the number of tables and functions it covers.
+     */
+    std::uint64_t SerializerBenchmark::describe( lua_State* L, std::vector< LuaReference >& roots, std::size_t& described ) {
+      described = 0;
+
+      if( !runChunk( L, DESCRIBER, "describer", 1 ) ) {
+        return 0;
+      }
+
+      lua_createtable( L, roots.size(), 0 ); // roots <describer>
+      for( unsigned int i = 0; i != roots.size(); i++ ) {
+        lua_rawgeti( L, LUA_REGISTRYINDEX, roots[ i ] ); // root roots <describer>
+        lua_rawseti( L, -2, i + 1 ); // roots <describer>
+      }
+
+      if( lua_pcall( L, 1, 2, 0 ) ) { // error
+        Log::getInstance().error( "SerializerBenchmark::describe", lua_tostring( L, -1 ) );
+        lua_pop( L, 1 ); // EMPTY
+        return 0;
+      } // count "description"
+
+      described = lua_tointeger( L, -1 );
+
+      std::size_t length = 0;
+      const char* description = lua_tolstring( L, -2, &length );
+      std::uint64_t hash = 14695981039346656037ULL;
+      for( std::size_t i = 0; i != length; i++ ) {
+        hash = ( hash ^ ( unsigned char ) description[ i ] ) * 1099511628211ULL;
+      }
+
+      lua_pop( L, 2 ); // EMPTY
+
+      return hash;
+    }
+
+    bool SerializerBenchmark::runOnce( unsigned int count ) {
+      using Clock = std::chrono::steady_clock;
+
+      Result result{ count, 0, 0, 0.0, 0.0, false };
+
+      std::unique_ptr< Engine > source = createEngine();
+      if( !source || !runChunk( source->L, NODE_CLASS, "node class", 0 ) || !runChunk( source->L, GENERATOR, "generator", 1 ) ) {
+        return false;
+      }
+
+      lua_State* L = source->L;
+      lua_pushinteger( L, count ); // count <generator>
+      lua_pushinteger( L, seed ); // seed count <generator>
+      if( lua_pcall( L, 2, 1, 0 ) ) { // error
+        Log::getInstance().error( "SerializerBenchmark::runOnce", lua_tostring( L, -1 ) );
+        lua_pop( L, 1 ); // EMPTY
+        return false;
+      } // roots
+
+      for( lua_Integer i = 1, length = luaL_len( L, -1 ); i <= length; i++ ) {
+        lua_rawgeti( L, -1, i ); // root roots
+        source->addObject( luaL_ref( L, LUA_REGISTRYINDEX ) ); // roots
+      }
+      lua_pop( L, 1 ); // EMPTY
+
+      std::size_t describedBefore = 0;
+      std::uint64_t before = describe( L, source->objects, describedBefore );
+
+      // Saved the way a lot is: streamed, record by record
+      std::stringstream buffer;
+      Clock::time_point start = Clock::now();
+      source->saveWorld( buffer );
+      result.saveSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+      result.bytes = buffer.tellp();
+
+      Tools::JSONIndex saved( buffer );
+      result.records = saved.index( "world" ).getKeys().size();
+
+      // Only one world in memory at a time
+      source.reset();
+
+      std::unique_ptr< Engine > target = createEngine();
+      if( !target || !runChunk( target->L, NODE_CLASS, "node class", 0 ) ) {
+        return false;
+      }
+
+      Tools::JSONIndex engineIndex( buffer );
+      start = Clock::now();
+      target->loadWorld( engineIndex );
+      result.loadSeconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+      std::size_t describedAfter = 0;
+      std::uint64_t after = describe( target->L, target->objects, describedAfter );
+
+      result.matched = before == after && describedBefore == describedAfter && describedBefore != 0;
+      if( !result.matched ) {
+        Log::getInstance().error(
+          "SerializerBenchmark::runOnce",
+          "Round trip of " + std::to_string( count ) + " objects (seed " + std::to_string( seed ) + ") doesn't match: " +
+          std::to_string( describedBefore ) + " objects described before saving, " + std::to_string( describedAfter ) + " after loading"
+        );
+      }
+
+      report( result );
+
+      return result.matched;
+    }
+
+    void SerializerBenchmark::report( const Result& result ) {
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << result.records << " objects (" << result.requested << " requested): "
+        << "save " << result.saveSeconds * 1000.0 << "ms, "
+        << ( result.saveSeconds > 0.0 ? result.records / result.saveSeconds : 0.0 ) << " objects/sec; "
+        << "load " << result.loadSeconds * 1000.0 << "ms, "
+        << ( result.loadSeconds > 0.0 ? result.records / result.loadSeconds : 0.0 ) << " objects/sec; "
+        << ( result.records ? ( double ) result.bytes / result.records : 0.0 ) << " bytes/object; "
+        << ( result.matched ? "round trip matches" : "ROUND TRIP MISMATCH" );
+
+      Log::getInstance().info( "SerializerBenchmark::report", stream.str() );
+    }
+
+    /**
+     * Returns false if any world failed to generate or didn't survive the round trip
+     */
+    bool SerializerBenchmark::run( const std::vector< unsigned int >& counts ) {
+      bool passed = true;
+
+      for( unsigned int count : counts ) {
+        Log::getInstance().info( "SerializerBenchmark::run", "Generating " + std::to_string( count ) + " objects (seed " + std::to_string( seed ) + ")" );
+        passed = runOnce( count ) && passed;
+      }
+
+      return passed;
+    }
+
+    /**
+     * Returns false if the lot failed to load on any pass
+     */
+    bool SerializerBenchmark::runLot( const std::string& path, unsigned int repeats ) {
+      using Clock = std::chrono::steady_clock;
+
+      std::ifstream file( path, std::ios::binary | std::ios::ate );
+      double megabytes = file.is_open() ? file.tellg() / ( 1024.0 * 1024.0 ) : 0.0;
+
+      double fastest = 0.0;
+      double total = 0.0;
+      for( unsigned int i = 0; i != repeats; i++ ) {
+        std::unique_ptr< Engine > engine = createEngine();
+        if( !engine ) {
+          return false;
+        }
+
+        Clock::time_point start = Clock::now();
+        if( !engine->loadLot( path.c_str() ) ) {
+          Log::getInstance().error( "SerializerBenchmark::runLot", "Failed to load " + path );
+          return false;
+        }
+        double seconds = std::chrono::duration< double >( Clock::now() - start ).count();
+
+        fastest = i == 0 ? seconds : std::min( fastest, seconds );
+        total += seconds;
+      }
+
+      double mean = repeats ? total / repeats : 0.0;
+
+      std::stringstream stream;
+      stream << std::fixed << std::setprecision( 2 )
+        << path << " (" << megabytes << "MB) over " << repeats << " loads: "
+        << "fastest " << fastest * 1000.0 << "ms, mean " << mean * 1000.0 << "ms, "
+        << ( fastest > 0.0 ? megabytes / fastest : 0.0 ) << "MB/sec";
+
+      Log::getInstance().info( "SerializerBenchmark::runLot", stream.str() );
+
+      return true;
+    }
+
+  }
+}
@@ -0,0 +1,385 @@
+#include "scripting/shardgroup.hpp"
+#include "scripting/engine.hpp"
+#include "scripting/event/waitingtable.hpp"
+#include "scripting/luakit/eventbridge.hpp"
+#include "scripting/luakit/refcache.hpp"
+#include "scripting/luakit/serializer.hpp"
+#include "tools/ctvalidators.hpp"
+#include "log.hpp"
+#include <tbb/task_group.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr double ShardGroup::CELL_SIZE;
+
+    ShardGroup::ShardGroup( Engine& primary, unsigned int count ) : primary( primary ), inboxes( count ), handlers( count ) {
+      for( unsigned int i = 1; i < count; i++ ) {
+        workers.push_back( std::make_unique< Engine >( this, i ) );
+      }
+
+      Log::getInstance().info( "ShardGroup::ShardGroup", "Running the lot across " + std::to_string( count ) + " shards" );
+    }
+
+    /**
+     * Handlers belong to the shards' states - let go of them while those still exist
+     */
+    ShardGroup::~ShardGroup() {
+      for( unsigned int i = 0; i != handlers.size(); i++ ) {
+        lua_State* L = getShard( i ).L;
+
+        for( auto& pair : handlers[ i ] ) {
+          luaL_unref( L, LUA_REGISTRYINDEX, pair.second );
+        }
+      }
+    }
+
+    unsigned int ShardGroup::getCount() {
+      return workers.size() + 1;
+    }
+
+    Engine& ShardGroup::getShard( unsigned int index ) {
+      return index ? *workers[ index - 1 ] : primary;
+    }
+
+    /**
+     * Load modpacks into every worker. Called after the primary has loaded its own.
+     */
+    bool ShardGroup::submitLuaContributions() {
+      for( std::unique_ptr< Engine >& worker : workers ) {
+        if( !worker->submitLuaContributions() ) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    /**
+     * Set up bluebear.shard on a shard's state.
+     *
+     * STACK ARGS: bluebear
+     * (Stack is unmodified after call)
+     */
+    void ShardGroup::registerLuaContributions( lua_State* L, unsigned int index ) {
+      // bluebear.shard
+      lua_pushstring( L, "shard" );
+      lua_newtable( L );
+
+      // bluebear.shard.index
+      lua_pushstring( L, "index" );
+      lua_pushinteger( L, index );
+      lua_settable( L, -3 );
+
+      // bluebear.shard.count
+      lua_pushstring( L, "count" );
+      lua_pushinteger( L, getCount() );
+      lua_settable( L, -3 );
+
+      // bluebear.shard.send
+      lua_pushstring( L, "send" );
+      lua_pushlightuserdata( L, this );
+      lua_pushinteger( L, index );
+      lua_pushcclosure( L, &ShardGroup::lua_send, 2 );
+      lua_settable( L, -3 );
+
+      // bluebear.shard.listen
+      lua_pushstring( L, "listen" );
+      lua_pushlightuserdata( L, this );
+      lua_pushinteger( L, index );
+      lua_pushcclosure( L, &ShardGroup::lua_listen, 2 );
+      lua_settable( L, -3 );
+
+      // Set the shard table on "bluebear"
+      lua_settable( L, -3 );
+    }
+
+    /**
+     * Run one tick on every shard. The primary runs on the calling thread (which holds its Lua lock, and may be the one with the GL
+     * context); the workers run as TBB tasks. Returns the number of callbacks run across all shards.
+     */
+    unsigned int ShardGroup::tick() {
+      std::atomic< unsigned int > callbacksRun( 0 );
+      tbb::task_group group;
+
+      for( std::unique_ptr< Engine >& worker : workers ) {
+        Engine* shard = worker.get();
+
+        group.run( [ shard, &callbacksRun ]() {
+          callbacksRun += shard->objectLoop();
+        } );
+      }
+
+      callbacksRun += primary.objectLoop();
+
+      // Barrier: nothing crosses between shards until they've all finished the tick
+      group.wait();
+
+      deliverMail();
+
+      return callbacksRun;
+    }
+
+    /**
+     * Engine::skipIdleTicks across the whole group: shards have to stay on the same tick, so only skip to the earliest deadline of any shard.
+     */
+    void ShardGroup::skipIdleTicks() {
+      bool pending = false;
+      Tick next = std::numeric_limits< Tick >::max();
+
+      for( unsigned int i = 0; i != getCount(); i++ ) {
+        Engine& shard = getShard( i );
+
+        if( !shard.waitingTable.queuedCallbacks.empty() ) {
+          return;
+        }
+
+        if( shard.waitingTable.hasPendingTimers() ) {
+          pending = true;
+          next = std::min( next, shard.waitingTable.getNextDeadline() );
+        }
+      }
+
+      if( pending && primary.limitSkip( next ) && next > primary.currentTick ) {
+        for( unsigned int i = 0; i != getCount(); i++ ) {
+          getShard( i ).currentTick = next;
+        }
+      }
+    }
+
+    /**
+     * Engine::countUnrestartable across the whole group; a save covers every shard
+     */
+    unsigned int ShardGroup::countUnrestartable() {
+      unsigned int count = 0;
+
+      for( unsigned int i = 0; i != getCount(); i++ ) {
+        count += getShard( i ).countUnrestartable();
+      }
+
+      return count;
+    }
+
+    /**
+     * May be called from any shard's thread during a tick
+     */
+    void ShardGroup::post( unsigned int from, unsigned int to, const std::string& channel, const std::string& payload ) {
+      std::unique_lock< std::mutex > lock( mailMutex );
+
+      inboxes[ to ].push_back( Message{ from, channel, payload } );
+    }
+
+    /**
+     * Called after the barrier, so nothing else is touching any shard's state. Each message is handed to its channel's handler on the next
+     * tick, as handler( payload, sender ). The shards have already moved on to that tick, so the handlers are queued for currentTick.
+     */
+    void ShardGroup::deliverMail() {
+      for( unsigned int i = 0; i != inboxes.size(); i++ ) {
+        Engine& shard = getShard( i );
+        lua_State* L = shard.L;
+
+        for( Message& message : inboxes[ i ] ) {
+          auto handler = handlers[ i ].find( message.channel );
+          if( handler == handlers[ i ].end() ) {
+            Log::getInstance().warn( "ShardGroup::deliverMail", "Shard " + std::to_string( i ) + " has no listener for channel \"" + message.channel + "\"; dropping message" );
+            continue;
+          }
+
+          LuaKit::RefCache::push( L, LuaKit::RefCache::Entry::BIND ); // <bind>
+          lua_rawgeti( L, LUA_REGISTRYINDEX, handler->second ); // <function> <bind>
+          lua_pushstring( L, message.payload.c_str() ); // "payload" <function> <bind>
+          lua_pushinteger( L, message.from ); // from "payload" <function> <bind>
+
+          if( lua_pcall( L, 3, 1, 0 ) ) { // error
+            Log::getInstance().error( "ShardGroup::deliverMail", "Couldn't create closure to deliver message: " + std::string( lua_tostring( L, -1 ) ) );
+            lua_pop( L, 1 ); // EMPTY
+            continue;
+          } // <temp_function>
+
+          shard.waitingTable.waitForTick( shard.currentTick, luaL_ref( L, LUA_REGISTRYINDEX ) ); // EMPTY
+        }
+
+        inboxes[ i ].clear();
+      }
+    }
+
+    /**
+     * Load each worker from its own section of the lot, through its own Serializer. Workers stay on the primary's tick.
+     */
+    void ShardGroup::loadWorld( Json::Value& shards ) {
+      if( shards.size() > workers.size() ) {
+        Log::getInstance().warn( "ShardGroup::loadWorld", "Lot has " + std::to_string( shards.size() + 1 ) + " shards but only " + std::to_string( getCount() ) + " are running; the extra shards will not be loaded" );
+      }
+
+      for( unsigned int i = 0; i != workers.size() && i != shards.size(); i++ ) {
+        workers[ i ]->loadWorld( shards[ i ] );
+        workers[ i ]->currentTick = primary.currentTick;
+      }
+    }
+
+    /**
+     * Split a lot saved without shards across the group. The primary has loaded all of it; each worker is handed its own part, saved from
+     * the primary by LuaKit::Serializer::savePartition, and the primary lets go of what it handed over. A lot object with a position
+     * (Entity:place_object) goes to the shard for the cell it stands in, and anything else stays on shard 0. Timers and event waiters go
+     * wherever the object recorded as their owner went (see Engine::setOwner); any without one stay on shard 0. Whatever objects on
+     * different shards both refer to is copied to each.
+     */
+    void ShardGroup::partition() {
+      lua_State* L = primary.L;
+
+      for( unsigned int i = 1; i != getCount(); i++ ) {
+        std::vector< LuaReference > objects;
+        for( LuaReference object : primary.objects ) {
+          if( getHome( object ) == i ) {
+            objects.push_back( object );
+          }
+        }
+
+        LuaKit::Serializer serializer( L );
+        Json::Value section = serializer.savePartition( objects, primary, [ & ]( LuaReference callback ) {
+          return getCallbackHome( callback ) == i;
+        } );
+        section[ "ticks" ] = ( Json::UInt64 ) primary.currentTick;
+
+        Engine& worker = getShard( i );
+        worker.loadWorld( section );
+        Log::getInstance().info( "ShardGroup::partition", "Shard " + std::to_string( i ) + " has " + std::to_string( worker.objects.size() ) + " lot objects" );
+      }
+
+      // Homes are looked up before any objects go, while their owners can still be recognised
+      auto elsewhere = [ & ]( LuaReference callback ) {
+        if( getCallbackHome( callback ) == 0 ) {
+          return false;
+        }
+
+        luaL_unref( L, LUA_REGISTRYINDEX, callback );
+        return true;
+      };
+
+      primary.waitingTable.dropTimers( elsewhere );
+      primary.eventBridge->dropWaiters( elsewhere );
+
+      std::vector< LuaReference > leaving;
+      for( LuaReference object : primary.objects ) {
+        if( getHome( object ) != 0 ) {
+          leaving.push_back( object );
+        }
+      }
+
+      for( LuaReference object : leaving ) {
+        primary.removeObject( object );
+      }
+
+      Log::getInstance().info( "ShardGroup::partition", "Shard 0 has " + std::to_string( primary.objects.size() ) + " lot objects" );
+    }
+
+    /**
+     * Which shard a lot object on the primary belongs on
+     */
+    unsigned int ShardGroup::getHome( LuaReference object ) {
+      lua_State* L = primary.L;
+
+      lua_rawgeti( L, LUA_REGISTRYINDEX, object ); // object
+      lua_getfield( L, -1, "position" ); // position object
+
+      SpatialIndex::Position position;
+      bool placed = Engine::getPosition( L, -1, position );
+      lua_pop( L, 2 ); // EMPTY
+
+      if( !placed ) {
+        return 0;
+      }
+
+      std::int64_t cellX = std::floor( position.x / CELL_SIZE );
+      std::int64_t cellY = std::floor( position.y / CELL_SIZE );
+
+      return ( ( std::uint64_t ) cellX * 73856093u ^ ( std::uint64_t ) cellY * 19349663u ) % getCount();
+    }
+
+    /**
+     * Which shard a timer or event waiter on the primary belongs on: its owner's
+     */
+    unsigned int ShardGroup::getCallbackHome( LuaReference callback ) {
+      LuaReference owner = primary.getOwner( callback );
+
+      return owner == LUA_NOREF ? 0 : getHome( owner );
+    }
+
+    Json::Value ShardGroup::saveWorld() {
+      Json::Value shards( Json::arrayValue );
+
+      for( std::unique_ptr< Engine >& worker : workers ) {
+        shards.append( worker->saveWorld() );
+      }
+
+      return shards;
+    }
+
+    void ShardGroup::saveWorld( std::ostream& output ) {
+      output << "[";
+
+      for( unsigned int i = 0; i != workers.size(); i++ ) {
+        if( i ) {
+          output << ",";
+        }
+
+        workers[ i ]->saveWorld( output );
+      }
+
+      output << "]";
+    }
+
+    /**
+     * STACK ARGS: shard "channel" "payload"
+     * RETURNS: EMPTY
+     */
+    int ShardGroup::lua_send( lua_State* L ) {
+      VERIFY_NUMBER_N( "ShardGroup::lua_send", "send", 3 );
+      VERIFY_STRING_N( "ShardGroup::lua_send", "send", 2 );
+      VERIFY_STRING_N( "ShardGroup::lua_send", "send", 1 );
+
+      ShardGroup* self = ( ShardGroup* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+      unsigned int from = lua_tointeger( L, lua_upvalueindex( 2 ) );
+
+      lua_Integer to = lua_tointeger( L, -3 );
+      if( to < 0 || to >= self->getCount() ) {
+        return luaL_error( L, "send: no shard %d", ( int ) to );
+      }
+
+      self->post( from, to, lua_tostring( L, -2 ), lua_tostring( L, -1 ) );
+
+      return 0;
+    }
+
+    /**
+     * Replaces any handler already listening on the channel.
+     *
+     * STACK ARGS: "channel" <function>
+     * RETURNS: EMPTY
+     */
+    int ShardGroup::lua_listen( lua_State* L ) {
+      VERIFY_FUNCTION_N( "ShardGroup::lua_listen", "listen", 1 );
+      VERIFY_STRING_N( "ShardGroup::lua_listen", "listen", 2 );
+
+      ShardGroup* self = ( ShardGroup* )lua_touserdata( L, lua_upvalueindex( 1 ) );
+      unsigned int index = lua_tointeger( L, lua_upvalueindex( 2 ) );
+
+      std::string channel( lua_tostring( L, -2 ) );
+      LuaReference handler = luaL_ref( L, LUA_REGISTRYINDEX ); // "channel"
+
+      auto existing = self->handlers[ index ].find( channel );
+      if( existing != self->handlers[ index ].end() ) {
+        luaL_unref( L, LUA_REGISTRYINDEX, existing->second );
+      }
+
+      self->handlers[ index ][ channel ] = handler;
+
+      return 0;
+    }
+
+  }
+}
@@ -0,0 +1,138 @@
+#include "scripting/spatialindex.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    SpatialIndex::SpatialIndex() {
+      resize( 1, 1, 1 );
+    }
+
+    /**
+     * Size the grid to a lot (levels, and floor cells along x and y). Everything indexed is forgotten.
+     */
+    void SpatialIndex::resize( unsigned int levels, unsigned int floorX, unsigned int floorY ) {
+      this->levels = std::max( levels, 1u );
+      x = std::max( floorX, 1u );
+      y = std::max( floorY, 1u );
+
+      // Display centres the lot on the origin: cell ( 0, 0 ) is at the top left, and the floor tile at x is centred on -( floorX / 2 ) + 0.5 + x
+      xOrigin = -( double )( floorX / 2 );
+      yOrigin = ( double )( floorY / 2 );
+
+      cells.clear();
+      cells.resize( ( std::size_t ) this->levels * x * y );
+      entries.clear();
+      instances.clear();
+    }
+
+    void SpatialIndex::clear() {
+      for( std::vector< Instance >& cell : cells ) {
+        cell.clear();
+      }
+
+      entries.clear();
+      instances.clear();
+    }
+
+    /**
+     * Positions off the lot are kept in the nearest cell on its edge
+     */
+    int SpatialIndex::getCellX( double worldX ) const {
+      return std::min( std::max( ( int ) std::floor( worldX - xOrigin ), 0 ), ( int ) x - 1 );
+    }
+
+    int SpatialIndex::getCellY( double worldY ) const {
+      return std::min( std::max( ( int ) std::floor( yOrigin - worldY ), 0 ), ( int ) y - 1 );
+    }
+
+    int SpatialIndex::getLevel( double worldZ ) const {
+      return std::min( std::max( ( int ) std::floor( worldZ / 2.0 ), 0 ), ( int ) levels - 1 );
+    }
+
+    std::size_t SpatialIndex::getCellIndex( int level, int cellX, int cellY ) const {
+      return ( ( std::size_t ) y * x * level ) + ( ( std::size_t ) x * cellY ) + cellX;
+    }
+
+    void SpatialIndex::removeFromCell( std::size_t cell, Instance instance ) {
+      std::vector< Instance >& list = cells[ cell ];
+      auto position = std::find( list.begin(), list.end(), instance );
+
+      if( position != list.end() ) {
+        *position = list.back();
+        list.pop_back();
+      }
+    }
+
+    /**
+     * Index instance (one of object's placed instances) at position, or move it there if it's already indexed
+     */
+    void SpatialIndex::place( LuaReference object, Instance instance, const Position& position ) {
+      std::size_t cell = getCellIndex( getLevel( position.z ), getCellX( position.x ), getCellY( position.y ) );
+
+      auto existing = entries.find( instance );
+      if( existing != entries.end() ) {
+        if( existing->second.object != object ) {
+          // Placed again, by a different object
+          remove( instance );
+        } else {
+          if( existing->second.cell != cell ) {
+            removeFromCell( existing->second.cell, instance );
+            cells[ cell ].push_back( instance );
+            existing->second.cell = cell;
+          }
+
+          existing->second.position = position;
+          return;
+        }
+      }
+
+      entries.emplace( instance, Entry{ object, position, cell } );
+      cells[ cell ].push_back( instance );
+      instances[ object ].push_back( instance );
+    }
+
+    void SpatialIndex::remove( Instance instance ) {
+      auto entry = entries.find( instance );
+      if( entry == entries.end() ) {
+        return;
+      }
+
+      removeFromCell( entry->second.cell, instance );
+
+      auto owned = instances.find( entry->second.object );
+      if( owned != instances.end() ) {
+        owned->second.erase( std::remove( owned->second.begin(), owned->second.end(), instance ), owned->second.end() );
+        if( owned->second.empty() ) {
+          instances.erase( owned );
+        }
+      }
+
+      entries.erase( entry );
+    }
+
+    /**
+     * Forget every instance object placed
+     */
+    void SpatialIndex::removeObject( LuaReference object ) {
+      auto owned = instances.find( object );
+      if( owned == instances.end() ) {
+        return;
+      }
+
+      for( Instance instance : owned->second ) {
+        auto entry = entries.find( instance );
+        removeFromCell( entry->second.cell, instance );
+        entries.erase( entry );
+      }
+
+      instances.erase( owned );
+    }
+
+    std::size_t SpatialIndex::getInstanceCount() const {
+      return entries.size();
+    }
+
+  }
+}
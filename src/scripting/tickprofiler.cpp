@@ -0,0 +1,196 @@
+#include "scripting/tickprofiler.hpp"
+#include "log.hpp"
+#include <jsoncpp/json/json.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    TickProfiler::TickProfiler( const std::string& tracePath, unsigned int topN, std::size_t maxEvents ) :
+      tracePath( tracePath ), topN( topN ), maxEvents( maxEvents ), truncated( false ), epoch( Clock::now() ), tickStart( epoch ), currentTick( 0 ), tickFirstCallback( 0 ) {
+      Log::getInstance().info( "TickProfiler::TickProfiler", "Profiling callbacks; trace will be written to " + tracePath );
+    }
+
+    /**
+     * RAII style - the trace and summary are written out when the owning Engine goes away
+     */
+    TickProfiler::~TickProfiler() {
+      writeTrace();
+      logSummary();
+    }
+
+    /**
+     * Microseconds between the profiler's creation and timePoint
+     */
+    double TickProfiler::since( Clock::time_point timePoint ) {
+      return std::chrono::duration< double, std::micro >( timePoint - epoch ).count();
+    }
+
+    unsigned int TickProfiler::intern( const std::string& name ) {
+      auto pair = labelIndex.find( name );
+      if( pair != labelIndex.end() ) {
+        return pair->second;
+      }
+
+      unsigned int index = labels.size();
+      labels.push_back( Label{ name, 0, 0.0, 0.0 } );
+      labelIndex[ name ] = index;
+      return index;
+    }
+
+    void TickProfiler::beginTick( Tick tick ) {
+      currentTick = tick;
+      tickFirstCallback = callbackEvents.size();
+      tickStart = Clock::now();
+    }
+
+    void TickProfiler::endTick( unsigned int callbacks ) {
+      Clock::time_point tickEnd = Clock::now();
+
+      if( tickEvents.size() + callbackEvents.size() >= maxEvents ) {
+        return;
+      }
+
+      tickEvents.push_back( TickEvent{ currentTick, since( tickStart ), std::chrono::duration< double, std::micro >( tickEnd - tickStart ).count(), callbacks, tickFirstCallback, callbackEvents.size() } );
+    }
+
+    /**
+     * Figure out what to call the function on top of the stack. sfunctions are labelled "class:method". Functions wrapped by bluebear.util.bind
+     * without an sfunction are unwrapped via their "func" upvalue, so that they are labelled with the chunk and line of the function that
+     * actually does the work, instead of the line in the class modpack where bind is defined.
+     *
+     * STACK ARGS: function
+     * (Stack is unmodified after call)
+     */
+    unsigned int TickProfiler::identify( lua_State* L ) {
+      lua_pushvalue( L, -1 ); // function function
+
+      // Bound functions can be nested, but not deeply; don't chase the "func" chain forever
+      for( int depth = 0; depth != 8; depth++ ) {
+        const char* derivedClass = nullptr;
+        const char* derivedFunc = nullptr;
+        int funcIndex = 0;
+
+        for( int i = 1; const char* upvalueId = lua_getupvalue( L, -1, i ); i++ ) { // upvalue function function
+          std::string key( upvalueId );
+
+          if( key == "__derived_class" && lua_type( L, -1 ) == LUA_TSTRING ) {
+            derivedClass = lua_tostring( L, -1 );
+          } else if( key == "__derived_func" && lua_type( L, -1 ) == LUA_TSTRING ) {
+            derivedFunc = lua_tostring( L, -1 );
+          } else if( key == "func" && lua_type( L, -1 ) == LUA_TFUNCTION ) {
+            funcIndex = i;
+          }
+
+          // Strings held as upvalues stay alive for as long as the function on the stack does
+          lua_pop( L, 1 ); // function function
+        }
+
+        if( derivedClass && derivedFunc ) {
+          unsigned int label = intern( std::string( derivedClass ) + ":" + derivedFunc );
+          lua_pop( L, 1 ); // function
+          return label;
+        }
+
+        if( !funcIndex ) {
+          break;
+        }
+
+        lua_getupvalue( L, -1, funcIndex ); // func function function
+        lua_remove( L, -2 ); // func function
+      }
+
+      lua_Debug debug;
+      lua_getinfo( L, ">S", &debug ); // function
+
+      return intern( std::string( debug.short_src ) + ":" + std::to_string( debug.linedefined ) );
+    }
+
+    TickProfiler::Clock::time_point TickProfiler::beginCallback() {
+      return Clock::now();
+    }
+
+    void TickProfiler::endCallback( unsigned int label, Clock::time_point start ) {
+      Clock::time_point end = Clock::now();
+      double duration = std::chrono::duration< double, std::micro >( end - start ).count();
+
+      Label& entry = labels[ label ];
+      entry.calls++;
+      entry.totalTime += duration;
+      entry.maxTime = std::max( entry.maxTime, duration );
+
+      // Aggregates are always kept, but individual trace events are capped so long sessions don't eat all available memory
+      if( tickEvents.size() + callbackEvents.size() >= maxEvents ) {
+        if( !truncated ) {
+          truncated = true;
+          Log::getInstance().warn( "TickProfiler::endCallback", "Reached profiler_max_events; no further trace events will be recorded" );
+        }
+
+        return;
+      }
+
+      callbackEvents.push_back( CallbackEvent{ label, since( start ), duration } );
+    }
+
+    /**
+     * Write the Chrome trace event format: one complete ("X") event per tick, with the callbacks it ran nested inside it
+     */
+    void TickProfiler::writeTrace() {
+      std::ofstream output( tracePath );
+      if( !output.is_open() ) {
+        Log::getInstance().error( "TickProfiler::writeTrace", "Could not open " + tracePath + " for writing" );
+        return;
+      }
+
+      output << std::fixed << std::setprecision( 3 ) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+      bool first = true;
+      for( const TickEvent& tick : tickEvents ) {
+        output << ( first ? "" : "," ) << "\n{\"name\":\"tick " << tick.tick << "\",\"cat\":\"tick\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << tick.start
+          << ",\"dur\":" << tick.duration << ",\"args\":{\"tick\":" << tick.tick << ",\"callbacks\":" << tick.callbacks << "}}";
+        first = false;
+
+        for( std::size_t i = tick.firstCallback; i != tick.lastCallback; i++ ) {
+          const CallbackEvent& callback = callbackEvents[ i ];
+
+          output << ",\n{\"name\":" << Json::valueToQuotedString( labels[ callback.label ].name.c_str() ) << ",\"cat\":\"callback\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << callback.start
+            << ",\"dur\":" << callback.duration << ",\"args\":{\"tick\":" << tick.tick << "}}";
+        }
+      }
+
+      output << "\n]}\n";
+
+      Log::getInstance().info( "TickProfiler::writeTrace", "Wrote " + std::to_string( tickEvents.size() + callbackEvents.size() ) + " trace events to " + tracePath );
+    }
+
+    void TickProfiler::logSummary() {
+      std::vector< const Label* > sorted;
+      for( const Label& label : labels ) {
+        sorted.push_back( &label );
+      }
+
+      std::sort( sorted.begin(), sorted.end(), []( const Label* left, const Label* right ) {
+        return left->totalTime > right->totalTime;
+      } );
+
+      if( sorted.size() > topN ) {
+        sorted.resize( topN );
+      }
+
+      for( const Label* label : sorted ) {
+        std::stringstream stream;
+        stream << std::fixed << std::setprecision( 2 )
+          << label->name << ": " << label->calls << " calls, "
+          << ( label->totalTime / 1000.0 ) << "ms total, "
+          << ( label->totalTime / label->calls ) << "us mean, "
+          << label->maxTime << "us max";
+
+        Log::getInstance().info( "TickProfiler::logSummary", stream.str() );
+      }
+    }
+
+  }
+}
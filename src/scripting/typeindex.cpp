@@ -0,0 +1,103 @@
+#include "scripting/typeindex.hpp"
+#include "log.hpp"
+
+namespace BlueBear {
+  namespace Scripting {
+
+    /**
+     * Classes must be registered after their parent (which bluebear.extend already guarantees). Re-registering a class under the same
+     * parent does nothing.
+     */
+    void TypeIndex::registerClass( const std::string& classId, const std::string& parentId ) {
+      auto existing = parents.find( classId );
+      if( existing != parents.end() ) {
+        if( existing->second != parentId ) {
+          Log::getInstance().warn( "TypeIndex::registerClass", "Class " + classId + " was registered again with a different parent; keeping the original" );
+        }
+
+        return;
+      }
+
+      parents[ classId ] = parentId;
+      descendants[ classId ].insert( classId );
+
+      // Make classId a descendant of every ancestor
+      std::string ancestor = parentId;
+      while( !ancestor.empty() ) {
+        descendants[ ancestor ].insert( classId );
+
+        auto next = parents.find( ancestor );
+        if( next == parents.end() ) {
+          break;
+        }
+
+        ancestor = next->second;
+      }
+    }
+
+    void TypeIndex::addObject( const std::string& classId, LuaReference object ) {
+      if( positions.find( object ) != positions.end() ) {
+        return;
+      }
+
+      Instances& list = instances[ classId ];
+      positions[ object ] = std::make_pair( &list, list.size() );
+      list.push_back( object );
+    }
+
+    /**
+     * Order within a class isn't kept: the last object takes the removed object's place.
+     */
+    void TypeIndex::removeObject( LuaReference object ) {
+      auto position = positions.find( object );
+      if( position == positions.end() ) {
+        return;
+      }
+
+      Instances& list = *position->second.first;
+      size_t index = position->second.second;
+
+      if( index != list.size() - 1 ) {
+        list[ index ] = list.back();
+        positions[ list[ index ] ].second = index;
+      }
+
+      list.pop_back();
+      positions.erase( position );
+    }
+
+    void TypeIndex::clearObjects() {
+      instances.clear();
+      positions.clear();
+    }
+
+    /**
+     * Whether object is an instance of classId or any class derived from it. Costs a lookup per class in that part of the hierarchy.
+     */
+    bool TypeIndex::isInstanceOf( LuaReference object, const std::string& classId ) const {
+      auto position = positions.find( object );
+      if( position == positions.end() ) {
+        return false;
+      }
+
+      auto isList = [ & ]( const std::string& subclass ) {
+        auto list = instances.find( subclass );
+        return list != instances.end() && &list->second == position->second.first;
+      };
+
+      auto subclasses = descendants.find( classId );
+      if( subclasses == descendants.end() ) {
+        return isList( classId );
+      }
+
+      for( const std::string& subclass : subclasses->second ) {
+        if( isList( subclass ) ) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+  }
+}
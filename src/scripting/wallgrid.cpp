@@ -0,0 +1,149 @@
+#include "scripting/wallgrid.hpp"
+#include "scripting/wallpaper.hpp"
+#include <limits>
+#include <stdexcept>
+
+namespace BlueBear {
+  namespace Scripting {
+
+    constexpr unsigned int WallGrid::AXES;
+    constexpr WallGrid::Index WallGrid::NONE;
+
+    WallGrid::WallGrid( unsigned int levels, unsigned int x, unsigned int y ) : palette( 1 ), cells( levels, x, y ), dimensions( Dimensions{ x, y, levels } ) {}
+
+    std::size_t WallGrid::getSingleIndex( unsigned int level, unsigned int x, unsigned int y ) const {
+      return ( ( std::size_t ) dimensions.y * dimensions.x * level ) + ( dimensions.x * y ) + x;
+    }
+
+    WallGrid::Dimensions WallGrid::getDimensions() const {
+      return dimensions;
+    }
+
+    unsigned int WallGrid::getX() const {
+      return dimensions.x;
+    }
+
+    unsigned int WallGrid::getY() const {
+      return dimensions.y;
+    }
+
+    unsigned int WallGrid::getLevels() const {
+      return dimensions.levels;
+    }
+
+    bool WallGrid::contains( int level, int x, int y ) const {
+      return level >= 0 && x >= 0 && y >= 0 && ( unsigned int ) level < dimensions.levels && ( unsigned int ) x < dimensions.x && ( unsigned int ) y < dimensions.y;
+    }
+
+    /**
+     * Wallpapers are added in the order of the lot's dict, so dict index i is palette index i + 1
+     */
+    WallGrid::Index WallGrid::addToPalette( const std::shared_ptr< Wallpaper >& wallpaper ) {
+      if( palette.size() > std::numeric_limits< Index >::max() ) {
+        throw std::length_error( "Too many wallpapers on one lot" );
+      }
+
+      palette.push_back( wallpaper );
+      return palette.size() - 1;
+    }
+
+    const std::shared_ptr< Wallpaper >& WallGrid::getPaletteEntry( Index index ) const {
+      return palette[ index ];
+    }
+
+    std::size_t WallGrid::getPaletteSize() const {
+      return palette.size();
+    }
+
+    /**
+     * Append cells in storage order, as the lot loader does. Cells the loader never gets to stay empty.
+     */
+    void WallGrid::pushRun( const Cell& cell, std::size_t run ) {
+      cells.pushRun( cell, run );
+    }
+
+    WallGrid::CellView WallGrid::getCell( unsigned int level, unsigned int x, unsigned int y ) const {
+      return CellView( this, getSingleIndex( level, x, y ) );
+    }
+
+    /**
+     * Reads never allocate; a cell in a chunk with no walls reads as an empty cell
+     */
+    const WallGrid::Cell& WallGrid::getPacked( unsigned int level, unsigned int x, unsigned int y ) const {
+      return cells.getItemByRef( level, x, y );
+    }
+
+    const WallGrid::Cell& WallGrid::getPacked( std::size_t cell ) const {
+      return cells.getItemDirectByRef( cell );
+    }
+
+    /**
+     * Replace a whole cell, as copied from another grid with the same palette
+     */
+    void WallGrid::setPacked( unsigned int level, unsigned int x, unsigned int y, const Cell& cell ) {
+      cells.setItem( level, x, y, cell );
+    }
+
+    void WallGrid::setSegment( unsigned int level, unsigned int x, unsigned int y, Axis axis, Index front, Index back ) {
+      if( front >= palette.size() || back >= palette.size() ) {
+        throw std::out_of_range( "Wallpaper index is not in the lot's palette" );
+      }
+
+      Cell cell = getPacked( level, x, y );
+      cell.segments |= 1 << ( unsigned int ) axis;
+      cell.wallpapers[ ( unsigned int ) axis * 2 ] = front;
+      cell.wallpapers[ ( unsigned int ) axis * 2 + 1 ] = back;
+      cells.setItem( level, x, y, cell );
+    }
+
+    void WallGrid::removeSegment( unsigned int level, unsigned int x, unsigned int y, Axis axis ) {
+      Cell cell = getPacked( level, x, y );
+      cell.segments &= ~( 1 << ( unsigned int ) axis );
+      cell.wallpapers[ ( unsigned int ) axis * 2 ] = NONE;
+      cell.wallpapers[ ( unsigned int ) axis * 2 + 1 ] = NONE;
+      cells.setItem( level, x, y, cell );
+    }
+
+    /**
+     * Edits, chunk by chunk; see ChunkedCollection3D
+     */
+    std::vector< WallGrid::ChunkPosition > WallGrid::takeDirtyChunks() {
+      return cells.takeDirtyChunks();
+    }
+
+    std::uint64_t WallGrid::getChunkVersion( unsigned int level, unsigned int x, unsigned int y ) const {
+      return cells.getChunkVersion( level, x, y );
+    }
+
+    std::uint64_t WallGrid::getVersion() const {
+      return cells.getVersion();
+    }
+
+    /**
+     * "x", "y", "d" or "r", as the lot format and Lua name them
+     */
+    bool WallGrid::getAxis( const char* name, Axis& axis ) {
+      if( !name || !name[ 0 ] || name[ 1 ] ) {
+        return false;
+      }
+
+      switch( name[ 0 ] ) {
+        case 'x':
+          axis = Axis::X;
+          return true;
+        case 'y':
+          axis = Axis::Y;
+          return true;
+        case 'd':
+          axis = Axis::D;
+          return true;
+        case 'r':
+          axis = Axis::R;
+          return true;
+        default:
+          return false;
+      }
+    }
+
+  }
+}
@@ -0,0 +1,34 @@
+#include "threading/commandbus.hpp"
+
+namespace BlueBear {
+  namespace Threading {
+
+    void CommandBus::post( std::function< void() > command ) {
+      std::unique_lock< std::mutex > lock( mutex );
+
+      pending.push_back( std::move( command ) );
+    }
+
+    /**
+     * Run everything posted so far. Commands posted while draining (including by the commands themselves) wait for the next drain.
+     */
+    void CommandBus::drain() {
+      {
+        std::unique_lock< std::mutex > lock( mutex );
+
+        if( pending.empty() ) {
+          return;
+        }
+
+        std::swap( pending, running );
+      }
+
+      for( auto& command : running ) {
+        command();
+      }
+
+      running.clear();
+    }
+
+  }
+}
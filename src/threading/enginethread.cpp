@@ -0,0 +1,61 @@
+#include "threading/enginethread.hpp"
+#include "scripting/engine.hpp"
+#include "configmanager.hpp"
+#include "log.hpp"
+#include <mutex>
+#include <string>
+
+namespace BlueBear {
+  namespace Threading {
+
+    EngineThread::EngineThread( Scripting::Engine& engine ) :
+      engine( engine ),
+      period( std::chrono::milliseconds( 1000 / ConfigManager::getInstance().getIntValue( "fps_overview" ) ) ),
+      running( false ) {}
+
+    EngineThread::~EngineThread() {
+      stop();
+    }
+
+    void EngineThread::start() {
+      if( running ) {
+        return;
+      }
+
+      running = true;
+      thread = std::thread( &EngineThread::loop, this );
+
+      Log::getInstance().info( "EngineThread::start", "Engine running on its own thread" );
+    }
+
+    void EngineThread::stop() {
+      running = false;
+
+      if( thread.joinable() ) {
+        thread.join();
+      }
+    }
+
+    void EngineThread::loop() {
+      std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+      while( running ) {
+        {
+          std::unique_lock< std::mutex > lock( engine.getLuaMutex() );
+          engine.update();
+        }
+
+        next += period;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if( now - next > period * MAX_CATCH_UP_TICKS ) {
+          Log::getInstance().debug( "EngineThread::loop", "Engine fell more than " + std::to_string( MAX_CATCH_UP_TICKS ) + " ticks behind; dropping the backlog" );
+          next = now;
+        }
+
+        std::this_thread::sleep_until( next );
+      }
+    }
+
+  }
+}
@@ -0,0 +1,190 @@
+#include "tools/blockcontainer.hpp"
+#include "tools/lz4block.hpp"
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+namespace BlueBear {
+	namespace Tools {
+
+		constexpr const char BlockContainer::MAGIC[ 4 ];
+		constexpr std::uint32_t BlockContainer::VERSION;
+
+		template < typename T > static void append( std::string& buffer, T value ) {
+			buffer.append( ( const char* ) &value, sizeof( T ) );
+		}
+
+		template < typename T > static bool take( const char*& cursor, const char* end, T& value ) {
+			if( ( std::size_t )( end - cursor ) < sizeof( T ) ) {
+				return false;
+			}
+
+			std::memcpy( &value, cursor, sizeof( T ) );
+			cursor += sizeof( T );
+			return true;
+		}
+
+		/**
+		 * Reads the index only; nothing is decompressed until it's asked for
+		 */
+		BlockContainer::BlockContainer( const char* data, std::size_t size ) : data( data ), size( size ), valid( false ) {
+			if( !isContainer( data, size ) ) {
+				return;
+			}
+
+			const char* cursor = data + sizeof( MAGIC );
+			const char* end = data + size;
+			std::uint32_t version;
+			std::uint32_t count;
+			if( !take( cursor, end, version ) || version > VERSION || !take( cursor, end, count ) ) {
+				return;
+			}
+
+			for( std::uint32_t i = 0; i != count; i++ ) {
+				std::uint16_t nameLength;
+				std::uint8_t codec;
+				Block block;
+
+				if( !take( cursor, end, nameLength ) || ( std::size_t )( end - cursor ) < nameLength ) {
+					return;
+				}
+				block.name.assign( cursor, nameLength );
+				cursor += nameLength;
+
+				if(
+					!take( cursor, end, codec ) || codec > ( std::uint8_t ) Codec::LZ4 ||
+					!take( cursor, end, block.offset ) || !take( cursor, end, block.storedLength ) || !take( cursor, end, block.length ) ||
+					block.offset > size || block.storedLength > size - block.offset
+				) {
+					return;
+				}
+				block.codec = Codec( codec );
+
+				byName[ block.name ] = blocks.size();
+				names.push_back( block.name );
+				blocks.push_back( std::move( block ) );
+			}
+
+			valid = true;
+		}
+
+		bool BlockContainer::isContainer( const char* data, std::size_t size ) {
+			return size >= sizeof( MAGIC ) && std::equal( MAGIC, MAGIC + sizeof( MAGIC ), data );
+		}
+
+		/**
+		 * Blocks are compressed (in parallel, unless asked not to), then written in the order given
+		 */
+		bool BlockContainer::write( std::ostream& output, const Blocks& blocks, bool parallel ) {
+			std::vector< std::string > compressed( blocks.size() );
+			std::vector< Codec > codecs( blocks.size(), Codec::LZ4 );
+
+			auto compressRange = [ & ]( const tbb::blocked_range< std::size_t >& range ) {
+				for( std::size_t i = range.begin(); i != range.end(); i++ ) {
+					const std::string& block = blocks[ i ].second;
+					LZ4Block::compress( block.data(), block.size(), compressed[ i ] );
+
+					if( compressed[ i ].size() >= block.size() ) {
+						compressed[ i ] = block;
+						codecs[ i ] = Codec::STORED;
+					}
+				}
+			};
+
+			tbb::blocked_range< std::size_t > all( 0, blocks.size() );
+			if( parallel ) {
+				tbb::parallel_for( all, compressRange );
+			} else {
+				compressRange( all );
+			}
+
+			std::string index( MAGIC, sizeof( MAGIC ) );
+			append< std::uint32_t >( index, VERSION );
+			append< std::uint32_t >( index, blocks.size() );
+
+			std::uint64_t indexLength = index.size();
+			for( const auto& block : blocks ) {
+				if( block.first.size() > std::numeric_limits< std::uint16_t >::max() || block.second.size() > std::numeric_limits< std::uint32_t >::max() ) {
+					return false;
+				}
+
+				indexLength += sizeof( std::uint16_t ) + block.first.size() + sizeof( std::uint8_t ) + sizeof( std::uint64_t ) + 2 * sizeof( std::uint32_t );
+			}
+
+			std::uint64_t offset = indexLength;
+			for( std::size_t i = 0; i != blocks.size(); i++ ) {
+				append< std::uint16_t >( index, blocks[ i ].first.size() );
+				index += blocks[ i ].first;
+				append< std::uint8_t >( index, ( std::uint8_t ) codecs[ i ] );
+				append< std::uint64_t >( index, offset );
+				append< std::uint32_t >( index, compressed[ i ].size() );
+				append< std::uint32_t >( index, blocks[ i ].second.size() );
+
+				offset += compressed[ i ].size();
+			}
+
+			output.write( index.data(), index.size() );
+			for( const std::string& block : compressed ) {
+				output.write( block.data(), block.size() );
+			}
+
+			return output.good();
+		}
+
+		bool BlockContainer::decode( const Block& block, std::string& output ) const {
+			const char* stored = data + block.offset;
+
+			if( block.codec == Codec::STORED ) {
+				if( block.storedLength != block.length ) {
+					return false;
+				}
+
+				output.assign( stored, block.length );
+				return true;
+			}
+
+			output.resize( block.length );
+			return LZ4Block::decompress( stored, block.storedLength, &output[ 0 ], block.length );
+		}
+
+		bool BlockContainer::isValid() const {
+			return valid;
+		}
+
+		const std::vector< std::string >& BlockContainer::getNames() const {
+			return names;
+		}
+
+		bool BlockContainer::hasBlock( const std::string& name ) const {
+			return byName.count( name ) != 0;
+		}
+
+		bool BlockContainer::read( const std::string& name, std::string& output ) const {
+			auto it = byName.find( name );
+			return it != byName.end() && decode( blocks[ it->second ], output );
+		}
+
+		/**
+		 * Decompress several blocks at once, on TBB workers. Returns false if any of them is missing or damaged.
+		 */
+		bool BlockContainer::read( const std::vector< std::string >& wanted, std::vector< std::string >& output ) const {
+			output.clear();
+			output.resize( wanted.size() );
+			std::atomic< bool > succeeded( true );
+
+			tbb::parallel_for( tbb::blocked_range< std::size_t >( 0, wanted.size() ), [ & ]( const tbb::blocked_range< std::size_t >& range ) {
+				for( std::size_t i = range.begin(); i != range.end(); i++ ) {
+					if( !read( wanted[ i ], output[ i ] ) ) {
+						succeeded = false;
+					}
+				}
+			} );
+
+			return succeeded;
+		}
+
+	}
+}
@@ -0,0 +1,197 @@
+#include "tools/jsonindex.hpp"
+#include "log.hpp"
+#include <jsoncpp/json/json.h>
+#include <cstring>
+#include <string>
+
+namespace BlueBear {
+	namespace Tools {
+
+		JSONIndex::JSONIndex( std::istream& input, std::streamoff begin ) : input( input ), valid( false ) {
+			if( begin < 0 ) {
+				return;
+			}
+
+			input.clear();
+			input.seekg( begin );
+
+			if( skipWhitespace() != '{' ) {
+				return;
+			}
+
+			int c = skipWhitespace();
+			while( c == '"' ) {
+				std::string key;
+				if( !readString( &key ) || skipWhitespace() != ':' ) {
+					return;
+				}
+
+				int first = skipWhitespace();
+				std::streamoff start = ( std::streamoff ) input.tellg() - 1;
+				if( !skipValue( first ) ) {
+					return;
+				}
+
+				// Same as Json::Reader, a repeated key replaces the earlier one
+				auto result = members.emplace( key, Span( start, input.tellg() ) );
+				if( result.second ) {
+					keys.push_back( key );
+				} else {
+					result.first->second = Span( start, input.tellg() );
+				}
+
+				c = skipWhitespace();
+				if( c != ',' ) {
+					break;
+				}
+				c = skipWhitespace();
+			}
+
+			valid = ( c == '}' );
+		}
+
+		int JSONIndex::skipWhitespace() {
+			int c;
+			do {
+				c = input.get();
+			} while( c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+
+			return c;
+		}
+
+		/**
+		 * Read the rest of a string whose opening quote has been consumed. If result is given, it receives the unescaped string.
+		 */
+		bool JSONIndex::readString( std::string* result ) {
+			std::string raw;
+			bool escaped = false;
+
+			for( int c = input.get(); c != '"'; c = input.get() ) {
+				if( c == EOF ) {
+					return false;
+				}
+
+				if( c == '\\' ) {
+					escaped = true;
+					if( result ) {
+						raw.push_back( c );
+					}
+
+					c = input.get();
+					if( c == EOF ) {
+						return false;
+					}
+				}
+
+				if( result ) {
+					raw.push_back( c );
+				}
+			}
+
+			if( result ) {
+				if( escaped ) {
+					// Rare enough (keys are pointers and identifiers) to hand the escapes to Json::Reader
+					Json::Value value;
+					Json::Reader reader;
+					if( !reader.parse( "\"" + raw + "\"", value ) ) {
+						return false;
+					}
+					*result = value.asString();
+				} else {
+					*result = raw;
+				}
+			}
+
+			return true;
+		}
+
+		/**
+		 * Skip a value whose first character has been consumed, leaving the stream just past its end
+		 */
+		bool JSONIndex::skipValue( int first ) {
+			switch( first ) {
+				case EOF:
+					return false;
+				case '"':
+					return readString( nullptr );
+				case '{':
+				case '[': {
+					unsigned int depth = 1;
+					while( depth ) {
+						switch( input.get() ) {
+							case EOF:
+								return false;
+							case '"':
+								if( !readString( nullptr ) ) {
+									return false;
+								}
+								break;
+							case '{':
+							case '[':
+								depth++;
+								break;
+							case '}':
+							case ']':
+								depth--;
+								break;
+						}
+					}
+					return true;
+				}
+				default:
+					// Numbers, true, false and null run up to the next delimiter
+					for( int c = input.peek(); c != EOF && c != 0 && !std::strchr( ",}] \t\r\n", c ); c = input.peek() ) {
+						input.get();
+					}
+					return true;
+			}
+		}
+
+		bool JSONIndex::isValid() const {
+			return valid;
+		}
+
+		bool JSONIndex::isMember( const std::string& key ) const {
+			return members.find( key ) != members.end();
+		}
+
+		const std::vector< std::string >& JSONIndex::getKeys() const {
+			return keys;
+		}
+
+		/**
+		 * Parse a single member. Missing members, and members that don't parse, come back as null.
+		 */
+		Json::Value JSONIndex::read( const std::string& key ) {
+			Json::Value value;
+
+			auto member = members.find( key );
+			if( member == members.end() ) {
+				return value;
+			}
+
+			std::string text( member->second.second - member->second.first, '\0' );
+			input.clear();
+			input.seekg( member->second.first );
+			input.read( &text[ 0 ], text.size() );
+
+			Json::Reader reader;
+			if( !input.good() || !reader.parse( text, value ) ) {
+				Log::getInstance().error( "JSONIndex::read", "Unable to parse member \"" + key + "\"" );
+				return Json::Value();
+			}
+
+			return value;
+		}
+
+		/**
+		 * Index a member that is itself an object, without parsing it
+		 */
+		JSONIndex JSONIndex::index( const std::string& key ) {
+			auto member = members.find( key );
+
+			return JSONIndex( input, member == members.end() ? -1 : member->second.first );
+		}
+
+	}
+}
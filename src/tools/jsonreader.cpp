@@ -0,0 +1,399 @@
+#include "tools/jsonreader.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace BlueBear {
+	namespace Tools {
+
+		JSONReader::JSONReader( const char* begin, const char* end ) : begin( begin ), cursor( begin ), end( end ), failed( false ) {}
+
+		void JSONReader::fail() {
+			failed = true;
+			cursor = end;
+		}
+
+		void JSONReader::skipWhitespace() {
+			while( cursor != end && ( *cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t' ) ) {
+				cursor++;
+			}
+		}
+
+		bool JSONReader::expect( char character ) {
+			skipWhitespace();
+
+			if( cursor == end || *cursor != character ) {
+				fail();
+				return false;
+			}
+
+			cursor++;
+			return true;
+		}
+
+		JSONReader::Type JSONReader::peek() {
+			skipWhitespace();
+
+			if( cursor == end ) {
+				return Type::END;
+			}
+
+			switch( *cursor ) {
+				case '{':
+					return Type::OBJECT;
+				case '[':
+					return Type::ARRAY;
+				case '"':
+					return Type::STRING;
+				case 't':
+				case 'f':
+					return Type::BOOLEAN;
+				case 'n':
+					return Type::NIL;
+				default:
+					return ( *cursor == '-' || ( *cursor >= '0' && *cursor <= '9' ) ) ? Type::NUMBER : Type::END;
+			}
+		}
+
+		bool JSONReader::beginObject() {
+			return expect( '{' );
+		}
+
+		/**
+		 * Reads the key of the next member, leaving the reader at its value. Returns false (having consumed the closing brace) when there
+		 * are no more members.
+		 */
+		bool JSONReader::nextMember( std::string& key ) {
+			skipWhitespace();
+			if( cursor != end && *cursor == ',' ) {
+				cursor++;
+				skipWhitespace();
+			}
+
+			if( cursor == end ) {
+				fail();
+				return false;
+			}
+
+			if( *cursor == '}' ) {
+				cursor++;
+				return false;
+			}
+
+			return readString( key ) && expect( ':' );
+		}
+
+		bool JSONReader::beginArray() {
+			return expect( '[' );
+		}
+
+		/**
+		 * Leaves the reader at the next element. Returns false (having consumed the closing bracket) when there are no more elements.
+		 */
+		bool JSONReader::nextElement() {
+			skipWhitespace();
+			if( cursor != end && *cursor == ',' ) {
+				cursor++;
+				skipWhitespace();
+			}
+
+			if( cursor == end ) {
+				fail();
+				return false;
+			}
+
+			if( *cursor == ']' ) {
+				cursor++;
+				return false;
+			}
+
+			return true;
+		}
+
+		bool JSONReader::readCodepoint( unsigned int& codepoint ) {
+			if( end - cursor < 4 ) {
+				return false;
+			}
+
+			codepoint = 0;
+			for( int i = 0; i != 4; i++ ) {
+				char digit = *cursor++;
+				codepoint <<= 4;
+
+				if( digit >= '0' && digit <= '9' ) {
+					codepoint |= digit - '0';
+				} else if( digit >= 'a' && digit <= 'f' ) {
+					codepoint |= digit - 'a' + 10;
+				} else if( digit >= 'A' && digit <= 'F' ) {
+					codepoint |= digit - 'A' + 10;
+				} else {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool JSONReader::readString( std::string& result ) {
+			if( !expect( '"' ) ) {
+				return false;
+			}
+
+			result.clear();
+
+			while( cursor != end ) {
+				// Copy everything up to the next quote or escape in one go
+				const char* run = cursor;
+				while( cursor != end && *cursor != '"' && *cursor != '\\' ) {
+					cursor++;
+				}
+				result.append( run, cursor - run );
+
+				if( cursor == end ) {
+					break;
+				}
+
+				if( *cursor++ == '"' ) {
+					return true;
+				}
+
+				if( cursor == end ) {
+					break;
+				}
+
+				switch( *cursor++ ) {
+					case '"': result += '"'; break;
+					case '\\': result += '\\'; break;
+					case '/': result += '/'; break;
+					case 'b': result += '\b'; break;
+					case 'f': result += '\f'; break;
+					case 'n': result += '\n'; break;
+					case 'r': result += '\r'; break;
+					case 't': result += '\t'; break;
+					case 'u': {
+						unsigned int codepoint;
+						if( !readCodepoint( codepoint ) ) {
+							fail();
+							return false;
+						}
+
+						// Surrogate pair
+						if( codepoint >= 0xD800 && codepoint <= 0xDBFF ) {
+							unsigned int low;
+							if( end - cursor < 2 || cursor[ 0 ] != '\\' || cursor[ 1 ] != 'u' ) {
+								fail();
+								return false;
+							}
+							cursor += 2;
+							if( !readCodepoint( low ) || low < 0xDC00 || low > 0xDFFF ) {
+								fail();
+								return false;
+							}
+							codepoint = 0x10000 + ( ( codepoint - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+						}
+
+						// UTF-8
+						if( codepoint < 0x80 ) {
+							result += ( char ) codepoint;
+						} else if( codepoint < 0x800 ) {
+							result += ( char )( 0xC0 | ( codepoint >> 6 ) );
+							result += ( char )( 0x80 | ( codepoint & 0x3F ) );
+						} else if( codepoint < 0x10000 ) {
+							result += ( char )( 0xE0 | ( codepoint >> 12 ) );
+							result += ( char )( 0x80 | ( ( codepoint >> 6 ) & 0x3F ) );
+							result += ( char )( 0x80 | ( codepoint & 0x3F ) );
+						} else {
+							result += ( char )( 0xF0 | ( codepoint >> 18 ) );
+							result += ( char )( 0x80 | ( ( codepoint >> 12 ) & 0x3F ) );
+							result += ( char )( 0x80 | ( ( codepoint >> 6 ) & 0x3F ) );
+							result += ( char )( 0x80 | ( codepoint & 0x3F ) );
+						}
+						break;
+					}
+					default:
+						fail();
+						return false;
+				}
+			}
+
+			fail();
+			return false;
+		}
+
+		/**
+		 * Integers are parsed by hand since strtol would need a terminator the mapping doesn't have
+		 */
+		bool JSONReader::readSigned( long long& result ) {
+			skipWhitespace();
+
+			bool negative = cursor != end && *cursor == '-';
+			if( negative ) {
+				cursor++;
+			}
+
+			if( cursor == end || *cursor < '0' || *cursor > '9' ) {
+				fail();
+				return false;
+			}
+
+			unsigned long long magnitude = 0;
+			while( cursor != end && *cursor >= '0' && *cursor <= '9' ) {
+				magnitude = magnitude * 10 + ( *cursor++ - '0' );
+				if( magnitude > ( unsigned long long ) std::numeric_limits< long long >::max() ) {
+					fail();
+					return false;
+				}
+			}
+
+			// Fractions and exponents aren't integers, even when they happen to be whole
+			if( cursor != end && ( *cursor == '.' || *cursor == 'e' || *cursor == 'E' ) ) {
+				fail();
+				return false;
+			}
+
+			result = negative ? -( long long ) magnitude : ( long long ) magnitude;
+			return true;
+		}
+
+		bool JSONReader::readInt( int& result ) {
+			long long value;
+			if( !readSigned( value ) || value < std::numeric_limits< int >::min() || value > std::numeric_limits< int >::max() ) {
+				fail();
+				return false;
+			}
+
+			result = value;
+			return true;
+		}
+
+		bool JSONReader::readUInt( unsigned int& result ) {
+			long long value;
+			if( !readSigned( value ) || value < 0 || value > std::numeric_limits< unsigned int >::max() ) {
+				fail();
+				return false;
+			}
+
+			result = value;
+			return true;
+		}
+
+		bool JSONReader::readDouble( double& result ) {
+			skipWhitespace();
+
+			// Copied out so strtod can't run past the end of the input
+			char buffer[ 64 ];
+			std::size_t length = 0;
+			while( cursor != end && length != sizeof( buffer ) - 1 && std::strchr( "+-.0123456789eE", *cursor ) && *cursor ) {
+				buffer[ length++ ] = *cursor++;
+			}
+			buffer[ length ] = 0;
+
+			char* parsed;
+			result = std::strtod( buffer, &parsed );
+			if( length == 0 || parsed != buffer + length ) {
+				fail();
+				return false;
+			}
+
+			return true;
+		}
+
+		bool JSONReader::readLiteral( const char* literal ) {
+			skipWhitespace();
+
+			for( ; *literal; literal++ ) {
+				if( cursor == end || *cursor != *literal ) {
+					fail();
+					return false;
+				}
+				cursor++;
+			}
+
+			return true;
+		}
+
+		bool JSONReader::readBool( bool& result ) {
+			result = peek() == Type::BOOLEAN && *cursor == 't';
+			return readLiteral( result ? "true" : "false" );
+		}
+
+		/**
+		 * Skip one value of any type
+		 */
+		bool JSONReader::skip() {
+			switch( peek() ) {
+				case Type::OBJECT: {
+					beginObject();
+					std::string key;
+					while( nextMember( key ) ) {
+						if( !skip() ) {
+							return false;
+						}
+					}
+					return !failed;
+				}
+				case Type::ARRAY: {
+					beginArray();
+					while( nextElement() ) {
+						if( !skip() ) {
+							return false;
+						}
+					}
+					return !failed;
+				}
+				case Type::STRING: {
+					// Escapes only matter for finding the closing quote
+					cursor++;
+					while( cursor != end && *cursor != '"' ) {
+						if( *cursor == '\\' && end - cursor > 1 ) {
+							cursor++;
+						}
+						cursor++;
+					}
+					return expect( '"' );
+				}
+				case Type::NUMBER: {
+					while( cursor != end && std::strchr( "+-.0123456789eE", *cursor ) && *cursor ) {
+						cursor++;
+					}
+					return true;
+				}
+				case Type::BOOLEAN:
+					return readLiteral( *cursor == 't' ? "true" : "false" );
+				case Type::NIL:
+					return readLiteral( "null" );
+				default:
+					fail();
+					return false;
+			}
+		}
+
+		Json::Value JSONReader::readValue() {
+			skipWhitespace();
+			const char* start = cursor;
+
+			Json::Value result;
+			if( skip() ) {
+				Json::Reader reader;
+				if( !reader.parse( start, cursor, result, false ) ) {
+					fail();
+				}
+			}
+
+			return result;
+		}
+
+		std::size_t JSONReader::getPosition() const {
+			return cursor - begin;
+		}
+
+		void JSONReader::seek( std::size_t position ) {
+			cursor = position < ( std::size_t )( end - begin ) ? begin + position : end;
+		}
+
+		bool JSONReader::hasFailed() const {
+			return failed;
+		}
+
+	}
+}
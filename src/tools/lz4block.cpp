@@ -0,0 +1,177 @@
+#include "tools/lz4block.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace BlueBear {
+	namespace Tools {
+
+		constexpr unsigned int LZ4Block::HASH_LOG;
+		constexpr std::size_t LZ4Block::MIN_MATCH;
+		constexpr std::size_t LZ4Block::LAST_LITERALS;
+		constexpr std::size_t LZ4Block::MATCH_FIND_LIMIT;
+		constexpr std::size_t LZ4Block::MAX_OFFSET;
+
+		static inline std::uint32_t read32( const char* at ) {
+			std::uint32_t value;
+			std::memcpy( &value, at, sizeof( value ) );
+			return value;
+		}
+
+		std::size_t LZ4Block::getBound( std::size_t size ) {
+			return size + size / 255 + 16;
+		}
+
+		/**
+		 * Lengths of 15 or more spill into extra bytes after the token: 255 for as long as needed, then the remainder
+		 */
+		void LZ4Block::writeLength( std::string& output, std::size_t length ) {
+			while( length >= 255 ) {
+				output += ( char ) 255;
+				length -= 255;
+			}
+			output += ( char ) length;
+		}
+
+		/**
+		 * Appends the compressed form of input to output
+		 */
+		void LZ4Block::compress( const char* input, std::size_t size, std::string& output ) {
+			output.reserve( output.size() + getBound( size ) );
+
+			const char* anchor = input;
+			const char* end = input + size;
+
+			auto emit = [ & ]( const char* literals, std::size_t literalLength, std::size_t offset, std::size_t matchLength ) {
+				std::size_t extraMatch = matchLength ? matchLength - MIN_MATCH : 0;
+				output += ( char )( ( ( literalLength < 15 ? literalLength : 15 ) << 4 ) | ( extraMatch < 15 ? extraMatch : 15 ) );
+
+				if( literalLength >= 15 ) {
+					writeLength( output, literalLength - 15 );
+				}
+				output.append( literals, literalLength );
+
+				if( matchLength ) {
+					output += ( char )( offset & 0xFF );
+					output += ( char )( offset >> 8 );
+
+					if( extraMatch >= 15 ) {
+						writeLength( output, extraMatch - 15 );
+					}
+				}
+			};
+
+			// The format wants the last match to start at least 12 bytes from the end, and the last 5 bytes to be literals
+			if( size > MATCH_FIND_LIMIT ) {
+				std::vector< std::uint32_t > table( 1 << HASH_LOG, 0 );
+				const char* matchFindLimit = end - MATCH_FIND_LIMIT;
+				const char* matchLimit = end - LAST_LITERALS;
+				const char* cursor = input + 1;
+
+				while( cursor < matchFindLimit ) {
+					std::uint32_t sequence = read32( cursor );
+					std::uint32_t hash = ( sequence * 2654435761U ) >> ( 32 - HASH_LOG );
+					const char* candidate = input + table[ hash ];
+					table[ hash ] = cursor - input;
+
+					if( candidate >= cursor || ( std::size_t )( cursor - candidate ) > MAX_OFFSET || read32( candidate ) != sequence ) {
+						cursor++;
+						continue;
+					}
+
+					// Extend backwards over literals, then forwards
+					while( cursor > anchor && candidate > input && cursor[ -1 ] == candidate[ -1 ] ) {
+						cursor--;
+						candidate--;
+					}
+
+					std::size_t matchLength = MIN_MATCH;
+					while( cursor + matchLength < matchLimit && cursor[ matchLength ] == candidate[ matchLength ] ) {
+						matchLength++;
+					}
+
+					emit( anchor, cursor - anchor, cursor - candidate, matchLength );
+					cursor += matchLength;
+					anchor = cursor;
+				}
+			}
+
+			emit( anchor, end - anchor, 0, 0 );
+		}
+
+		/**
+		 * Returns false unless input decodes to exactly outputSize bytes. Never reads or writes out of bounds, whatever input holds.
+		 */
+		bool LZ4Block::decompress( const char* input, std::size_t size, char* output, std::size_t outputSize ) {
+			const unsigned char* cursor = ( const unsigned char* ) input;
+			const unsigned char* end = cursor + size;
+			char* written = output;
+			char* outputEnd = output + outputSize;
+
+			auto readLength = [ & ]( std::size_t& length ) {
+				unsigned char next;
+				do {
+					if( cursor == end ) {
+						return false;
+					}
+					next = *cursor++;
+					length += next;
+				} while( next == 255 );
+
+				return true;
+			};
+
+			while( cursor != end ) {
+				unsigned char token = *cursor++;
+
+				std::size_t literalLength = token >> 4;
+				if( literalLength == 15 && !readLength( literalLength ) ) {
+					return false;
+				}
+				if( literalLength > ( std::size_t )( end - cursor ) || literalLength > ( std::size_t )( outputEnd - written ) ) {
+					return false;
+				}
+				std::memcpy( written, cursor, literalLength );
+				written += literalLength;
+				cursor += literalLength;
+
+				// The last sequence is literals only
+				if( cursor == end ) {
+					break;
+				}
+
+				if( end - cursor < 2 ) {
+					return false;
+				}
+				std::size_t offset = cursor[ 0 ] | ( cursor[ 1 ] << 8 );
+				cursor += 2;
+				if( offset == 0 || offset > ( std::size_t )( written - output ) ) {
+					return false;
+				}
+
+				std::size_t matchLength = token & 0x0F;
+				if( matchLength == 15 && !readLength( matchLength ) ) {
+					return false;
+				}
+				matchLength += MIN_MATCH;
+				if( matchLength > ( std::size_t )( outputEnd - written ) ) {
+					return false;
+				}
+
+				// Matches may overlap what they're copying, so runs repeat
+				const char* source = written - offset;
+				if( offset >= matchLength ) {
+					std::memcpy( written, source, matchLength );
+					written += matchLength;
+				} else {
+					for( std::size_t i = 0; i != matchLength; i++ ) {
+						*written++ = *source++;
+					}
+				}
+			}
+
+			return written == outputEnd;
+		}
+
+	}
+}
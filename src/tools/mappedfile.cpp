@@ -0,0 +1,113 @@
+#include "tools/mappedfile.hpp"
+#include <fstream>
+#include <iterator>
+
+// Not X-Platform
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+namespace BlueBear {
+	namespace Tools {
+
+		MappedFile::MappedFile( const std::string& path ) : data( nullptr ), size( 0 ), mapped( false ), valid( false ) {
+#ifndef _WIN32
+			int descriptor = open( path.c_str(), O_RDONLY );
+			if( descriptor < 0 ) {
+				return;
+			}
+
+			struct stat status;
+			if( fstat( descriptor, &status ) == 0 && status.st_size > 0 ) {
+				void* address = mmap( nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0 );
+
+				if( address != MAP_FAILED ) {
+					// Read front to back, once
+					madvise( address, status.st_size, MADV_SEQUENTIAL );
+
+					data = ( const char* ) address;
+					size = status.st_size;
+					mapped = true;
+					valid = true;
+				}
+			}
+
+			// The mapping outlives the descriptor
+			close( descriptor );
+
+			if( valid ) {
+				return;
+			}
+#endif
+
+			std::ifstream file( path, std::ios::binary );
+			if( !file.is_open() ) {
+				return;
+			}
+
+			fallback.assign( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
+			data = fallback.data();
+			size = fallback.size();
+			valid = !file.bad();
+		}
+
+		MappedFile::~MappedFile() {
+#ifndef _WIN32
+			if( mapped ) {
+				munmap( ( void* ) data, size );
+			}
+#endif
+		}
+
+		bool MappedFile::isValid() const {
+			return valid;
+		}
+
+		const char* MappedFile::getData() const {
+			return data;
+		}
+
+		const char* MappedFile::getEnd() const {
+			return data + size;
+		}
+
+		std::size_t MappedFile::getSize() const {
+			return size;
+		}
+
+		MemoryBuffer::MemoryBuffer( const char* begin, const char* end ) {
+			// Never written through; std::streambuf just wants non-const pointers
+			setg( ( char* ) begin, ( char* ) begin, ( char* ) end );
+		}
+
+		MemoryBuffer::pos_type MemoryBuffer::seekoff( off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode mode ) {
+			char* target;
+
+			switch( direction ) {
+				case std::ios_base::beg:
+					target = eback() + offset;
+					break;
+				case std::ios_base::end:
+					target = egptr() + offset;
+					break;
+				default:
+					target = gptr() + offset;
+			}
+
+			if( !( mode & std::ios_base::in ) || target < eback() || target > egptr() ) {
+				return pos_type( off_type( -1 ) );
+			}
+
+			setg( eback(), target, egptr() );
+			return pos_type( target - eback() );
+		}
+
+		MemoryBuffer::pos_type MemoryBuffer::seekpos( pos_type position, std::ios_base::openmode mode ) {
+			return seekoff( off_type( position ), std::ios_base::beg, mode );
+		}
+
+	}
+}
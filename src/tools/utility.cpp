@@ -403,6 +403,77 @@ namespace BlueBear {
 			return stringBuilder.str();
 		}
 
+		/**
+		 * Standard (RFC 4648) base64, with padding
+		 */
+		std::string Utility::encodeBase64( const std::string& data ) {
+			static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+			std::string encoded;
+			encoded.reserve( ( ( data.length() + 2 ) / 3 ) * 4 );
+
+			std::size_t i = 0;
+			for( ; i + 2 < data.length(); i += 3 ) {
+				std::uint32_t group = ( ( unsigned char ) data[ i ] << 16 ) | ( ( unsigned char ) data[ i + 1 ] << 8 ) | ( unsigned char ) data[ i + 2 ];
+				encoded.push_back( alphabet[ ( group >> 18 ) & 0x3F ] );
+				encoded.push_back( alphabet[ ( group >> 12 ) & 0x3F ] );
+				encoded.push_back( alphabet[ ( group >> 6 ) & 0x3F ] );
+				encoded.push_back( alphabet[ group & 0x3F ] );
+			}
+
+			if( i < data.length() ) {
+				std::uint32_t group = ( unsigned char ) data[ i ] << 16;
+				if( i + 1 < data.length() ) {
+					group |= ( unsigned char ) data[ i + 1 ] << 8;
+				}
+
+				encoded.push_back( alphabet[ ( group >> 18 ) & 0x3F ] );
+				encoded.push_back( alphabet[ ( group >> 12 ) & 0x3F ] );
+				encoded.push_back( i + 1 < data.length() ? alphabet[ ( group >> 6 ) & 0x3F ] : '=' );
+				encoded.push_back( '=' );
+			}
+
+			return encoded;
+		}
+
+		/**
+		 * Inverse of encodeBase64. Returns false (leaving data incomplete) on anything that isn't base64.
+		 */
+		bool Utility::decodeBase64( const std::string& encoded, std::string& data ) {
+			data.clear();
+			data.reserve( ( encoded.length() / 4 ) * 3 );
+
+			std::uint32_t group = 0;
+			unsigned int bits = 0;
+			for( char c : encoded ) {
+				std::uint32_t value;
+				if( c >= 'A' && c <= 'Z' ) {
+					value = c - 'A';
+				} else if( c >= 'a' && c <= 'z' ) {
+					value = c - 'a' + 26;
+				} else if( c >= '0' && c <= '9' ) {
+					value = c - '0' + 52;
+				} else if( c == '+' ) {
+					value = 62;
+				} else if( c == '/' ) {
+					value = 63;
+				} else if( c == '=' ) {
+					break;
+				} else {
+					return false;
+				}
+
+				group = ( group << 6 ) | value;
+				bits += 6;
+				if( bits >= 8 ) {
+					bits -= 8;
+					data.push_back( ( char ) ( ( group >> bits ) & 0xFF ) );
+				}
+			}
+
+			return true;
+		}
+
 		/**
 		 * THE AGONY
 		 */
@@ -41,6 +41,9 @@ bluebear.register_class = function( Class )
 
 	currentObject[ id[ #id ] ] = Class
 
+	-- Let the engine index the hierarchy, so it can find objects by type without asking Lua about each one
+	bluebear.engine.register_type( Class.name, Class.super and Class.super.name )
+
 	print( "bluebear.register_class", "Registered class "..Class.name )
 end
 
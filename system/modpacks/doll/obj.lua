@@ -70,6 +70,11 @@ local Doll = bluebear.extend( "system.entity.base", "system.doll.base", {
   --]]
   HEARTBEAT_INTERVAL = 15,
 
+  --[[
+    How far around itself an idle doll looks for something to do
+  --]]
+  AWARENESS_RADIUS = 10,
+
   --[[
     TODO: Placeholder for BlueBear Picasso milestone
   --]]
@@ -163,6 +168,27 @@ function Doll:enqueue_interaction( entity, interaction )
   table.insert( self.interaction_queue, queued_interaction )
 end
 
+--[[
+  Queue the first interaction offered to this doll by anything within AWARENESS_RADIUS of it.
+  Returns true if one was queued.
+--]]
+function Doll:look_around()
+  local nearby = bluebear.engine.get_objects_in_radius( self.position, Doll.AWARENESS_RADIUS )
+
+  for index, entity in ipairs( nearby ) do
+    if entity ~= self and entity.interactions then
+      local interaction = entity:get_interactions( self )[ 1 ]
+
+      if interaction then
+        self:enqueue_interaction( entity, interaction )
+        return true
+      end
+    end
+  end
+
+  return false
+end
+
 --[[
   Return a system.promise.pathfinder
 --]]
@@ -181,32 +207,38 @@ end
   This vthread handles interactions that appear in the interaction queue
 --]]
 function Doll:main()
-  -- check the interaction queue if we are in IDLE state
-  if self.current_state == Doll.STATES.IDLE then
-    if #self.interaction_queue > 0 then
-      -- take next item from queue and process it
-      self:change_state( Doll.STATES.PREPARING )
-    else
-      -- TODO for ET3, the main() vthread should look around its environment
-      -- for things that satisfy its needs if it has nothing to do
-      -- Account for waiting (the doll should be able to just stand there for a bit)
+  while true do
+    -- check the interaction queue if we are in IDLE state
+    if self.current_state == Doll.STATES.IDLE then
+      if #self.interaction_queue > 0 then
+        -- take next item from queue and process it
+        self:change_state( Doll.STATES.PREPARING )
+      elseif self.position then
+        -- Nothing queued: look around for something to do
+        -- TODO: Pick by what satisfies the doll's needs, and account for waiting (the doll should be able to just stand there for a bit)
+        self:look_around()
+      end
     end
+
+    self:sleep( Doll.HEARTBEAT_INTERVAL, true )
   end
-  -- TODO: Think about getting the current class ID instead of just rattling off system.doll.base:main. This won't work when main is extended.
-  self:sleep( Doll.HEARTBEAT_INTERVAL ):then_call( bluebear.util.bind( 'system.doll.base:main', self ) )
 end
 
 --[[
-  This function is designed to run in a loop and decay all motives once per game minute.
+  This vthread decays all motives once per game minute.
 --]]
 function Doll:decay_my_motives()
+  while true do
+    self:decay_motives()
 
+    self:sleep( bluebear.util.time.minutes_to_ticks( 1 ), true )
+  end
+end
+
+function Doll:decay_motives()
   for class_id, motive in pairs( self.motives ) do
       motive:decay()
   end
-
-  -- TODO: Think about getting the current class ID instead of just rattling off system.doll.base:decay_my_motives. This won't work when main is extended.
-  self:sleep( bluebear.util.time.minutes_to_ticks( 1 ) ):then_call( bluebear.util.bind( 'system.doll.base:decay_my_motives', self ) )
 end
 
 --[[
@@ -215,7 +247,8 @@ end
 --]]
 function Doll:kill()
   print( Doll.name, "Doll died!" )
-  -- TODO
+  -- TODO: Death animation, dialog box and urn
+  self:remove_from_lot()
 end
 
 bluebear.register_class( Doll )
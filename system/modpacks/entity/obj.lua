@@ -5,14 +5,20 @@ bluebear.engine.require_modpack( "stemcell" )
 
 local Entity = class( 'system.entity.base' )
 local Stemcell = bluebear.get_class( "system.stemcell" )
-local TimedPromise = bluebear.get_class( 'system.promise.timer' )
 
 --[[
-	Sleep numTicks amount of ticks and then call the function on this object named by functionName
+	Suspend the calling vthread for numTicks amount of ticks. Must be called from something the
+	engine is running (a callback, or an object's main function).
+
+	A saved vthread starts over from the top of the function it was started with when it wakes.
+	Pass restart = true where that's harmless - typically a sleep at the end of a loop. The lot
+	can't be saved while any vthread sleeps without it.
+
+	The sleeping vthread is recorded as this entity's, so it moves with the entity when the lot is
+	split between shards.
 --]]
-function Entity:sleep( numTicks )
-	-- do nothing but return a new promise with the ticks set to "numTicks"
-	return TimedPromise:new( numTicks )
+function Entity:sleep( numTicks, restart )
+	bluebear.engine.sleep( numTicks, restart, self )
 end
 
 --[[
@@ -55,7 +61,15 @@ end
 function Entity:place_object( id, coord )
 	local instance = self.model_loader:get_instance( id, coord )
 
-	table.insert( self.world_objects, instance )
+	if instance then
+		table.insert( self.world_objects, instance )
+
+		-- The first object placed stands for where the entity is
+		self.position = self.position or coord
+
+		-- So get_objects_in_radius and friends can find this entity
+		bluebear.engine.place_instance( self, instance, coord )
+	end
 
 	return instance
 end
@@ -74,11 +88,21 @@ function Entity:remove_object( obj )
 		end
 	end
 
-	if not index == nil then
+	if index ~= nil then
 		table.remove( self.world_objects, index )
+		bluebear.engine.remove_instance( obj )
 	end
 end
 
+--[[
+	Take this entity off the lot: it's no longer drawn or saved as a lot object, and the engine
+	no longer finds it by type or position. Timers it has set still run.
+--]]
+function Entity:remove_from_lot()
+	self:on_destroy()
+	bluebear.engine.remove_object( self )
+end
+
 --[[
   Provide interfaces for objects placed on a lot
 --]]
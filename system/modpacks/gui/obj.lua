@@ -112,7 +112,8 @@ function GUIProvider:handle_command()
   table.insert( self.command_history, text )
   self.command_history_index = #self.command_history + 1
 
-  self:sleep( 1 ):then_call( load( text ) )
+  -- Run it on the next tick, outside of this event handler
+  bluebear.engine.set_timeout( load( text ), 1 )
 
   self.console_input:set_content( '' )
 end
@@ -129,7 +130,6 @@ function GUIProvider:determine_max_chat_chars()
 end
 
 function GUIProvider:toggle_visibility()
-  local interval = 0
   local initial = self.console_window:get_property( 'top' )
   local final
   local step
@@ -143,8 +143,8 @@ function GUIProvider:toggle_visibility()
   end
 
   for i=initial,final,step do
-    interval = interval + 1
-    self:sleep( interval ):then_call( function() self.console_window:set_property( 'top', i ) end )
+    self:sleep( 1 )
+    self.console_window:set_property( 'top', i )
   end
 end
 